@@ -42,6 +42,9 @@ typedef struct _AudinALSADevice
 	int wformat;
 	int block_size;
 	ADPCM adpcm;
+	DSP_RESAMPLER* resampler;
+	uint8* resample_buffer;
+	int resample_size;
 
 	freerdp_thread* thread;
 
@@ -96,7 +99,6 @@ static tbool audin_alsa_thread_receive(AudinALSADevice* alsa, uint8* src, int si
 	uint8* encoded_data;
 	int rbytes_per_frame;
 	int tbytes_per_frame;
-	uint8* resampled_data;
 
 	rbytes_per_frame = alsa->actual_channels * alsa->bytes_per_channel;
 	tbytes_per_frame = alsa->target_channels * alsa->bytes_per_channel;
@@ -104,18 +106,30 @@ static tbool audin_alsa_thread_receive(AudinALSADevice* alsa, uint8* src, int si
 	if ((alsa->target_rate == alsa->actual_rate) &&
 		(alsa->target_channels == alsa->actual_channels))
 	{
-		resampled_data = NULL;
 		frames = size / rbytes_per_frame;
 	}
 	else
 	{
-		resampled_data = dsp_resample(src, alsa->bytes_per_channel,
-			alsa->actual_channels, alsa->actual_rate, size / rbytes_per_frame,
-			alsa->target_channels, alsa->target_rate, &frames);
+		if (alsa->resampler == NULL)
+		{
+			alsa->resampler = dsp_resampler_new(alsa->bytes_per_channel,
+				alsa->actual_channels, alsa->actual_rate,
+				alsa->target_channels, alsa->target_rate);
+			if (alsa->resampler == NULL)
+				return false;
+		}
+		frames = dsp_resampler_max_frames(alsa->resampler, size / rbytes_per_frame);
+		if (frames * tbytes_per_frame > alsa->resample_size)
+		{
+			alsa->resample_size = frames * tbytes_per_frame;
+			alsa->resample_buffer = xrenew(uint8, alsa->resample_buffer, alsa->resample_size);
+		}
+		frames = dsp_resampler_process(alsa->resampler, src, size / rbytes_per_frame,
+			alsa->resample_buffer, frames);
 		DEBUG_DVC("resampled %d frames at %d to %d frames at %d",
 			size / rbytes_per_frame, alsa->actual_rate, frames, alsa->target_rate);
 		size = frames * tbytes_per_frame;
-		src = resampled_data;
+		src = alsa->resample_buffer;
 	}
 
 	while (frames > 0)
@@ -133,7 +147,7 @@ static tbool audin_alsa_thread_receive(AudinALSADevice* alsa, uint8* src, int si
 		{
 			if (alsa->wformat == 0x11)
 			{
-				encoded_data = dsp_encode_ima_adpcm(&alsa->adpcm,
+				encoded_data = dsp_ima_adpcm_encode(&alsa->adpcm,
 					alsa->buffer, alsa->buffer_frames * tbytes_per_frame,
 					alsa->target_channels, alsa->block_size, &encoded_size);
 				DEBUG_DVC("encoded %d to %d",
@@ -153,8 +167,6 @@ static tbool audin_alsa_thread_receive(AudinALSADevice* alsa, uint8* src, int si
 			else
 				ret = alsa->receive(encoded_data, encoded_size, alsa->user_data);
 			alsa->buffer_frames = 0;
-			if (encoded_data != alsa->buffer)
-				xfree(encoded_data);
 			if (!ret)
 				break;
 		}
@@ -162,9 +174,6 @@ static tbool audin_alsa_thread_receive(AudinALSADevice* alsa, uint8* src, int si
 		frames -= cframes;
 	}
 
-	if (resampled_data)
-		xfree(resampled_data);
-
 	return ret;
 }
 
@@ -184,7 +193,10 @@ static void* audin_alsa_thread_func(void* arg)
 	alsa->buffer = (uint8*) xzalloc(tbytes_per_frame * alsa->frames_per_packet);
 	alsa->buffer_frames = 0;
 	buffer = (uint8*) xzalloc(rbytes_per_frame * alsa->frames_per_packet);
-	memset(&alsa->adpcm, 0, sizeof(ADPCM));
+	dsp_ima_adpcm_reset(&alsa->adpcm);
+	/* the capture rate is only known once the device is set up */
+	dsp_resampler_free(alsa->resampler);
+	alsa->resampler = NULL;
 	do
 	{
 		if ((error = snd_pcm_open(&capture_handle, alsa->device_name, SND_PCM_STREAM_CAPTURE, 0)) < 0)
@@ -233,6 +245,9 @@ static void audin_alsa_free(IAudinDevice* device)
 	AudinALSADevice* alsa = (AudinALSADevice*) device;
 
 	freerdp_thread_free(alsa->thread);
+	dsp_ima_adpcm_uninit(&alsa->adpcm);
+	dsp_resampler_free(alsa->resampler);
+	xfree(alsa->resample_buffer);
 	xfree(alsa);
 }
 
@@ -217,7 +217,8 @@ static int audin_send_open_reply_pdu(IWTSVirtualChannelCallback* pChannelCallbac
 static tbool audin_receive_wave_data(uint8* data, int size, void* user_data)
 {
 	int error;
-	STREAM* out;
+	uint8 header[1];
+	DVC_SEGMENT segments[2];
 	AUDIN_CHANNEL_CALLBACK* callback = (AUDIN_CHANNEL_CALLBACK*) user_data;
 
 	error = audin_send_incoming_data_pdu((IWTSVirtualChannelCallback*) callback);
@@ -225,11 +226,13 @@ static tbool audin_receive_wave_data(uint8* data, int size, void* user_data)
 	if (error != 0)
 		return false;
 
-	out = stream_new(size + 1);
-	stream_write_uint8(out, MSG_SNDIN_DATA);
-	stream_write(out, data, size);
-	error = callback->channel->Write(callback->channel, stream_get_length(out), stream_get_head(out), NULL);
-	stream_free(out);
+	/* the wave data follows the header without being copied next to it */
+	header[0] = MSG_SNDIN_DATA;
+	segments[0].pBuffer = header;
+	segments[0].cbSize = 1;
+	segments[1].pBuffer = data;
+	segments[1].cbSize = size;
+	error = callback->channel->WriteV(callback->channel, segments, 2);
 
 	return (error == 0 ? true : false);
 }
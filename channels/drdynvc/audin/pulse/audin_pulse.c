@@ -145,6 +145,7 @@ static void audin_pulse_free(IAudinDevice* device)
 		pa_threaded_mainloop_free(pulse->mainloop);
 		pulse->mainloop = NULL;
 	}
+	dsp_ima_adpcm_uninit(&pulse->adpcm);
 	xfree(pulse);
 }
 
@@ -297,7 +298,7 @@ static void audin_pulse_stream_request_callback(pa_stream* stream, size_t length
 		{
 			if (pulse->format == 0x11)
 			{
-				encoded_data = dsp_encode_ima_adpcm(&pulse->adpcm,
+				encoded_data = dsp_ima_adpcm_encode(&pulse->adpcm,
 					pulse->buffer, pulse->buffer_frames * pulse->bytes_per_frame,
 					pulse->sample_spec.channels, pulse->block_size, &encoded_size);
 				DEBUG_DVC("encoded %d to %d",
@@ -311,8 +312,6 @@ static void audin_pulse_stream_request_callback(pa_stream* stream, size_t length
 
 			ret = pulse->receive(encoded_data, encoded_size, pulse->user_data);
 			pulse->buffer_frames = 0;
-			if (encoded_data != pulse->buffer)
-				xfree(encoded_data);
 			if (!ret)
 				break;
 		}
@@ -412,7 +411,7 @@ static void audin_pulse_open(IAudinDevice* device, AudinReceive receive, void* u
 	pa_threaded_mainloop_unlock(pulse->mainloop);
 	if (state == PA_STREAM_READY)
 	{
-		memset(&pulse->adpcm, 0, sizeof(ADPCM));
+		dsp_ima_adpcm_reset(&pulse->adpcm);
 		pulse->buffer = xzalloc(pulse->bytes_per_frame * pulse->frames_per_packet);
 		pulse->buffer_frames = 0;
 		DEBUG_DVC("connected");
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <freerdp/constants.h>
 #include <freerdp/utils/memory.h>
+#include <freerdp/utils/mutex.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/svc_plugin.h>
 #include <freerdp/utils/wait_obj.h>
@@ -36,6 +37,12 @@
 #define CLOSE_REQUEST_PDU      0x04
 #define CAPABILITY_REQUEST_PDU 0x05
 
+#define DVC_HEADER_MAX_LENGTH	9 /* Cmd, ChannelId and Length */
+
+#define DVC_BUFFER_MIN_SHIFT	11
+#define DVC_BUFFER_MAX_SHIFT	24
+#define DVC_BUFFER_POOL_DEPTH	4
+
 struct drdynvc_plugin
 {
 	rdpSvcPlugin plugin;
@@ -47,8 +54,151 @@ struct drdynvc_plugin
 	int PriorityCharge3;
 
 	IWTSVirtualChannelManager* channel_mgr;
+
+	freerdp_mutex pool_mutex;
+	DVC_BUFFER* pool[DVC_BUFFER_MAX_SHIFT + 1];
+	int pool_depth[DVC_BUFFER_MAX_SHIFT + 1];
 };
 
+/**
+ * Buffers are pooled by power of two size class, so that the steady
+ * flow of large messages of a multimedia channel does not go through
+ * the allocator for every message.
+ */
+
+DVC_BUFFER* drdynvc_buffer_acquire(drdynvcPlugin* drdynvc, uint32 size)
+{
+	int shift;
+	DVC_BUFFER* buffer = NULL;
+
+	for (shift = DVC_BUFFER_MIN_SHIFT; shift < DVC_BUFFER_MAX_SHIFT; shift++)
+	{
+		if (size <= (1U << shift))
+			break;
+	}
+
+	if (size <= (1U << shift))
+	{
+		freerdp_mutex_lock(drdynvc->pool_mutex);
+
+		buffer = drdynvc->pool[shift];
+
+		if (buffer != NULL)
+		{
+			drdynvc->pool[shift] = buffer->next;
+			drdynvc->pool_depth[shift]--;
+		}
+
+		freerdp_mutex_unlock(drdynvc->pool_mutex);
+
+		size = 1 << shift;
+	}
+	else
+	{
+		/* too large to be pooled */
+		shift = 0;
+	}
+
+	if (buffer == NULL)
+	{
+		buffer = xnew(DVC_BUFFER);
+		buffer->data = (uint8*) xmalloc(size);
+		buffer->size = size;
+		buffer->shift = shift;
+	}
+
+	buffer->refs = 1;
+	buffer->next = NULL;
+
+	return buffer;
+}
+
+void drdynvc_buffer_ref(drdynvcPlugin* drdynvc, DVC_BUFFER* buffer)
+{
+	freerdp_mutex_lock(drdynvc->pool_mutex);
+	buffer->refs++;
+	freerdp_mutex_unlock(drdynvc->pool_mutex);
+}
+
+void drdynvc_buffer_release(drdynvcPlugin* drdynvc, DVC_BUFFER* buffer)
+{
+	int shift = buffer->shift;
+
+	freerdp_mutex_lock(drdynvc->pool_mutex);
+
+	if (--buffer->refs > 0)
+	{
+		freerdp_mutex_unlock(drdynvc->pool_mutex);
+		return;
+	}
+
+	if (shift > 0 && drdynvc->pool_depth[shift] < DVC_BUFFER_POOL_DEPTH)
+	{
+		buffer->next = drdynvc->pool[shift];
+		drdynvc->pool[shift] = buffer;
+		drdynvc->pool_depth[shift]++;
+		buffer = NULL;
+	}
+
+	freerdp_mutex_unlock(drdynvc->pool_mutex);
+
+	if (buffer != NULL)
+	{
+		xfree(buffer->data);
+		xfree(buffer);
+	}
+}
+
+static void drdynvc_write_complete(rdpSvcPlugin* plugin, void* user_data)
+{
+	drdynvc_buffer_release((drdynvcPlugin*) plugin, (DVC_BUFFER*) user_data);
+}
+
+/**
+ * Send the PDU written to a stream attached to a pool buffer. Each write
+ * holds a reference on the buffer until the channel has sent it.
+ */
+
+static int drdynvc_send_pdu(drdynvcPlugin* drdynvc, DVC_BUFFER* buffer, STREAM* s, uint32 offset)
+{
+	int error;
+
+	drdynvc_buffer_ref(drdynvc, buffer);
+
+	error = svc_plugin_send_buffer((rdpSvcPlugin*) drdynvc, buffer->data + offset,
+		stream_get_pos(s) - offset, buffer);
+
+	if (error != CHANNEL_RC_OK)
+		drdynvc_buffer_release(drdynvc, buffer);
+
+	return error;
+}
+
+/**
+ * Send a control PDU built in a stream of its own, the stream is freed.
+ */
+
+static int drdynvc_send_stream(drdynvcPlugin* drdynvc, STREAM* data_out)
+{
+	int error;
+	STREAM* s;
+	DVC_BUFFER* buffer;
+
+	buffer = drdynvc_buffer_acquire(drdynvc, stream_get_length(data_out));
+
+	s = stream_new(0);
+	stream_attach(s, buffer->data, buffer->size);
+	stream_write(s, stream_get_head(data_out), stream_get_length(data_out));
+	error = drdynvc_send_pdu(drdynvc, buffer, s, 0);
+	stream_detach(s);
+	stream_free(s);
+
+	drdynvc_buffer_release(drdynvc, buffer);
+	stream_free(data_out);
+
+	return error;
+}
+
 static int drdynvc_write_variable_uint(STREAM* stream, uint32 val)
 {
 	int cb;
@@ -71,64 +221,109 @@ static int drdynvc_write_variable_uint(STREAM* stream, uint32 val)
 	return cb;
 }
 
-int drdynvc_write_data(drdynvcPlugin* drdynvc, uint32 ChannelId, uint8* data, uint32 data_size)
+/**
+ * Copy the next length bytes of a segment list to a stream.
+ */
+
+static void drdynvc_gather(STREAM* s, DVC_SEGMENT** segment, uint32* offset, uint32 length)
 {
-	STREAM* data_out;
-	uint32 pos = 0;
+	uint32 n;
+
+	while (length > 0)
+	{
+		n = MIN(length, (*segment)->cbSize - *offset);
+		stream_write(s, (*segment)->pBuffer + *offset, n);
+		length -= n;
+		*offset += n;
+
+		if (*offset == (*segment)->cbSize)
+		{
+			(*segment)++;
+			*offset = 0;
+		}
+	}
+}
+
+/**
+ * Write a message made of several segments. All the fragments are laid
+ * out back to back in a single pool buffer, each fragment being sent as a
+ * slice of it, instead of allocating and filling a stream per fragment.
+ */
+
+int drdynvc_write_segments(drdynvcPlugin* drdynvc, uint32 ChannelId, DVC_SEGMENT* segments, int count)
+{
+	int i;
+	STREAM* s;
+	uint32 pos;
+	uint32 end;
 	uint32 cbChId;
 	uint32 cbLen;
 	uint32 chunk_len;
-	int error;
+	uint32 data_size;
+	uint32 num_chunks;
+	uint32 segment_offset;
+	DVC_BUFFER* buffer;
+	int error = CHANNEL_RC_OK;
+
+	data_size = 0;
+
+	for (i = 0; i < count; i++)
+		data_size += segments[i].cbSize;
 
 	DEBUG_DVC("ChannelId=%d size=%d", ChannelId, data_size);
 
-	data_out = stream_new(CHANNEL_CHUNK_LENGTH);
-	stream_set_pos(data_out, 1);
-	cbChId = drdynvc_write_variable_uint(data_out, ChannelId);
+	num_chunks = data_size / (CHANNEL_CHUNK_LENGTH - DVC_HEADER_MAX_LENGTH) + 1;
+	buffer = drdynvc_buffer_acquire(drdynvc, data_size + num_chunks * DVC_HEADER_MAX_LENGTH);
+
+	s = stream_new(0);
+	stream_attach(s, buffer->data, buffer->size);
+	segment_offset = 0;
 
-	if (data_size <= CHANNEL_CHUNK_LENGTH - pos)
+	pos = 0;
+	stream_seek(s, 1);
+	cbChId = drdynvc_write_variable_uint(s, ChannelId);
+
+	if (data_size <= CHANNEL_CHUNK_LENGTH - (stream_get_pos(s) - pos))
 	{
-		pos = stream_get_pos(data_out);
-		stream_set_pos(data_out, 0);
-		stream_write_uint8(data_out, 0x30 | cbChId);
-		stream_set_pos(data_out, pos);
-		stream_write(data_out, data, data_size);
-		error = svc_plugin_send((rdpSvcPlugin*)drdynvc, data_out);
+		end = stream_get_pos(s);
+		stream_set_pos(s, pos);
+		stream_write_uint8(s, 0x30 | cbChId);
+		stream_set_pos(s, end);
+		drdynvc_gather(s, &segments, &segment_offset, data_size);
+		error = drdynvc_send_pdu(drdynvc, buffer, s, pos);
 	}
 	else
 	{
 		/* Fragment the data */
-		cbLen = drdynvc_write_variable_uint(data_out, data_size);
-		pos = stream_get_pos(data_out);
-		stream_set_pos(data_out, 0);
-		stream_write_uint8(data_out, 0x20 | cbChId | (cbLen << 2));
-		stream_set_pos(data_out, pos);
-		chunk_len = CHANNEL_CHUNK_LENGTH - pos;
-		stream_write(data_out, data, chunk_len);
-		data += chunk_len;
+		cbLen = drdynvc_write_variable_uint(s, data_size);
+		end = stream_get_pos(s);
+		stream_set_pos(s, pos);
+		stream_write_uint8(s, 0x20 | cbChId | (cbLen << 2));
+		stream_set_pos(s, end);
+		chunk_len = CHANNEL_CHUNK_LENGTH - (stream_get_pos(s) - pos);
+		drdynvc_gather(s, &segments, &segment_offset, chunk_len);
 		data_size -= chunk_len;
-		error = svc_plugin_send((rdpSvcPlugin*)drdynvc, data_out);
+		error = drdynvc_send_pdu(drdynvc, buffer, s, pos);
 
 		while (error == CHANNEL_RC_OK && data_size > 0)
 		{
-			data_out = stream_new(CHANNEL_CHUNK_LENGTH);
-			stream_set_pos(data_out, 1);
-			cbChId = drdynvc_write_variable_uint(data_out, ChannelId);
-
-			pos = stream_get_pos(data_out);
-			stream_set_pos(data_out, 0);
-			stream_write_uint8(data_out, 0x30 | cbChId);
-			stream_set_pos(data_out, pos);
+			pos = stream_get_pos(s);
+			stream_write_uint8(s, 0x30 | cbChId);
+			drdynvc_write_variable_uint(s, ChannelId);
 
 			chunk_len = data_size;
-			if (chunk_len > CHANNEL_CHUNK_LENGTH - pos)
-				chunk_len = CHANNEL_CHUNK_LENGTH - pos;
-			stream_write(data_out, data, chunk_len);
-			data += chunk_len;
+			if (chunk_len > CHANNEL_CHUNK_LENGTH - (stream_get_pos(s) - pos))
+				chunk_len = CHANNEL_CHUNK_LENGTH - (stream_get_pos(s) - pos);
+			drdynvc_gather(s, &segments, &segment_offset, chunk_len);
 			data_size -= chunk_len;
-			error = svc_plugin_send((rdpSvcPlugin*)drdynvc, data_out);
+			error = drdynvc_send_pdu(drdynvc, buffer, s, pos);
 		}
 	}
+
+	stream_detach(s);
+	stream_free(s);
+	drdynvc_buffer_release(drdynvc, buffer);
+
 	if (error != CHANNEL_RC_OK)
 	{
 		DEBUG_WARN("VirtualChannelWrite failed %d", error);
@@ -137,6 +332,16 @@ int drdynvc_write_data(drdynvcPlugin* drdynvc, uint32 ChannelId, uint8* data, ui
 	return 0;
 }
 
+int drdynvc_write_data(drdynvcPlugin* drdynvc, uint32 ChannelId, uint8* data, uint32 data_size)
+{
+	DVC_SEGMENT segment;
+
+	segment.pBuffer = data;
+	segment.cbSize = data_size;
+
+	return drdynvc_write_segments(drdynvc, ChannelId, &segment, 1);
+}
+
 int drdynvc_push_event(drdynvcPlugin* drdynvc, RDP_EVENT* event)
 {
 	int error;
@@ -168,7 +373,7 @@ static int drdynvc_process_capability_request(drdynvcPlugin* drdynvc, int Sp, in
 	data_out = stream_new(4);
 	stream_write_uint16(data_out, 0x0050); /* Cmd+Sp+cbChId+Pad. Note: MSTSC sends 0x005c */
 	stream_write_uint16(data_out, drdynvc->version);
-	error = svc_plugin_send((rdpSvcPlugin*)drdynvc, data_out);
+	error = drdynvc_send_stream(drdynvc, data_out);
 	if (error != CHANNEL_RC_OK)
 	{
 		DEBUG_WARN("VirtualChannelWrite failed %d", error);
@@ -225,7 +430,7 @@ static int drdynvc_process_create_request(drdynvcPlugin* drdynvc, int Sp, int cb
 		stream_write_uint32(data_out, (uint32)(-1));
 	}
 
-	error = svc_plugin_send((rdpSvcPlugin*)drdynvc, data_out);
+	error = drdynvc_send_stream(drdynvc, data_out);
 	if (error != CHANNEL_RC_OK)
 	{
 		DEBUG_WARN("VirtualChannelWrite failed %d", error);
@@ -320,6 +525,9 @@ static void drdynvc_process_connect(rdpSvcPlugin* plugin)
 
 	DEBUG_DVC("connecting");
 
+	drdynvc->pool_mutex = freerdp_mutex_new();
+	plugin->write_complete_callback = drdynvc_write_complete;
+
 	drdynvc->channel_mgr = dvcman_new(drdynvc);
 	dvcman_load_plugin(drdynvc->channel_mgr, svc_plugin_get_data(plugin));
 	dvcman_init(drdynvc->channel_mgr);
@@ -332,12 +540,28 @@ static void drdynvc_process_event(rdpSvcPlugin* plugin, RDP_EVENT* event)
 
 static void drdynvc_process_terminate(rdpSvcPlugin* plugin)
 {
+	int i;
+	DVC_BUFFER* buffer;
 	drdynvcPlugin* drdynvc = (drdynvcPlugin*)plugin;
 
 	DEBUG_DVC("terminating");
 
 	if (drdynvc->channel_mgr != NULL)
 		dvcman_free(drdynvc->channel_mgr);
+
+	for (i = 0; i <= DVC_BUFFER_MAX_SHIFT; i++)
+	{
+		while ((buffer = drdynvc->pool[i]) != NULL)
+		{
+			drdynvc->pool[i] = buffer->next;
+			xfree(buffer->data);
+			xfree(buffer);
+		}
+	}
+
+	if (drdynvc->pool_mutex != NULL)
+		freerdp_mutex_free(drdynvc->pool_mutex);
+
 	xfree(drdynvc);
 }
 
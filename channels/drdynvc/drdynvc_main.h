@@ -21,10 +21,30 @@
 #define __DRDYNVC_MAIN_H
 
 #include <freerdp/types.h>
+#include <freerdp/dvc.h>
 
 typedef struct drdynvc_plugin drdynvcPlugin;
 
+/**
+ * Reference-counted buffer from the plugin buffer pool, holding either
+ * the fragments of an outgoing message or a message being reassembled.
+ */
+typedef struct _DVC_BUFFER DVC_BUFFER;
+struct _DVC_BUFFER
+{
+	uint8* data;
+	uint32 size;
+	int refs;
+	int shift;
+	DVC_BUFFER* next;
+};
+
+DVC_BUFFER* drdynvc_buffer_acquire(drdynvcPlugin* plugin, uint32 size);
+void drdynvc_buffer_ref(drdynvcPlugin* plugin, DVC_BUFFER* buffer);
+void drdynvc_buffer_release(drdynvcPlugin* plugin, DVC_BUFFER* buffer);
+
 int drdynvc_write_data(drdynvcPlugin* plugin, uint32 ChannelId, uint8* data, uint32 data_size);
+int drdynvc_write_segments(drdynvcPlugin* plugin, uint32 ChannelId, DVC_SEGMENT* segments, int count);
 int drdynvc_push_event(drdynvcPlugin* plugin, RDP_EVENT* event);
 
 #endif
@@ -26,6 +26,7 @@
 #include <freerdp/utils/load_plugin.h>
 
 #include "drdynvc_types.h"
+#include "drdynvc_main.h"
 #include "dvcman.h"
 
 #define MAX_PLUGINS 10
@@ -77,7 +78,10 @@ struct _DVCMAN_CHANNEL
 	uint32 channel_id;
 	IWTSVirtualChannelCallback* channel_callback;
 
-	STREAM* dvc_data;
+	/* message being reassembled from DATA_FIRST and DATA PDUs */
+	DVC_BUFFER* dvc_data;
+	uint32 dvc_data_length;
+	uint32 dvc_data_pos;
 };
 
 static int dvcman_get_configuration(IWTSListener* pListener, void** ppPropertyBag)
@@ -212,8 +216,19 @@ int dvcman_load_plugin(IWTSVirtualChannelManager* pChannelMgr, RDP_PLUGIN_DATA*
 	return 0;
 }
 
+static void dvcman_channel_free_data(DVCMAN_CHANNEL* channel)
+{
+	if (channel->dvc_data)
+	{
+		drdynvc_buffer_release(channel->dvcman->drdynvc, channel->dvc_data);
+		channel->dvc_data = NULL;
+	}
+}
+
 static void dvcman_channel_free(DVCMAN_CHANNEL* channel)
 {
+	dvcman_channel_free_data(channel);
+
 	if (channel->channel_callback)
 		channel->channel_callback->OnClose(channel->channel_callback);
 
@@ -275,6 +290,13 @@ static int dvcman_write_channel(IWTSVirtualChannel* pChannel, uint32 cbSize, uin
 	return drdynvc_write_data(channel->dvcman->drdynvc, channel->channel_id, pBuffer, cbSize);
 }
 
+static int dvcman_write_channel_v(IWTSVirtualChannel* pChannel, DVC_SEGMENT* pSegments, int nSegments)
+{
+	DVCMAN_CHANNEL* channel = (DVCMAN_CHANNEL*) pChannel;
+
+	return drdynvc_write_segments(channel->dvcman->drdynvc, channel->channel_id, pSegments, nSegments);
+}
+
 static int dvcman_close_channel_iface(IWTSVirtualChannel* pChannel)
 {
 	DVCMAN_CHANNEL* channel = (DVCMAN_CHANNEL*) pChannel;
@@ -308,6 +330,7 @@ int dvcman_create_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 Channel
 			channel = xnew(DVCMAN_CHANNEL);
 			channel->iface.Write = dvcman_write_channel;
 			channel->iface.Close = dvcman_close_channel_iface;
+			channel->iface.WriteV = dvcman_write_channel_v;
 			channel->dvcman = dvcman;
 			channel->channel_id = ChannelId;
 
@@ -365,11 +388,7 @@ int dvcman_close_channel(IWTSVirtualChannelManager* pChannelMgr, uint32 ChannelI
 		return 1;
 	}
 
-	if (channel->dvc_data)
-	{
-		stream_free(channel->dvc_data);
-		channel->dvc_data = NULL;
-	}
+	dvcman_channel_free_data(channel);
 
 	DEBUG_DVC("dvcman_close_channel: channel %d closed", ChannelId);
 	ichannel = (IWTSVirtualChannel*)channel;
@@ -390,10 +409,11 @@ int dvcman_receive_channel_data_first(IWTSVirtualChannelManager* pChannelMgr, ui
 		return 1;
 	}
 
-	if (channel->dvc_data)
-		stream_free(channel->dvc_data);
+	dvcman_channel_free_data(channel);
 
-	channel->dvc_data = stream_new(length);
+	channel->dvc_data = drdynvc_buffer_acquire(((DVCMAN*) pChannelMgr)->drdynvc, length);
+	channel->dvc_data_length = length;
+	channel->dvc_data_pos = 0;
 
 	return 0;
 }
@@ -413,23 +433,22 @@ int dvcman_receive_channel_data(IWTSVirtualChannelManager* pChannelMgr, uint32 C
 
 	if (channel->dvc_data)
 	{
-		/* Fragmented data */
-		if (stream_get_length(channel->dvc_data) + data_size > stream_get_size(channel->dvc_data))
+		/* Fragmented data, reassembled in a pool buffer reused across messages */
+		if (channel->dvc_data_pos + data_size > channel->dvc_data_length)
 		{
 			DEBUG_WARN("data exceeding declared length!");
-			stream_free(channel->dvc_data);
-			channel->dvc_data = NULL;
+			dvcman_channel_free_data(channel);
 			return 1;
 		}
 
-		stream_write(channel->dvc_data, data, data_size);
+		memcpy(channel->dvc_data->data + channel->dvc_data_pos, data, data_size);
+		channel->dvc_data_pos += data_size;
 
-		if (stream_get_length(channel->dvc_data) >= stream_get_size(channel->dvc_data))
+		if (channel->dvc_data_pos >= channel->dvc_data_length)
 		{
 			error = channel->channel_callback->OnDataReceived(channel->channel_callback,
-				stream_get_size(channel->dvc_data), stream_get_data(channel->dvc_data));
-			stream_free(channel->dvc_data);
-			channel->dvc_data = NULL;
+				channel->dvc_data_length, channel->dvc_data->data);
+			dvcman_channel_free_data(channel);
 		}
 	}
 	else
@@ -49,6 +49,9 @@ typedef struct _TSMFFFmpegDecoder
 	uint8* decoded_data;
 	uint32 decoded_size;
 	uint32 decoded_size_max;
+
+	RDP_VIDEO_FRAME_POOL* frame_pool;
+	RDP_VIDEO_FRAME_BUFFER* decoded_frame;
 } TSMFFFmpegDecoder;
 
 static tbool tsmf_ffmpeg_init_context(ITSMFDecoder* decoder)
@@ -76,6 +79,7 @@ static tbool tsmf_ffmpeg_init_video_stream(ITSMFDecoder* decoder, const TS_AM_ME
 	mdecoder->codec_context->time_base.num = media_type->SamplesPerSecond.Denominator;
 
 	mdecoder->frame = avcodec_alloc_frame();
+	mdecoder->frame_pool = freerdp_video_frame_pool_get();
 
 	return true;
 }
@@ -306,7 +310,10 @@ static tbool tsmf_ffmpeg_decode_video(ITSMFDecoder* decoder, const uint8* data,
 	TSMFFFmpegDecoder* mdecoder = (TSMFFFmpegDecoder*) decoder;
 	int decoded;
 	int len;
+	int i;
 	AVFrame* frame;
+	AVPicture picture;
+	RDP_VIDEO_FRAME_BUFFER* buffer;
 	tbool ret = true;
 
 #if LIBAVCODEC_VERSION_MAJOR < 52 || (LIBAVCODEC_VERSION_MAJOR == 52 && LIBAVCODEC_VERSION_MINOR <= 20)
@@ -342,6 +349,36 @@ static tbool tsmf_ffmpeg_decode_video(ITSMFDecoder* decoder, const uint8* data,
 			mdecoder->codec_context->pix_fmt,
 			mdecoder->codec_context->width, mdecoder->codec_context->height);
 
+		if (mdecoder->decoded_frame)
+		{
+			mdecoder->frame_pool->Release(mdecoder->frame_pool, mdecoder->decoded_frame);
+			mdecoder->decoded_frame = NULL;
+		}
+
+		/* write the planes straight into a buffer the client can display */
+		if (mdecoder->frame_pool && mdecoder->codec_context->pix_fmt == PIX_FMT_YUV420P)
+		{
+			buffer = mdecoder->frame_pool->Acquire(mdecoder->frame_pool,
+				mdecoder->codec_context->width, mdecoder->codec_context->height);
+
+			if (buffer)
+			{
+				memset(&picture, 0, sizeof(AVPicture));
+				for (i = 0; i < 3; i++)
+				{
+					picture.data[i] = buffer->data + buffer->offsets[i];
+					picture.linesize[i] = buffer->pitches[i];
+				}
+
+				av_picture_copy(&picture, (AVPicture *) mdecoder->frame,
+					mdecoder->codec_context->pix_fmt,
+					mdecoder->codec_context->width, mdecoder->codec_context->height);
+
+				mdecoder->decoded_frame = buffer;
+				return true;
+			}
+		}
+
 		mdecoder->decoded_size = avpicture_get_size(mdecoder->codec_context->pix_fmt,
 			mdecoder->codec_context->width, mdecoder->codec_context->height);
 		mdecoder->decoded_data = xzalloc(mdecoder->decoded_size);
@@ -499,6 +536,16 @@ static uint8* tsmf_ffmpeg_get_decoded_data(ITSMFDecoder* decoder, uint32* size)
 	return buf;
 }
 
+static RDP_VIDEO_FRAME_BUFFER* tsmf_ffmpeg_get_decoded_frame(ITSMFDecoder* decoder)
+{
+	TSMFFFmpegDecoder* mdecoder = (TSMFFFmpegDecoder*) decoder;
+	RDP_VIDEO_FRAME_BUFFER* buffer;
+
+	buffer = mdecoder->decoded_frame;
+	mdecoder->decoded_frame = NULL;
+	return buffer;
+}
+
 static uint32 tsmf_ffmpeg_get_decoded_format(ITSMFDecoder* decoder)
 {
 	TSMFFFmpegDecoder* mdecoder = (TSMFFFmpegDecoder*) decoder;
@@ -539,6 +586,8 @@ static void tsmf_ffmpeg_free(ITSMFDecoder* decoder)
 		av_free(mdecoder->frame);
 	if (mdecoder->decoded_data)
 		xfree(mdecoder->decoded_data);
+	if (mdecoder->decoded_frame)
+		mdecoder->frame_pool->Release(mdecoder->frame_pool, mdecoder->decoded_frame);
 	if (mdecoder->codec_context)
 	{
 		if (mdecoder->prepared)
@@ -568,6 +617,7 @@ TSMFDecoderEntry(void)
 	decoder->iface.SetFormat = tsmf_ffmpeg_set_format;
 	decoder->iface.Decode = tsmf_ffmpeg_decode;
 	decoder->iface.GetDecodedData = tsmf_ffmpeg_get_decoded_data;
+	decoder->iface.GetDecodedFrame = tsmf_ffmpeg_get_decoded_frame;
 	decoder->iface.GetDecodedFormat = tsmf_ffmpeg_get_decoded_format;
 	decoder->iface.GetDecodedDimension = tsmf_ffmpeg_get_decoded_dimension;
 	decoder->iface.Free = tsmf_ffmpeg_free;
@@ -20,6 +20,8 @@
 #ifndef __TSMF_DECODER_H
 #define __TSMF_DECODER_H
 
+#include <freerdp/plugins/tsmf.h>
+
 #include "drdynvc_types.h"
 #include "tsmf_types.h"
 
@@ -33,6 +35,8 @@ struct _ITSMFDecoder
 	boolean (*Decode) (ITSMFDecoder* decoder, const uint8* data, uint32 data_size, uint32 extensions);
 	/* Get the decoded data */
 	uint8* (*GetDecodedData) (ITSMFDecoder* decoder, uint32* size);
+	/* Get the decoded video frame if it was written to a frame pool buffer, optional */
+	RDP_VIDEO_FRAME_BUFFER* (*GetDecodedFrame) (ITSMFDecoder* decoder);
 	/* Get the pixel format of decoded video frame */
 	uint32 (*GetDecodedFormat) (ITSMFDecoder* decoder);
 	/* Get the width and height of decoded video frame */
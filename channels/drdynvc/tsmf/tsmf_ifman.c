@@ -428,15 +428,33 @@ int tsmf_ifman_on_playback_started(TSMF_IFMAN* ifman)
 
 int tsmf_ifman_on_playback_paused(TSMF_IFMAN* ifman)
 {
+	TSMF_PRESENTATION* presentation;
+
 	DEBUG_DVC("");
 	ifman->output_pending = true;
+
+	presentation = tsmf_presentation_find_by_id(stream_get_tail(ifman->input));
+	if (presentation)
+		tsmf_presentation_pause(presentation);
+	else
+		DEBUG_WARN("unknown presentation id");
+
 	return 0;
 }
 
 int tsmf_ifman_on_playback_restarted(TSMF_IFMAN* ifman)
 {
+	TSMF_PRESENTATION* presentation;
+
 	DEBUG_DVC("");
 	ifman->output_pending = true;
+
+	presentation = tsmf_presentation_find_by_id(stream_get_tail(ifman->input));
+	if (presentation)
+		tsmf_presentation_restart(presentation);
+	else
+		DEBUG_WARN("unknown presentation id");
+
 	return 0;
 }
 
@@ -20,14 +20,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <time.h>
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/list.h>
 #include <freerdp/utils/thread.h>
 #include <freerdp/utils/mutex.h>
 #include <freerdp/utils/event.h>
-#include <freerdp/utils/sleep.h>
 #include <freerdp/plugins/tsmf.h>
 
 #include "drdynvc_types.h"
@@ -39,7 +38,14 @@
 #include "tsmf_codec.h"
 #include "tsmf_media.h"
 
-#define AUDIO_TOLERANCE 10000000LL
+/* decoded video frames a stream may hold ahead of the clock */
+#define TSMF_FRAME_QUEUE_DEPTH	8
+/* audio positions closer than this to the clock do not move it, in 100ns */
+#define TSMF_CLOCK_SLACK	100000LL
+/* frames presented later than this past their start time count as late */
+#define TSMF_LATE_TOLERANCE	200000LL
+/* longest sleep of an idle stream thread, in ms */
+#define TSMF_IDLE_TIMEOUT	100
 
 struct _TSMF_PRESENTATION
 {
@@ -65,8 +71,17 @@ struct _TSMF_PRESENTATION
 
 	IWTSVirtualChannelCallback* channel_callback;
 
-	uint64 audio_start_time;
-	uint64 audio_end_time;
+	/**
+	 * Master clock: media time clock_media is current at monotonic system
+	 * time clock_system. Audio playback anchors it; without audio it runs
+	 * free from the first video frame. While playback is paused the clock
+	 * stands still at clock_media. Protected by the mutex.
+	 */
+	uint64 clock_media;
+	uint64 clock_system;
+	tbool clock_audio;
+	tbool clock_paused;
+	TSMF_PLAYBACK_STATS stats;
 
 	/* The stream list could be accessed by differnt threads and need to be protected. */
 	freerdp_mutex mutex;
@@ -92,15 +107,14 @@ struct _TSMF_STREAM
 	uint32 channels;
 	uint32 bits_per_sample;
 
-	/* The end_time of last played sample */
-	uint64 last_end_time;
-	/* Next sample should not start before this system time. */
-	uint64 next_start_time;
-
 	freerdp_thread* thread;
 
 	LIST* sample_list;
 
+	/* Decoded video frames, a min-heap on start time protected by the thread lock. */
+	TSMF_SAMPLE* frames[TSMF_FRAME_QUEUE_DEPTH];
+	int num_frames;
+
 	/* The sample ack response queue will be accessed only by the stream thread. */
 	LIST* sample_ack_list;
 };
@@ -116,6 +130,9 @@ struct _TSMF_SAMPLE
 	uint8* data;
 	uint32 decoded_size;
 	uint32 pixfmt;
+	uint32 width;
+	uint32 height;
+	RDP_VIDEO_FRAME_BUFFER* frame_buffer;
 
 	TSMF_STREAM* stream;
 	IWTSVirtualChannelCallback* channel_callback;
@@ -126,67 +143,148 @@ static LIST* presentation_list = NULL;
 
 static uint64 get_current_time(void)
 {
-	struct timeval tp;
+	struct timespec tp;
 
-	gettimeofday(&tp, 0);
-	return ((uint64)tp.tv_sec) * 10000000LL + ((uint64)tp.tv_usec) * 10LL;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return ((uint64)tp.tv_sec) * 10000000LL + ((uint64)tp.tv_nsec) / 100LL;
 }
 
-static TSMF_SAMPLE* tsmf_stream_pop_sample(TSMF_STREAM* stream, int sync)
+static TSMF_SAMPLE* tsmf_stream_pop_sample(TSMF_STREAM* stream)
 {
-	TSMF_STREAM* s;
-	LIST_ITEM* item;
 	TSMF_SAMPLE* sample;
-	tbool pending = false;
-	TSMF_PRESENTATION* presentation = stream->presentation;
 
 	if (!stream->sample_list->head)
 		return NULL;
 
-	if (sync)
-	{
-		if (stream->major_type == TSMF_MAJOR_TYPE_AUDIO)
-		{
-			/* Check if some other stream has earlier sample that needs to be played first */
-			if (stream->last_end_time > AUDIO_TOLERANCE)
-			{
-				freerdp_mutex_lock(presentation->mutex);
-				for (item = presentation->stream_list->head; item; item = item->next)
-				{
-					s = (TSMF_STREAM*) item->data;
-					if (s != stream && !s->eos && s->last_end_time &&
-						s->last_end_time < stream->last_end_time - AUDIO_TOLERANCE)
-					{
-							pending = true;
-							break;
-					}
-				}
-				freerdp_mutex_unlock(presentation->mutex);
-			}
-		}
-		else
-		{
-			if (stream->last_end_time > presentation->audio_end_time)
-			{
-				pending = true;
-			}
-		}
-	}
-	if (pending)
-		return NULL;
-
 	freerdp_thread_lock(stream->thread);
 	sample = (TSMF_SAMPLE*) list_dequeue(stream->sample_list);
 	freerdp_thread_unlock(stream->thread);
 
-	if (sample && sample->end_time > stream->last_end_time)
-		stream->last_end_time = sample->end_time;
-
 	return sample;
 }
 
+/**
+ * Get the media time of the presentation clock at system time now.
+ * An unset clock is started at start_time.
+ */
+
+static uint64 tsmf_presentation_get_clock(TSMF_PRESENTATION* presentation, uint64 now, uint64 start_time)
+{
+	uint64 clock;
+
+	freerdp_mutex_lock(presentation->mutex);
+
+	if (presentation->clock_system == 0)
+	{
+		presentation->clock_media = start_time;
+		presentation->clock_system = now;
+	}
+
+	if (presentation->clock_paused)
+		clock = presentation->clock_media;
+	else if (now >= presentation->clock_system)
+		clock = presentation->clock_media + (now - presentation->clock_system);
+	else if (presentation->clock_media > presentation->clock_system - now)
+		clock = presentation->clock_media - (presentation->clock_system - now);
+	else
+		clock = 0;
+
+	freerdp_mutex_unlock(presentation->mutex);
+
+	return clock;
+}
+
+/**
+ * Anchor the presentation clock to audio playback: media time is heard
+ * at system time. Small drift is tolerated to keep the clock smooth.
+ */
+
+static void tsmf_presentation_sync_clock(TSMF_PRESENTATION* presentation, uint64 media_time, uint64 system_time)
+{
+	sint64 drift;
+
+	freerdp_mutex_lock(presentation->mutex);
+
+	presentation->stats.audio_samples++;
+
+	if (presentation->clock_paused)
+	{
+		freerdp_mutex_unlock(presentation->mutex);
+		return;
+	}
+
+	drift = (sint64) presentation->clock_media - (sint64) media_time +
+		((sint64) system_time - (sint64) presentation->clock_system);
+
+	if (presentation->clock_system == 0 || !presentation->clock_audio ||
+		drift > TSMF_CLOCK_SLACK || drift < -TSMF_CLOCK_SLACK)
+	{
+		if (presentation->clock_audio)
+			presentation->stats.clock_resyncs++;
+
+		presentation->clock_media = media_time;
+		presentation->clock_system = system_time;
+		presentation->clock_audio = true;
+	}
+
+	freerdp_mutex_unlock(presentation->mutex);
+}
+
+static void tsmf_presentation_reset_clock(TSMF_PRESENTATION* presentation)
+{
+	freerdp_mutex_lock(presentation->mutex);
+	presentation->clock_media = 0;
+	presentation->clock_system = 0;
+	presentation->clock_audio = false;
+	presentation->clock_paused = false;
+	freerdp_mutex_unlock(presentation->mutex);
+}
+
+/**
+ * Freeze the presentation clock at its current media time.
+ */
+
+void tsmf_presentation_pause(TSMF_PRESENTATION* presentation)
+{
+	uint64 now;
+
+	freerdp_mutex_lock(presentation->mutex);
+
+	if (!presentation->clock_paused && presentation->clock_system != 0)
+	{
+		now = get_current_time();
+
+		if (now >= presentation->clock_system)
+			presentation->clock_media += now - presentation->clock_system;
+
+		presentation->clock_system = now;
+		presentation->clock_paused = true;
+	}
+
+	freerdp_mutex_unlock(presentation->mutex);
+}
+
+/**
+ * Let the presentation clock run again from the media time it was paused at.
+ */
+
+void tsmf_presentation_restart(TSMF_PRESENTATION* presentation)
+{
+	freerdp_mutex_lock(presentation->mutex);
+
+	if (presentation->clock_paused)
+	{
+		presentation->clock_system = get_current_time();
+		presentation->clock_paused = false;
+	}
+
+	freerdp_mutex_unlock(presentation->mutex);
+}
+
 static void tsmf_sample_free(TSMF_SAMPLE* sample)
 {
+	if (sample->frame_buffer)
+		sample->frame_buffer->pool->Release(sample->frame_buffer->pool, sample->frame_buffer);
 	if (sample->data)
 		xfree(sample->data);
 	xfree(sample);
@@ -222,6 +320,79 @@ static void tsmf_stream_process_ack(TSMF_STREAM* stream)
 	}
 }
 
+static void tsmf_stream_push_frame(TSMF_STREAM* stream, TSMF_SAMPLE* sample)
+{
+	int i, parent;
+	TSMF_SAMPLE** frames = stream->frames;
+
+	freerdp_thread_lock(stream->thread);
+
+	for (i = stream->num_frames++; i > 0; i = parent)
+	{
+		parent = (i - 1) / 2;
+
+		if (frames[parent]->start_time <= sample->start_time)
+			break;
+
+		frames[i] = frames[parent];
+	}
+	frames[i] = sample;
+
+	freerdp_thread_unlock(stream->thread);
+}
+
+static tbool tsmf_stream_peek_frame(TSMF_STREAM* stream, uint64* start_time)
+{
+	tbool found = false;
+
+	freerdp_thread_lock(stream->thread);
+
+	if (stream->num_frames > 0)
+	{
+		*start_time = stream->frames[0]->start_time;
+		found = true;
+	}
+
+	freerdp_thread_unlock(stream->thread);
+
+	return found;
+}
+
+static TSMF_SAMPLE* tsmf_stream_pop_frame(TSMF_STREAM* stream)
+{
+	int i, child;
+	TSMF_SAMPLE* last;
+	TSMF_SAMPLE* sample;
+	TSMF_SAMPLE** frames = stream->frames;
+
+	freerdp_thread_lock(stream->thread);
+
+	if (stream->num_frames == 0)
+	{
+		freerdp_thread_unlock(stream->thread);
+		return NULL;
+	}
+
+	sample = frames[0];
+	last = frames[--stream->num_frames];
+
+	for (i = 0; (child = 2 * i + 1) < stream->num_frames; i = child)
+	{
+		if (child + 1 < stream->num_frames && frames[child + 1]->start_time < frames[child]->start_time)
+			child++;
+
+		if (last->start_time <= frames[child]->start_time)
+			break;
+
+		frames[i] = frames[child];
+	}
+	frames[i] = last;
+
+	freerdp_thread_unlock(stream->thread);
+
+	return sample;
+}
+
 TSMF_PRESENTATION* tsmf_presentation_new(const uint8* guid, IWTSVirtualChannelCallback* pChannelCallback)
 {
 	TSMF_PRESENTATION* presentation;
@@ -285,7 +456,6 @@ static void tsmf_presentation_restore_last_video_frame(TSMF_PRESENTATION* presen
 
 static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 {
-	uint64 t;
 	RDP_VIDEO_FRAME_EVENT* vevent;
 	TSMF_STREAM* stream = sample->stream;
 	TSMF_PRESENTATION* presentation = stream->presentation;
@@ -293,17 +463,8 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 	DEBUG_DVC("MessageId %d EndTime %d data_size %d consumed.",
 		sample->sample_id, (int)sample->end_time, sample->data_size);
 
-	if (sample->data)
+	if (sample->data || sample->frame_buffer)
 	{
-		t = get_current_time();
-		if (stream->next_start_time > t &&
-			(sample->end_time >= presentation->audio_start_time ||
-			sample->end_time < stream->last_end_time))
-		{
-			freerdp_usleep((stream->next_start_time - t) / 10);
-		}
-		stream->next_start_time = t + sample->duration - 50000;
-
 		if (presentation->last_x != presentation->output_x ||
 			presentation->last_y != presentation->output_y ||
 			presentation->last_width != presentation->output_width ||
@@ -339,8 +500,9 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 		vevent->frame_data = sample->data;
 		vevent->frame_size = sample->decoded_size;
 		vevent->frame_pixfmt = sample->pixfmt;
-		vevent->frame_width = sample->stream->width;
-		vevent->frame_height = sample->stream->height;
+		vevent->frame_width = sample->width;
+		vevent->frame_height = sample->height;
+		vevent->frame_buffer = sample->frame_buffer;
 		vevent->x = presentation->output_x;
 		vevent->y = presentation->output_y;
 		vevent->width = presentation->output_width;
@@ -356,6 +518,7 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 		/* The frame data ownership is passed to the event object, and is freed after the event is processed. */
 		sample->data = NULL;
 		sample->decoded_size = 0;
+		sample->frame_buffer = NULL;
 
 		if (!tsmf_push_event(sample->channel_callback, (RDP_EVENT*) vevent))
 		{
@@ -373,10 +536,10 @@ static void tsmf_sample_playback_video(TSMF_SAMPLE* sample)
 			snprintf(buf, sizeof(buf), "/tmp/FreeRDP_Frame_%d.ppm", frame_id);
 			fp = fopen(buf, "wb");
 			fwrite("P5\n", 1, 3, fp);
-			snprintf(buf, sizeof(buf), "%d %d\n", sample->stream->width, sample->stream->height);
+			snprintf(buf, sizeof(buf), "%d %d\n", sample->width, sample->height);
 			fwrite(buf, 1, strlen(buf), fp);
 			fwrite("255\n", 1, 4, fp);
-			fwrite(sample->data, 1, sample->stream->width * sample->stream->height, fp);
+			fwrite(sample->data, 1, sample->width * sample->height, fp);
 			fflush(fp);
 			fclose(fp);
 		}
@@ -409,9 +572,65 @@ static void tsmf_sample_playback_audio(TSMF_SAMPLE* sample)
 	}
 
 	sample->ack_time = latency + get_current_time();
-	stream->last_end_time = sample->end_time + latency;
-	stream->presentation->audio_start_time = sample->start_time + latency;
-	stream->presentation->audio_end_time = sample->end_time + latency;
+	tsmf_presentation_sync_clock(stream->presentation, sample->end_time, sample->ack_time);
+}
+
+/**
+ * Present the decoded frames that are due on the presentation clock.
+ * A due frame is dropped when the next one is due as well, so a stream
+ * falling behind catches up instead of drifting.
+ * @return time in ms until the next frame is due, 0 if none is queued
+ */
+
+static int tsmf_stream_present_frames(TSMF_STREAM* stream, tbool drain)
+{
+	uint64 now;
+	uint64 clock;
+	uint64 start_time;
+	TSMF_SAMPLE* sample;
+	TSMF_PRESENTATION* presentation = stream->presentation;
+
+	while (tsmf_stream_peek_frame(stream, &start_time))
+	{
+		now = get_current_time();
+		clock = tsmf_presentation_get_clock(presentation, now, start_time);
+
+		if (!drain && start_time > clock)
+		{
+			freerdp_mutex_lock(presentation->mutex);
+			presentation->stats.frames_waited++;
+			freerdp_mutex_unlock(presentation->mutex);
+
+			return (int) ((start_time - clock + 9999) / 10000);
+		}
+
+		sample = tsmf_stream_pop_frame(stream);
+		if (sample == NULL)
+			break;
+
+		freerdp_mutex_lock(presentation->mutex);
+		if (!drain && tsmf_stream_peek_frame(stream, &start_time) && start_time <= clock)
+		{
+			presentation->stats.frames_dropped++;
+			freerdp_mutex_unlock(presentation->mutex);
+
+			DEBUG_DVC("MessageId %d dropped.", sample->sample_id);
+		}
+		else
+		{
+			presentation->stats.frames_presented++;
+			if (clock > sample->start_time + TSMF_LATE_TOLERANCE)
+				presentation->stats.frames_late++;
+			freerdp_mutex_unlock(presentation->mutex);
+
+			tsmf_sample_playback_video(sample);
+		}
+
+		tsmf_sample_ack(sample);
+		tsmf_sample_free(sample);
+	}
+
+	return 0;
 }
 
 static void tsmf_sample_playback(TSMF_SAMPLE* sample)
@@ -456,9 +675,17 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 			stream->width = width;
 			stream->height = height;
 		}
+
+		sample->width = stream->width;
+		sample->height = stream->height;
+	}
+
+	if (stream->decoder->GetDecodedFrame)
+	{
+		sample->frame_buffer = stream->decoder->GetDecodedFrame(stream->decoder);
 	}
 
-	if (stream->decoder->GetDecodedData)
+	if (!sample->frame_buffer && stream->decoder->GetDecodedData)
 	{
 		sample->data = stream->decoder->GetDecodedData(stream->decoder, &sample->decoded_size);
 	}
@@ -466,9 +693,10 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 	switch (sample->stream->major_type)
 	{
 		case TSMF_MAJOR_TYPE_VIDEO:
-			tsmf_sample_playback_video(sample);
-			tsmf_sample_ack(sample);
-			tsmf_sample_free(sample);
+			freerdp_mutex_lock(stream->presentation->mutex);
+			stream->presentation->stats.frames_decoded++;
+			freerdp_mutex_unlock(stream->presentation->mutex);
+			tsmf_stream_push_frame(stream, sample);
 			break;
 		case TSMF_MAJOR_TYPE_AUDIO:
 			tsmf_sample_playback_audio(sample);
@@ -479,6 +707,10 @@ static void tsmf_sample_playback(TSMF_SAMPLE* sample)
 
 static void* tsmf_stream_playback_func(void* arg)
 {
+	uint64 now;
+	int timeout;
+	int ack_timeout;
+	uint64 ack_time;
 	TSMF_SAMPLE* sample;
 	TSMF_STREAM* stream = (TSMF_STREAM*) arg;
 	TSMF_PRESENTATION* presentation = stream->presentation;
@@ -500,16 +732,42 @@ static void* tsmf_stream_playback_func(void* arg)
 	while (!freerdp_thread_is_stopped(stream->thread))
 	{
 		tsmf_stream_process_ack(stream);
-		sample = tsmf_stream_pop_sample(stream, 1);
+
+		sample = NULL;
+		if (stream->num_frames < TSMF_FRAME_QUEUE_DEPTH)
+			sample = tsmf_stream_pop_sample(stream);
 		if (sample)
 			tsmf_sample_playback(sample);
-		else
-			freerdp_usleep(5000);
+
+		timeout = tsmf_stream_present_frames(stream, false);
+
+		if (sample)
+			continue;
+
+		/* sleep until a frame or an ack is due, or a sample arrives */
+		if (timeout == 0 || timeout > TSMF_IDLE_TIMEOUT)
+			timeout = TSMF_IDLE_TIMEOUT;
+		if (stream->sample_ack_list->head)
+		{
+			ack_time = ((TSMF_SAMPLE*) list_peek(stream->sample_ack_list))->ack_time;
+			now = get_current_time();
+			ack_timeout = (ack_time > now) ? (int) ((ack_time - now + 9999) / 10000) : 0;
+			if (ack_timeout < timeout)
+				timeout = ack_timeout;
+		}
+		if (timeout > 0)
+			freerdp_thread_wait_timeout(stream->thread, timeout);
+		freerdp_thread_reset(stream->thread);
 	}
 	if (stream->eos || presentation->eos)
 	{
-		while ((sample = tsmf_stream_pop_sample(stream, 1)) != NULL)
+		while ((sample = tsmf_stream_pop_sample(stream)) != NULL)
+		{
 			tsmf_sample_playback(sample);
+			if (stream->num_frames == TSMF_FRAME_QUEUE_DEPTH)
+				tsmf_stream_present_frames(stream, true);
+		}
+		tsmf_stream_present_frames(stream, true);
 	}
 	if (stream->audio)
 	{
@@ -565,6 +823,12 @@ void tsmf_presentation_stop(TSMF_PRESENTATION* presentation)
 		tsmf_stream_stop(stream);
 	}
 
+	DEBUG_DVC("frames decoded %d presented %d late %d dropped %d waits %d, audio samples %d clock resyncs %d",
+		presentation->stats.frames_decoded, presentation->stats.frames_presented,
+		presentation->stats.frames_late, presentation->stats.frames_dropped,
+		presentation->stats.frames_waited, presentation->stats.audio_samples,
+		presentation->stats.clock_resyncs);
+
 	tsmf_presentation_restore_last_video_frame(presentation);
 	if (presentation->last_rects)
 	{
@@ -604,7 +868,10 @@ static void tsmf_stream_flush(TSMF_STREAM* stream)
 {
 	TSMF_SAMPLE* sample;
 
-	while ((sample = tsmf_stream_pop_sample(stream, 0)) != NULL)
+	while ((sample = tsmf_stream_pop_sample(stream)) != NULL)
+		tsmf_sample_free(sample);
+
+	while ((sample = tsmf_stream_pop_frame(stream)) != NULL)
 		tsmf_sample_free(sample);
 
 	while ((sample = list_dequeue(stream->sample_ack_list)) != NULL)
@@ -614,13 +881,6 @@ static void tsmf_stream_flush(TSMF_STREAM* stream)
 		stream->audio->Flush(stream->audio);
 
 	stream->eos = 0;
-	stream->last_end_time = 0;
-	stream->next_start_time = 0;
-	if (stream->major_type == TSMF_MAJOR_TYPE_AUDIO)
-	{
-		stream->presentation->audio_start_time = 0;
-		stream->presentation->audio_end_time = 0;
-	}
 }
 
 void tsmf_presentation_flush(TSMF_PRESENTATION* presentation)
@@ -635,8 +895,14 @@ void tsmf_presentation_flush(TSMF_PRESENTATION* presentation)
 	}
 
 	presentation->eos = 0;
-	presentation->audio_start_time = 0;
-	presentation->audio_end_time = 0;
+	tsmf_presentation_reset_clock(presentation);
+}
+
+void tsmf_presentation_get_stats(TSMF_PRESENTATION* presentation, TSMF_PLAYBACK_STATS* stats)
+{
+	freerdp_mutex_lock(presentation->mutex);
+	memcpy(stats, &presentation->stats, sizeof(TSMF_PLAYBACK_STATS));
+	freerdp_mutex_unlock(presentation->mutex);
 }
 
 void tsmf_presentation_free(TSMF_PRESENTATION* presentation)
@@ -785,6 +1051,8 @@ void tsmf_stream_push_sample(TSMF_STREAM* stream, IWTSVirtualChannelCallback* pC
 	freerdp_thread_lock(stream->thread);
 	list_enqueue(stream->sample_list, sample);
 	freerdp_thread_unlock(stream->thread);
+
+	freerdp_thread_signal(stream->thread);
 }
 
 void tsmf_media_init(void)
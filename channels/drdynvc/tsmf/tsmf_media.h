@@ -31,6 +31,22 @@ typedef struct _TSMF_STREAM TSMF_STREAM;
 
 typedef struct _TSMF_SAMPLE TSMF_SAMPLE;
 
+typedef struct _TSMF_PLAYBACK_STATS TSMF_PLAYBACK_STATS;
+
+/**
+ * Scheduling decisions of a presentation, counted since it was created.
+ */
+struct _TSMF_PLAYBACK_STATS
+{
+	uint32 frames_decoded;
+	uint32 frames_presented;
+	uint32 frames_late; /* presented past their start time plus tolerance */
+	uint32 frames_dropped; /* skipped because the next frame was due as well */
+	uint32 frames_waited; /* waits for the next frame to become due */
+	uint32 audio_samples; /* audio samples played against the clock */
+	uint32 clock_resyncs; /* audio anchors that moved the clock beyond tolerance */
+};
+
 TSMF_PRESENTATION* tsmf_presentation_new(const uint8* guid, IWTSVirtualChannelCallback* pChannelCallback);
 TSMF_PRESENTATION* tsmf_presentation_find_by_id(const uint8* guid);
 void tsmf_presentation_start(TSMF_PRESENTATION* presentation);
@@ -41,6 +57,9 @@ void tsmf_presentation_set_geometry_info(TSMF_PRESENTATION* presentation,
 void tsmf_presentation_set_audio_device(TSMF_PRESENTATION* presentation,
 	const char* name, const char* device);
 void tsmf_presentation_flush(TSMF_PRESENTATION* presentation);
+void tsmf_presentation_pause(TSMF_PRESENTATION* presentation);
+void tsmf_presentation_restart(TSMF_PRESENTATION* presentation);
+void tsmf_presentation_get_stats(TSMF_PRESENTATION* presentation, TSMF_PLAYBACK_STATS* stats);
 void tsmf_presentation_free(TSMF_PRESENTATION* presentation);
 
 TSMF_STREAM* tsmf_stream_new(TSMF_PRESENTATION* presentation, uint32 stream_id);
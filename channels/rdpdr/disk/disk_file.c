@@ -270,6 +270,20 @@ static tbool disk_file_init(DISK_FILE* file, uint32 DesiredAccess, uint32 Create
 	return true;
 }
 
+static void disk_file_free_snapshot(DISK_FILE* file)
+{
+	int i;
+
+	for (i = 0; i < file->num_entries; i++)
+		xfree(file->entries[i].name);
+
+	xfree(file->entries);
+	file->entries = NULL;
+	file->num_entries = 0;
+	file->next_entry = 0;
+	file->snapshot = false;
+}
+
 DISK_FILE* disk_file_new(const char* base_path, const char* path, uint32 id,
 	uint32 DesiredAccess, uint32 CreateDisposition, uint32 CreateOptions)
 {
@@ -305,38 +319,105 @@ void disk_file_free(DISK_FILE* file)
 			unlink(file->fullpath);
 	}
 
+	disk_file_free_snapshot(file);
 	xfree(file->pattern);
 	xfree(file->fullpath);
 	xfree(file);
 }
 
-tbool disk_file_seek(DISK_FILE* file, uint64 Offset)
+/**
+ * Hint the kernel to prefetch ahead of a sequential reader.
+ * Two reads in a row that continue where the previous one ended start the
+ * read-ahead, which then stays one window ahead of the requests.
+ */
+
+static void disk_file_read_ahead(DISK_FILE* file, uint64 Offset, uint32 Length)
 {
-	if (file->is_dir || file->fd == -1)
-		return false;
+#ifdef POSIX_FADV_WILLNEED
+	uint64 window;
 
-	if (lseek(file->fd, Offset, SEEK_SET) == (off_t)-1)
-		return false;
+	if (Offset != file->next_offset)
+	{
+		file->sequential = 0;
+		file->read_ahead_end = 0;
+		return;
+	}
 
-	return true;
+	if (++file->sequential < 2)
+		return;
+
+	window = (uint64) Length * DISK_FILE_READ_AHEAD_FACTOR;
+	if (window > DISK_FILE_READ_AHEAD_MAX)
+		window = DISK_FILE_READ_AHEAD_MAX;
+
+	/* only issue a new hint once half of the previous window was consumed */
+	if (Offset + Length + window / 2 <= file->read_ahead_end)
+		return;
+
+	if (file->read_ahead_end < Offset + Length)
+		file->read_ahead_end = Offset + Length;
+
+	posix_fadvise(file->fd, file->read_ahead_end, Offset + Length + window - file->read_ahead_end, POSIX_FADV_WILLNEED);
+	file->read_ahead_end = Offset + Length + window;
+#endif
+}
+
+/**
+ * Bound the length of a read request to the data the file holds past the
+ * offset, and to DISK_FILE_READ_MAX, before a buffer is sized from it.
+ * Reading less than requested is a valid answer to the server.
+ */
+
+uint32 disk_file_read_length(DISK_FILE* file, uint32 Length, uint64 Offset)
+{
+	struct stat st;
+
+	if (Length > DISK_FILE_READ_MAX)
+		Length = DISK_FILE_READ_MAX;
+
+	if (file->is_dir || file->fd == -1 || fstat(file->fd, &st) != 0)
+		return Length;
+
+	if (Offset >= (uint64) st.st_size)
+		return 0;
+
+	if ((uint64) st.st_size - Offset < Length)
+		Length = (uint32) ((uint64) st.st_size - Offset);
+
+	return Length;
 }
 
-tbool disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length)
+tbool disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length, uint64 Offset)
 {
 	ssize_t r;
+	uint32 done = 0;
 
 	if (file->is_dir || file->fd == -1)
 		return false;
 
-	r = read(file->fd, buffer, *Length);
-	if (r < 0)
-		return false;
-	*Length = (uint32)r;
+	disk_file_read_ahead(file, Offset, *Length);
+
+	while (done < *Length)
+	{
+		r = pread(file->fd, buffer + done, *Length - done, Offset + done);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (r == 0)
+			break;
+		done += (uint32) r;
+	}
+
+	*Length = done;
+	file->next_offset = Offset + done;
 
 	return true;
 }
 
-tbool disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length)
+tbool disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length, uint64 Offset)
 {
 	ssize_t r;
 
@@ -345,11 +426,16 @@ tbool disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length)
 
 	while (Length > 0)
 	{
-		r = write(file->fd, buffer, Length);
+		r = pwrite(file->fd, buffer, Length, Offset);
 		if (r == -1)
+		{
+			if (errno == EINTR)
+				continue;
 			return false;
+		}
 		Length -= r;
 		buffer += r;
+		Offset += r;
 	}
 
 	return true;
@@ -502,13 +588,75 @@ tbool disk_file_set_information(DISK_FILE* file, uint32 FsInformationClass, uint
 	return true;
 }
 
+/**
+ * Read the whole directory once, keeping the names matching the current
+ * pattern along with their stat data. Later queries on the handle are
+ * answered from this snapshot instead of readdir and stat per entry.
+ */
+
+static void disk_file_take_snapshot(DISK_FILE* file)
+{
+	struct dirent* ent;
+	DISK_DIR_ENTRY* entry;
+	UNICONV* uniconv;
+	char* ent_path;
+	int max_entries;
+	int path_size;
+	int base_len;
+	int len;
+
+	disk_file_free_snapshot(file);
+	file->snapshot = true;
+
+	rewinddir(file->dir);
+
+	uniconv = freerdp_uniconv_new();
+	base_len = strlen(file->fullpath);
+	path_size = base_len + 256;
+	ent_path = xmalloc(path_size);
+	max_entries = 0;
+
+	while ((ent = readdir(file->dir)) != NULL)
+	{
+		if (file->pattern && !disk_file_wildcard_match(file->pattern, ent->d_name))
+			continue;
+
+		if (file->num_entries + 1 > max_entries)
+		{
+			max_entries = (max_entries > 0) ? max_entries * 2 : 64;
+			file->entries = xrenew(DISK_DIR_ENTRY, file->entries, max_entries);
+		}
+
+		len = strlen(ent->d_name);
+		if (base_len + len + 2 > path_size)
+		{
+			path_size = base_len + len + 2;
+			ent_path = xrealloc(ent_path, path_size);
+		}
+		sprintf(ent_path, "%s/%s", file->fullpath, ent->d_name);
+
+		entry = &file->entries[file->num_entries++];
+		memset(&entry->st, 0, sizeof(struct stat));
+		if (stat(ent_path, &entry->st) != 0)
+		{
+			DEBUG_WARN("stat %s failed.", ent_path);
+		}
+
+		entry->name = freerdp_uniconv_out(uniconv, ent->d_name, &entry->length);
+	}
+
+	xfree(ent_path);
+	freerdp_uniconv_free(uniconv);
+
+	DEBUG_SVC("  pattern %s matched %d entries", file->pattern, file->num_entries);
+}
+
 tbool disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint8 InitialQuery,
 	const char* path, STREAM* output)
 {
-	struct dirent* ent;
+	DISK_DIR_ENTRY* entry;
 	char* ent_path;
 	struct stat st;
-	UNICONV* uniconv;
 	size_t len;
 	tbool ret;
 
@@ -523,33 +671,21 @@ tbool disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint
 
 	if (InitialQuery != 0)
 	{
-		rewinddir(file->dir);
 		xfree(file->pattern);
 
 		if (path[0])
 			file->pattern = strdup(strrchr(path, '\\') + 1);
 		else
 			file->pattern = NULL;
-	}
-
-	if (file->pattern)
-	{
-		do
-		{
-			ent = readdir(file->dir);
-			if (ent == NULL)
-				continue;
 
-			if (disk_file_wildcard_match(file->pattern, ent->d_name))
-				break;
-		} while (ent);
+		disk_file_take_snapshot(file);
 	}
-	else
+	else if (!file->snapshot)
 	{
-		ent = readdir(file->dir);
+		disk_file_take_snapshot(file);
 	}
 
-	if (ent == NULL)
+	if (file->next_entry >= file->num_entries)
 	{
 		DEBUG_SVC("  pattern %s not found.", file->pattern);
 		stream_write_uint32(output, 0); /* Length */
@@ -557,20 +693,10 @@ tbool disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint
 		return false;
 	}
 
-	memset(&st, 0, sizeof(struct stat));
-	ent_path = xmalloc(strlen(file->fullpath) + strlen(ent->d_name) + 2);
-	sprintf(ent_path, "%s/%s", file->fullpath, ent->d_name);
-	if (stat(ent_path, &st) != 0)
-	{
-		DEBUG_WARN("stat %s failed.", ent_path);
-	}
-	xfree(ent_path);
-
-	DEBUG_SVC("  pattern %s matched %s\n", file->pattern, ent_path);
-
-	uniconv = freerdp_uniconv_new();
-	ent_path = freerdp_uniconv_out(uniconv, ent->d_name, &len);
-	freerdp_uniconv_free(uniconv);
+	entry = &file->entries[file->next_entry++];
+	st = entry->st;
+	ent_path = entry->name;
+	len = entry->length;
 
 	ret = true;
 	switch (FsInformationClass)
@@ -649,7 +775,5 @@ tbool disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint
 			break;
 	}
 
-	xfree(ent_path);
-
 	return ret;
 }
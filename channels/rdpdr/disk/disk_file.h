@@ -25,6 +25,19 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
+#define DISK_FILE_READ_AHEAD_FACTOR	8
+#define DISK_FILE_READ_AHEAD_MAX	(4 * 1024 * 1024)
+#define DISK_FILE_READ_MAX		(16 * 1024 * 1024)
+
+/* a directory entry, as captured by the first query on a handle */
+typedef struct _DISK_DIR_ENTRY DISK_DIR_ENTRY;
+struct _DISK_DIR_ENTRY
+{
+	char* name; /* UTF-16LE */
+	size_t length;
+	struct stat st;
+};
+
 typedef struct _DISK_FILE DISK_FILE;
 struct _DISK_FILE
 {
@@ -38,15 +51,28 @@ struct _DISK_FILE
 	char* filename;
 	char* pattern;
 	boolean delete_pending;
+
+	/* sequential read detection */
+	uint64 next_offset;
+	uint32 sequential;
+	uint64 read_ahead_end;
+
+	/* directory snapshot served to IRP_MN_QUERY_DIRECTORY */
+	DISK_DIR_ENTRY* entries;
+	int num_entries;
+	int next_entry;
+	boolean snapshot;
+
+	DISK_FILE* hash_next;
 };
 
 DISK_FILE* disk_file_new(const char* base_path, const char* path, uint32 id,
 	uint32 DesiredAccess, uint32 CreateDisposition, uint32 CreateOptions);
 void disk_file_free(DISK_FILE* file);
 
-boolean disk_file_seek(DISK_FILE* file, uint64 Offset);
-boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length);
-boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length);
+uint32 disk_file_read_length(DISK_FILE* file, uint32 Length, uint64 Offset);
+boolean disk_file_read(DISK_FILE* file, uint8* buffer, uint32* Length, uint64 Offset);
+boolean disk_file_write(DISK_FILE* file, uint8* buffer, uint32 Length, uint64 Offset);
 boolean disk_file_query_information(DISK_FILE* file, uint32 FsInformationClass, STREAM* output);
 boolean disk_file_set_information(DISK_FILE* file, uint32 FsInformationClass, uint32 Length, STREAM* input);
 boolean disk_file_query_directory(DISK_FILE* file, uint32 FsInformationClass, uint8 InitialQuery,
@@ -27,6 +27,7 @@
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/unicode.h>
 #include <freerdp/utils/list.h>
+#include <freerdp/utils/mutex.h>
 #include <freerdp/utils/thread.h>
 #include <freerdp/utils/svc_plugin.h>
 
@@ -34,16 +35,41 @@
 #include "rdpdr_types.h"
 #include "disk_file.h"
 
+#define DISK_DEFAULT_WORKERS	4
+#define DISK_MAX_WORKERS	64
+
+#define DISK_FILES_INITIAL_SIZE	64
+
 typedef struct _DISK_DEVICE DISK_DEVICE;
+
+typedef struct _DISK_WORKER DISK_WORKER;
+struct _DISK_WORKER
+{
+	DISK_DEVICE* disk;
+	freerdp_thread* thread;
+
+	boolean busy; /* signaled, or draining the IRP list */
+	boolean active; /* FileId is being processed */
+	uint32 FileId;
+};
+
 struct _DISK_DEVICE
 {
 	DEVICE device;
 
 	char* path;
-	LIST* files;
 
+	/* open files, hashed by FileId */
+	DISK_FILE** files;
+	int files_size;
+	int num_files;
+
+	/* protects files, irp_list and the worker states */
+	freerdp_mutex mutex;
 	LIST* irp_list;
-	freerdp_thread* thread;
+
+	DISK_WORKER* workers;
+	int num_workers;
 };
 
 
@@ -80,18 +106,73 @@ disk_map_posix_err(int fs_errno)
 	return rc;
 }
 
+#define disk_file_hash(_disk, _id) ((_id) & ((_disk)->files_size - 1))
+
 static DISK_FILE* disk_get_file_by_id(DISK_DEVICE* disk, uint32 id)
 {
-	LIST_ITEM* item;
 	DISK_FILE* file;
 
-	for (item = disk->files->head; item; item = item->next)
+	freerdp_mutex_lock(disk->mutex);
+
+	for (file = disk->files[disk_file_hash(disk, id)]; file; file = file->hash_next)
 	{
-		file = (DISK_FILE*)item->data;
 		if (file->id == id)
-			return file;
+			break;
+	}
+
+	freerdp_mutex_unlock(disk->mutex);
+
+	return file;
+}
+
+/* Called with the device mutex held. */
+static void disk_add_file(DISK_DEVICE* disk, DISK_FILE* file)
+{
+	int i;
+	DISK_FILE* next;
+	DISK_FILE** old_files;
+	int old_size;
+
+	if (disk->num_files + 1 > disk->files_size)
+	{
+		old_files = disk->files;
+		old_size = disk->files_size;
+
+		disk->files_size *= 2;
+		disk->files = xzalloc(sizeof(DISK_FILE*) * disk->files_size);
+
+		for (i = 0; i < old_size; i++)
+		{
+			for (; old_files[i]; old_files[i] = next)
+			{
+				next = old_files[i]->hash_next;
+				old_files[i]->hash_next = disk->files[disk_file_hash(disk, old_files[i]->id)];
+				disk->files[disk_file_hash(disk, old_files[i]->id)] = old_files[i];
+			}
+		}
+
+		xfree(old_files);
+	}
+
+	file->hash_next = disk->files[disk_file_hash(disk, file->id)];
+	disk->files[disk_file_hash(disk, file->id)] = file;
+	disk->num_files++;
+}
+
+/* Called with the device mutex held. */
+static void disk_remove_file(DISK_DEVICE* disk, DISK_FILE* file)
+{
+	DISK_FILE** link;
+
+	for (link = &disk->files[disk_file_hash(disk, file->id)]; *link; link = &(*link)->hash_next)
+	{
+		if (*link == file)
+		{
+			*link = file->hash_next;
+			disk->num_files--;
+			break;
+		}
 	}
-	return NULL;
 }
 
 static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
@@ -116,7 +197,10 @@ static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
 	path = freerdp_uniconv_in(uniconv, stream_get_tail(irp->input), PathLength);
 	freerdp_uniconv_free(uniconv);
 
+	freerdp_mutex_lock(disk->mutex);
 	FileId = irp->devman->id_sequence++;
+	freerdp_mutex_unlock(disk->mutex);
+
 	file = disk_file_new(disk->path, path, FileId,
 		DesiredAccess, CreateDisposition, CreateOptions);
 
@@ -140,7 +224,9 @@ static void disk_process_irp_create(DISK_DEVICE* disk, IRP* irp)
 	}
 	else
 	{
-		list_enqueue(disk->files, file);
+		freerdp_mutex_lock(disk->mutex);
+		disk_add_file(disk, file);
+		freerdp_mutex_unlock(disk->mutex);
 
 		switch (CreateDisposition)
 		{
@@ -187,7 +273,10 @@ static void disk_process_irp_close(DISK_DEVICE* disk, IRP* irp)
 	{
 		DEBUG_SVC("%s(%d) closed.", file->fullpath, file->id);
 
-		list_remove(disk->files, file);
+		freerdp_mutex_lock(disk->mutex);
+		disk_remove_file(disk, file);
+		freerdp_mutex_unlock(disk->mutex);
+
 		disk_file_free(file);
 	}
 
@@ -201,13 +290,17 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 	DISK_FILE* file;
 	uint32 Length;
 	uint64 Offset;
-	uint8* buffer = NULL;
+	int pos;
 
 	stream_read_uint32(irp->input, Length);
 	stream_read_uint64(irp->input, Offset);
 
 	file = disk_get_file_by_id(disk, irp->FileId);
 
+	/* the data is read straight into the response, after its Length field */
+	pos = stream_get_pos(irp->output);
+	stream_seek_uint32(irp->output);
+
 	if (file == NULL)
 	{
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
@@ -215,21 +308,15 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 
 		DEBUG_WARN("FileId %d not valid.", irp->FileId);
 	}
-	else if (!disk_file_seek(file, Offset))
-	{
-		irp->IoStatus = STATUS_UNSUCCESSFUL;
-		Length = 0;
-
-		DEBUG_WARN("seek %s(%d) failed.", file->fullpath, file->id);
-	}
 	else
 	{
-		buffer = (uint8*)xmalloc(Length);
-		if (!disk_file_read(file, buffer, &Length))
+		/* Length comes from the server, never size the response from it alone */
+		Length = disk_file_read_length(file, Length, Offset);
+		stream_check_size(irp->output, Length);
+
+		if (!disk_file_read(file, stream_get_tail(irp->output), &Length, Offset))
 		{
 			irp->IoStatus = STATUS_UNSUCCESSFUL;
-			xfree(buffer);
-			buffer = NULL;
 			Length = 0;
 
 			DEBUG_WARN("read %s(%d) failed.", file->fullpath, file->id);
@@ -240,13 +327,9 @@ static void disk_process_irp_read(DISK_DEVICE* disk, IRP* irp)
 		}
 	}
 
+	stream_set_pos(irp->output, pos);
 	stream_write_uint32(irp->output, Length);
-	if (Length > 0)
-	{
-		stream_check_size(irp->output, Length);
-		stream_write(irp->output, buffer, Length);
-	}
-	xfree(buffer);
+	stream_seek(irp->output, Length);
 
 	irp->Complete(irp);
 }
@@ -270,14 +353,7 @@ static void disk_process_irp_write(DISK_DEVICE* disk, IRP* irp)
 
 		DEBUG_WARN("FileId %d not valid.", irp->FileId);
 	}
-	else if (!disk_file_seek(file, Offset))
-	{
-		irp->IoStatus = STATUS_UNSUCCESSFUL;
-		Length = 0;
-
-		DEBUG_WARN("seek %s(%d) failed.", file->fullpath, file->id);
-	}
-	else if (!disk_file_write(file, stream_get_tail(irp->input), Length))
+	else if (!disk_file_write(file, stream_get_tail(irp->input), Length, Offset))
 	{
 		irp->IoStatus = STATUS_UNSUCCESSFUL;
 		Length = 0;
@@ -542,55 +618,122 @@ static void disk_process_irp(DISK_DEVICE* disk, IRP* irp)
 	}
 }
 
-static void disk_process_irp_list(DISK_DEVICE* disk)
+/**
+ * Take the first queued IRP that may run now: IRPs on the same FileId
+ * run one at a time and in order, other IRPs run concurrently.
+ * Called with the device mutex held.
+ */
+
+static IRP* disk_next_irp(DISK_DEVICE* disk)
+{
+	int i;
+	IRP* irp;
+	LIST_ITEM* item;
+
+	for (item = disk->irp_list->head; item; item = item->next)
+	{
+		irp = (IRP*)item->data;
+
+		if (irp->FileId != 0)
+		{
+			for (i = 0; i < disk->num_workers; i++)
+			{
+				if (disk->workers[i].active && disk->workers[i].FileId == irp->FileId)
+					break;
+			}
+
+			/* an earlier IRP on this FileId is in progress, keep this one queued */
+			if (i < disk->num_workers)
+				continue;
+		}
+
+		list_remove(disk->irp_list, irp);
+
+		return irp;
+	}
+
+	return NULL;
+}
+
+static void disk_process_irp_list(DISK_WORKER* worker)
 {
 	IRP* irp;
+	DISK_DEVICE* disk = worker->disk;
 
 	while (1)
 	{
-		if (freerdp_thread_is_stopped(disk->thread))
+		if (freerdp_thread_is_stopped(worker->thread))
 			break;
 
-		freerdp_thread_lock(disk->thread);
-		irp = (IRP*)list_dequeue(disk->irp_list);
-		freerdp_thread_unlock(disk->thread);
+		freerdp_mutex_lock(disk->mutex);
+
+		irp = disk_next_irp(disk);
 
 		if (irp == NULL)
+		{
+			worker->busy = false;
+			freerdp_mutex_unlock(disk->mutex);
 			break;
+		}
+
+		worker->active = true;
+		worker->FileId = irp->FileId;
+
+		freerdp_mutex_unlock(disk->mutex);
 
 		disk_process_irp(disk, irp);
+
+		freerdp_mutex_lock(disk->mutex);
+		worker->active = false;
+		freerdp_mutex_unlock(disk->mutex);
 	}
 }
 
 static void* disk_thread_func(void* arg)
 {
-	DISK_DEVICE* disk = (DISK_DEVICE*)arg;
+	DISK_WORKER* worker = (DISK_WORKER*)arg;
 
 	while (1)
 	{
-		freerdp_thread_wait(disk->thread);
+		freerdp_thread_wait(worker->thread);
 
-		if (freerdp_thread_is_stopped(disk->thread))
+		if (freerdp_thread_is_stopped(worker->thread))
 			break;
 
-		freerdp_thread_reset(disk->thread);
-		disk_process_irp_list(disk);
+		freerdp_thread_reset(worker->thread);
+		disk_process_irp_list(worker);
 	}
 
-	freerdp_thread_quit(disk->thread);
+	freerdp_thread_quit(worker->thread);
 
 	return NULL;
 }
 
 static void disk_irp_request(DEVICE* device, IRP* irp)
 {
+	int i;
+	DISK_WORKER* worker = NULL;
 	DISK_DEVICE* disk = (DISK_DEVICE*)device;
 
-	freerdp_thread_lock(disk->thread);
+	freerdp_mutex_lock(disk->mutex);
+
 	list_enqueue(disk->irp_list, irp);
-	freerdp_thread_unlock(disk->thread);
 
-	freerdp_thread_signal(disk->thread);
+	/* a busy worker rescans the list before going idle, only wake an idle one */
+	for (i = 0; i < disk->num_workers; i++)
+	{
+		if (!disk->workers[i].busy)
+		{
+			worker = &disk->workers[i];
+			worker->busy = true;
+			break;
+		}
+	}
+
+	freerdp_mutex_unlock(disk->mutex);
+
+	if (worker != NULL)
+		freerdp_thread_signal(worker->thread);
 }
 
 static void disk_free(DEVICE* device)
@@ -598,17 +741,33 @@ static void disk_free(DEVICE* device)
 	DISK_DEVICE* disk = (DISK_DEVICE*)device;
 	IRP* irp;
 	DISK_FILE* file;
+	int i;
+
+	/* ask all workers to stop before waiting for each of them */
+	for (i = 0; i < disk->num_workers; i++)
+		wait_obj_set(disk->workers[i].thread->signals[0]);
+
+	for (i = 0; i < disk->num_workers; i++)
+	{
+		freerdp_thread_stop(disk->workers[i].thread);
+		freerdp_thread_free(disk->workers[i].thread);
+	}
+	xfree(disk->workers);
 
-	freerdp_thread_stop(disk->thread);
-	freerdp_thread_free(disk->thread);
-	
 	while ((irp = (IRP*)list_dequeue(disk->irp_list)) != NULL)
 		irp->Discard(irp);
 	list_free(disk->irp_list);
 
-	while ((file = (DISK_FILE*)list_dequeue(disk->files)) != NULL)
-		disk_file_free(file);
-	list_free(disk->files);
+	for (i = 0; i < disk->files_size; i++)
+	{
+		while ((file = disk->files[i]) != NULL)
+		{
+			disk->files[i] = file->hash_next;
+			disk_file_free(file);
+		}
+	}
+	xfree(disk->files);
+	freerdp_mutex_free(disk->mutex);
 	xfree(disk);
 }
 
@@ -617,10 +776,12 @@ int DeviceServiceEntry(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints)
 	DISK_DEVICE* disk;
 	char* name;
 	char* path;
+	char* workers;
 	int i, len;
 
 	name = (char*)pEntryPoints->plugin_data->data[1];
 	path = (char*)pEntryPoints->plugin_data->data[2];
+	workers = (char*)pEntryPoints->plugin_data->data[3];
 
 	if (name[0] && path[0])
 	{
@@ -637,14 +798,30 @@ int DeviceServiceEntry(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints)
 			stream_write_uint8(disk->device.data, name[i] < 0 ? '_' : name[i]);
 
 		disk->path = path;
-		disk->files = list_new();
+		disk->files_size = DISK_FILES_INITIAL_SIZE;
+		disk->files = xzalloc(sizeof(DISK_FILE*) * disk->files_size);
 
+		disk->mutex = freerdp_mutex_new();
 		disk->irp_list = list_new();
-		disk->thread = freerdp_thread_new();
+
+		/* optional fourth field: number of IRP worker threads */
+		disk->num_workers = (workers && workers[0]) ? atoi(workers) : DISK_DEFAULT_WORKERS;
+		if (disk->num_workers < 1)
+			disk->num_workers = 1;
+		if (disk->num_workers > DISK_MAX_WORKERS)
+			disk->num_workers = DISK_MAX_WORKERS;
+
+		disk->workers = xzalloc(sizeof(DISK_WORKER) * disk->num_workers);
+		for (i = 0; i < disk->num_workers; i++)
+		{
+			disk->workers[i].disk = disk;
+			disk->workers[i].thread = freerdp_thread_new();
+		}
 
 		pEntryPoints->RegisterDevice(pEntryPoints->devman, (DEVICE*)disk);
 
-		freerdp_thread_start(disk->thread, disk_thread_func, disk);
+		for (i = 0; i < disk->num_workers; i++)
+			freerdp_thread_start(disk->workers[i].thread, disk_thread_func, &disk->workers[i]);
 	}
 
 	return 0;
@@ -36,10 +36,16 @@ static void irp_free(IRP* irp)
 	DEBUG_SVC("DeviceId %d FileId %d CompletionId %d", irp->device->id, irp->FileId, irp->CompletionId);
 
 	stream_free(irp->input);
-	stream_free(irp->output);
+	svc_plugin_stream_free(irp->devman->plugin, irp->output);
 	xfree(irp);
 }
 
+/**
+ * Send the completion of an IRP and free it.
+ * Only touches the IRP itself, and channel writes are serialized by the
+ * channel manager, so devices may complete IRPs from several threads.
+ */
+
 static void irp_complete(IRP* irp)
 {
 	int pos;
@@ -80,7 +86,7 @@ IRP* irp_new(DEVMAN* devman, STREAM* data_in)
 	stream_read_uint32(data_in, irp->MinorFunction);
 	irp->input = data_in;
 
-	irp->output = stream_new(256);
+	irp->output = svc_plugin_stream_new(irp->devman->plugin, 256);
 	stream_write_uint16(irp->output, RDPDR_CTYP_CORE);
 	stream_write_uint16(irp->output, PAKID_CORE_DEVICE_IOCOMPLETION);
 	stream_write_uint32(irp->output, DeviceId);
@@ -51,6 +51,9 @@ struct rdpsnd_alsa_plugin
 	int               block_size;
 	int               latency;
 	ADPCM             adpcm;
+	DSP_RESAMPLER*    resampler;
+	uint8*            resample_buffer;
+	int               resample_size;
 
 	/* for recording */
 	int rec_dev_opened;
@@ -68,6 +71,10 @@ static void rdpsnd_alsa_set_params(rdpsndAlsaPlugin* alsa)
 
 	snd_pcm_drop(alsa->out_handle);
 
+	/* the rates or channels may change, recreate the resampler on next play */
+	dsp_resampler_free(alsa->resampler);
+	alsa->resampler = NULL;
+
 	error = snd_pcm_hw_params_malloc(&hw_params);
 	if (error < 0)
 	{
@@ -180,7 +187,7 @@ static void rdpsnd_alsa_open(rdpsndDevicePlugin* device, rdpsndFormat* format, i
 	else
 	{
 		snd_config_update_free_global();
-		memset(&alsa->adpcm, 0, sizeof(ADPCM));
+		dsp_ima_adpcm_reset(&alsa->adpcm);
 		rdpsnd_alsa_set_format(device, format, latency);
 	}
 }
@@ -371,6 +378,9 @@ static void rdpsnd_alsa_free(rdpsndDevicePlugin* device)
 	rdpsndAlsaPlugin* alsa = (rdpsndAlsaPlugin*)device;
 
 	rdpsnd_alsa_close(device);
+	dsp_ima_adpcm_uninit(&alsa->adpcm);
+	dsp_resampler_free(alsa->resampler);
+	xfree(alsa->resample_buffer);
 	xfree(alsa->device_name);
 	xfree(alsa);
 }
@@ -408,10 +418,8 @@ static void rdpsnd_alsa_set_volume(rdpsndDevicePlugin* device, uint32 value)
 static void rdpsnd_alsa_play(rdpsndDevicePlugin* device, uint8* data, int size)
 {
 	rdpsndAlsaPlugin* alsa = (rdpsndAlsaPlugin*)device;
-	uint8* decoded_data;
 	int decoded_size;
 	uint8* src;
-	uint8* resampled_data;
 	int len;
 	int error;
 	int frames;
@@ -425,14 +433,12 @@ static void rdpsnd_alsa_play(rdpsndDevicePlugin* device, uint8* data, int size)
 
 	if (alsa->wformat == 0x11)
 	{
-		decoded_data = dsp_decode_ima_adpcm(&alsa->adpcm,
+		src = dsp_ima_adpcm_decode(&alsa->adpcm,
 			data, size, alsa->source_channels, alsa->block_size, &decoded_size);
 		size = decoded_size;
-		src = decoded_data;
 	}
 	else
 	{
-		decoded_data = NULL;
 		src = data;
 	}
 
@@ -444,20 +450,29 @@ static void rdpsnd_alsa_play(rdpsndDevicePlugin* device, uint8* data, int size)
 		return;
 	}
 
-	if ((alsa->source_rate == alsa->actual_rate) &&
-		(alsa->source_channels == alsa->actual_channels))
+	if ((alsa->source_rate != alsa->actual_rate) ||
+		(alsa->source_channels != alsa->actual_channels))
 	{
-		resampled_data = NULL;
-	}
-	else
-	{
-		resampled_data = dsp_resample(src, alsa->bytes_per_channel,
-			alsa->source_channels, alsa->source_rate, size / sbytes_per_frame,
-			alsa->actual_channels, alsa->actual_rate, &frames);
+		if (alsa->resampler == NULL)
+		{
+			alsa->resampler = dsp_resampler_new(alsa->bytes_per_channel,
+				alsa->source_channels, alsa->source_rate,
+				alsa->actual_channels, alsa->actual_rate);
+			if (alsa->resampler == NULL)
+				return;
+		}
+		frames = dsp_resampler_max_frames(alsa->resampler, size / sbytes_per_frame);
+		if (frames * rbytes_per_frame > alsa->resample_size)
+		{
+			alsa->resample_size = frames * rbytes_per_frame;
+			alsa->resample_buffer = xrenew(uint8, alsa->resample_buffer, alsa->resample_size);
+		}
+		frames = dsp_resampler_process(alsa->resampler, src, size / sbytes_per_frame,
+			alsa->resample_buffer, frames);
 		DEBUG_SVC("resampled %d frames at %d to %d frames at %d",
 			size / sbytes_per_frame, alsa->source_rate, frames, alsa->actual_rate);
 		size = frames * rbytes_per_frame;
-		src = resampled_data;
+		src = alsa->resample_buffer;
 	}
 
 	pindex = src;
@@ -482,11 +497,6 @@ static void rdpsnd_alsa_play(rdpsndDevicePlugin* device, uint8* data, int size)
 		}
 		pindex += error * rbytes_per_frame;
 	}
-
-	if (resampled_data)
-		xfree(resampled_data);
-	if (decoded_data)
-		xfree(decoded_data);
 }
 
 static void rdpsnd_alsa_start(rdpsndDevicePlugin* device)
@@ -384,7 +384,7 @@ static void rdpsnd_pulse_open(rdpsndDevicePlugin* device, rdpsndFormat* format,
 	pa_threaded_mainloop_unlock(pulse->mainloop);
 	if (state == PA_STREAM_READY)
 	{
-		memset(&pulse->adpcm, 0, sizeof(ADPCM));
+		dsp_ima_adpcm_reset(&pulse->adpcm);
 		DEBUG_SVC("connected");
 	}
 	else
@@ -415,6 +415,8 @@ static void rdpsnd_pulse_free(rdpsndDevicePlugin* device)
 		pa_threaded_mainloop_free(pulse->mainloop);
 		pulse->mainloop = NULL;
 	}
+	dsp_ima_adpcm_uninit(&pulse->adpcm);
+	dsp_ima_adpcm_uninit(&pulse->rec_adpcm);
 	xfree(pulse->device_name);
 	xfree(pulse->rec_device_name);
 	xfree(pulse);
@@ -486,7 +488,6 @@ static void rdpsnd_pulse_play(rdpsndDevicePlugin* device, uint8* data, int size)
 	rdpsndPulsePlugin* pulse = (rdpsndPulsePlugin*)device;
 	int len;
 	int ret;
-	uint8* decoded_data;
 	uint8* src;
 	int decoded_size;
 
@@ -495,14 +496,12 @@ static void rdpsnd_pulse_play(rdpsndDevicePlugin* device, uint8* data, int size)
 
 	if (pulse->format == 0x11)
 	{
-		decoded_data = dsp_decode_ima_adpcm(&pulse->adpcm,
+		src = dsp_ima_adpcm_decode(&pulse->adpcm,
 			data, size, pulse->sample_spec.channels, pulse->block_size, &decoded_size);
 		size = decoded_size;
-		src = decoded_data;
 	}
 	else
 	{
-		decoded_data = NULL;
 		src = data;
 	}
 
@@ -528,9 +527,6 @@ static void rdpsnd_pulse_play(rdpsndDevicePlugin* device, uint8* data, int size)
 		size -= len;
 	}
 	pa_threaded_mainloop_unlock(pulse->mainloop);
-
-	if (decoded_data)
-		xfree(decoded_data);
 }
 
 static void rdpsnd_pulse_start(rdpsndDevicePlugin* device)
@@ -623,7 +619,7 @@ static int rdpsnd_pulse_rec_open(rdpsndDevicePlugin* device,
 
 	if (state == PA_STREAM_READY)
 	{
-		memset(&pulse->rec_adpcm, 0, sizeof(ADPCM));
+		dsp_ima_adpcm_reset(&pulse->rec_adpcm);
 		DEBUG_SVC("connected");
 	}
 	else
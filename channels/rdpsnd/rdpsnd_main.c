@@ -115,7 +115,7 @@ static void rdpsnd_source_data_callback(void* plugin, void* buf, int buf_length)
 	rdpsndPlugin* rdpsnd = (rdpsndPlugin*) plugin;
 	STREAM*       out_stream;
 
-	out_stream = stream_new(4 + buf_length);
+	out_stream = svc_plugin_stream_new((rdpSvcPlugin*) &rdpsnd->plugin, 4 + buf_length);
 
 	stream_write_uint16(out_stream, RDPSND_REC_DATA);
 	stream_write_uint16(out_stream, buf_length);
@@ -172,7 +172,7 @@ static void rdpsnd_process_interval(rdpSvcPlugin* plugin)
 
 	if (rdpsnd->rec_device_opened)
 	{
-		STREAM* out = stream_new(4 + 32768);
+		STREAM* out = svc_plugin_stream_new(plugin, 4 + 32768);
 
 		len = rdpsnd->device->RecCapture(rdpsnd->device,
 						(char *) &out->data[4], 32768);
@@ -185,7 +185,7 @@ static void rdpsnd_process_interval(rdpSvcPlugin* plugin)
 		}
 		else
 		{
-			stream_free(out);
+			svc_plugin_stream_free(plugin, out);
 		}
 
 		rdpsnd->plugin.interval_ms = 10;
@@ -416,7 +416,7 @@ static void rdpsnd_process_message_wave(rdpsndPlugin* rdpsnd, STREAM* data_in)
 		stream_get_size(data_in), delay_ms, process_ms);
 
 	item = xnew(struct data_out_item);
-	item->data_out = stream_new(8);
+	item->data_out = svc_plugin_stream_new((rdpSvcPlugin*) rdpsnd, 8);
 	stream_write_uint8(item->data_out, SNDC_WAVECONFIRM);
 	stream_write_uint8(item->data_out, 0);
 	stream_write_uint16(item->data_out, 4);
@@ -34,6 +34,25 @@ struct clipboard_format_mapping
 	uint32 format_id;
 };
 
+/**
+ * Clipboard data is moved through the X server in chunks of at most
+ * XF_CLIPRDR_CHUNK_SIZE bytes (less if the server request limit is lower),
+ * and converted chunk by chunk, so that a large selection never needs more
+ * than its converted copy plus one chunk in memory.
+ */
+#define XF_CLIPRDR_CHUNK_SIZE	(256 * 1024)
+
+/* server->client data handed out to a requestor with the INCR protocol */
+typedef struct clipboard_transfer clipboardTransfer;
+struct clipboard_transfer
+{
+	Window requestor;
+	Atom property;
+	Atom target;
+	int offset;
+	clipboardTransfer* next;
+};
+
 typedef struct clipboard_context clipboardContext;
 struct clipboard_context
 {
@@ -42,6 +61,7 @@ struct clipboard_context
 	Atom clipboard_atom;
 	Atom property_atom;
 	Atom identity_atom;
+	UNICONV* uniconv;
 
 	clipboardFormatMapping format_mappings[20];
 	int num_format_mappings;
@@ -51,28 +71,36 @@ struct clipboard_context
 	int num_formats;
 	Atom targets[20];
 	int num_targets;
+	uint8 data_header[14];
+	int data_header_length;
 	uint8* data;
 	uint32 data_format;
 	uint32 data_alt_format;
 	int data_length;
 	XEvent* respond;
+	clipboardTransfer* transfers;
 
 	/* client->server data */
 	Window owner;
 	int request_index;
 	tbool sync;
+	STREAM* request_stream;
+	int request_input_length;
+	uint8 request_pending[4];
+	int request_pending_length;
+	STREAM* request_chunk;
 
 	/* INCR mechanism */
 	Atom incr_atom;
 	tbool incr_starts;
-	uint8* incr_data;
-	int incr_data_length;
+	int chunk_size;
 };
 
 void xf_cliprdr_init(xfInfo* xfi, rdpChannels* chanman)
 {
 	int n;
 	uint32 id;
+	long max_request;
 	clipboardContext* cb;
 
 	cb = xnew(clipboardContext);
@@ -80,6 +108,8 @@ void xf_cliprdr_init(xfInfo* xfi, rdpChannels* chanman)
 
 	cb->channels = chanman;
 	cb->request_index = -1;
+	cb->uniconv = freerdp_uniconv_new();
+	cb->request_chunk = stream_new(0);
 
 	cb->root_window = DefaultRootWindow(xfi->display);
 	cb->clipboard_atom = XInternAtom(xfi->display, "CLIPBOARD", false);
@@ -136,37 +166,59 @@ void xf_cliprdr_init(xfInfo* xfi, rdpChannels* chanman)
 	cb->num_targets = 2;
 
 	cb->incr_atom = XInternAtom(xfi->display, "INCR", false);
+
+	/* a chunk must fit in a single ChangeProperty request */
+	max_request = XExtendedMaxRequestSize(xfi->display);
+
+	if (max_request == 0)
+		max_request = XMaxRequestSize(xfi->display);
+
+	cb->chunk_size = MIN(XF_CLIPRDR_CHUNK_SIZE, (int) ((max_request * 4 - 64) & ~3));
 }
 
 void xf_cliprdr_uninit(xfInfo* xfi)
 {
+	clipboardTransfer* transfer;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
 	if (cb)
 	{
+		while (cb->transfers != NULL)
+		{
+			transfer = cb->transfers;
+			cb->transfers = transfer->next;
+			xfree(transfer);
+		}
+
 		xfree(cb->formats);
 		xfree(cb->data);
 		xfree(cb->respond);
-		xfree(cb->incr_data);
+
+		if (cb->request_stream)
+			stream_free(cb->request_stream);
+
+		stream_free(cb->request_chunk);
+		freerdp_uniconv_free(cb->uniconv);
 		xfree(cb);
 		xfi->clipboard_context = NULL;
 	}
 }
 
-static uint8* lf2crlf(uint8* data, int* size)
+/**
+ * Append data to a stream, replacing LF line endings with CRLF.
+ */
+
+static void lf2crlf(STREAM* s, uint8* data, int size)
 {
 	uint8 c;
-	uint8* outbuf;
 	uint8* out;
 	uint8* in_end;
 	uint8* in;
-	int out_size;
 
-	out_size = (*size) * 2 + 1;
-	outbuf = (uint8*) xzalloc(out_size);
-	out = outbuf;
+	stream_check_size(s, size * 2);
+	out = stream_get_tail(s);
 	in = data;
-	in_end = data + (*size);
+	in_end = data + size;
 
 	while (in < in_end)
 	{
@@ -182,10 +234,37 @@ static uint8* lf2crlf(uint8* data, int* size)
 		}
 	}
 
-	*out++ = 0;
-	*size = out - outbuf;
+	stream_set_pos(s, out - stream_get_head(s));
+}
 
-	return outbuf;
+/**
+ * Get the length of the part of a UTF-8 buffer that does not end
+ * in the middle of a multibyte sequence.
+ */
+
+static int utf8_complete_length(uint8* data, int size)
+{
+	int i;
+	int need;
+
+	for (i = size - 1; i >= 0 && i >= size - 4; i--)
+	{
+		if ((data[i] & 0xC0) == 0x80)
+			continue;
+
+		if (data[i] >= 0xF0)
+			need = 4;
+		else if (data[i] >= 0xE0)
+			need = 3;
+		else if (data[i] >= 0xC0)
+			need = 2;
+		else
+			need = 1;
+
+		return (size - i >= need) ? size : i;
+	}
+
+	return size;
 }
 
 static void crlf2lf(uint8* data, int* size)
@@ -511,60 +590,105 @@ static void xf_cliprdr_get_requested_targets(xfInfo* xfi)
 	}
 }
 
-static uint8* xf_cliprdr_process_requested_raw(uint8* data, int* size)
+static void xf_cliprdr_begin_request(clipboardContext* cb, int size)
 {
-	uint8* outbuf;
+	if (cb->request_stream)
+		stream_free(cb->request_stream);
 
-	outbuf = (uint8*) xmalloc(*size);
-	memcpy(outbuf, data, *size);
-	return outbuf;
+	cb->request_stream = stream_new(size > 0 ? size + 2 : -1);
+	cb->request_input_length = 0;
+	cb->request_pending_length = 0;
 }
 
-static uint8* xf_cliprdr_process_requested_unicodetext(uint8* data, int* size)
+static void xf_cliprdr_end_request(clipboardContext* cb)
 {
-	uint8* inbuf;
-	uint8* outbuf;
+	if (cb->request_stream)
+	{
+		stream_free(cb->request_stream);
+		cb->request_stream = NULL;
+	}
+
+	cb->incr_starts = false;
+}
+
+static void xf_cliprdr_process_requested_unicodetext(clipboardContext* cb, uint8* data, int size)
+{
+	int length;
+	int complete;
+	char* outbuf;
 	size_t out_size;
-	UNICONV* uniconv;
+	STREAM* s = cb->request_chunk;
 
-	inbuf = lf2crlf(data, size);
+	/* carry a multibyte sequence split by the chunk boundary over to the next chunk */
+	stream_set_pos(s, 0);
+	stream_check_size(s, cb->request_pending_length);
+	stream_write(s, cb->request_pending, cb->request_pending_length);
+	lf2crlf(s, data, size);
 
-	uniconv = freerdp_uniconv_new();
-	outbuf = (uint8*) freerdp_uniconv_out(uniconv, (char*) inbuf, &out_size);
-	freerdp_uniconv_free(uniconv);
+	length = stream_get_length(s);
+	complete = utf8_complete_length(stream_get_head(s), length);
+	cb->request_pending_length = length - complete;
+	memcpy(cb->request_pending, stream_get_head(s) + complete, cb->request_pending_length);
 
-	xfree(inbuf);
+	if (complete == 0)
+		return;
 
-	*size = (int) out_size + 2;
+	stream_set_pos(s, complete);
+	stream_check_size(s, 1);
+	stream_write_uint8(s, 0);
 
-	return outbuf;
+	outbuf = freerdp_uniconv_out(cb->uniconv, (char*) stream_get_head(s), &out_size);
+
+	if (outbuf != NULL)
+	{
+		stream_check_size(cb->request_stream, (int) out_size);
+		stream_write(cb->request_stream, outbuf, out_size);
+		xfree(outbuf);
+	}
 }
 
-static uint8* xf_cliprdr_process_requested_text(uint8* data, int* size)
+static void xf_cliprdr_process_requested_dib(clipboardContext* cb, uint8* data, int size)
 {
-	uint8* outbuf;
+	int skip;
 
-	outbuf = lf2crlf(data, size);
+	/* drop the BMP file header, DIB starts with the BITMAPINFOHEADER */
+	skip = MIN(size, MAX(0, 14 - cb->request_input_length));
 
-	return outbuf;
+	stream_check_size(cb->request_stream, size - skip);
+	stream_write(cb->request_stream, data + skip, size - skip);
 }
 
-static uint8* xf_cliprdr_process_requested_dib(uint8* data, int* size)
+/**
+ * Convert one chunk of the selection read from the X server
+ * and append it to the pending data response.
+ */
+
+static void xf_cliprdr_process_requested_chunk(clipboardContext* cb, uint8* data, int size)
 {
-	uint8* outbuf;
+	STREAM* s = cb->request_stream;
 
-	/* length should be at least BMP header (14) + sizeof(BITMAPINFOHEADER) */
-	if (*size < 54)
+	switch (cb->format_mappings[cb->request_index].format_id)
 	{
-		DEBUG_X11_CLIPRDR("bmp length %d too short", *size);
-		return NULL;
-	}
+		case CB_FORMAT_UNICODETEXT:
+			xf_cliprdr_process_requested_unicodetext(cb, data, size);
+			break;
 
-	*size -= 14;
-	outbuf = (uint8*) xzalloc(*size);
-	memcpy(outbuf, data + 14, *size);
+		case CB_FORMAT_TEXT:
+			lf2crlf(s, data, size);
+			break;
 
-	return outbuf;
+		case CB_FORMAT_DIB:
+			xf_cliprdr_process_requested_dib(cb, data, size);
+			break;
+
+		default:
+			/* raw and image formats are forwarded as is, HTML is converted when complete */
+			stream_check_size(s, size);
+			stream_write(s, data, size);
+			break;
+	}
+
+	cb->request_input_length += size;
 }
 
 static uint8* xf_cliprdr_process_requested_html(uint8* data, int* size)
@@ -639,50 +763,75 @@ static uint8* xf_cliprdr_process_requested_html(uint8* data, int* size)
 	return outbuf;
 }
 
-static void xf_cliprdr_process_requested_data(xfInfo* xfi, tbool has_data, uint8* data, int size)
+static void xf_cliprdr_process_requested_data(xfInfo* xfi, tbool has_data)
 {
+	int size;
 	uint8* outbuf;
+	STREAM* s;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
-	if (cb->incr_starts && has_data)
-		return;
+	s = cb->request_stream;
 
-	if (!has_data || data == NULL)
+	if (!has_data || s == NULL)
 	{
+		xf_cliprdr_end_request(cb);
 		xf_cliprdr_send_null_data_response(xfi);
 		return;
 	}
 
+	outbuf = NULL;
+	size = 0;
+
 	switch (cb->format_mappings[cb->request_index].format_id)
 	{
 		case CB_FORMAT_RAW:
 		case CB_FORMAT_PNG:
 		case CB_FORMAT_JPEG:
 		case CB_FORMAT_GIF:
-			outbuf = xf_cliprdr_process_requested_raw(data, &size);
+			if (stream_get_length(s) > 0)
+				outbuf = stream_get_head(s);
 			break;
 
 		case CB_FORMAT_UNICODETEXT:
-			outbuf = xf_cliprdr_process_requested_unicodetext(data, &size);
+			stream_check_size(s, 2);
+			stream_write_uint16(s, 0);
+			outbuf = stream_get_head(s);
 			break;
 
 		case CB_FORMAT_TEXT:
-			outbuf = xf_cliprdr_process_requested_text(data, &size);
+			stream_check_size(s, 1);
+			stream_write_uint8(s, 0);
+			outbuf = stream_get_head(s);
 			break;
 
 		case CB_FORMAT_DIB:
-			outbuf = xf_cliprdr_process_requested_dib(data, &size);
+			/* length should be at least BMP header (14) + sizeof(BITMAPINFOHEADER) */
+			if (cb->request_input_length >= 54)
+				outbuf = stream_get_head(s);
+			else
+				DEBUG_X11_CLIPRDR("bmp length %d too short", cb->request_input_length);
 			break;
 
 		case CB_FORMAT_HTML:
-			outbuf = xf_cliprdr_process_requested_html(data, &size);
+			size = stream_get_length(s);
+			stream_check_size(s, 1);
+			stream_write_uint8(s, 0);
+			outbuf = xf_cliprdr_process_requested_html(stream_get_head(s), &size);
 			break;
 
 		default:
-			outbuf = NULL;
 			break;
 	}
 
+	if (outbuf == stream_get_head(s))
+	{
+		/* the response takes over the converted data */
+		size = stream_get_length(s);
+		stream_detach(s);
+	}
+
+	xf_cliprdr_end_request(cb);
+
 	if (outbuf)
 		xf_cliprdr_send_data_response(xfi, outbuf, size);
 	else
@@ -692,19 +841,67 @@ static void xf_cliprdr_process_requested_data(xfInfo* xfi, tbool has_data, uint8
 	xf_cliprdr_send_format_list(xfi);
 }
 
+/**
+ * Read the selection property in windows of at most one chunk,
+ * converting each window as it arrives.
+ */
+
+static tbool xf_cliprdr_read_requested_data(xfInfo* xfi, Atom target, unsigned long bytes_left)
+{
+	Atom type;
+	int format;
+	int size;
+	long offset;
+	uint8* data;
+	unsigned long length;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	offset = 0;
+
+	while (bytes_left > 0)
+	{
+		data = NULL;
+
+		if (XGetWindowProperty(xfi->display, xfi->drawable,
+			cb->property_atom, offset, cb->chunk_size / 4, 0, target,
+			&type, &format, &length, &bytes_left, &data) != Success)
+		{
+			DEBUG_X11_CLIPRDR("XGetWindowProperty failed");
+			return false;
+		}
+
+		size = length * format / 8;
+		DEBUG_X11("%d bytes", size);
+
+		if (data)
+		{
+			xf_cliprdr_process_requested_chunk(cb, data, size);
+			XFree(data);
+		}
+
+		if (size == 0)
+			break;
+
+		offset += size / 4;
+	}
+
+	return true;
+}
+
 static tbool xf_cliprdr_get_requested_data(xfInfo* xfi, Atom target)
 {
 	Atom type;
 	int format;
 	uint8* data = NULL;
 	tbool has_data = false;
-	unsigned long length, bytes_left, dummy;
+	unsigned long length, bytes_left;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
 	if ((cb->request_index < 0) ||
 		(cb->format_mappings[cb->request_index].target_format != target))
 	{
 		DEBUG_X11_CLIPRDR("invalid target");
+		xf_cliprdr_end_request(cb);
 		xf_cliprdr_send_null_data_response(xfi);
 		return false;
 	}
@@ -729,55 +926,29 @@ static tbool xf_cliprdr_get_requested_data(xfInfo* xfi, Atom target)
 	{
 		DEBUG_X11("INCR started");
 		cb->incr_starts = true;
-		if (cb->incr_data)
-		{
-			xfree(cb->incr_data);
-			cb->incr_data = NULL;
-		}
-		cb->incr_data_length = 0;
+		xf_cliprdr_begin_request(cb, 0);
 		/* Data will be followed in PropertyNotify event */
 		has_data = true;
 	}
+	else if (bytes_left <= 0)
+	{
+		/* INCR finish */
+		DEBUG_X11("INCR finished");
+		has_data = true;
+		cb->incr_starts = false;
+	}
 	else
 	{
-		if (bytes_left <= 0)
-		{
-			/* INCR finish */
-			data = cb->incr_data;
-			cb->incr_data = NULL;
-			bytes_left = cb->incr_data_length;
-			cb->incr_data_length = 0;
-			cb->incr_starts = 0;
-			DEBUG_X11("INCR finished");
-			has_data = true;
-		}
-		else if (XGetWindowProperty(xfi->display, xfi->drawable,
-			cb->property_atom, 0, bytes_left, 0, target,
-			&type, &format, &length, &dummy, &data) == Success)
-		{
-			if (cb->incr_starts)
-			{
-				bytes_left = length * format / 8;
-				DEBUG_X11("%d bytes", (int)bytes_left);
-				cb->incr_data = (uint8*) xrealloc(cb->incr_data, cb->incr_data_length + bytes_left);
-				memcpy(cb->incr_data + cb->incr_data_length, data, bytes_left);
-				cb->incr_data_length += bytes_left;
-				XFree(data);
-				data = NULL;
-			}
-			has_data = true;
-		}
-		else
-		{
-			DEBUG_X11_CLIPRDR("XGetWindowProperty failed");
-		}
+		if (!cb->incr_starts)
+			xf_cliprdr_begin_request(cb, (int) bytes_left);
+
+		has_data = xf_cliprdr_read_requested_data(xfi, target, bytes_left);
 	}
 	XDeleteProperty(xfi->display, xfi->drawable, cb->property_atom);
 
-	xf_cliprdr_process_requested_data(xfi, has_data, data, (int) bytes_left);
-
-	if (data)
-		XFree(data);
+	/* while INCR is in progress, deleting the property asks the owner for the next chunk */
+	if (!(cb->incr_starts && has_data))
+		xf_cliprdr_process_requested_data(xfi, has_data);
 
 	return true;
 }
@@ -812,31 +983,148 @@ static void xf_cliprdr_provide_targets(xfInfo* xfi, XEvent* respond)
 	}
 }
 
+/**
+ * Write part of the server data (the synthesized header followed by the
+ * payload) to a requestor property, replacing its previous value.
+ */
+
+static void xf_cliprdr_write_data(xfInfo* xfi, Window requestor, Atom property, Atom target, int offset, int size)
+{
+	int n;
+	int mode = PropModeReplace;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	if (offset < cb->data_header_length)
+	{
+		n = MIN(size, cb->data_header_length - offset);
+		XChangeProperty(xfi->display, requestor, property, target, 8, mode,
+			cb->data_header + offset, n);
+		offset += n;
+		size -= n;
+		mode = PropModeAppend;
+	}
+
+	if (size > 0 || mode == PropModeReplace)
+	{
+		XChangeProperty(xfi->display, requestor, property, target, 8, mode,
+			cb->data + offset - cb->data_header_length, size);
+	}
+}
+
 static void xf_cliprdr_provide_data(xfInfo* xfi, XEvent* respond)
 {
+	long length;
+	clipboardTransfer* transfer;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
-	if (respond->xselection.property != None)
+	if (respond->xselection.property == None)
+		return;
+
+	length = cb->data_header_length + cb->data_length;
+
+	if (length <= cb->chunk_size)
 	{
-		XChangeProperty(xfi->display,
-			respond->xselection.requestor,
-			respond->xselection.property,
-			respond->xselection.target, 8, PropModeReplace,
-			(uint8*) cb->data, cb->data_length);
+		xf_cliprdr_write_data(xfi, respond->xselection.requestor,
+			respond->xselection.property, respond->xselection.target, 0, (int) length);
+		return;
 	}
+
+	/**
+	 * Too large for one request: announce INCR, then write a chunk each
+	 * time the requestor deletes the property, see xf_cliprdr_process_transfer.
+	 */
+	DEBUG_X11_CLIPRDR("INCR transfer of %d bytes", (int) length);
+
+	transfer = xnew(clipboardTransfer);
+	transfer->requestor = respond->xselection.requestor;
+	transfer->property = respond->xselection.property;
+	transfer->target = respond->xselection.target;
+	transfer->next = cb->transfers;
+	cb->transfers = transfer;
+
+	XSelectInput(xfi->display, transfer->requestor, PropertyChangeMask);
+	XChangeProperty(xfi->display, transfer->requestor, transfer->property,
+		cb->incr_atom, 32, PropModeReplace, (uint8*) &length, 1);
 }
 
-static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_LIST_EVENT* event)
+static void xf_cliprdr_end_transfer(xfInfo* xfi, clipboardTransfer* transfer)
 {
-	int i, j;
+	clipboardTransfer** link;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	for (link = &cb->transfers; *link != NULL; link = &(*link)->next)
+	{
+		if (*link == transfer)
+		{
+			*link = transfer->next;
+			break;
+		}
+	}
+
+	XSelectInput(xfi->display, transfer->requestor, NoEventMask);
+	xfree(transfer);
+}
+
+static tbool xf_cliprdr_process_transfer(xfInfo* xfi, XEvent* xevent)
+{
+	int size;
+	clipboardTransfer* transfer;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
+	for (transfer = cb->transfers; transfer != NULL; transfer = transfer->next)
+	{
+		if (transfer->requestor == xevent->xproperty.window &&
+			transfer->property == xevent->xproperty.atom)
+			break;
+	}
+
+	if (transfer == NULL)
+		return false;
+
+	/* the requestor deletes the property once it has read a chunk */
+	if (xevent->xproperty.state != PropertyDelete)
+		return true;
+
+	size = MIN(cb->chunk_size, cb->data_header_length + cb->data_length - transfer->offset);
+
+	xf_cliprdr_write_data(xfi, transfer->requestor, transfer->property,
+		transfer->target, transfer->offset, size);
+	transfer->offset += size;
+
+	/* a zero-length chunk marks the end of the data */
+	if (size == 0)
+		xf_cliprdr_end_transfer(xfi, transfer);
+
+	XFlush(xfi->display);
+
+	return true;
+}
+
+static void xf_cliprdr_free_data(xfInfo* xfi)
+{
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	/* transfers still in progress cannot be completed without the data */
+	while (cb->transfers != NULL)
+		xf_cliprdr_end_transfer(xfi, cb->transfers);
+
 	if (cb->data)
 	{
 		xfree(cb->data);
 		cb->data = NULL;
 	}
 
+	cb->data_length = 0;
+	cb->data_header_length = 0;
+}
+
+static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_LIST_EVENT* event)
+{
+	int i, j;
+	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
+
+	xf_cliprdr_free_data(xfi);
+
 	if (cb->formats)
 		xfree(cb->formats);
 
@@ -869,21 +1157,22 @@ static void xf_cliprdr_process_cb_format_list_event(xfInfo* xfi, RDP_CB_FORMAT_L
 	XFlush(xfi->display);
 }
 
+/**
+ * The functions below take over the received data and convert it in place
+ * where the conversion does not grow it.
+ */
+
 static void xf_cliprdr_process_text(clipboardContext* cb, uint8* data, int size)
 {
-	cb->data = (uint8*) xmalloc(size);
-	memcpy(cb->data, data, size);
+	cb->data = data;
 	cb->data_length = size;
 	crlf2lf(cb->data, &cb->data_length);
 }
 
 static void xf_cliprdr_process_unicodetext(clipboardContext* cb, uint8* data, int size)
 {
-	UNICONV* uniconv;
-
-	uniconv = freerdp_uniconv_new();
-	cb->data = (uint8*) freerdp_uniconv_in(uniconv, data, size);
-	freerdp_uniconv_free(uniconv);
+	cb->data = (uint8*) freerdp_uniconv_in(cb->uniconv, data, size);
+	xfree(data);
 	cb->data_length = strlen((char*) cb->data);
 	crlf2lf(cb->data, &cb->data_length);
 }
@@ -899,6 +1188,7 @@ static void xf_cliprdr_process_dib(clipboardContext* cb, uint8* data, int size)
 	if (size < 40)
 	{
 		DEBUG_X11_CLIPRDR("dib size %d too short", size);
+		xfree(data);
 		return;
 	}
 
@@ -909,22 +1199,22 @@ static void xf_cliprdr_process_dib(clipboardContext* cb, uint8* data, int size)
 	stream_read_uint32(s, ncolors);
 	offset = 14 + 40 + (bpp <= 8 ? (ncolors == 0 ? (1 << bpp) : ncolors) * 4 : 0);
 	stream_detach(s);
-	stream_free(s);
 
 	DEBUG_X11_CLIPRDR("offset=%d bpp=%d ncolors=%d", offset, bpp, ncolors);
 
-	s = stream_new(14 + size);
+	/* the BMP file header is kept apart and written in front of the DIB */
+	stream_attach(s, cb->data_header, sizeof(cb->data_header));
 	stream_write_uint8(s, 'B');
 	stream_write_uint8(s, 'M');
 	stream_write_uint32(s, 14 + size);
 	stream_write_uint32(s, 0);
 	stream_write_uint32(s, offset);
-	stream_write(s, data, size);
-
-	cb->data = stream_get_head(s);
-	cb->data_length = stream_get_length(s);
 	stream_detach(s);
 	stream_free(s);
+
+	cb->data_header_length = sizeof(cb->data_header);
+	cb->data = data;
+	cb->data_length = size;
 }
 
 static void xf_cliprdr_process_html(clipboardContext* cb, uint8* data, int size)
@@ -939,6 +1229,7 @@ static void xf_cliprdr_process_html(clipboardContext* cb, uint8* data, int size)
 	if (start_str == NULL || end_str == NULL)
 	{
 		DEBUG_X11_CLIPRDR("invalid HTML clipboard format");
+		xfree(data);
 		return;
 	}
 	start = atoi(start_str + 10);
@@ -946,17 +1237,19 @@ static void xf_cliprdr_process_html(clipboardContext* cb, uint8* data, int size)
 	if (start > size || end > size || start >= end)
 	{
 		DEBUG_X11_CLIPRDR("invalid HTML offset");
+		xfree(data);
 		return;
 	}
 
-	cb->data = (uint8*) xmalloc(size - start + 1);
-	memcpy(cb->data, data + start, end - start);
+	memmove(data, data + start, end - start);
+	cb->data = data;
 	cb->data_length = end - start;
 	crlf2lf(cb->data, &cb->data_length);
 }
 
 static void xf_cliprdr_process_cb_data_response_event(xfInfo* xfi, RDP_CB_DATA_RESPONSE_EVENT* event)
 {
+	uint8* data;
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
 	DEBUG_X11_CLIPRDR("size=%d", event->size);
@@ -973,43 +1266,43 @@ static void xf_cliprdr_process_cb_data_response_event(xfInfo* xfi, RDP_CB_DATA_R
 	}
 	else
 	{
-		if (cb->data)
-		{
-			xfree(cb->data);
-			cb->data = NULL;
-		}
+		xf_cliprdr_free_data(xfi);
+
+		data = event->data;
+		event->data = NULL;
+
 		switch (cb->data_format)
 		{
 			case CB_FORMAT_RAW:
 			case CB_FORMAT_PNG:
 			case CB_FORMAT_JPEG:
 			case CB_FORMAT_GIF:
-				cb->data = event->data;
+				cb->data = data;
 				cb->data_length = event->size;
-				event->data = NULL;
-				event->size = 0;
 				break;
 
 			case CB_FORMAT_TEXT:
-				xf_cliprdr_process_text(cb, event->data, event->size);
+				xf_cliprdr_process_text(cb, data, event->size);
 				break;
 
 			case CB_FORMAT_UNICODETEXT:
-				xf_cliprdr_process_unicodetext(cb, event->data, event->size);
+				xf_cliprdr_process_unicodetext(cb, data, event->size);
 				break;
 
 			case CB_FORMAT_DIB:
-				xf_cliprdr_process_dib(cb, event->data, event->size);
+				xf_cliprdr_process_dib(cb, data, event->size);
 				break;
 
 			case CB_FORMAT_HTML:
-				xf_cliprdr_process_html(cb, event->data, event->size);
+				xf_cliprdr_process_html(cb, data, event->size);
 				break;
 
 			default:
+				xfree(data);
 				cb->respond->xselection.property = None;
 				break;
 		}
+		event->size = 0;
 		xf_cliprdr_provide_data(xfi, cb->respond);
 	}
 
@@ -1153,11 +1446,7 @@ tbool xf_cliprdr_process_selection_request(xfInfo* xfi, XEvent* xevent)
 				 * Send clipboard data request to the server.
 				 * Response will be postponed after receiving the data
 				 */
-				if (cb->data)
-				{
-					xfree(cb->data);
-					cb->data = NULL;
-				}
+				xf_cliprdr_free_data(xfi);
 
 				respond->xselection.property = xevent->xselectionrequest.property;
 				cb->respond = respond;
@@ -1196,6 +1485,9 @@ tbool xf_cliprdr_process_property_notify(xfInfo* xfi, XEvent* xevent)
 {
 	clipboardContext* cb = (clipboardContext*) xfi->clipboard_context;
 
+	if (xf_cliprdr_process_transfer(xfi, xevent))
+		return true;
+
 	if (xevent->xproperty.atom != cb->property_atom)
 		return false; /* Not cliprdr-related */
 
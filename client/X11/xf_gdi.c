@@ -36,6 +36,7 @@
 #include <freerdp/codec/jpeg.h>
 
 #include "xf_gdi.h"
+#include "xf_h264.h"
 
 #ifdef WITH_YAMIINF
 #include <unistd.h> /* close */
@@ -663,7 +664,7 @@ void xf_gdi_surface_frame_marker(rdpContext* context, SURFACE_FRAME_MARKER* surf
 }
 
 #ifdef WITH_YAMIINF
-static int xf_gdi_surface_h264(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command)
+static int xf_gdi_surface_h264_yami(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command)
 {
 	STREAM* s;
 	int error;
@@ -844,13 +845,241 @@ static int xf_gdi_surface_h264(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_c
 	stream_free(s);
 	return 0;
 }
-#else
-static int xf_gdi_surface_h264(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command)
+#endif
+
+#ifdef WITH_FFMPEG
+/**
+ * Convert the decoded picture under each rectangle to BGRX in the shared
+ * memory image, then put the rectangles to the primary surface.
+ */
+static void xf_gdi_surface_h264_put(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command,
+		STREAM* s, int num_rects, uint8** planes, int* strides, int width, int height,
+		tbool full_range)
+{
+	int x;
+	int y;
+	int x0;
+	int y0;
+	int cx;
+	int cy;
+	int lx;
+	int ly;
+	int bytes;
+	int index;
+	uint8* rects_p;
+	XImage* image;
+	XShmSegmentInfo shminfo;
+	Drawable dst = xfi->skip_bs ? xfi->drawable : xfi->primary;
+
+	bytes = width * height * 4;
+	if (xfi->shm_info == 0)
+	{
+		xfi->shm_info = create_shm_info(bytes);
+	}
+	else if (xfi->shm_info->bytes < bytes)
+	{
+		delete_shm_info(xfi->shm_info);
+		xfi->shm_info = create_shm_info(bytes);
+	}
+
+	memset(&shminfo, 0, sizeof(shminfo));
+	shminfo.shmid = xfi->shm_info->shmid;
+	shminfo.shmaddr = xfi->shm_info->ptr;
+	image = XShmCreateImage(xfi->display, xfi->visual, xfi->depth,
+			ZPixmap, xfi->shm_info->ptr, &shminfo, width, height);
+	XShmAttach(xfi->display, &shminfo);
+	XSetFunction(xfi->display, xfi->gc, GXcopy);
+	XSetFillStyle(xfi->display, xfi->gc, FillSolid);
+
+	stream_get_mark(s, rects_p);
+	for (index = 0; index < num_rects; index++)
+	{
+		stream_read_uint16(s, x);
+		stream_read_uint16(s, y);
+		stream_read_uint16(s, cx);
+		stream_read_uint16(s, cy);
+		if (x + cx > width)
+		{
+			cx = width - x;
+		}
+		if (y + cy > height)
+		{
+			cy = height - y;
+		}
+		lx = x + surface_bits_command->destLeft;
+		ly = y + surface_bits_command->destTop;
+		if (lx + cx > surface_bits_command->destRight)
+		{
+			cx = surface_bits_command->destRight - lx;
+		}
+		if (ly + cy > surface_bits_command->destBottom)
+		{
+			cy = surface_bits_command->destBottom - ly;
+		}
+		if ((cx > 0) && (cy > 0))
+		{
+			/* chroma is subsampled, start on even coordinates */
+			x0 = x & ~1;
+			y0 = y & ~1;
+			if (full_range)
+			{
+				freerdp_image_yuvj420p_to_bgrx(planes[0] + y0 * strides[0] + x0, strides[0],
+						planes[1] + (y0 / 2) * strides[1] + x0 / 2, strides[1],
+						planes[2] + (y0 / 2) * strides[2] + x0 / 2, strides[2],
+						(uint8*) xfi->shm_info->ptr + (y0 * width + x0) * 4, width * 4,
+						x + cx - x0, y + cy - y0);
+			}
+			else
+			{
+				freerdp_image_yuv420p_to_bgrx(planes[0] + y0 * strides[0] + x0, strides[0],
+						planes[1] + (y0 / 2) * strides[1] + x0 / 2, strides[1],
+						planes[2] + (y0 / 2) * strides[2] + x0 / 2, strides[2],
+						(uint8*) xfi->shm_info->ptr + (y0 * width + x0) * 4, width * 4,
+						x + cx - x0, y + cy - y0);
+			}
+			XShmPutImage(xfi->display, dst, xfi->gc, image, x, y, lx, ly, cx, cy, false);
+		}
+	}
+	XSync(xfi->display, false);
+	XShmDetach(xfi->display, &shminfo);
+	XFree(image);
+
+	if (!xfi->remote_app && !xfi->skip_bs)
+	{
+		stream_set_mark(s, rects_p);
+		for (index = 0; index < num_rects; index++)
+		{
+			stream_read_uint16(s, x);
+			stream_read_uint16(s, y);
+			stream_read_uint16(s, cx);
+			stream_read_uint16(s, cy);
+			lx = x + surface_bits_command->destLeft;
+			ly = y + surface_bits_command->destTop;
+			XCopyArea(xfi->display, xfi->primary, xfi->drawable, xfi->gc, lx, ly, cx, cy, lx, ly);
+		}
+	}
+}
+
+/**
+ * Software H.264 path, used when no hardware decoder is available.
+ */
+static int xf_gdi_surface_h264_sw(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command)
 {
+	STREAM* s;
+	int flags;
+	int session_id;
+	int src_width;
+	int src_height;
+	int dst_width;
+	int dst_height;
+	int num_rects;
+	int h264_bytes;
+	int width;
+	int height;
+	int strides[3];
+	uint8* planes[3];
+	uint8* rects_p;
+	tbool full_range;
+	xfH264Decoder* decoder;
+
+	if ((surface_bits_command->bitmapDataLength < 1) || (surface_bits_command->bitmapData == NULL))
+	{
+		return 1;
+	}
+	s = stream_new(0);
+	stream_attach(s, surface_bits_command->bitmapData, surface_bits_command->bitmapDataLength);
+	if (stream_get_left(s) < 18)
+	{
+		LLOGLN(0, ("xf_gdi_surface_h264_sw: error bytes"));
+		stream_detach(s);
+		stream_free(s);
+		return 1;
+	}
+	stream_read_uint32(s, flags);
+	stream_read_uint32(s, session_id);
+	stream_read_uint16(s, src_width);
+	stream_read_uint16(s, src_height);
+	stream_read_uint16(s, dst_width);
+	stream_read_uint16(s, dst_height);
+	stream_read_uint16(s, num_rects);
+	if ((num_rects < 0) || (stream_get_left(s) < num_rects * 8 + 4))
+	{
+		LLOGLN(0, ("xf_gdi_surface_h264_sw: error bytes"));
+		stream_detach(s);
+		stream_free(s);
+		return 1;
+	}
+	stream_get_mark(s, rects_p); /* save for later */
+	stream_seek(s, num_rects * 8);
+	stream_read_uint32(s, h264_bytes);
+	/* h264_bytes can be zero */
+	if ((h264_bytes < 0) || (stream_get_left(s) < h264_bytes))
+	{
+		LLOGLN(0, ("xf_gdi_surface_h264_sw: error bytes"));
+		stream_detach(s);
+		stream_free(s);
+		return 1;
+	}
+	session_id &= 0xF;
+	if (flags & 2) /* delete */
+	{
+		xf_h264_free(xfi->h264_decoders[session_id]);
+		xfi->h264_decoders[session_id] = NULL;
+	}
+	if ((h264_bytes > 0) && (num_rects > 0))
+	{
+		decoder = xfi->h264_decoders[session_id];
+		if (decoder == NULL)
+		{
+			decoder = xf_h264_new(src_width, src_height);
+			LLOGLN(0, ("xf_gdi_surface_h264_sw: decoder %p width %d height %d", decoder,
+					src_width, src_height));
+			xfi->h264_decoders[session_id] = decoder;
+		}
+		if (decoder == NULL)
+		{
+			LLOGLN(0, ("xf_gdi_surface_h264_sw: error getting decoder"));
+		}
+		else if (xf_h264_decode(decoder, s->p, h264_bytes, planes, strides,
+				&width, &height, &full_range))
+		{
+			if ((src_width != dst_width) || (src_height != dst_height))
+			{
+				LLOGLN(0, ("xf_gdi_surface_h264_sw: unsupported stretch"));
+			}
+			else if (xfi->bpp != 32)
+			{
+				LLOGLN(0, ("xf_gdi_surface_h264_sw: unsupported bpp %d", xfi->bpp));
+			}
+			else
+			{
+				stream_set_mark(s, rects_p);
+				xf_gdi_surface_h264_put(xfi, surface_bits_command, s, num_rects,
+						planes, strides, width, height, full_range);
+			}
+		}
+	}
+	stream_detach(s);
+	stream_free(s);
 	return 0;
 }
 #endif
 
+static int xf_gdi_surface_h264(xfInfo* xfi, SURFACE_BITS_COMMAND* surface_bits_command)
+{
+#ifdef WITH_YAMIINF
+	if (g_yami_funcs.yami_decoder_create != NULL)
+	{
+		return xf_gdi_surface_h264_yami(xfi, surface_bits_command);
+	}
+#endif
+#ifdef WITH_FFMPEG
+	return xf_gdi_surface_h264_sw(xfi, surface_bits_command);
+#else
+	return 0;
+#endif
+}
+
 void xf_gdi_surface_bits(rdpContext* context, SURFACE_BITS_COMMAND* surface_bits_command)
 {
 	int i, tx, ty;
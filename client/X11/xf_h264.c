@@ -0,0 +1,185 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 H.264 Software Decoder
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <freerdp/utils/memory.h>
+
+#include "xf_h264.h"
+
+#ifdef WITH_FFMPEG
+
+#include <libavcodec/avcodec.h>
+
+#if LIBAVCODEC_VERSION_MAJOR < 54 || (LIBAVCODEC_VERSION_MAJOR == 54 && LIBAVCODEC_VERSION_MINOR < 25)
+#define AV_CODEC_ID_H264 CODEC_ID_H264
+#endif
+
+#ifndef CODEC_FLAG_LOW_DELAY
+#define CODEC_FLAG_LOW_DELAY AV_CODEC_FLAG_LOW_DELAY
+#endif
+
+/* most slice threads per decoder */
+#define XF_H264_MAX_THREADS	16
+
+struct xf_h264_decoder
+{
+	AVCodecContext* context;
+	AVFrame* frame;
+};
+
+static tbool initialized = false;
+
+static int xf_h264_thread_count(void)
+{
+	long count;
+
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1)
+		count = 1;
+	if (count > XF_H264_MAX_THREADS)
+		count = XF_H264_MAX_THREADS;
+
+	return (int) count;
+}
+
+xfH264Decoder* xf_h264_new(int width, int height)
+{
+	AVCodec* codec;
+	xfH264Decoder* decoder;
+
+	if (!initialized)
+	{
+		avcodec_register_all();
+		initialized = true;
+	}
+
+	codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+
+	if (codec == NULL)
+	{
+		printf("xf_h264_new: no h264 decoder\n");
+		return NULL;
+	}
+
+	decoder = xnew(xfH264Decoder);
+	decoder->context = avcodec_alloc_context3(codec);
+	decoder->context->width = width;
+	decoder->context->height = height;
+	decoder->context->flags |= CODEC_FLAG_LOW_DELAY;
+
+	/**
+	 * Slice threading only: frame threading would hold pictures back,
+	 * while each update must be drawn with the rectangles it came with.
+	 */
+	decoder->context->thread_count = xf_h264_thread_count();
+#ifdef FF_THREAD_SLICE
+	decoder->context->thread_type = FF_THREAD_SLICE;
+#endif
+
+	if (avcodec_open2(decoder->context, codec, NULL) < 0)
+	{
+		printf("xf_h264_new: avcodec_open2 failed\n");
+		av_free(decoder->context);
+		xfree(decoder);
+		return NULL;
+	}
+
+#if LIBAVCODEC_VERSION_MAJOR > 55 || (LIBAVCODEC_VERSION_MAJOR == 55 && LIBAVCODEC_VERSION_MINOR >= 28)
+	decoder->frame = av_frame_alloc();
+#else
+	decoder->frame = avcodec_alloc_frame();
+#endif
+
+	return decoder;
+}
+
+void xf_h264_free(xfH264Decoder* decoder)
+{
+	if (decoder != NULL)
+	{
+		avcodec_close(decoder->context);
+		av_free(decoder->context);
+		av_free(decoder->frame);
+		xfree(decoder);
+	}
+}
+
+/**
+ * Decode one access unit.
+ * @return true if a YUV 4:2:0 picture was decoded, its planes are valid
+ * until the next call; full_range is set for JPEG range (YUVJ420P) pictures
+ */
+
+tbool xf_h264_decode(xfH264Decoder* decoder, uint8* data, int size,
+	uint8** planes, int* strides, int* width, int* height, tbool* full_range)
+{
+	int i;
+	int len;
+	int decoded = 0;
+	AVPacket pkt;
+
+	av_init_packet(&pkt);
+	pkt.data = data;
+	pkt.size = size;
+
+	len = avcodec_decode_video2(decoder->context, decoder->frame, &decoded, &pkt);
+
+	if (len < 0 || !decoded)
+		return false;
+
+	if (decoder->context->pix_fmt != PIX_FMT_YUV420P &&
+		decoder->context->pix_fmt != PIX_FMT_YUVJ420P)
+	{
+		printf("xf_h264_decode: unsupported pixel format %d\n", decoder->context->pix_fmt);
+		return false;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		planes[i] = decoder->frame->data[i];
+		strides[i] = decoder->frame->linesize[i];
+	}
+
+	*width = decoder->context->width;
+	*height = decoder->context->height;
+	*full_range = decoder->context->pix_fmt == PIX_FMT_YUVJ420P ||
+		decoder->context->color_range == AVCOL_RANGE_JPEG;
+
+	return true;
+}
+
+#else /* WITH_FFMPEG */
+
+xfH264Decoder* xf_h264_new(int width, int height)
+{
+	return NULL;
+}
+
+void xf_h264_free(xfH264Decoder* decoder)
+{
+}
+
+tbool xf_h264_decode(xfH264Decoder* decoder, uint8* data, int size,
+	uint8** planes, int* strides, int* width, int* height, tbool* full_range)
+{
+	return false;
+}
+
+#endif /* WITH_FFMPEG */
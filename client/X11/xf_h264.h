@@ -0,0 +1,31 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 H.264 Software Decoder
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __XF_H264_H
+#define __XF_H264_H
+
+/* kept apart from xfreerdp.h, whose CODEC_ID_H264 clashes with libavcodec's */
+#include <freerdp/types.h>
+
+typedef struct xf_h264_decoder xfH264Decoder;
+
+xfH264Decoder* xf_h264_new(int width, int height);
+void xf_h264_free(xfH264Decoder* decoder);
+tbool xf_h264_decode(xfH264Decoder* decoder, uint8* data, int size,
+	uint8** planes, int* strides, int* width, int* height, tbool* full_range);
+
+#endif /* __XF_H264_H */
@@ -29,6 +29,7 @@
 #include <X11/extensions/XShm.h>
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/event.h>
+#include <freerdp/utils/mutex.h>
 #include <freerdp/plugins/tsmf.h>
 
 #include "xf_tsmf.h"
@@ -39,9 +40,42 @@
 #include <X11/extensions/Xvlib.h>
 
 typedef struct xf_xv_context xfXvContext;
+typedef struct xf_xv_buffer xfXvBuffer;
+
+/* most frame buffers handed out to the decoder at once */
+#define XF_XV_POOL_SIZE		16
+
+/**
+ * A frame buffer the decoder writes into, displayed with XvShmPutImage.
+ * The shared memory segment is allocated on any thread, while the
+ * XvImage and the server attachment are made on the main thread when
+ * the buffer is first displayed.
+ */
+struct xf_xv_buffer
+{
+	RDP_VIDEO_FRAME_BUFFER frame;
+	XShmSegmentInfo shminfo;
+	XvImage* image;
+	xfXvBuffer* next;
+};
 
 struct xf_xv_context
 {
+	RDP_VIDEO_FRAME_POOL pool;
+	Display* display;
+
+	/* layout of the images for the current video size, set on the main thread */
+	freerdp_mutex pool_mutex;
+	tbool pool_layout;
+	uint32 pool_pixfmt;
+	int pool_width;
+	int pool_height;
+	uint32 pool_size;
+	uint32 pool_offsets[3];
+	uint32 pool_pitches[3];
+	xfXvBuffer* pool_free;
+	int pool_count;
+
 	long xv_port;
 	Atom xv_colorkey_atom;
 	Atom xv_autopaint_colorkey_atom;
@@ -59,6 +93,171 @@ struct xf_xv_context
 #define DEBUG_XV(fmt, ...) DEBUG_NULL(fmt, ## __VA_ARGS__)
 #endif
 
+static RDP_VIDEO_FRAME_BUFFER* xf_xv_pool_acquire(RDP_VIDEO_FRAME_POOL* pool, int width, int height)
+{
+	xfXvBuffer* buffer;
+	xfXvBuffer** prev;
+	xfXvContext* xv = (xfXvContext*) pool;
+
+	freerdp_mutex_lock(xv->pool_mutex);
+
+	if (!xv->pool_layout || xv->pool_width != width || xv->pool_height != height)
+	{
+		freerdp_mutex_unlock(xv->pool_mutex);
+		return NULL;
+	}
+
+	for (prev = &xv->pool_free; *prev; prev = &(*prev)->next)
+	{
+		buffer = *prev;
+
+		if (buffer->frame.pixfmt == xv->pool_pixfmt &&
+			buffer->frame.width == width && buffer->frame.height == height)
+		{
+			*prev = buffer->next;
+			freerdp_mutex_unlock(xv->pool_mutex);
+			return &buffer->frame;
+		}
+	}
+
+	if (xv->pool_count >= XF_XV_POOL_SIZE)
+	{
+		freerdp_mutex_unlock(xv->pool_mutex);
+		return NULL;
+	}
+
+	buffer = xnew(xfXvBuffer);
+	buffer->shminfo.shmid = shmget(IPC_PRIVATE, xv->pool_size, IPC_CREAT | 0777);
+
+	if (buffer->shminfo.shmid < 0)
+	{
+		freerdp_mutex_unlock(xv->pool_mutex);
+		xfree(buffer);
+		return NULL;
+	}
+
+	buffer->shminfo.shmaddr = shmat(buffer->shminfo.shmid, 0, 0);
+	buffer->shminfo.readOnly = false;
+
+	if (buffer->shminfo.shmaddr == (char*) -1)
+	{
+		freerdp_mutex_unlock(xv->pool_mutex);
+		shmctl(buffer->shminfo.shmid, IPC_RMID, NULL);
+		xfree(buffer);
+		return NULL;
+	}
+
+	buffer->frame.pool = pool;
+	buffer->frame.data = (uint8*) buffer->shminfo.shmaddr;
+	buffer->frame.size = xv->pool_size;
+	buffer->frame.pixfmt = xv->pool_pixfmt;
+	buffer->frame.width = width;
+	buffer->frame.height = height;
+	memcpy(buffer->frame.offsets, xv->pool_offsets, sizeof(xv->pool_offsets));
+	memcpy(buffer->frame.pitches, xv->pool_pitches, sizeof(xv->pool_pitches));
+	xv->pool_count++;
+
+	freerdp_mutex_unlock(xv->pool_mutex);
+
+	return &buffer->frame;
+}
+
+static void xf_xv_pool_release(RDP_VIDEO_FRAME_POOL* pool, RDP_VIDEO_FRAME_BUFFER* frame)
+{
+	xfXvContext* xv = (xfXvContext*) pool;
+	xfXvBuffer* buffer = (xfXvBuffer*) frame;
+
+	freerdp_mutex_lock(xv->pool_mutex);
+	buffer->next = xv->pool_free;
+	xv->pool_free = buffer;
+	freerdp_mutex_unlock(xv->pool_mutex);
+}
+
+/* X requests are only made here and in the other main thread functions */
+static void xf_xv_buffer_free(xfXvContext* xv, xfXvBuffer* buffer)
+{
+	if (buffer->image)
+	{
+		XShmDetach(xv->display, &buffer->shminfo);
+		XFree(buffer->image);
+	}
+
+	shmdt(buffer->shminfo.shmaddr);
+	shmctl(buffer->shminfo.shmid, IPC_RMID, NULL);
+	xfree(buffer);
+}
+
+/**
+ * Free the idle buffers that do not match the current layout.
+ */
+
+static void xf_xv_pool_prune(xfXvContext* xv, tbool all)
+{
+	xfXvBuffer* buffer;
+	xfXvBuffer** prev;
+	xfXvBuffer* stale = NULL;
+
+	freerdp_mutex_lock(xv->pool_mutex);
+
+	for (prev = &xv->pool_free; *prev; )
+	{
+		buffer = *prev;
+
+		if (all || buffer->frame.pixfmt != xv->pool_pixfmt ||
+			buffer->frame.width != xv->pool_width || buffer->frame.height != xv->pool_height)
+		{
+			*prev = buffer->next;
+			buffer->next = stale;
+			stale = buffer;
+			xv->pool_count--;
+		}
+		else
+		{
+			prev = &buffer->next;
+		}
+	}
+
+	freerdp_mutex_unlock(xv->pool_mutex);
+
+	while (stale)
+	{
+		buffer = stale;
+		stale = buffer->next;
+		xf_xv_buffer_free(xv, buffer);
+	}
+}
+
+/**
+ * Take the image layout of a copied frame as the pool layout, so that
+ * the following frames of that size are decoded into pool buffers.
+ */
+
+static void xf_xv_pool_set_layout(xfXvContext* xv, XvImage* image)
+{
+	uint32 pixfmt = image->id;
+
+	if (xv->pool_layout && xv->pool_pixfmt == pixfmt &&
+		xv->pool_width == image->width && xv->pool_height == image->height)
+		return;
+
+	freerdp_mutex_lock(xv->pool_mutex);
+	xv->pool_layout = true;
+	xv->pool_pixfmt = pixfmt;
+	xv->pool_width = image->width;
+	xv->pool_height = image->height;
+	xv->pool_size = image->data_size;
+	xv->pool_offsets[0] = image->offsets[0];
+	xv->pool_pitches[0] = image->pitches[0];
+	/* YV12 stores V before U */
+	xv->pool_offsets[1] = image->offsets[(pixfmt == RDP_PIXFMT_YV12) ? 2 : 1];
+	xv->pool_pitches[1] = image->pitches[(pixfmt == RDP_PIXFMT_YV12) ? 2 : 1];
+	xv->pool_offsets[2] = image->offsets[(pixfmt == RDP_PIXFMT_YV12) ? 1 : 2];
+	xv->pool_pitches[2] = image->pitches[(pixfmt == RDP_PIXFMT_YV12) ? 1 : 2];
+	freerdp_mutex_unlock(xv->pool_mutex);
+
+	xf_xv_pool_prune(xv, false);
+}
+
 void xf_tsmf_init(xfInfo* xfi, long xv_port)
 {
 	int ret;
@@ -81,6 +280,10 @@ void xf_tsmf_init(xfInfo* xfi, long xv_port)
 	xv->xv_autopaint_colorkey_atom = None;
 	xv->xv_image_size = 0;
 	xv->xv_port = xv_port;
+	xv->display = xfi->display;
+	xv->pool.Acquire = xf_xv_pool_acquire;
+	xv->pool.Release = xf_xv_pool_release;
+	xv->pool_mutex = freerdp_mutex_new();
 
 	if (!XShmQueryExtension(xfi->display))
 	{
@@ -169,6 +372,10 @@ void xf_tsmf_init(xfInfo* xfi, long xv_port)
 #ifdef WITH_DEBUG_XV
 	printf("\n");
 #endif
+
+	/* decoders write into XvShm images when the port can display planar YUV */
+	if (xv->can_do_FOURCC_I420 || xv->can_do_FOURCC_YV12)
+		freerdp_video_frame_pool_register(&xv->pool);
 }
 
 void xf_tsmf_uninit(xfInfo* xfi)
@@ -177,6 +384,11 @@ void xf_tsmf_uninit(xfInfo* xfi)
 
 	if (xv)
 	{
+		if (freerdp_video_frame_pool_get() == &xv->pool)
+			freerdp_video_frame_pool_register(NULL);
+		xf_xv_pool_prune(xv, true);
+		freerdp_mutex_free(xv->pool_mutex);
+
 		if (xv->xv_image_size > 0)
 		{
 			shmdt(xv->xv_shmaddr);
@@ -209,6 +421,38 @@ xf_tsmf_is_format_supported(xfXvContext* xv, uint32 pixfmt)
 	return false;
 }
 
+static void xf_process_tsmf_video_frame_buffer(xfInfo* xfi, RDP_VIDEO_FRAME_EVENT* vevent)
+{
+	xfXvContext* xv = (xfXvContext*) (xfi->xv_context);
+	xfXvBuffer* buffer = (xfXvBuffer*) vevent->frame_buffer;
+
+	if (!buffer->image)
+	{
+		buffer->image = XvShmCreateImage(xfi->display, xv->xv_port, buffer->frame.pixfmt, 0,
+			buffer->frame.width, buffer->frame.height, &buffer->shminfo);
+
+		if (!buffer->image || !XShmAttach(xfi->display, &buffer->shminfo))
+		{
+			if (buffer->image)
+				XFree(buffer->image);
+			buffer->image = NULL;
+			DEBUG_XV("XShmAttach failed.");
+			return;
+		}
+
+		buffer->image->data = buffer->shminfo.shmaddr;
+	}
+
+	XvShmPutImage(xfi->display, xv->xv_port, xfi->window->handle, xfi->gc, buffer->image,
+		0, 0, buffer->image->width, buffer->image->height,
+		vevent->x, vevent->y, vevent->width, vevent->height, false);
+
+	/* the buffer goes back to the decoder once the server is done with it */
+	XSync(xfi->display, false);
+
+	xf_xv_pool_prune(xv, false);
+}
+
 static void xf_process_tsmf_video_frame_event(xfInfo* xfi, RDP_VIDEO_FRAME_EVENT* vevent)
 {
 	int i;
@@ -244,6 +488,12 @@ static void xf_process_tsmf_video_frame_event(xfInfo* xfi, RDP_VIDEO_FRAME_EVENT
 		}
 	}
 
+	if (vevent->frame_buffer)
+	{
+		xf_process_tsmf_video_frame_buffer(xfi, vevent);
+		return;
+	}
+
 	src_pixfmt = vevent->frame_pixfmt;
 	if (xf_tsmf_is_format_supported(xv, src_pixfmt))
 	{
@@ -360,6 +610,10 @@ static void xf_process_tsmf_video_frame_event(xfInfo* xfi, RDP_VIDEO_FRAME_EVENT
 	XSync(xfi->display, false);
 
 	XShmDetach(xfi->display, &shminfo);
+
+	if (dst_pixfmt == RDP_PIXFMT_I420 || dst_pixfmt == RDP_PIXFMT_YV12)
+		xf_xv_pool_set_layout(xv, image);
+
 	XFree(image);
 }
 
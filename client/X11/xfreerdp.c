@@ -51,6 +51,7 @@
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/event.h>
 #include <freerdp/utils/signal.h>
+#include <freerdp/utils/event_loop.h>
 #include <freerdp/utils/passphrase.h>
 #include <freerdp/plugins/cliprdr.h>
 #include <freerdp/rail.h>
@@ -58,6 +59,7 @@
 #include "xf_gdi.h"
 #include "xf_rail.h"
 #include "xf_tsmf.h"
+#include "xf_h264.h"
 #include "xf_event.h"
 #include "xf_cliprdr.h"
 #include "xf_monitor.h"
@@ -165,15 +167,25 @@ void xf_sw_end_paint(rdpContext* context)
 	}
 	else
 	{
-		if (gdi->primary->hdc->hwnd->invalid->null)
+		int i;
+		int ninvalid;
+		HGDI_RGN cinvalid;
+
+		if (gdi->primary->hdc->hwnd->ninvalid < 1)
 			return;
 
-		x = gdi->primary->hdc->hwnd->invalid->x;
-		y = gdi->primary->hdc->hwnd->invalid->y;
-		w = gdi->primary->hdc->hwnd->invalid->w;
-		h = gdi->primary->hdc->hwnd->invalid->h;
+		ninvalid = gdi->primary->hdc->hwnd->ninvalid;
+		cinvalid = gdi->primary->hdc->hwnd->cinvalid;
 
-		xf_rail_paint(xfi, context->rail, x, y, x + w - 1, y + h - 1);
+		for (i = 0; i < ninvalid; i++)
+		{
+			x = cinvalid[i].x;
+			y = cinvalid[i].y;
+			w = cinvalid[i].w;
+			h = cinvalid[i].h;
+
+			xf_rail_paint(xfi, context->rail, x, y, x + w - 1, y + h - 1);
+		}
 	}
 }
 
@@ -702,6 +714,12 @@ tbool xf_post_connect(freerdp* instance)
 #endif
 	}
 
+#ifdef WITH_SSE2
+	/* for the conversion of decoded H.264 frames */
+	if (instance->settings->h264_codec)
+		freerdp_color_set_cpu_opt(xf_detect_cpu());
+#endif
+
 	xfi->width = instance->settings->width;
 	xfi->height = instance->settings->height;
 
@@ -901,8 +919,21 @@ void xf_process_channel_event(rdpChannels* chanman, freerdp* instance)
 	}
 }
 
+static void xf_print_bitmap_cache_stats(rdpBitmapCache* bitmap_cache)
+{
+	BITMAP_CACHE_STATS stats;
+
+	bitmap_cache_get_stats(bitmap_cache, &stats);
+
+	printf("bitmap cache: %u hits, %u decodes, %u misses, %u evictions, "
+		"%u KB decoded, %u KB retained (budget %u KB)\n",
+		stats.hits, stats.decodes, stats.misses, stats.evictions,
+		stats.decodedSize / 1024, stats.retainedSize / 1024, stats.budget / 1024);
+}
+
 void xf_window_free(xfInfo* xfi)
 {
+	int i;
 	rdpContext* context = xfi->instance->context;
 
 	XFreeModifiermap(xfi->modifier_map);
@@ -935,6 +966,9 @@ void xf_window_free(xfInfo* xfi)
 
 	if (context != NULL)
 	{
+			if (context->cache != NULL && context->cache->bitmap != NULL && context->cache->bitmap->lazy)
+				xf_print_bitmap_cache_stats(context->cache->bitmap);
+
 			cache_free(context->cache);
 			context->cache = NULL;
 
@@ -953,6 +987,12 @@ void xf_window_free(xfInfo* xfi)
 	if (xfi->hdc)
 		gdi_DeleteDC(xfi->hdc);
 
+	for (i = 0; i < 16; i++)
+	{
+		xf_h264_free(xfi->h264_decoders[i]);
+		xfi->h264_decoders[i] = NULL;
+	}
+
 	xf_tsmf_uninit(xfi);
 	xf_cliprdr_uninit(xfi);
 }
@@ -968,26 +1008,52 @@ void xf_free(xfInfo* xfi)
 	xfree(xfi);
 }
 
-int xfreerdp_run(freerdp* instance)
+/**
+ * Register the descriptors of the connection, the channels and the display
+ * with the event loop. They only change when the connection is re-established.
+ */
+
+static tbool xf_register_fds(freerdp* instance, struct event_loop* loop)
 {
-	int i;
-	int fds;
-	xfInfo* xfi;
-	int max_fds;
-	int rcount;
-	int wcount;
-	int ret = 0;
+	int rcount = 0;
+	int wcount = 0;
 	void* rfds[32];
 	void* wfds[32];
-	fd_set rfds_set;
-	fd_set wfds_set;
-	int select_status;
-	rdpChannels* channels;
-	struct timeval timeout;
+	rdpChannels* channels = instance->context->channels;
 
 	memset(rfds, 0, sizeof(rfds));
 	memset(wfds, 0, sizeof(wfds));
-	memset(&timeout, 0, sizeof(struct timeval));
+
+	if (freerdp_get_fds(instance, rfds, &rcount, wfds, &wcount) == false)
+	{
+		printf("Failed to get FreeRDP file descriptor\n");
+		return false;
+	}
+	if (freerdp_channels_get_fds(channels, instance, rfds, &rcount, wfds, &wcount) == false)
+	{
+		printf("Failed to get channel manager file descriptor\n");
+		return false;
+	}
+	if (xf_get_fds(instance, rfds, &rcount, wfds, &wcount) == false)
+	{
+		printf("Failed to get xfreerdp file descriptor\n");
+		return false;
+	}
+
+	if (rcount == 0 || event_loop_update_fds(loop, rfds, rcount) == false)
+		return false;
+
+	return true;
+}
+
+int xfreerdp_run(freerdp* instance)
+{
+	xfInfo* xfi;
+	int ret = 0;
+	int wait_status;
+	uint32 connection_id;
+	rdpChannels* channels;
+	struct event_loop* loop;
 
 	if (!freerdp_connect(instance))
 		return XF_EXIT_CONN_FAILED;
@@ -995,66 +1061,29 @@ int xfreerdp_run(freerdp* instance)
 	xfi = ((xfContext*) instance->context)->xfi;
 	channels = instance->context->channels;
 
-	while (!xfi->disconnect && !freerdp_shall_disconnect(instance))
-	{
-		rcount = 0;
-		wcount = 0;
-
-		if (freerdp_get_fds(instance, rfds, &rcount, wfds, &wcount) == false)
-		{
-			printf("Failed to get FreeRDP file descriptor\n");
-			ret = XF_EXIT_CONN_FAILED;
-			break;
-		}
-		if (freerdp_channels_get_fds(channels, instance, rfds, &rcount, wfds, &wcount) == false)
-		{
-			printf("Failed to get channel manager file descriptor\n");
-			ret = XF_EXIT_CONN_FAILED;
-			break;
-		}
-		if (xf_get_fds(instance, rfds, &rcount, wfds, &wcount) == false)
-		{
-			printf("Failed to get xfreerdp file descriptor\n");
-			ret = XF_EXIT_CONN_FAILED;
-			break;
-		}
-
-		max_fds = 0;
-		FD_ZERO(&rfds_set);
-		FD_ZERO(&wfds_set);
+	loop = event_loop_new();
 
-		for (i = 0; i < rcount; i++)
-		{
-			fds = (int)(long)(rfds[i]);
-
-			if (fds > max_fds)
-				max_fds = fds;
+	if (loop == NULL)
+		return XF_EXIT_CONN_FAILED;
 
-			FD_SET(fds, &rfds_set);
-		}
+	connection_id = freerdp_get_connection_id(instance);
 
-		if (max_fds == 0)
-			break;
+	if (xf_register_fds(instance, loop) == false)
+		ret = XF_EXIT_CONN_FAILED;
 
-		timeout.tv_sec = 5;
-		select_status = select(max_fds + 1, &rfds_set, &wfds_set, NULL, &timeout);
+	while (!ret && !xfi->disconnect && !freerdp_shall_disconnect(instance))
+	{
+		wait_status = event_loop_wait(loop, 5000);
 
-		if (select_status == 0)
+		if (wait_status == 0)
 		{
 			//freerdp_send_keep_alive(instance);
 			continue;
 		}
-		else if (select_status == -1)
+		else if (wait_status == -1)
 		{
-			/* these are not really errors */
-			if (!((errno == EAGAIN) ||
-				(errno == EWOULDBLOCK) ||
-				(errno == EINPROGRESS) ||
-				(errno == EINTR))) /* signal occurred */
-			{
-				printf("xfreerdp_run: select failed\n");
-				break;
-			}
+			printf("xfreerdp_run: event_loop_wait failed\n");
+			break;
 		}
 
 		if (freerdp_check_fds(instance) == false)
@@ -1062,7 +1091,18 @@ int xfreerdp_run(freerdp* instance)
 			printf("Failed to check FreeRDP file descriptor\n");
 			break;
 		}
-		if (xf_check_fds(instance, &rfds_set) == false)
+		if (freerdp_get_connection_id(instance) != connection_id)
+		{
+			/* redirected: the transport descriptors were replaced */
+			connection_id = freerdp_get_connection_id(instance);
+
+			if (xf_register_fds(instance, loop) == false)
+			{
+				ret = XF_EXIT_CONN_FAILED;
+				break;
+			}
+		}
+		if (xf_check_fds(instance, NULL) == false)
 		{
 			printf("Failed to check xfreerdp file descriptor\n");
 			break;
@@ -1075,6 +1115,8 @@ int xfreerdp_run(freerdp* instance)
 		xf_process_channel_event(channels, instance);
 	}
 
+	event_loop_free(loop);
+
 	if (!ret)
 		ret = freerdp_error_info(instance);
 
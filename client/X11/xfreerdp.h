@@ -190,6 +190,7 @@ struct xf_info
 	int suppress_output;
 	int primary_adjust_x;
 	int primary_adjust_y;
+	struct xf_h264_decoder* h264_decoders[16];
 #ifdef WITH_YAMIINF
 	void* decoders[16];
 	xcb_connection_t* xcb;
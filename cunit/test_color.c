@@ -19,7 +19,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
 #include <freerdp/gdi/gdi.h>
 #include <freerdp/codec/color.h>
 #include "test_color.h"
@@ -44,6 +46,8 @@ int add_color_suite(void)
 	add_test_function(color_GetRGB16);
 	add_test_function(color_GetBGR_565);
 	add_test_function(color_GetBGR16);
+	add_test_function(color_yuv420p_to_bgrx);
+	add_test_function(color_yuvj420p_to_bgrx);
 
 	return 0;
 }
@@ -150,3 +154,91 @@ void test_color_GetBGR16(void)
 	CU_ASSERT(b == 0xEF);
 }
 
+void test_color_yuv420p_to_bgrx(void)
+{
+	int i;
+	uint8 y[2 * 19];
+	uint8 u[10];
+	uint8 v[10];
+	uint8 bgrx[2 * 19 * 4];
+	uint8 bgrx_simd[2 * 19 * 4];
+
+	/* white, black and red, the odd width covers the tail of a row */
+	memset(y, 235, sizeof(y));
+	memset(u, 128, sizeof(u));
+	memset(v, 128, sizeof(v));
+	y[19 + 18] = 16;
+	y[19 + 0] = y[19 + 1] = y[0] = y[1] = 81;
+	u[0] = 90;
+	v[0] = 240;
+
+	freerdp_image_yuv420p_to_bgrx(y, 19, u, 10, v, 10, bgrx, 19 * 4, 19, 2);
+
+	for (i = 0; i < 2; i++)
+	{
+		CU_ASSERT(bgrx[i * 4 + 0] == 0x00);
+		CU_ASSERT(bgrx[i * 4 + 1] == 0x00);
+		CU_ASSERT(bgrx[i * 4 + 2] == 0xFF);
+		CU_ASSERT(bgrx[i * 4 + 3] == 0xFF);
+	}
+
+	for (i = 2; i < 19; i++)
+	{
+		CU_ASSERT(bgrx[i * 4 + 0] == 0xFF);
+		CU_ASSERT(bgrx[i * 4 + 1] == 0xFF);
+		CU_ASSERT(bgrx[i * 4 + 2] == 0xFF);
+	}
+
+	CU_ASSERT(bgrx[(19 + 1) * 4 + 2] == 0xFF);
+	CU_ASSERT(bgrx[(19 + 18) * 4 + 0] == 0x00);
+	CU_ASSERT(bgrx[(19 + 18) * 4 + 1] == 0x00);
+	CU_ASSERT(bgrx[(19 + 18) * 4 + 2] == 0x00);
+
+	/* the SIMD rows, when built in, match the C ones */
+	freerdp_color_set_cpu_opt(CPU_SSE2);
+	freerdp_image_yuv420p_to_bgrx(y, 19, u, 10, v, 10, bgrx_simd, 19 * 4, 19, 2);
+	freerdp_color_set_cpu_opt(0);
+
+	CU_ASSERT(memcmp(bgrx, bgrx_simd, sizeof(bgrx)) == 0);
+}
+
+void test_color_yuvj420p_to_bgrx(void)
+{
+	int i;
+	uint8 y[2 * 5];
+	uint8 u[3];
+	uint8 v[3];
+	uint8 bgrx[2 * 5 * 4];
+
+	/* full range: red, then mid gray, black and white on neutral chroma */
+	y[0] = y[1] = y[5 + 0] = y[5 + 1] = 76;
+	y[2] = y[3] = y[5 + 3] = 128;
+	y[5 + 2] = 0;
+	y[4] = y[5 + 4] = 255;
+	u[0] = 85;
+	v[0] = 255;
+	u[1] = u[2] = v[1] = v[2] = 128;
+
+	freerdp_image_yuvj420p_to_bgrx(y, 5, u, 3, v, 3, bgrx, 5 * 4, 5, 2);
+
+	for (i = 0; i < 2; i++)
+	{
+		CU_ASSERT(bgrx[i * 4 + 0] == 0x00);
+		CU_ASSERT(bgrx[i * 4 + 1] == 0x00);
+		CU_ASSERT(bgrx[i * 4 + 2] >= 0xFD);
+		CU_ASSERT(bgrx[(5 + i) * 4 + 2] == bgrx[i * 4 + 2]);
+	}
+
+	/* limited range would give 130 for 128 and 255 for 235 */
+	for (i = 0; i < 3; i++)
+	{
+		CU_ASSERT(bgrx[2 * 4 + i] == 128);
+		CU_ASSERT(bgrx[(5 + 3) * 4 + i] == 128);
+		CU_ASSERT(bgrx[(5 + 2) * 4 + i] == 0);
+		CU_ASSERT(bgrx[4 * 4 + i] == 255);
+		CU_ASSERT(bgrx[(5 + 4) * 4 + i] == 255);
+	}
+
+	for (i = 0; i < 2 * 5; i++)
+		CU_ASSERT(bgrx[i * 4 + 3] == 0xFF);
+}
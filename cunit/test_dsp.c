@@ -0,0 +1,241 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Audio DSP Unit Tests
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <freerdp/freerdp.h>
+#include <freerdp/utils/dsp.h>
+#include <freerdp/utils/memory.h>
+
+#include "test_dsp.h"
+
+#define TEST_FRAMES		4000
+
+int init_dsp_suite(void)
+{
+	return 0;
+}
+
+int clean_dsp_suite(void)
+{
+	return 0;
+}
+
+int add_dsp_suite(void)
+{
+	add_test_suite(dsp);
+
+	add_test_function(dsp_resampler_packets);
+	add_test_function(dsp_resampler_dc_gain);
+	add_test_function(dsp_ima_adpcm_round_trip);
+
+	return 0;
+}
+
+/* interleaved 16-bit samples, a sine per channel */
+static void test_dsp_sine(uint8* data, int frames, int channels, int period, int amplitude)
+{
+	int i, c;
+	sint16 v;
+
+	for (i = 0; i < frames; i++)
+	{
+		for (c = 0; c < channels; c++)
+		{
+			v = (sint16) (amplitude * sin(2 * M_PI * (i + c * period / 4) / period));
+			*data++ = v & 0xFF;
+			*data++ = (v >> 8) & 0xFF;
+		}
+	}
+}
+
+static sint16 test_dsp_sample(uint8* data, int index)
+{
+	return (sint16) (data[index * 2] | (data[index * 2 + 1] << 8));
+}
+
+/**
+ * Resample 16-bit input in packets of the given sizes, taken in turn.
+ * @return number of bytes written to dst
+ */
+
+static int test_dsp_resample(DSP_RESAMPLER* resampler, uint8* src, int sframes, int schan,
+	const int* sizes, int num_sizes, uint8* dst, int rchan)
+{
+	int i;
+	int size;
+	int rframes;
+	int done = 0;
+	int length = 0;
+
+	dsp_resampler_reset(resampler);
+
+	for (i = 0; done < sframes; i++)
+	{
+		size = sizes[i % num_sizes];
+		if (size > sframes - done)
+			size = sframes - done;
+
+		rframes = dsp_resampler_process(resampler, src + done * schan * 2, size,
+			dst + length, dsp_resampler_max_frames(resampler, size));
+		length += rframes * rchan * 2;
+		done += size;
+	}
+
+	return length;
+}
+
+void test_dsp_resampler_packets(void)
+{
+	int whole, split;
+	uint8* src;
+	uint8* dst_whole;
+	uint8* dst_split;
+	DSP_RESAMPLER* resampler;
+	static const int whole_size[] = { TEST_FRAMES };
+	static const int split_sizes[] = { 1, 7, 441, 2, 100, 1023 };
+
+	src = (uint8*) xmalloc(TEST_FRAMES * 2 * 2);
+	dst_whole = (uint8*) xzalloc(TEST_FRAMES * 4 * 2 * 2);
+	dst_split = (uint8*) xzalloc(TEST_FRAMES * 4 * 2 * 2);
+	test_dsp_sine(src, TEST_FRAMES, 2, 50, 12000);
+
+	/* the output does not depend on how the input is cut into packets */
+	resampler = dsp_resampler_new(2, 2, 22050, 2, 44100);
+	whole = test_dsp_resample(resampler, src, TEST_FRAMES, 2, whole_size, 1, dst_whole, 2);
+	split = test_dsp_resample(resampler, src, TEST_FRAMES, 2, split_sizes, 6, dst_split, 2);
+	dsp_resampler_free(resampler);
+
+	CU_ASSERT(whole > TEST_FRAMES * 2 * 2 * 2 - 256);
+	CU_ASSERT(whole == split);
+	CU_ASSERT(memcmp(dst_whole, dst_split, whole) == 0);
+
+	resampler = dsp_resampler_new(2, 2, 44100, 1, 48000);
+	whole = test_dsp_resample(resampler, src, TEST_FRAMES, 2, whole_size, 1, dst_whole, 1);
+	split = test_dsp_resample(resampler, src, TEST_FRAMES, 2, split_sizes, 6, dst_split, 1);
+	dsp_resampler_free(resampler);
+
+	CU_ASSERT(whole > TEST_FRAMES * 2 - 256);
+	CU_ASSERT(whole == split);
+	CU_ASSERT(memcmp(dst_whole, dst_split, whole) == 0);
+
+	xfree(src);
+	xfree(dst_whole);
+	xfree(dst_split);
+}
+
+static void test_dsp_dc_gain(uint32 srate, uint32 rrate)
+{
+	int i;
+	int length;
+	uint8* src;
+	uint8* dst;
+	int max_error = 0;
+	DSP_RESAMPLER* resampler;
+	int sizes[] = { TEST_FRAMES };
+
+	src = (uint8*) xmalloc(TEST_FRAMES * 2);
+	dst = (uint8*) xzalloc(TEST_FRAMES * 4 * 2);
+
+	for (i = 0; i < TEST_FRAMES; i++)
+	{
+		src[i * 2] = 10000 & 0xFF;
+		src[i * 2 + 1] = 10000 >> 8;
+	}
+
+	resampler = dsp_resampler_new(2, 1, srate, 1, rrate);
+	length = test_dsp_resample(resampler, src, TEST_FRAMES, 1, sizes, 1, dst, 1);
+	dsp_resampler_free(resampler);
+
+	/* past the filter ramp up from the silence before the first packet */
+	for (i = 200; i < length / 2; i++)
+		max_error = MAX(max_error, abs(test_dsp_sample(dst, i) - 10000));
+
+	CU_ASSERT(length / 2 > 400);
+	CU_ASSERT(max_error <= 1);
+
+	xfree(src);
+	xfree(dst);
+}
+
+void test_dsp_resampler_dc_gain(void)
+{
+	test_dsp_dc_gain(22050, 44100);
+	test_dsp_dc_gain(44100, 48000);
+	test_dsp_dc_gain(48000, 22050);
+	test_dsp_dc_gain(44100, 8000);
+}
+
+void test_dsp_ima_adpcm_round_trip(void)
+{
+	int i;
+	int size;
+	int half_size;
+	int encoded_size;
+	int decoded_size;
+	int max_error = 0;
+	uint8* src;
+	uint8* encoded;
+	uint8* decoded;
+	uint8* whole;
+	ADPCM enc = { { 0 } };
+	ADPCM dec = { { 0 } };
+
+	/* four mono blocks of 256 bytes: a 4 byte header and 504 samples each */
+	size = 4 * 504 * 2;
+	src = (uint8*) xmalloc(size);
+	test_dsp_sine(src, size / 2, 1, 80, 8000);
+
+	encoded = dsp_ima_adpcm_encode(&enc, src, size, 1, 256, &encoded_size);
+	CU_ASSERT(encoded == enc.buffer);
+	CU_ASSERT(encoded_size == 4 * 256);
+
+	whole = (uint8*) xmalloc(encoded_size);
+	memcpy(whole, encoded, encoded_size);
+
+	decoded = dsp_ima_adpcm_decode(&dec, whole, encoded_size, 1, 256, &decoded_size);
+	CU_ASSERT(decoded == dec.buffer);
+	CU_ASSERT(decoded_size == size);
+
+	/* past the step size adapting from the smallest one */
+	for (i = 32; i < size / 2; i++)
+		max_error = MAX(max_error, abs(test_dsp_sample(decoded, i) - test_dsp_sample(src, i)));
+
+	CU_ASSERT(max_error < 512);
+
+	/* the context carries the state from one packet to the next */
+	dsp_ima_adpcm_reset(&enc);
+	half_size = size / 2;
+
+	encoded = dsp_ima_adpcm_encode(&enc, src, half_size, 1, 256, &encoded_size);
+	CU_ASSERT(encoded_size == 2 * 256);
+	CU_ASSERT(memcmp(encoded, whole, encoded_size) == 0);
+
+	encoded = dsp_ima_adpcm_encode(&enc, src + half_size, half_size, 1, 256, &encoded_size);
+	CU_ASSERT(encoded == enc.buffer);
+	CU_ASSERT(encoded_size == 2 * 256);
+	CU_ASSERT(memcmp(encoded, whole + 2 * 256, encoded_size) == 0);
+
+	dsp_ima_adpcm_uninit(&enc);
+	dsp_ima_adpcm_uninit(&dec);
+	CU_ASSERT(enc.buffer == NULL);
+
+	xfree(src);
+	xfree(whole);
+}
@@ -39,6 +39,8 @@
 #include "test_rail.h"
 #include "test_pcap.h"
 #include "test_mppc.h"
+#include "test_wtsvc.h"
+#include "test_dsp.h"
 
 void dump_data(unsigned char * p, int len, int width, char* name)
 {
@@ -130,6 +132,8 @@ int main(int argc, char* argv[])
 		add_license_suite();
 		add_stream_suite();
 		add_mppc_suite();
+		add_wtsvc_suite();
+		add_dsp_suite();
 	}
 	else
 	{
@@ -211,6 +215,14 @@ int main(int argc, char* argv[])
 			{
 				add_mppc_suite();
 			}
+			else if (strcmp("wtsvc", argv[*pindex]) == 0)
+			{
+				add_wtsvc_suite();
+			}
+			else if (strcmp("dsp", argv[*pindex]) == 0)
+			{
+				add_dsp_suite();
+			}
 
 			*pindex = *pindex + 1;
 		}
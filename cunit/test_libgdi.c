@@ -74,6 +74,7 @@ int add_libgdi_suite(void)
 	add_test_function(gdi_BitBlt_8bpp);
 	add_test_function(gdi_ClipCoords);
 	add_test_function(gdi_InvalidateRegion);
+	add_test_function(gdi_CombineRects);
 
 	return 0;
 }
@@ -2864,13 +2865,14 @@ void test_gdi_InvalidateRegion(void)
 	gdi_SelectObject(hdc, (HGDIOBJECT) bmp);
 	gdi_SetNullClipRgn(hdc);
 
-	hdc->hwnd = (HGDI_WND) malloc(sizeof(GDI_WND));
+	hdc->hwnd = (HGDI_WND) calloc(1, sizeof(GDI_WND));
 	hdc->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	hdc->hwnd->invalid->null = 1;
 	invalid = hdc->hwnd->invalid;
 	
 	hdc->hwnd->count = 16;
 	hdc->hwnd->cinvalid = (HGDI_RGN) malloc(sizeof(GDI_RGN) * hdc->hwnd->count);
+	hdc->hwnd->ninvalid = 0;
 
 	rgn1 = gdi_CreateRectRgn(0, 0, 0, 0);
 	rgn2 = gdi_CreateRectRgn(0, 0, 0, 0);
@@ -2989,3 +2991,66 @@ void test_gdi_InvalidateRegion(void)
 	gdi_InvalidateRegion(hdc, rgn1->x, rgn1->y, rgn1->w, rgn1->h);
 	CU_ASSERT(gdi_EqualRgn(invalid, rgn2) == 1);
 }
+
+void test_gdi_CombineRects(void)
+{
+	int n;
+	int count = 0;
+	GDI_RGN rgn1;
+	GDI_RGN rgn2;
+	GDI_RGN rects[3];
+	HGDI_RGN dst = NULL;
+
+	/* two overlapping rectangles form three bands */
+	gdi_SetRgn(&rgn1, 0, 0, 100, 100);
+	gdi_SetRgn(&rgn2, 50, 50, 100, 100);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_OR);
+	CU_ASSERT(n == 3);
+	gdi_SetRgn(&rects[0], 0, 0, 100, 50);
+	gdi_SetRgn(&rects[1], 0, 50, 150, 50);
+	gdi_SetRgn(&rects[2], 50, 100, 100, 50);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+	CU_ASSERT(gdi_EqualRgn(&dst[1], &rects[1]) == 1);
+	CU_ASSERT(gdi_EqualRgn(&dst[2], &rects[2]) == 1);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_AND);
+	CU_ASSERT(n == 1);
+	gdi_SetRgn(&rects[0], 50, 50, 50, 50);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_DIFF);
+	CU_ASSERT(n == 2);
+	gdi_SetRgn(&rects[0], 0, 0, 100, 50);
+	gdi_SetRgn(&rects[1], 0, 50, 50, 50);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+	CU_ASSERT(gdi_EqualRgn(&dst[1], &rects[1]) == 1);
+
+	/* adjacent rectangles are coalesced */
+	gdi_SetRgn(&rgn1, 0, 0, 100, 100);
+	gdi_SetRgn(&rgn2, 0, 100, 100, 100);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_OR);
+	CU_ASSERT(n == 1);
+	gdi_SetRgn(&rects[0], 0, 0, 100, 200);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+
+	gdi_SetRgn(&rgn2, 100, 0, 100, 100);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_OR);
+	CU_ASSERT(n == 1);
+	gdi_SetRgn(&rects[0], 0, 0, 200, 100);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+
+	/* simplifying falls back to the bounding rectangle */
+	gdi_SetRgn(&rgn1, 0, 0, 100, 100);
+	gdi_SetRgn(&rgn2, 50, 50, 100, 100);
+
+	n = gdi_CombineRects(&dst, &count, &rgn1, 1, &rgn2, 1, GDI_RGN_OR);
+	n = gdi_SimplifyRects(dst, n, 1);
+	CU_ASSERT(n == 1);
+	gdi_SetRgn(&rects[0], 0, 0, 150, 150);
+	CU_ASSERT(gdi_EqualRgn(&dst[0], &rects[0]) == 1);
+
+	free(dst);
+}
@@ -182,6 +182,8 @@ int add_librfx_suite(void)
 	add_test_function(decode);
 	add_test_function(encode);
 	add_test_function(message);
+	add_test_function(message_tileset);
+	add_test_function(message_rects);
 
 	return 0;
 }
@@ -408,3 +410,94 @@ void test_message(void)
 	rfx_context_free(context);
 	free(rgb_data);
 }
+
+void test_message_tileset(void)
+{
+	int i;
+	STREAM* s1;
+	STREAM* s2;
+	STREAM* tileset;
+	uint8* image_data;
+	RFX_CONTEXT* context;
+	RFX_CONTEXT* encoder;
+	RFX_RECT rect = {0, 0, 100, 80};
+
+	image_data = (uint8*) malloc(100 * 80 * 4);
+	for (i = 0; i < 100 * 80 * 4; i++)
+		image_data[i] = (uint8) (i * 7);
+
+	s1 = stream_new(65536);
+	s2 = stream_new(65536);
+	tileset = stream_new(65536);
+
+	context = rfx_context_new();
+	context->mode = RLGR3;
+	context->width = 800;
+	context->height = 600;
+	rfx_context_set_pixel_format(context, RFX_PIXEL_FORMAT_BGRA);
+	rfx_compose_message(context, s1, &rect, 1, image_data, 100, 80, 100 * 4);
+	rfx_context_free(context);
+
+	/* the tileset encoded by another context, then framed */
+	encoder = rfx_context_new();
+	encoder->mode = RLGR3;
+	rfx_context_set_pixel_format(encoder, RFX_PIXEL_FORMAT_BGRA);
+	rfx_compose_message_tileset(encoder, tileset, &rect, 1, image_data, 100, 80, 100 * 4);
+	rfx_context_free(encoder);
+
+	context = rfx_context_new();
+	context->mode = RLGR3;
+	context->width = 800;
+	context->height = 600;
+	rfx_context_set_pixel_format(context, RFX_PIXEL_FORMAT_BGRA);
+	rfx_compose_message_frame(context, s2, &rect, 1,
+		stream_get_head(tileset), stream_get_length(tileset));
+	rfx_context_free(context);
+
+	CU_ASSERT(stream_get_length(s1) == stream_get_length(s2));
+	CU_ASSERT(memcmp(stream_get_head(s1), stream_get_head(s2), stream_get_length(s1)) == 0);
+
+	stream_free(s1);
+	stream_free(s2);
+	stream_free(tileset);
+	free(image_data);
+}
+
+void test_message_rects(void)
+{
+	int i;
+	STREAM* s;
+	uint8* image_data;
+	RFX_CONTEXT* context;
+	RFX_MESSAGE* message;
+	RFX_RECT rects[2] = { { 10, 10, 20, 20 }, { 200, 130, 40, 50 } };
+
+	image_data = (uint8*) malloc(256 * 192 * 4);
+	for (i = 0; i < 256 * 192 * 4; i++)
+		image_data[i] = (uint8) (i * 7);
+
+	s = stream_new(65536);
+
+	context = rfx_context_new();
+	context->mode = RLGR3;
+	context->width = 256;
+	context->height = 192;
+	rfx_context_set_pixel_format(context, RFX_PIXEL_FORMAT_BGRA);
+	rfx_compose_message(context, s, rects, 2, image_data, 256, 192, 256 * 4);
+	stream_seal(s);
+	stream_set_pos(s, 0);
+
+	/* only the tiles under the rects are sent: (0,0), then (3,2) */
+	message = rfx_process_message(context, s->p, s->size);
+	CU_ASSERT(rfx_message_get_rect_count(message) == 2);
+	CU_ASSERT(rfx_message_get_tile_count(message) == 2);
+	CU_ASSERT(rfx_message_get_tile(message, 0)->x == 0);
+	CU_ASSERT(rfx_message_get_tile(message, 0)->y == 0);
+	CU_ASSERT(rfx_message_get_tile(message, 1)->x == 192);
+	CU_ASSERT(rfx_message_get_tile(message, 1)->y == 128);
+	rfx_message_free(context, message);
+
+	rfx_context_free(context);
+	stream_free(s);
+	free(image_data);
+}
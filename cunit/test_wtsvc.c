@@ -0,0 +1,278 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Server Virtual Channel Unit Tests
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
+#include <freerdp/peer.h>
+#include <freerdp/channels/wtsvc.h>
+#include <freerdp/utils/memory.h>
+
+#include "libfreerdp-channels/wtsvc.h"
+
+#include "test_wtsvc.h"
+
+#define TEST_DRDYNVC_ID		1004
+#define TEST_CHUNK_SIZE		64
+#define TEST_MAX_PDUS		64
+
+int init_wtsvc_suite(void)
+{
+	return 0;
+}
+
+int clean_wtsvc_suite(void)
+{
+	return 0;
+}
+
+int add_wtsvc_suite(void)
+{
+	add_test_suite(wtsvc);
+
+	add_test_function(wtsvc_dvc_round_trip);
+	add_test_function(wtsvc_dvc_oversized);
+	add_test_function(wtsvc_dvc_close);
+
+	return 0;
+}
+
+/* the drdynvc PDUs the server sent to the client */
+static uint8 sent_data[TEST_MAX_PDUS][CHANNEL_CHUNK_LENGTH];
+static int sent_length[TEST_MAX_PDUS];
+static int num_sent;
+
+static int test_send_channel_data(freerdp_peer* client, int channelId, uint8* data, int size)
+{
+	CU_ASSERT(channelId == TEST_DRDYNVC_ID);
+	CU_ASSERT(size <= CHANNEL_CHUNK_LENGTH);
+
+	if (num_sent < TEST_MAX_PDUS && size <= CHANNEL_CHUNK_LENGTH)
+	{
+		memcpy(sent_data[num_sent], data, size);
+		sent_length[num_sent++] = size;
+	}
+
+	return true;
+}
+
+/* one drdynvc PDU from the client, in a single channel chunk */
+static void test_receive_pdu(freerdp_peer* client, uint8* data, int length)
+{
+	client->ReceiveChannelData(client, TEST_DRDYNVC_ID, data, length,
+		CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, length);
+}
+
+static void test_flush(WTSVirtualChannelManager* vcm)
+{
+	num_sent = 0;
+	CU_ASSERT(WTSVirtualChannelManagerCheckFileDescriptor(vcm) == true);
+}
+
+/**
+ * Open the dynamic channel TESTDVC, answering the capability and create
+ * requests of the server like a client would.
+ */
+
+static void* test_open_dvc(freerdp_peer* client, rdpSettings* settings, WTSVirtualChannelManager** pvcm)
+{
+	void* channel;
+	uint8 pdu[8];
+	WTSVirtualChannelManager* vcm;
+
+	memset(settings, 0, sizeof(rdpSettings));
+	memset(client, 0, sizeof(freerdp_peer));
+
+	strcpy(settings->channels[0].name, "drdynvc");
+	settings->channels[0].channel_id = TEST_DRDYNVC_ID;
+	settings->channels[0].joined = true;
+	settings->num_channels = 1;
+
+	client->settings = settings;
+	client->SendChannelData = test_send_channel_data;
+
+	vcm = WTSCreateVirtualChannelManager(client);
+	WTSVirtualChannelManagerSetDvcChunkSize(vcm, TEST_CHUNK_SIZE);
+	*pvcm = vcm;
+
+	channel = WTSVirtualChannelOpenEx(vcm, "TESTDVC", WTS_CHANNEL_OPTION_DYNAMIC);
+	CU_ASSERT(channel != NULL);
+
+	test_flush(vcm);
+	CU_ASSERT(num_sent == 1);
+	CU_ASSERT((sent_data[0][0] >> 4) == CAPABILITY_REQUEST_PDU);
+
+	pdu[0] = CAPABILITY_REQUEST_PDU << 4;
+	pdu[1] = 0; /* pad */
+	pdu[2] = 1; /* version */
+	pdu[3] = 0;
+	test_receive_pdu(client, pdu, 4);
+
+	/* create request: header, 1 byte channel id, then the name */
+	test_flush(vcm);
+	CU_ASSERT(num_sent == 1);
+	CU_ASSERT(sent_data[0][0] == (CREATE_REQUEST_PDU << 4));
+	CU_ASSERT(strcmp((char*) &sent_data[0][2], "TESTDVC") == 0);
+
+	pdu[0] = CREATE_REQUEST_PDU << 4;
+	pdu[1] = sent_data[0][1];
+	memset(&pdu[2], 0, 4); /* CreationStatus */
+	test_receive_pdu(client, pdu, 6);
+
+	return channel;
+}
+
+static void test_close_dvc(WTSVirtualChannelManager* vcm, void* channel)
+{
+	WTSVirtualChannelClose(channel);
+	WTSDestroyVirtualChannelManager(vcm);
+}
+
+void test_wtsvc_dvc_round_trip(void)
+{
+	int i;
+	uint32 length;
+	uint8 data[1000];
+	uint8 received[1000];
+	void* channel;
+	rdpSettings settings;
+	freerdp_peer client;
+	WTSVirtualChannelManager* vcm;
+
+	channel = test_open_dvc(&client, &settings, &vcm);
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+
+	CU_ASSERT(WTSVirtualChannelWrite(channel, data, sizeof(data), &length) == true);
+	CU_ASSERT(length == sizeof(data));
+
+	/* DATA_FIRST then DATA PDUs, each at most one chunk long */
+	test_flush(vcm);
+	CU_ASSERT(num_sent > 1);
+	CU_ASSERT((sent_data[0][0] >> 4) == DATA_FIRST_PDU);
+
+	for (i = 0; i < num_sent; i++)
+	{
+		CU_ASSERT(sent_length[i] <= TEST_CHUNK_SIZE);
+		if (i > 0)
+			CU_ASSERT((sent_data[i][0] >> 4) == DATA_PDU);
+	}
+
+	/* the server parses the PDUs it produced back into the message */
+	for (i = 0; i < num_sent; i++)
+		test_receive_pdu(&client, sent_data[i], sent_length[i]);
+
+	memset(received, 0, sizeof(received));
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == true);
+	CU_ASSERT(length == sizeof(data));
+	CU_ASSERT(memcmp(received, data, sizeof(data)) == 0);
+
+	/* a message that fits in one chunk goes as a single DATA PDU */
+	CU_ASSERT(WTSVirtualChannelWrite(channel, data, 10, &length) == true);
+	test_flush(vcm);
+	CU_ASSERT(num_sent == 1);
+	CU_ASSERT((sent_data[0][0] >> 4) == DATA_PDU);
+	CU_ASSERT(sent_length[0] == 2 + 10);
+
+	test_receive_pdu(&client, sent_data[0], sent_length[0]);
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == true);
+	CU_ASSERT(length == 10);
+	CU_ASSERT(memcmp(received, data, 10) == 0);
+
+	test_close_dvc(vcm, channel);
+}
+
+void test_wtsvc_dvc_oversized(void)
+{
+	uint32 length;
+	uint8 pdu[32];
+	uint8 received[32];
+	void* channel;
+	rdpSettings settings;
+	freerdp_peer client;
+	WTSVirtualChannelManager* vcm;
+
+	channel = test_open_dvc(&client, &settings, &vcm);
+
+	/* DATA_FIRST with a 4 byte length above the reassembly limit */
+	memset(pdu, 0xAA, sizeof(pdu));
+	pdu[0] = (DATA_FIRST_PDU << 4) | (2 << 2);
+	pdu[1] = 1; /* channel id */
+	pdu[2] = (WTS_MESSAGE_MAX_LENGTH + 1) & 0xFF;
+	pdu[3] = ((WTS_MESSAGE_MAX_LENGTH + 1) >> 8) & 0xFF;
+	pdu[4] = ((WTS_MESSAGE_MAX_LENGTH + 1) >> 16) & 0xFF;
+	pdu[5] = ((WTS_MESSAGE_MAX_LENGTH + 1) >> 24) & 0xFF;
+	test_receive_pdu(&client, pdu, 16);
+
+	/* its continuation is dropped too */
+	pdu[0] = DATA_PDU << 4;
+	test_receive_pdu(&client, pdu, 16);
+
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == true);
+	CU_ASSERT(length == 0);
+
+	/* the next message goes through */
+	pdu[0] = (DATA_FIRST_PDU << 4);
+	pdu[1] = 1;
+	pdu[2] = 8; /* total length */
+	memcpy(&pdu[3], "0123", 4);
+	test_receive_pdu(&client, pdu, 7);
+
+	pdu[0] = DATA_PDU << 4;
+	memcpy(&pdu[2], "4567", 4);
+	test_receive_pdu(&client, pdu, 6);
+
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == true);
+	CU_ASSERT(length == 8);
+	CU_ASSERT(memcmp(received, "01234567", 8) == 0);
+
+	test_close_dvc(vcm, channel);
+}
+
+void test_wtsvc_dvc_close(void)
+{
+	uint32 length;
+	uint8 pdu[8];
+	uint8 received[8];
+	void* channel;
+	rdpSettings settings;
+	freerdp_peer client;
+	WTSVirtualChannelManager* vcm;
+
+	channel = test_open_dvc(&client, &settings, &vcm);
+
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == true);
+	CU_ASSERT(length == 0);
+
+	pdu[0] = CLOSE_REQUEST_PDU << 4;
+	pdu[1] = 1; /* channel id */
+	test_receive_pdu(&client, pdu, 2);
+
+	/* reading a channel closed by the client is an error */
+	CU_ASSERT(WTSVirtualChannelRead(channel, 0, received, sizeof(received), &length) == false);
+	CU_ASSERT(length == 0);
+
+	/* a closed channel does not send a close request of its own */
+	WTSVirtualChannelClose(channel);
+	test_flush(vcm);
+	CU_ASSERT(num_sent == 0);
+
+	WTSDestroyVirtualChannelManager(vcm);
+}
@@ -26,15 +26,55 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/utils/stream.h>
 
+typedef struct _BITMAP_V2_SLOT BITMAP_V2_SLOT;
 typedef struct _BITMAP_V2_CELL BITMAP_V2_CELL;
+typedef struct _BITMAP_CACHE_STATS BITMAP_CACHE_STATS;
 typedef struct rdp_bitmap_cache rdpBitmapCache;
 
 #include <freerdp/cache/cache.h>
 
+/**
+ * Per-entry bookkeeping. When the cache runs with a memory budget or with
+ * lazy decoding, the bitmap data received in the cache order is kept here
+ * and the decoded rdpBitmap in entries[] can be dropped and rebuilt at will.
+ */
+struct _BITMAP_V2_SLOT
+{
+	uint32 id;
+	uint32 index;
+	uint32 size; /* bytes accounted for the decoded bitmap */
+	uint8* data; /* bitmap data as received, NULL if not retained */
+	uint32 length;
+	uint16 width;
+	uint16 height;
+	uint32 bpp;
+	uint32 codec_id;
+	tbool compressed;
+	BITMAP_V2_SLOT* prev; /* LRU list of decoded entries */
+	BITMAP_V2_SLOT* next;
+};
+
 struct _BITMAP_V2_CELL
 {
 	uint32 number;
 	rdpBitmap** entries;
+	BITMAP_V2_SLOT* slots;
+	uint32 decodedSize; /* bytes of decoded bitmaps held by this cell */
+	uint32 retainedSize; /* bytes of retained bitmap data held by this cell */
+};
+
+struct _BITMAP_CACHE_STATS
+{
+	uint32 budget; /* 0 means unlimited */
+	uint32 decodedSize;
+	uint32 retainedSize;
+	uint32 hits; /* lookups served from a decoded bitmap */
+	uint32 decodes; /* lookups that had to decode retained data */
+	uint32 misses; /* lookups of empty or invalid entries */
+	uint32 evictions; /* decoded bitmaps dropped to honour the budget */
+	uint32 numCells;
+	uint32 cellDecodedSize[8];
+	uint32 cellRetainedSize[8];
 };
 
 struct rdp_bitmap_cache
@@ -57,11 +97,20 @@ struct rdp_bitmap_cache
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
+
+	uint32 budget;
+	tbool lazy;
+	tbool retain;
+	BITMAP_V2_SLOT* lru_head; /* most recently used */
+	BITMAP_V2_SLOT* lru_tail;
+	BITMAP_CACHE_STATS stats;
 };
 
 FREERDP_API rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index);
 FREERDP_API void bitmap_cache_put(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index, rdpBitmap* bitmap);
 
+FREERDP_API void bitmap_cache_get_stats(rdpBitmapCache* bitmap_cache, BITMAP_CACHE_STATS* stats);
+
 FREERDP_API void bitmap_cache_register_callbacks(rdpUpdate* update);
 
 FREERDP_API rdpBitmapCache* bitmap_cache_new(rdpSettings* settings);
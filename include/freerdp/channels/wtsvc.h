@@ -54,6 +54,14 @@ FREERDP_API void WTSVirtualChannelManagerGetFileDescriptor(WTSVirtualChannelMana
 	void** fds, int* fds_count);
 FREERDP_API boolean WTSVirtualChannelManagerCheckFileDescriptor(WTSVirtualChannelManager* vcm);
 
+/**
+ * Sets the size of the PDUs messages of dynamic channels are fragmented
+ * into, CHANNEL_CHUNK_LENGTH by default. The size is clamped to at least
+ * 18 bytes and at most CHANNEL_CHUNK_LENGTH, the largest a static channel
+ * chunk can carry.
+ */
+FREERDP_API void WTSVirtualChannelManagerSetDvcChunkSize(WTSVirtualChannelManager* vcm, uint32 size);
+
 /**
  * Opens a static or dynamic virtual channel and return the handle. If the
  * operation fails, a NULL handle is returned.
@@ -62,6 +70,13 @@ FREERDP_API boolean WTSVirtualChannelManagerCheckFileDescriptor(WTSVirtualChanne
  * use our WTSVirtualChannelManager object instead.
  *
  * This functions should be called only from the main thread.
+ *
+ * FreeRDP behavior:
+ *
+ * A dynamic channel handle is returned right away. Data written to it is
+ * queued until the client accepts the channel. If the client refuses or
+ * closes the channel, WTSVirtualChannelRead returns false with pBytesRead
+ * set to zero.
  */
 FREERDP_API void* WTSVirtualChannelOpenEx(
 	/* __in */ WTSVirtualChannelManager* vcm,
@@ -110,6 +125,18 @@ FREERDP_API boolean WTSVirtualChannelRead(
 	/* __in */  uint32 BufferSize,
 	/* __out */ uint32* pBytesRead);
 
+/**
+ * Reads data from the server end of a virtual channel without copying it.
+ *
+ * This function is a FreeRDP extension to the API. The reassembled packet
+ * is handed over in ppBuffer and must be released with WTSFreeMemory.
+ * If no packet is pending, ppBuffer is set to NULL and pBytesRead to zero.
+ */
+FREERDP_API boolean WTSVirtualChannelReadEx(
+	/* __in */  void* hChannelHandle,
+	/* __out */ uint8** ppBuffer,
+	/* __out */ uint32* pBytesRead);
+
 /**
  * Writes data to the server end of a virtual channel.
  */
@@ -119,6 +146,19 @@ FREERDP_API boolean WTSVirtualChannelWrite(
 	/* __in */  uint32 Length,
 	/* __out */ uint32* pBytesWritten);
 
+/**
+ * Writes data to the server end of a virtual channel without copying it.
+ *
+ * This function is a FreeRDP extension to the API. Buffer must have been
+ * allocated with xmalloc, ownership passes to the channel which frees it
+ * once sent, or right away if the write fails. Data of a dynamic channel
+ * is still copied into the PDUs it is fragmented into.
+ */
+FREERDP_API boolean WTSVirtualChannelWriteEx(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer,
+	/* __in */  uint32 Length);
+
 /**
  * Closes an open virtual channel handle.
  */
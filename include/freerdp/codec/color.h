@@ -245,6 +245,11 @@ FREERDP_API uint8* freerdp_icon_convert(uint8* srcData, uint8* dstData, uint8* m
 FREERDP_API uint8* freerdp_mono_image_convert(uint8* srcData, int width, int height, int srcBpp, int dstBpp, uint32 bgcolor, uint32 fgcolor, HCLRCONV clrconv);
 FREERDP_API void freerdp_alpha_cursor_convert(uint8* alphaData, uint8* xorMask, uint8* andMask, int width, int height, int bpp, HCLRCONV clrconv);
 FREERDP_API void freerdp_image_swap_color_order(uint8* data, int width, int height);
+FREERDP_API void freerdp_color_set_cpu_opt(uint32 cpu_opt);
+FREERDP_API void freerdp_image_yuv420p_to_bgrx(const uint8* pY, int strideY, const uint8* pU, int strideU,
+	const uint8* pV, int strideV, uint8* dstData, int dstStride, int width, int height);
+FREERDP_API void freerdp_image_yuvj420p_to_bgrx(const uint8* pY, int strideY, const uint8* pU, int strideU,
+	const uint8* pV, int strideV, uint8* dstData, int dstStride, int width, int height);
 
 FREERDP_API uint32 freerdp_color_convert_var(uint32 srcColor, int srcBpp, int dstBpp, HCLRCONV clrconv);
 FREERDP_API uint32 freerdp_color_convert_rgb(uint32 srcColor, int srcBpp, int dstBpp, HCLRCONV clrconv);
@@ -141,6 +141,10 @@ FREERDP_API void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message);
 FREERDP_API void rfx_compose_message_header(RFX_CONTEXT* context, STREAM* s);
 FREERDP_API void rfx_compose_message(RFX_CONTEXT* context, STREAM* s,
 	const RFX_RECT* rects, int num_rects, uint8* image_data, int width, int height, int rowstride);
+FREERDP_API void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
+	const RFX_RECT* rects, int num_rects, uint8* image_data, int width, int height, int rowstride);
+FREERDP_API void rfx_compose_message_frame(RFX_CONTEXT* context, STREAM* s,
+	const RFX_RECT* rects, int num_rects, uint8* tileset, int tileset_length);
 
 #ifdef __cplusplus
 }
@@ -68,6 +68,14 @@ struct _IWTSListener
 		void** ppPropertyBag);
 };
 
+/* One part of a message written with IWTSVirtualChannel.WriteV */
+typedef struct _DVC_SEGMENT DVC_SEGMENT;
+struct _DVC_SEGMENT
+{
+	uint8* pBuffer;
+	uint32 cbSize;
+};
+
 struct _IWTSVirtualChannel
 {
 	/* Starts a write request on the channel. */
@@ -77,6 +85,12 @@ struct _IWTSVirtualChannel
 		void* pReserved);
 	/* Closes the channel. */
 	int (*Close) (IWTSVirtualChannel* pChannel);
+	/* Starts a write request of a message made of several segments,
+	   such as a header and a payload, without assembling it first.
+	   This is a FreeRDP extension to standard MS API. */
+	int (*WriteV) (IWTSVirtualChannel* pChannel,
+		DVC_SEGMENT* pSegments,
+		int nSegments);
 };
 
 struct _IWTSVirtualChannelManager
@@ -191,12 +191,18 @@ struct _GDI_BRUSH
 typedef struct _GDI_BRUSH GDI_BRUSH;
 typedef GDI_BRUSH* HGDI_BRUSH;
 
+/* default cap on the number of invalid rectangles kept per window */
+#define GDI_MAX_INVALID_RECTS	64
+
 struct _GDI_WND
 {
 	int count;
 	int ninvalid;
 	HGDI_RGN invalid;
 	HGDI_RGN cinvalid;
+	int maxInvalid; /* 0 means GDI_MAX_INVALID_RECTS */
+	int scount;
+	HGDI_RGN scratch;
 };
 typedef struct _GDI_WND GDI_WND;
 typedef GDI_WND* HGDI_WND;
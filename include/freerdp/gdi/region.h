@@ -23,6 +23,11 @@
 #include <freerdp/api.h>
 #include <freerdp/gdi/gdi.h>
 
+/* gdi_CombineRects modes */
+#define GDI_RGN_AND		1
+#define GDI_RGN_OR		2
+#define GDI_RGN_DIFF		4
+
 FREERDP_API HGDI_RGN gdi_CreateRectRgn(int nLeftRect, int nTopRect, int nRightRect, int nBottomRect);
 FREERDP_API HGDI_RECT gdi_CreateRect(int xLeft, int yTop, int xRight, int yBottom);
 FREERDP_API void gdi_RectToRgn(HGDI_RECT rect, HGDI_RGN rgn);
@@ -40,6 +45,8 @@ FREERDP_API int gdi_SetRectRgn(HGDI_RGN hRgn, int nLeftRect, int nTopRect, int n
 FREERDP_API int gdi_EqualRgn(HGDI_RGN hSrcRgn1, HGDI_RGN hSrcRgn2);
 FREERDP_API int gdi_CopyRect(HGDI_RECT dst, HGDI_RECT src);
 FREERDP_API int gdi_PtInRect(HGDI_RECT rc, int x, int y);
+FREERDP_API int gdi_CombineRects(HGDI_RGN* dst, int* count, HGDI_RGN src1, int nsrc1, HGDI_RGN src2, int nsrc2, int mode);
+FREERDP_API int gdi_SimplifyRects(HGDI_RGN rects, int nrects, int max);
 FREERDP_API int gdi_InvalidateRegion(HGDI_DC hdc, int x, int y, int w, int h);
 
 #endif /* __GDI_REGION_H */
@@ -35,6 +35,8 @@ typedef boolean (*psListenerOpen)(freerdp_listener* instance, const char* bind_a
 typedef boolean (*psListenerGetFileDescriptor)(freerdp_listener* instance, void** rfds, int* rcount);
 typedef boolean (*psListenerCheckFileDescriptor)(freerdp_listener* instance);
 typedef void (*psListenerClose)(freerdp_listener* instance);
+typedef boolean (*psListenerGetAcceptorFileDescriptor)(freerdp_listener* instance, int acceptor, void** rfds, int* rcount);
+typedef boolean (*psListenerCheckAcceptorFileDescriptor)(freerdp_listener* instance, int acceptor);
 typedef void (*psPeerAccepted)(freerdp_listener* instance, freerdp_peer* client);
 
 struct rdp_freerdp_listener
@@ -52,6 +54,19 @@ struct rdp_freerdp_listener
 	psListenerClose Close;
 
 	psPeerAccepted PeerAccepted;
+
+	/**
+	 * Set before Open. Each acceptor gets a socket of its own per address,
+	 * bound with SO_REUSEPORT so that the kernel spreads the connections,
+	 * and is served by its own thread through the acceptor functions.
+	 * Open sets it to the number of acceptors it could open sockets for,
+	 * which is 1 without SO_REUSEPORT.
+	 */
+	int num_acceptors; /* 0 or 1 for a single acceptor */
+	int backlog; /* 0 for the system maximum */
+
+	psListenerGetAcceptorFileDescriptor GetAcceptorFileDescriptor;
+	psListenerCheckAcceptorFileDescriptor CheckAcceptorFileDescriptor;
 };
 
 FREERDP_API freerdp_listener* freerdp_listener_new(void);
@@ -73,5 +73,14 @@ FREERDP_API void freerdp_peer_context_free(freerdp_peer* client);
 FREERDP_API freerdp_peer* freerdp_peer_new(int sockfd);
 FREERDP_API void freerdp_peer_free(freerdp_peer* client);
 
+/**
+ * With queued output, writes to a peer whose socket is full are kept
+ * instead of waiting for the client, and freerdp_peer_flush_output
+ * writes them once the socket is writable. It returns the number of
+ * bytes still queued, or -1 on error.
+ */
+FREERDP_API void freerdp_peer_set_queue_output(freerdp_peer* client, boolean queue);
+FREERDP_API int freerdp_peer_flush_output(freerdp_peer* client);
+
 #endif /* __FREERDP_PEER_H */
 
@@ -20,6 +20,44 @@
 #ifndef __TSMF_PLUGIN
 #define __TSMF_PLUGIN
 
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+typedef struct _RDP_VIDEO_FRAME_BUFFER RDP_VIDEO_FRAME_BUFFER;
+typedef struct _RDP_VIDEO_FRAME_POOL RDP_VIDEO_FRAME_POOL;
+
+/**
+ * Frame Buffers
+ *
+ * A client can register a pool of frame buffers it is able to display
+ * directly (e.g. shared memory images). Decoders then write their frames
+ * into pool buffers, which travel in the video frame events instead of
+ * frame_data.
+ */
+struct _RDP_VIDEO_FRAME_BUFFER
+{
+	RDP_VIDEO_FRAME_POOL* pool;
+	uint8* data;
+	uint32 size;
+	uint32 pixfmt;
+	sint16 width;
+	sint16 height;
+	/* Y, U and V planes, in this order whatever the pixel format */
+	uint32 offsets[3];
+	uint32 pitches[3];
+};
+
+struct _RDP_VIDEO_FRAME_POOL
+{
+	/* Get a planar YUV 4:2:0 buffer, NULL if none is available for this size */
+	RDP_VIDEO_FRAME_BUFFER* (*Acquire) (RDP_VIDEO_FRAME_POOL* pool, int width, int height);
+	/* Give a buffer back, may be called from any thread */
+	void (*Release) (RDP_VIDEO_FRAME_POOL* pool, RDP_VIDEO_FRAME_BUFFER* buffer);
+};
+
+FREERDP_API void freerdp_video_frame_pool_register(RDP_VIDEO_FRAME_POOL* pool);
+FREERDP_API RDP_VIDEO_FRAME_POOL* freerdp_video_frame_pool_get(void);
+
 /**
  * Event Types
  */
@@ -37,6 +75,7 @@ struct _RDP_VIDEO_FRAME_EVENT
 	uint32 frame_pixfmt;
 	sint16 frame_width;
 	sint16 frame_height;
+	RDP_VIDEO_FRAME_BUFFER* frame_buffer; /* replaces frame_data when set */
 	sint16 x;
 	sint16 y;
 	sint16 width;
@@ -303,7 +303,8 @@ struct rdp_settings
 	boolean rdp_security; /* 147 */
 	uint32 ntlm_version; /* 148 */
 	boolean secure_checksum; /* 149 */
-	uint32 paddingF[160 - 150]; /* 150 */
+	boolean persist_tls_sessions; /* 150 */
+	uint32 paddingF[160 - 151]; /* 151 */
 
 	/* Session */
 	boolean console_audio; /* 160 */
@@ -373,7 +374,8 @@ struct rdp_settings
 	uint32 jpeg_quality; /* 288 */
 	uint32 v3_codec_id; /* 289 */
 	boolean h264_codec; /* 290 */
-	uint32 paddingM[296 - 291]; /* 291 */
+	uint32 max_unacknowledged_frames; /* 291 */
+	uint32 paddingM[296 - 292]; /* 292 */
 
 	/* Recording */
 	boolean dump_rfx; /* 296 */
@@ -402,7 +404,9 @@ struct rdp_settings
 	boolean persistent_bitmap_cache; /* 330 */
 	uint32 bitmapCacheV2NumCells; /* 331 */
 	BITMAP_CACHE_V2_CELL_INFO* bitmapCacheV2CellInfo; /* 332 */
-	uint32 paddingQ[344 - 333]; /* 333 */
+	uint32 bitmap_cache_budget; /* 333 */
+	boolean bitmap_cache_lazy_decode; /* 334 */
+	uint32 paddingQ[344 - 335]; /* 335 */
 
 	/* Offscreen Bitmap Cache */
 	boolean offscreen_bitmap_cache; /* 344 */
@@ -456,6 +460,9 @@ struct rdp_settings
 	/* No Orders */
 	tbool no_orders;
 
+	/* Print the time spent in each connection phase */
+	tbool print_timings;
+
 };
 typedef struct rdp_settings rdpSettings;
 
@@ -123,6 +123,12 @@ struct _SURFACE_FRAME_MARKER
 };
 typedef struct _SURFACE_FRAME_MARKER SURFACE_FRAME_MARKER;
 
+enum SURFCMD_FRAMEACTION
+{
+	SURFACECMD_FRAMEACTION_BEGIN = 0x0000,
+	SURFACECMD_FRAMEACTION_END = 0x0001
+};
+
 /* Update Interface */
 
 typedef void (*pBeginPaint)(rdpContext* context);
@@ -141,6 +147,7 @@ typedef void (*pSuppressOutput)(rdpContext* context, uint8 allow, RECTANGLE_16*
 typedef void (*pSurfaceCommand)(rdpContext* context, STREAM* s);
 typedef void (*pSurfaceBits)(rdpContext* context, SURFACE_BITS_COMMAND* surface_bits_command);
 typedef void (*pSurfaceFrameMarker)(rdpContext* context, SURFACE_FRAME_MARKER* surface_frame_marker);
+typedef void (*pSurfaceFrameAcknowledge)(rdpContext* context, uint32 frameId);
 
 struct rdp_update
 {
@@ -171,7 +178,8 @@ struct rdp_update
 	pSurfaceCommand SurfaceCommand; /* 64 */
 	pSurfaceBits SurfaceBits; /* 65 */
 	pSurfaceFrameMarker SurfaceFrameMarker; /* 66 */
-	uint32 paddingE[80 - 67]; /* 67 */
+	pSurfaceFrameAcknowledge SurfaceFrameAcknowledge; /* 67 */
+	uint32 paddingE[80 - 68]; /* 68 */
 
 	/* internal */
 
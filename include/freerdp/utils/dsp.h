@@ -21,22 +21,42 @@
 #define __DSP_UTILS_H
 
 #include <freerdp/api.h>
+#include <freerdp/types.h>
 
 struct _ADPCM
 {
 	sint16 last_sample[2];
 	sint16 last_step[2];
+	uint8* buffer;
+	int buffer_size;
 };
 typedef struct _ADPCM ADPCM;
 
+typedef struct _DSP_RESAMPLER DSP_RESAMPLER;
+
 FREERDP_API uint8* dsp_resample(uint8* src, int bytes_per_sample,
 	uint32 schan, uint32 srate, int sframes,
 	uint32 rchan, uint32 rrate, int * prframes);
 
+FREERDP_API DSP_RESAMPLER* dsp_resampler_new(int bytes_per_sample,
+	uint32 schan, uint32 srate, uint32 rchan, uint32 rrate);
+FREERDP_API void dsp_resampler_free(DSP_RESAMPLER* resampler);
+FREERDP_API void dsp_resampler_reset(DSP_RESAMPLER* resampler);
+FREERDP_API int dsp_resampler_max_frames(DSP_RESAMPLER* resampler, int sframes);
+FREERDP_API int dsp_resampler_process(DSP_RESAMPLER* resampler, const uint8* src, int sframes,
+	uint8* dst, int max_rframes);
+
 FREERDP_API uint8* dsp_decode_ima_adpcm(ADPCM* adpcm,
 	uint8* src, int size, int channels, int block_size, int* out_size);
 FREERDP_API uint8* dsp_encode_ima_adpcm(ADPCM* adpcm,
 	uint8* src, int size, int channels, int block_size, int* out_size);
 
+FREERDP_API void dsp_ima_adpcm_reset(ADPCM* adpcm);
+FREERDP_API void dsp_ima_adpcm_uninit(ADPCM* adpcm);
+FREERDP_API uint8* dsp_ima_adpcm_decode(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size);
+FREERDP_API uint8* dsp_ima_adpcm_encode(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size);
+
 #endif /* __DSP_UTILS_H */
 
@@ -0,0 +1,53 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Event Loop Utils
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __EVENT_LOOP_UTILS_H
+#define __EVENT_LOOP_UTILS_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/utils/wait_obj.h>
+
+/**
+ * An event loop keeps a persistent set of readable file descriptors,
+ * backed by epoll where available and select otherwise.
+ *
+ * Descriptors are registered either explicitly with event_loop_add_fd,
+ * or through event_loop_update_fds, which takes the list produced by the
+ * usual *_get_fds functions and is meant to be called only when that list
+ * changes. A closed descriptor must be removed or registered again, as
+ * its number may be reused. event_loop_set_writable makes the loop report
+ * a descriptor when it becomes writable as well, until it is reset.
+ */
+struct event_loop;
+
+FREERDP_API struct event_loop* event_loop_new(void);
+FREERDP_API void event_loop_free(struct event_loop* loop);
+
+FREERDP_API tbool event_loop_add_fd(struct event_loop* loop, int fd, void* data);
+FREERDP_API tbool event_loop_remove_fd(struct event_loop* loop, int fd);
+FREERDP_API tbool event_loop_add_wait_obj(struct event_loop* loop, struct wait_obj* obj, void* data);
+FREERDP_API tbool event_loop_remove_wait_obj(struct event_loop* loop, struct wait_obj* obj);
+FREERDP_API tbool event_loop_update_fds(struct event_loop* loop, void** fds, int count);
+FREERDP_API tbool event_loop_set_writable(struct event_loop* loop, int fd, tbool writable);
+
+FREERDP_API int event_loop_wait(struct event_loop* loop, int timeout);
+FREERDP_API tbool event_loop_is_ready(struct event_loop* loop, int fd);
+FREERDP_API int event_loop_get_ready(struct event_loop* loop, int index, void** data);
+FREERDP_API int event_loop_get_fd(struct event_loop* loop);
+
+#endif /* __EVENT_LOOP_UTILS_H */
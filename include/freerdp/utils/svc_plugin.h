@@ -44,12 +44,16 @@ struct rdp_svc_plugin
 	void (*event_callback)(rdpSvcPlugin* plugin, RDP_EVENT* event);
 	void (*interval_callback)(rdpSvcPlugin* plugin);
 	void (*terminate_callback)(rdpSvcPlugin* plugin);
+	void (*write_complete_callback)(rdpSvcPlugin* plugin, void* user_data);
 
 	rdpSvcPluginPrivate* priv;
 };
 
 FREERDP_API void svc_plugin_init(rdpSvcPlugin* plugin, CHANNEL_ENTRY_POINTS* pEntryPoints);
+FREERDP_API STREAM* svc_plugin_stream_new(rdpSvcPlugin* plugin, int size);
+FREERDP_API void svc_plugin_stream_free(rdpSvcPlugin* plugin, STREAM* s);
 FREERDP_API int svc_plugin_send(rdpSvcPlugin* plugin, STREAM* data_out);
+FREERDP_API int svc_plugin_send_buffer(rdpSvcPlugin* plugin, uint8* data, uint32 length, void* user_data);
 FREERDP_API int svc_plugin_send_event(rdpSvcPlugin* plugin, RDP_EVENT* event);
 
 #define svc_plugin_get_data(_p) (RDP_PLUGIN_DATA*)(((rdpSvcPlugin*)_p)->channel_entry_points.pExtendedData)
@@ -24,6 +24,9 @@
 
 #include <freerdp/cache/bitmap.h>
 
+static void bitmap_cache_store(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index,
+		uint8* data, int width, int height, int bpp, int length, tbool compressed, int codec_id);
+
 void update_gdi_memblt(rdpContext* context, MEMBLT_ORDER* memblt)
 {
 	rdpBitmap* bitmap;
@@ -54,90 +57,44 @@ void update_gdi_mem3blt(rdpContext* context, MEM3BLT_ORDER* mem3blt)
 
 void update_gdi_cache_bitmap(rdpContext* context, CACHE_BITMAP_ORDER* cache_bitmap)
 {
-	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 
-	bitmap = Bitmap_Alloc(context);
-
-	Bitmap_SetDimensions(context, bitmap, cache_bitmap->bitmapWidth, cache_bitmap->bitmapHeight);
-
-	bitmap->Decompress(context, bitmap,
+	bitmap_cache_store(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex,
 			cache_bitmap->bitmapDataStream, cache_bitmap->bitmapWidth, cache_bitmap->bitmapHeight,
 			cache_bitmap->bitmapBpp, cache_bitmap->bitmapLength,
 			cache_bitmap->compressed, CODEC_ID_NONE);
-
-	bitmap->New(context, bitmap);
-
-	prevBitmap = bitmap_cache_get(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex);
-
-	if (prevBitmap != NULL)
-		Bitmap_Free(context, prevBitmap);
-
-	bitmap_cache_put(cache->bitmap, cache_bitmap->cacheId, cache_bitmap->cacheIndex, bitmap);
 }
 
 void update_gdi_cache_bitmap_v2(rdpContext* context, CACHE_BITMAP_V2_ORDER* cache_bitmap_v2)
 {
-	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 
-	bitmap = Bitmap_Alloc(context);
-
-	Bitmap_SetDimensions(context, bitmap, cache_bitmap_v2->bitmapWidth, cache_bitmap_v2->bitmapHeight);
-
 	if (cache_bitmap_v2->bitmapBpp == 0)
 	{
 		/* Workaround for Windows 8 bug where bitmapBpp is not set */
 		cache_bitmap_v2->bitmapBpp = context->instance->settings->color_depth;
 	}
 
-	bitmap->Decompress(context, bitmap,
+	bitmap_cache_store(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex,
 			cache_bitmap_v2->bitmapDataStream, cache_bitmap_v2->bitmapWidth, cache_bitmap_v2->bitmapHeight,
 			cache_bitmap_v2->bitmapBpp, cache_bitmap_v2->bitmapLength,
 			cache_bitmap_v2->compressed, CODEC_ID_NONE);
-
-	bitmap->New(context, bitmap);
-
-	prevBitmap = bitmap_cache_get(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex);
-
-	if (prevBitmap != NULL)
-		Bitmap_Free(context, prevBitmap);
-
-	bitmap_cache_put(cache->bitmap, cache_bitmap_v2->cacheId, cache_bitmap_v2->cacheIndex, bitmap);
 }
 
 void update_gdi_cache_bitmap_v3(rdpContext* context, CACHE_BITMAP_V3_ORDER* cache_bitmap_v3)
 {
-	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 	BITMAP_DATA_EX* bitmapData = &cache_bitmap_v3->bitmapData;
 
-	bitmap = Bitmap_Alloc(context);
-
-	Bitmap_SetDimensions(context, bitmap, bitmapData->width, bitmapData->height);
-
 	if (cache_bitmap_v3->bitmapData.bpp == 0)
 	{
 		/* Workaround for Windows 8 bug where bitmapBpp is not set */
 		cache_bitmap_v3->bitmapData.bpp = context->instance->settings->color_depth;
 	}
 
-	bitmap->Decompress(context, bitmap,
-			bitmapData->data, bitmap->width, bitmap->height,
-			bitmapData->bpp, bitmapData->length, true,
-			bitmapData->codecID);
-
-	bitmap->New(context, bitmap);
-
-	prevBitmap = bitmap_cache_get(cache->bitmap, cache_bitmap_v3->cacheId, cache_bitmap_v3->cacheIndex);
-
-	if (prevBitmap != NULL)
-		Bitmap_Free(context, prevBitmap);
-
-	bitmap_cache_put(cache->bitmap, cache_bitmap_v3->cacheId, cache_bitmap_v3->cacheIndex, bitmap);
+	bitmap_cache_store(cache->bitmap, cache_bitmap_v3->cacheId, cache_bitmap_v3->cacheIndex,
+			bitmapData->data, bitmapData->width, bitmapData->height,
+			bitmapData->bpp, bitmapData->length, true, bitmapData->codecID);
 }
 
 void update_gdi_bitmap_update(rdpContext* context, BITMAP_UPDATE* bitmap_update)
@@ -187,50 +144,292 @@ void update_gdi_bitmap_update(rdpContext* context, BITMAP_UPDATE* bitmap_update)
 	}
 }
 
+/**
+ * Decoded bitmaps are accounted as a 32bpp surface (X pixmap or gdi bitmap)
+ * plus whatever decompressed data the bitmap keeps around.
+ */
+static uint32 bitmap_cache_entry_size(rdpBitmap* bitmap)
+{
+	uint32 size;
+
+	size = bitmap->width * bitmap->height * 4;
+
+	if (bitmap->data != NULL)
+		size += bitmap->length;
+
+	return size;
+}
+
+static tbool bitmap_cache_check_index(rdpBitmapCache* bitmap_cache, uint32 id, uint32* index)
+{
+	if (id >= bitmap_cache->maxCells)
+		return false;
+
+	if (*index == BITMAP_CACHE_WAITING_LIST_INDEX)
+		*index = bitmap_cache->cells[id].number;
+	else if (*index > bitmap_cache->cells[id].number)
+		return false;
+
+	return true;
+}
+
+static void bitmap_cache_lru_remove(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* slot)
+{
+	if (slot->prev != NULL)
+		slot->prev->next = slot->next;
+	else if (bitmap_cache->lru_head == slot)
+		bitmap_cache->lru_head = slot->next;
+
+	if (slot->next != NULL)
+		slot->next->prev = slot->prev;
+	else if (bitmap_cache->lru_tail == slot)
+		bitmap_cache->lru_tail = slot->prev;
+
+	slot->prev = NULL;
+	slot->next = NULL;
+}
+
+static void bitmap_cache_lru_push(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* slot)
+{
+	slot->prev = NULL;
+	slot->next = bitmap_cache->lru_head;
+
+	if (bitmap_cache->lru_head != NULL)
+		bitmap_cache->lru_head->prev = slot;
+
+	bitmap_cache->lru_head = slot;
+
+	if (bitmap_cache->lru_tail == NULL)
+		bitmap_cache->lru_tail = slot;
+}
+
+/* drop the decoded bitmap of an entry, keeping its retained data */
+static void bitmap_cache_drop_decoded(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* slot)
+{
+	BITMAP_V2_CELL* cell = &bitmap_cache->cells[slot->id];
+	rdpBitmap* bitmap = cell->entries[slot->index];
+
+	bitmap_cache_lru_remove(bitmap_cache, slot);
+
+	if (bitmap != NULL)
+	{
+		Bitmap_Free(bitmap_cache->context, bitmap);
+		cell->entries[slot->index] = NULL;
+	}
+
+	cell->decodedSize -= slot->size;
+	bitmap_cache->stats.decodedSize -= slot->size;
+	slot->size = 0;
+}
+
+static void bitmap_cache_drop_retained(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* slot)
+{
+	BITMAP_V2_CELL* cell = &bitmap_cache->cells[slot->id];
+
+	if (slot->data != NULL)
+	{
+		cell->retainedSize -= slot->length;
+		bitmap_cache->stats.retainedSize -= slot->length;
+		xfree(slot->data);
+		slot->data = NULL;
+		slot->length = 0;
+	}
+}
+
+/**
+ * Evict least recently used decoded bitmaps until the cache fits its budget.
+ * Only entries whose data was retained can be evicted, since the server
+ * still expects every cached bitmap to be available.
+ */
+static void bitmap_cache_enforce_budget(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* keep)
+{
+	BITMAP_V2_SLOT* slot;
+	BITMAP_V2_SLOT* prev;
+
+	if (bitmap_cache->budget == 0)
+		return;
+
+	slot = bitmap_cache->lru_tail;
+
+	while (slot != NULL && bitmap_cache->stats.decodedSize > bitmap_cache->budget)
+	{
+		prev = slot->prev;
+
+		if (slot != keep && slot->data != NULL)
+		{
+			bitmap_cache_drop_decoded(bitmap_cache, slot);
+			bitmap_cache->stats.evictions++;
+		}
+
+		slot = prev;
+	}
+}
+
+static void bitmap_cache_account(rdpBitmapCache* bitmap_cache, BITMAP_V2_SLOT* slot, rdpBitmap* bitmap)
+{
+	BITMAP_V2_CELL* cell = &bitmap_cache->cells[slot->id];
+
+	slot->size = bitmap_cache_entry_size(bitmap);
+	cell->decodedSize += slot->size;
+	bitmap_cache->stats.decodedSize += slot->size;
+
+	bitmap_cache_lru_push(bitmap_cache, slot);
+	bitmap_cache_enforce_budget(bitmap_cache, slot);
+}
+
+static rdpBitmap* bitmap_cache_decode(rdpBitmapCache* bitmap_cache, uint8* data, int width, int height,
+		int bpp, int length, tbool compressed, int codec_id)
+{
+	rdpBitmap* bitmap;
+	rdpContext* context = bitmap_cache->context;
+
+	bitmap = Bitmap_Alloc(context);
+
+	Bitmap_SetDimensions(context, bitmap, width, height);
+
+	bitmap->Decompress(context, bitmap, data, width, height,
+			bpp, length, compressed, codec_id);
+
+	bitmap->New(context, bitmap);
+
+	return bitmap;
+}
+
+static void bitmap_cache_store(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index,
+		uint8* data, int width, int height, int bpp, int length, tbool compressed, int codec_id)
+{
+	rdpBitmap* bitmap;
+	BITMAP_V2_SLOT* slot;
+
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index))
+	{
+		printf("put invalid bitmap index %d in cell id: %d\n", index, id);
+		return;
+	}
+
+	slot = &bitmap_cache->cells[id].slots[index];
+
+	bitmap_cache_drop_decoded(bitmap_cache, slot);
+	bitmap_cache_drop_retained(bitmap_cache, slot);
+
+	if (bitmap_cache->retain)
+	{
+		/* the order data lives in the receive buffer, keep a copy */
+		slot->data = (uint8*) xmalloc(length);
+		memcpy(slot->data, data, length);
+		slot->length = length;
+		slot->width = width;
+		slot->height = height;
+		slot->bpp = bpp;
+		slot->compressed = compressed;
+		slot->codec_id = codec_id;
+
+		bitmap_cache->cells[id].retainedSize += length;
+		bitmap_cache->stats.retainedSize += length;
+
+		/* decoded on first use */
+		if (bitmap_cache->lazy)
+			return;
+	}
+
+	bitmap = bitmap_cache_decode(bitmap_cache, data, width, height, bpp, length, compressed, codec_id);
+	bitmap_cache->cells[id].entries[index] = bitmap;
+	bitmap_cache_account(bitmap_cache, slot, bitmap);
+}
+
 rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index)
 {
 	rdpBitmap* bitmap;
+	BITMAP_V2_SLOT* slot;
 
-	if (id > bitmap_cache->maxCells)
+	if (id >= bitmap_cache->maxCells)
 	{
 		printf("get invalid bitmap cell id: %d\n", id);
+		bitmap_cache->stats.misses++;
 		return NULL;
 	}
 
-	if (index == BITMAP_CACHE_WAITING_LIST_INDEX)
-	{
-		index = bitmap_cache->cells[id].number;
-	}
-	else if (index > bitmap_cache->cells[id].number)
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index))
 	{
 		printf("get invalid bitmap index %d in cell id: %d\n", index, id);
+		bitmap_cache->stats.misses++;
 		return NULL;
 	}
 
 	bitmap = bitmap_cache->cells[id].entries[index];
+	slot = &bitmap_cache->cells[id].slots[index];
+
+	if (bitmap != NULL)
+	{
+		bitmap_cache->stats.hits++;
+
+		if (bitmap_cache->lru_head != slot)
+		{
+			bitmap_cache_lru_remove(bitmap_cache, slot);
+			bitmap_cache_lru_push(bitmap_cache, slot);
+		}
+	}
+	else if (slot->data != NULL)
+	{
+		bitmap_cache->stats.decodes++;
+
+		bitmap = bitmap_cache_decode(bitmap_cache, slot->data, slot->width, slot->height,
+				slot->bpp, slot->length, slot->compressed, slot->codec_id);
+		bitmap_cache->cells[id].entries[index] = bitmap;
+		bitmap_cache_account(bitmap_cache, slot, bitmap);
+	}
+	else
+	{
+		bitmap_cache->stats.misses++;
+	}
 
 	return bitmap;
 }
 
 void bitmap_cache_put(rdpBitmapCache* bitmap_cache, uint32 id, uint32 index, rdpBitmap* bitmap)
 {
-	if (id > bitmap_cache->maxCells)
+	BITMAP_V2_SLOT* slot;
+
+	if (id >= bitmap_cache->maxCells)
 	{
 		printf("put invalid bitmap cell id: %d\n", id);
 		return;
 	}
 
-	if (index == BITMAP_CACHE_WAITING_LIST_INDEX)
-	{
-		index = bitmap_cache->cells[id].number;
-	}
-	else if (index > bitmap_cache->cells[id].number)
+	if (!bitmap_cache_check_index(bitmap_cache, id, &index))
 	{
 		printf("put invalid bitmap index %d in cell id: %d\n", index, id);
 		return;
 	}
 
+	if (bitmap_cache->cells[id].entries[index] == bitmap)
+		return;
+
+	/* the bitmap being replaced is freed */
+	slot = &bitmap_cache->cells[id].slots[index];
+	bitmap_cache_drop_decoded(bitmap_cache, slot);
+	bitmap_cache_drop_retained(bitmap_cache, slot);
+
 	bitmap_cache->cells[id].entries[index] = bitmap;
+
+	if (bitmap != NULL)
+		bitmap_cache_account(bitmap_cache, slot, bitmap);
+}
+
+void bitmap_cache_get_stats(rdpBitmapCache* bitmap_cache, BITMAP_CACHE_STATS* stats)
+{
+	int i;
+
+	memcpy(stats, &bitmap_cache->stats, sizeof(BITMAP_CACHE_STATS));
+
+	stats->budget = bitmap_cache->budget;
+	stats->numCells = MIN(bitmap_cache->maxCells, sizeof(stats->cellDecodedSize) / sizeof(uint32));
+
+	for (i = 0; i < (int) stats->numCells; i++)
+	{
+		stats->cellDecodedSize[i] = bitmap_cache->cells[i].decodedSize;
+		stats->cellRetainedSize[i] = bitmap_cache->cells[i].retainedSize;
+	}
 }
 
 void bitmap_cache_register_callbacks(rdpUpdate* update)
@@ -252,7 +451,7 @@ void bitmap_cache_register_callbacks(rdpUpdate* update)
 
 rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 {
-	int i;
+	int i, j;
 	rdpBitmapCache* bitmap_cache;
 
 	bitmap_cache = (rdpBitmapCache*) xzalloc(sizeof(rdpBitmapCache));
@@ -265,6 +464,14 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 
 		bitmap_cache->maxCells = 5;
 
+		/*
+		 * A budget can only be honoured if decoded bitmaps can be rebuilt,
+		 * which needs the data that lazy decoding retains.
+		 */
+		bitmap_cache->budget = settings->bitmap_cache_budget;
+		bitmap_cache->lazy = settings->bitmap_cache_lazy_decode || (bitmap_cache->budget != 0);
+		bitmap_cache->retain = bitmap_cache->lazy;
+
 		settings->bitmap_cache = false;
 		settings->bitmapCacheV2NumCells = 5;
 		settings->bitmapCacheV2CellInfo[0].numEntries = 600;
@@ -284,6 +491,13 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 		{
 			bitmap_cache->cells[i].number = settings->bitmapCacheV2CellInfo[i].numEntries;
 			bitmap_cache->cells[i].entries = (rdpBitmap**) xzalloc(sizeof(rdpBitmap*) * (bitmap_cache->cells[i].number + 1));
+			bitmap_cache->cells[i].slots = (BITMAP_V2_SLOT*) xzalloc(sizeof(BITMAP_V2_SLOT) * (bitmap_cache->cells[i].number + 1));
+
+			for (j = 0; j < (int) bitmap_cache->cells[i].number + 1; j++)
+			{
+				bitmap_cache->cells[i].slots[j].id = i;
+				bitmap_cache->cells[i].slots[j].index = j;
+			}
 		}
 	}
 
@@ -307,9 +521,12 @@ void bitmap_cache_free(rdpBitmapCache* bitmap_cache)
 				{
 					Bitmap_Free(bitmap_cache->context, bitmap);
 				}
+
+				xfree(bitmap_cache->cells[i].slots[j].data);
 			}
 
 			xfree(bitmap_cache->cells[i].entries);
+			xfree(bitmap_cache->cells[i].slots);
 		}
 
 		if (bitmap_cache->bitmap != NULL)
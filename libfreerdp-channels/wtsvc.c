@@ -26,55 +26,608 @@
 
 #include "wtsvc.h"
 
-typedef struct wts_data_item
+/**
+ * Buffers are pooled by power of two size class, so that the steady
+ * flow of messages of a high rate dynamic channel does not go through
+ * the allocator for every message.
+ */
+
+static wts_buffer* wts_buffer_acquire(WTSVirtualChannelManager* vcm, uint32 size)
 {
-	uint16 channel_id;
-	uint8* buffer;
-	uint32 length;
-} wts_data_item;
+	int shift;
+	wts_buffer* buffer = NULL;
+
+	for (shift = WTS_BUFFER_MIN_SHIFT; shift < WTS_BUFFER_MAX_SHIFT; shift++)
+	{
+		if (size <= (1U << shift))
+			break;
+	}
+
+	if (size <= (1U << shift))
+	{
+		freerdp_mutex_lock(vcm->pool_mutex);
+
+		buffer = vcm->pool[shift];
+
+		if (buffer != NULL)
+		{
+			vcm->pool[shift] = buffer->next;
+			vcm->pool_depth[shift]--;
+		}
+
+		freerdp_mutex_unlock(vcm->pool_mutex);
+
+		size = 1 << shift;
+	}
+	else
+	{
+		/* too large to be pooled */
+		shift = 0;
+	}
+
+	if (buffer == NULL)
+	{
+		buffer = xnew(wts_buffer);
+		buffer->data = (uint8*) xmalloc(size);
+		buffer->size = size;
+		buffer->shift = shift;
+	}
+
+	buffer->next = NULL;
+
+	return buffer;
+}
 
-static void wts_data_item_free(wts_data_item* item)
+static void wts_buffer_release(WTSVirtualChannelManager* vcm, wts_buffer* buffer)
 {
-	xfree(item->buffer);
+	int shift = buffer->shift;
+
+	freerdp_mutex_lock(vcm->pool_mutex);
+
+	if (shift > 0 && vcm->pool_depth[shift] < WTS_BUFFER_POOL_DEPTH)
+	{
+		buffer->next = vcm->pool[shift];
+		vcm->pool[shift] = buffer;
+		vcm->pool_depth[shift]++;
+		buffer = NULL;
+	}
+
+	freerdp_mutex_unlock(vcm->pool_mutex);
+
+	if (buffer != NULL)
+	{
+		xfree(buffer->data);
+		xfree(buffer);
+	}
+}
+
+static void wts_data_item_free(WTSVirtualChannelManager* vcm, wts_data_item* item)
+{
+	if (item->pool_buffer != NULL)
+		wts_buffer_release(vcm, item->pool_buffer);
+	else
+		xfree(item->buffer);
 	xfree(item);
 }
 
+/**
+ * Get an item able to hold length bytes, reusing the buffer
+ * of the last message the channel handed back if it is large enough.
+ * The length comes from the client, NULL is returned above
+ * WTS_MESSAGE_MAX_LENGTH or when the buffer cannot be allocated.
+ */
+
+static wts_data_item* wts_data_item_new(rdpPeerChannel* channel, uint32 length)
+{
+	wts_data_item* item;
+
+	if (length > WTS_MESSAGE_MAX_LENGTH)
+	{
+		printf("wts_data_item_new: message length %u too large\n", length);
+		return NULL;
+	}
+
+	freerdp_mutex_lock(channel->mutex);
+	item = channel->free_item;
+	channel->free_item = NULL;
+	freerdp_mutex_unlock(channel->mutex);
+
+	if (item == NULL)
+	{
+		item = xnew(wts_data_item);
+	}
+	else if (item->size < length)
+	{
+		xfree(item->buffer);
+		item->buffer = NULL;
+		item->size = 0;
+	}
+
+	if (item->buffer == NULL)
+	{
+		item->buffer = xmalloc(length > 0 ? length : 1);
+		if (item->buffer == NULL)
+		{
+			xfree(item);
+			return NULL;
+		}
+		item->size = length;
+	}
+
+	item->channel_id = channel->channel_id;
+	item->length = 0;
+
+	return item;
+}
+
+static void wts_data_item_recycle(rdpPeerChannel* channel, wts_data_item* item)
+{
+	freerdp_mutex_lock(channel->mutex);
+	if (channel->free_item == NULL)
+	{
+		channel->free_item = item;
+		item = NULL;
+	}
+	freerdp_mutex_unlock(channel->mutex);
+
+	if (item != NULL)
+		wts_data_item_free(channel->vcm, item);
+}
+
+/**
+ * Get an item holding drdynvc PDUs in a pool buffer of at least size bytes,
+ * sent in slices of pdu_size bytes, or as a whole when pdu_size is zero.
+ */
+
+static wts_data_item* wts_dvc_item_new(WTSVirtualChannelManager* vcm, uint32 size, uint32 pdu_size)
+{
+	wts_data_item* item;
+
+	item = xnew(wts_data_item);
+	item->channel_id = vcm->drdynvc_channel->channel_id;
+	item->pool_buffer = wts_buffer_acquire(vcm, size);
+	item->buffer = item->pool_buffer->data;
+	item->size = item->pool_buffer->size;
+	item->pdu_size = pdu_size;
+
+	return item;
+}
+
+/* called with the manager mutex held */
+static void wts_queue_item(WTSVirtualChannelManager* vcm, wts_data_item* item)
+{
+	list_enqueue(vcm->send_queue, item);
+	wait_obj_set(vcm->send_event);
+}
+
+static int wts_write_variable_uint(STREAM* s, uint32 val)
+{
+	int cb;
+
+	if (val <= 0xFF)
+	{
+		cb = 0;
+		stream_write_uint8(s, val);
+	}
+	else if (val <= 0xFFFF)
+	{
+		cb = 1;
+		stream_write_uint16(s, val);
+	}
+	else
+	{
+		cb = 2;
+		stream_write_uint32(s, val);
+	}
+	return cb;
+}
+
+static uint32 wts_read_variable_uint(STREAM* s, int cbLen)
+{
+	uint32 val;
+
+	switch (cbLen)
+	{
+		case 0:
+			stream_read_uint8(s, val);
+			break;
+		case 1:
+			stream_read_uint16(s, val);
+			break;
+		default:
+			stream_read_uint32(s, val);
+			break;
+	}
+	return val;
+}
+
+static int wts_variable_uint_length(int cbLen)
+{
+	return (cbLen == 0) ? 1 : ((cbLen == 1) ? 2 : 4);
+}
+
+/**
+ * Lay out a message of a dynamic channel as DATA_FIRST and DATA PDUs
+ * back to back in a single pool buffer. Every PDU but the last one is
+ * exactly dvc_chunk_size long, which is how the sender slices them.
+ */
+
+static wts_data_item* wts_dvc_data_item_new(WTSVirtualChannelManager* vcm, uint32 ChannelId, uint8* data, uint32 length)
+{
+	STREAM* s;
+	uint32 pos;
+	uint32 chunk;
+	uint32 cbChId;
+	uint32 cbLen;
+	uint32 chunk_len;
+	uint32 num_pdus;
+	wts_data_item* item;
+
+	/* the layout and the slicing must agree on the chunk size */
+	freerdp_mutex_lock(vcm->mutex);
+	chunk = vcm->dvc_chunk_size;
+	freerdp_mutex_unlock(vcm->mutex);
+
+	num_pdus = length / (chunk - DVC_HEADER_MAX_LENGTH) + 1;
+	item = wts_dvc_item_new(vcm, length + num_pdus * DVC_HEADER_MAX_LENGTH, chunk);
+
+	s = stream_new(0);
+	stream_attach(s, item->buffer, item->size);
+
+	stream_seek(s, 1);
+	cbChId = wts_write_variable_uint(s, ChannelId);
+
+	if (stream_get_pos(s) + length <= chunk)
+	{
+		item->buffer[0] = (DATA_PDU << 4) | cbChId;
+		stream_write(s, data, length);
+	}
+	else
+	{
+		cbLen = wts_write_variable_uint(s, length);
+		item->buffer[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
+
+		chunk_len = chunk - stream_get_pos(s);
+		stream_write(s, data, chunk_len);
+		data += chunk_len;
+		length -= chunk_len;
+
+		while (length > 0)
+		{
+			pos = stream_get_pos(s);
+			stream_write_uint8(s, (DATA_PDU << 4) | cbChId);
+			wts_write_variable_uint(s, ChannelId);
+
+			chunk_len = MIN(length, chunk - (stream_get_pos(s) - pos));
+			stream_write(s, data, chunk_len);
+			data += chunk_len;
+			length -= chunk_len;
+		}
+	}
+
+	item->length = stream_get_pos(s);
+
+	stream_detach(s);
+	stream_free(s);
+
+	return item;
+}
+
+/* called with the manager mutex held */
+static void wts_dvc_send_capability_request(WTSVirtualChannelManager* vcm)
+{
+	wts_data_item* item;
+
+	item = wts_dvc_item_new(vcm, 4, 0);
+	item->buffer[0] = CAPABILITY_REQUEST_PDU << 4;
+	item->buffer[1] = 0; /* pad */
+	item->buffer[2] = 1; /* version */
+	item->buffer[3] = 0;
+	item->length = 4;
+
+	vcm->drdynvc_state = DRDYNVC_STATE_INITIALIZED;
+	wts_queue_item(vcm, item);
+}
+
+/* called with the manager mutex held */
+static void wts_dvc_send_create_request(WTSVirtualChannelManager* vcm, rdpPeerChannel* channel)
+{
+	STREAM* s;
+	uint32 cbChId;
+	uint32 name_length;
+	wts_data_item* item;
+
+	name_length = strlen(channel->dvc_name) + 1;
+	item = wts_dvc_item_new(vcm, DVC_HEADER_MAX_LENGTH + name_length, 0);
+
+	s = stream_new(0);
+	stream_attach(s, item->buffer, item->size);
+	stream_seek(s, 1);
+	cbChId = wts_write_variable_uint(s, channel->channel_id);
+	stream_write(s, channel->dvc_name, name_length);
+	item->buffer[0] = (CREATE_REQUEST_PDU << 4) | cbChId;
+	item->length = stream_get_pos(s);
+	stream_detach(s);
+	stream_free(s);
+
+	channel->dvc_open_state = DVC_OPEN_STATE_PENDING;
+	wts_queue_item(vcm, item);
+}
+
+/* called with the manager mutex held */
+static void wts_dvc_send_close_request(WTSVirtualChannelManager* vcm, rdpPeerChannel* channel)
+{
+	STREAM* s;
+	uint32 cbChId;
+	wts_data_item* item;
+
+	item = wts_dvc_item_new(vcm, DVC_HEADER_MAX_LENGTH, 0);
+
+	s = stream_new(0);
+	stream_attach(s, item->buffer, item->size);
+	stream_seek(s, 1);
+	cbChId = wts_write_variable_uint(s, channel->channel_id);
+	item->buffer[0] = (CLOSE_REQUEST_PDU << 4) | cbChId;
+	item->length = stream_get_pos(s);
+	stream_detach(s);
+	stream_free(s);
+
+	channel->dvc_open_state = DVC_OPEN_STATE_CLOSED;
+	wts_queue_item(vcm, item);
+}
+
+static rdpPeerChannel* wts_get_dvc_channel(WTSVirtualChannelManager* vcm, uint32 ChannelId)
+{
+	LIST_ITEM* list_item;
+	rdpPeerChannel* channel;
+
+	for (list_item = vcm->dvc_channels->head; list_item != NULL; list_item = list_item->next)
+	{
+		channel = (rdpPeerChannel*) list_item->data;
+
+		if (channel->channel_id == ChannelId)
+			return channel;
+	}
+
+	return NULL;
+}
+
+static void wts_dvc_process_capability_response(WTSVirtualChannelManager* vcm, STREAM* s)
+{
+	uint16 version;
+	LIST_ITEM* list_item;
+	rdpPeerChannel* channel;
+
+	if (stream_get_left(s) < 3)
+		return;
+
+	stream_seek(s, 1); /* pad */
+	stream_read_uint16(s, version);
+
+	vcm->drdynvc_state = DRDYNVC_STATE_READY;
+
+	/* channels opened before the client was ready */
+	for (list_item = vcm->dvc_channels->head; list_item != NULL; list_item = list_item->next)
+	{
+		channel = (rdpPeerChannel*) list_item->data;
+
+		if (channel->dvc_open_state == DVC_OPEN_STATE_NONE)
+			wts_dvc_send_create_request(vcm, channel);
+	}
+}
+
+static void wts_dvc_process_create_response(WTSVirtualChannelManager* vcm, rdpPeerChannel* channel, STREAM* s)
+{
+	uint32 CreationStatus;
+	wts_data_item* item;
+
+	if (stream_get_left(s) < 4)
+		return;
+
+	stream_read_uint32(s, CreationStatus);
+
+	if ((sint32) CreationStatus < 0)
+	{
+		printf("wts_dvc_process_create_response: channel %s refused by the client\n", channel->dvc_name);
+		channel->dvc_open_state = DVC_OPEN_STATE_FAILED;
+
+		while ((item = (wts_data_item*) list_dequeue(channel->dvc_pending)) != NULL)
+			wts_data_item_free(vcm, item);
+
+		wait_obj_set(channel->receive_event);
+		return;
+	}
+
+	channel->dvc_open_state = DVC_OPEN_STATE_SUCCEEDED;
+
+	/* data written while the channel was being opened */
+	while ((item = (wts_data_item*) list_dequeue(channel->dvc_pending)) != NULL)
+		wts_queue_item(vcm, item);
+}
+
+static void wts_dvc_process_data(rdpPeerChannel* channel, uint8* data, uint32 length, tbool first, uint32 total_length)
+{
+	wts_data_item* item;
+
+	if (!first && channel->receive_item == NULL && channel->dvc_discard_length > 0)
+	{
+		channel->dvc_discard_length -= MIN(length, channel->dvc_discard_length);
+		return;
+	}
+
+	if (first || channel->receive_item == NULL)
+	{
+		if (channel->receive_item != NULL)
+			wts_data_item_recycle(channel, channel->receive_item);
+
+		if (!first)
+			total_length = length;
+
+		/* DATA_FIRST announces the length of the whole message */
+		channel->receive_item = wts_data_item_new(channel, total_length);
+		channel->dvc_total_length = total_length;
+		channel->dvc_discard_length = 0;
+
+		if (channel->receive_item == NULL)
+		{
+			channel->dvc_discard_length = total_length - MIN(length, total_length);
+			return;
+		}
+	}
+
+	item = channel->receive_item;
+
+	if (item->length + length > channel->dvc_total_length)
+	{
+		printf("wts_dvc_process_data: data exceeds total length\n");
+		wts_data_item_recycle(channel, item);
+		channel->receive_item = NULL;
+		return;
+	}
+
+	memcpy(item->buffer + item->length, data, length);
+	item->length += length;
+
+	if (item->length == channel->dvc_total_length)
+	{
+		channel->receive_item = NULL;
+
+		freerdp_mutex_lock(channel->mutex);
+		list_enqueue(channel->receive_queue, item);
+		freerdp_mutex_unlock(channel->mutex);
+
+		wait_obj_set(channel->receive_event);
+	}
+}
+
+/**
+ * Process a PDU received on the drdynvc static channel and dispatch it
+ * to the dynamic channel it is addressed to.
+ */
+
+static void wts_dvc_process_pdu(WTSVirtualChannelManager* vcm, uint8* data, uint32 length)
+{
+	int Sp;
+	int Cmd;
+	int cbChId;
+	uint8 value;
+	STREAM* s;
+	uint32 Length;
+	uint32 ChannelId;
+	rdpPeerChannel* channel;
+
+	if (length < 1)
+		return;
+
+	s = stream_new(0);
+	stream_attach(s, data, length);
+
+	stream_read_uint8(s, value);
+	Cmd = (value & 0xf0) >> 4;
+	Sp = (value & 0x0c) >> 2;
+	cbChId = (value & 0x03) >> 0;
+
+	freerdp_mutex_lock(vcm->mutex);
+
+	if (Cmd == CAPABILITY_REQUEST_PDU)
+	{
+		wts_dvc_process_capability_response(vcm, s);
+	}
+	else if (stream_get_left(s) >= wts_variable_uint_length(cbChId))
+	{
+		ChannelId = wts_read_variable_uint(s, cbChId);
+		channel = wts_get_dvc_channel(vcm, ChannelId);
+
+		if (channel == NULL)
+		{
+			printf("wts_dvc_process_pdu: unknown channel id %d\n", ChannelId);
+		}
+		else
+		{
+			switch (Cmd)
+			{
+				case CREATE_REQUEST_PDU:
+					wts_dvc_process_create_response(vcm, channel, s);
+					break;
+
+				case DATA_FIRST_PDU:
+					if (stream_get_left(s) < wts_variable_uint_length(Sp))
+						break;
+					Length = wts_read_variable_uint(s, Sp);
+					wts_dvc_process_data(channel, stream_get_tail(s), stream_get_left(s), true, Length);
+					break;
+
+				case DATA_PDU:
+					wts_dvc_process_data(channel, stream_get_tail(s), stream_get_left(s), false, 0);
+					break;
+
+				case CLOSE_REQUEST_PDU:
+					channel->dvc_open_state = DVC_OPEN_STATE_CLOSED;
+					wait_obj_set(channel->receive_event);
+					break;
+
+				default:
+					printf("wts_dvc_process_pdu: unknown drdynvc cmd 0x%x\n", Cmd);
+					break;
+			}
+		}
+	}
+
+	freerdp_mutex_unlock(vcm->mutex);
+
+	stream_detach(s);
+	stream_free(s);
+}
+
 static void WTSProcessChannelData(rdpPeerChannel* channel, int channelId, uint8* data, int size, int flags, int total_size)
 {
 	wts_data_item* item;
 
+	/* chunks are reassembled in place into the buffer of the queued item */
 	if (flags & CHANNEL_FLAG_FIRST)
 	{
-		stream_set_pos(channel->receive_data, 0);
+		if (channel->receive_item != NULL)
+			wts_data_item_recycle(channel, channel->receive_item);
+		channel->receive_item = wts_data_item_new(channel, total_size);
+	}
+
+	/* the message was dropped, so are its remaining chunks */
+	item = channel->receive_item;
+	if (item == NULL)
+		return;
+
+	if (item->length + size > item->size)
+	{
+		printf("WTSProcessChannelData: chunk exceeds total length\n");
+		wts_data_item_recycle(channel, item);
+		channel->receive_item = NULL;
+		return;
 	}
 
-	stream_check_size(channel->receive_data, size);
-	stream_write(channel->receive_data, data, size);
+	memcpy(item->buffer + item->length, data, size);
+	item->length += size;
 
 	if (flags & CHANNEL_FLAG_LAST)
 	{
-		if (stream_get_length(channel->receive_data) != total_size)
+		channel->receive_item = NULL;
+
+		if (item->length != total_size)
 		{
 			printf("WTSProcessChannelData: read error\n");
 		}
 		if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC)
 		{
-			/* TODO: Receive DVC channel data */
+			wts_dvc_process_pdu(channel->vcm, item->buffer, item->length);
+			wts_data_item_recycle(channel, item);
 		}
 		else
 		{
-			item = xnew(wts_data_item);
-			item->length = stream_get_length(channel->receive_data);
-			item->buffer = xmalloc(item->length);
-			memcpy(item->buffer, stream_get_head(channel->receive_data), item->length);
-
 			freerdp_mutex_lock(channel->mutex);
 			list_enqueue(channel->receive_queue, item);
 			freerdp_mutex_unlock(channel->mutex);
 
 			wait_obj_set(channel->receive_event);
 		}
-		stream_set_pos(channel->receive_data, 0);
 	}
 }
 
@@ -83,15 +636,25 @@ static int WTSReceiveChannelData(freerdp_peer* client, int channelId, uint8* dat
 	int i;
 	tbool result = false;
 	rdpPeerChannel* channel;
+	rdpSettings* settings = client->settings;
 
-	for (i = 0; i < client->settings->num_channels; i++)
+	if (settings->num_channels < 1)
+		return false;
+
+	/* channel ids are assigned in order, so the id gives the index directly */
+	i = channelId - settings->channels[0].channel_id;
+
+	if (i < 0 || i >= settings->num_channels || settings->channels[i].channel_id != channelId)
 	{
-		if (client->settings->channels[i].channel_id == channelId)
-			break;
+		for (i = 0; i < settings->num_channels; i++)
+		{
+			if (settings->channels[i].channel_id == channelId)
+				break;
+		}
 	}
-	if (i < client->settings->num_channels)
+	if (i < settings->num_channels)
 	{
-		channel = (rdpPeerChannel*) client->settings->channels[i].handle;
+		channel = (rdpPeerChannel*) settings->channels[i].handle;
 		if (channel != NULL)
 		{
 			WTSProcessChannelData(channel, channelId, data, size, flags, total_size);
@@ -112,8 +675,13 @@ WTSVirtualChannelManager* WTSCreateVirtualChannelManager(freerdp_peer* client)
 		vcm->client = client;
 		vcm->send_event = wait_obj_new();
 		vcm->send_queue = list_new();
+		vcm->send_batch = list_new();
 		vcm->mutex = freerdp_mutex_new();
 
+		vcm->dvc_chunk_size = CHANNEL_CHUNK_LENGTH;
+		vcm->dvc_channels = list_new();
+		vcm->pool_mutex = freerdp_mutex_new();
+
 		client->ReceiveChannelData = WTSReceiveChannelData;
 	}
 
@@ -122,10 +690,19 @@ WTSVirtualChannelManager* WTSCreateVirtualChannelManager(freerdp_peer* client)
 
 void WTSDestroyVirtualChannelManager(WTSVirtualChannelManager* vcm)
 {
+	int i;
+	wts_buffer* buffer;
 	wts_data_item* item;
+	rdpPeerChannel* channel;
 
 	if (vcm != NULL)
 	{
+		while ((channel = (rdpPeerChannel*) list_peek(vcm->dvc_channels)) != NULL)
+		{
+			WTSVirtualChannelClose(channel);
+		}
+		list_free(vcm->dvc_channels);
+
 		if (vcm->drdynvc_channel != NULL)
 		{
 			WTSVirtualChannelClose(vcm->drdynvc_channel);
@@ -135,10 +712,23 @@ void WTSDestroyVirtualChannelManager(WTSVirtualChannelManager* vcm)
 		wait_obj_free(vcm->send_event);
 		while ((item = (wts_data_item*) list_dequeue(vcm->send_queue)) != NULL)
 		{
-			wts_data_item_free(item);
+			wts_data_item_free(vcm, item);
 		}
 		list_free(vcm->send_queue);
+		list_free(vcm->send_batch);
 		freerdp_mutex_free(vcm->mutex);
+
+		for (i = 0; i <= WTS_BUFFER_MAX_SHIFT; i++)
+		{
+			while ((buffer = vcm->pool[i]) != NULL)
+			{
+				vcm->pool[i] = buffer->next;
+				xfree(buffer->data);
+				xfree(buffer);
+			}
+		}
+		freerdp_mutex_free(vcm->pool_mutex);
+
 		xfree(vcm);
 	}
 }
@@ -151,27 +741,90 @@ void WTSVirtualChannelManagerGetFileDescriptor(WTSVirtualChannelManager* vcm,
 
 tbool WTSVirtualChannelManagerCheckFileDescriptor(WTSVirtualChannelManager* vcm)
 {
+	LIST* batch;
+	uint32 length;
+	uint32 offset;
 	tbool result = true;
 	wts_data_item* item;
 
 	wait_obj_clear(vcm->send_event);
 
+	/* take the whole queue at once so writers are not held up while sending */
 	freerdp_mutex_lock(vcm->mutex);
-	while ((item = (wts_data_item*) list_dequeue(vcm->send_queue)) != NULL)
+	batch = vcm->send_queue;
+	vcm->send_queue = vcm->send_batch;
+	freerdp_mutex_unlock(vcm->mutex);
+
+	while (result && (item = (wts_data_item*) list_dequeue(batch)) != NULL)
 	{
-		if (vcm->client->SendChannelData(vcm->client, item->channel_id, item->buffer, item->length) == false)
+		/* dynamic channel items are sent one drdynvc PDU at a time */
+		for (offset = 0; result && offset < item->length; offset += length)
 		{
-			result = false;
+			length = item->length - offset;
+			if (item->pdu_size > 0 && length > item->pdu_size)
+				length = item->pdu_size;
+
+			if (vcm->client->SendChannelData(vcm->client, item->channel_id, item->buffer + offset, length) == false)
+			{
+				/* part of the item may be out already, it cannot be sent again */
+				printf("WTSVirtualChannelManagerCheckFileDescriptor: failed to send channel data, "
+					"%u bytes dropped\n", item->length - offset);
+				result = false;
+			}
 		}
-		wts_data_item_free(item);
-		if (result == false)
-			break;
+		wts_data_item_free(vcm, item);
+	}
+
+	freerdp_mutex_lock(vcm->mutex);
+	if (list_size(batch) > 0)
+	{
+		/* put what was not sent back ahead of what was queued meanwhile */
+		while ((item = (wts_data_item*) list_dequeue(vcm->send_queue)) != NULL)
+			list_enqueue(batch, item);
+		vcm->send_batch = vcm->send_queue;
+		vcm->send_queue = batch;
+	}
+	else
+	{
+		vcm->send_batch = batch;
 	}
 	freerdp_mutex_unlock(vcm->mutex);
 
 	return result;
 }
 
+void WTSVirtualChannelManagerSetDvcChunkSize(WTSVirtualChannelManager* vcm, uint32 size)
+{
+	freerdp_mutex_lock(vcm->mutex);
+	vcm->dvc_chunk_size = MIN(MAX(size, DVC_HEADER_MAX_LENGTH * 2), CHANNEL_CHUNK_LENGTH);
+	freerdp_mutex_unlock(vcm->mutex);
+}
+
+static rdpPeerChannel* WTSCreateDynamicChannel(WTSVirtualChannelManager* vcm, const char* pVirtualName)
+{
+	rdpPeerChannel* channel;
+
+	channel = xnew(rdpPeerChannel);
+	channel->vcm = vcm;
+	channel->client = vcm->client;
+	channel->channel_type = RDP_PEER_CHANNEL_TYPE_DVC_SUB;
+	channel->index = vcm->client->settings->num_channels;
+	channel->receive_event = wait_obj_new();
+	channel->receive_queue = list_new();
+	channel->mutex = freerdp_mutex_new();
+	channel->dvc_name = xstrdup(pVirtualName);
+	channel->dvc_pending = list_new();
+
+	freerdp_mutex_lock(vcm->mutex);
+	channel->channel_id = ++vcm->dvc_channel_id_seq;
+	list_enqueue(vcm->dvc_channels, channel);
+	if (vcm->drdynvc_state == DRDYNVC_STATE_READY)
+		wts_dvc_send_create_request(vcm, channel);
+	freerdp_mutex_unlock(vcm->mutex);
+
+	return channel;
+}
+
 void* WTSVirtualChannelOpenEx(
 	/* __in */ WTSVirtualChannelManager* vcm,
 	/* __in */ const char* pVirtualName,
@@ -208,27 +861,29 @@ void* WTSVirtualChannelOpenEx(
 		channel->client = client;
 		channel->channel_id = client->settings->channels[i].channel_id;
 		channel->index = i;
-		channel->receive_data = stream_new(client->settings->vc_chunk_size);
+		channel->mutex = freerdp_mutex_new();
 		if ((flags & WTS_CHANNEL_OPTION_DYNAMIC) != 0)
 		{
 			channel->channel_type = RDP_PEER_CHANNEL_TYPE_DVC;
+
+			freerdp_mutex_lock(vcm->mutex);
 			vcm->drdynvc_channel = channel;
+			wts_dvc_send_capability_request(vcm);
+			freerdp_mutex_unlock(vcm->mutex);
 		}
 		else
 		{
 			channel->channel_type = RDP_PEER_CHANNEL_TYPE_SVC;
 			channel->receive_event = wait_obj_new();
 			channel->receive_queue = list_new();
-			channel->mutex = freerdp_mutex_new();
 		}
 
 		client->settings->channels[i].handle = channel;
 	}
 	if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC)
 	{
-		/* TODO: do DVC channel initialization here using pVirtualName */
-		/* A sub-channel should be created and returned, instead of using the main drdynvc channel */
-		/* Set channel->index to num_channels */
+		/* each dynamic channel is multiplexed over the drdynvc channel */
+		channel = WTSCreateDynamicChannel(vcm, pVirtualName);
 	}
 
 	return channel;
@@ -267,6 +922,43 @@ void WTSFreeMemory(
 	xfree(pMemory);
 }
 
+static wts_data_item* WTSVirtualChannelDequeue(rdpPeerChannel* channel, uint32 BufferSize, uint32* pBytesRead)
+{
+	wts_data_item* item;
+
+	freerdp_mutex_lock(channel->mutex);
+	item = (wts_data_item*) list_peek(channel->receive_queue);
+	if (item == NULL)
+	{
+		wait_obj_clear(channel->receive_event);
+		*pBytesRead = 0;
+	}
+	else
+	{
+		*pBytesRead = item->length;
+		if (item->length > BufferSize)
+		{
+			item = NULL;
+		}
+		else
+		{
+			list_dequeue(channel->receive_queue);
+			if (channel->receive_queue->head == NULL)
+				wait_obj_clear(channel->receive_event);
+		}
+	}
+	freerdp_mutex_unlock(channel->mutex);
+
+	return item;
+}
+
+/* a dynamic channel refused or closed by the client reads as an error */
+static tbool WTSVirtualChannelIsOpen(rdpPeerChannel* channel)
+{
+	return (channel->dvc_open_state != DVC_OPEN_STATE_FAILED &&
+		channel->dvc_open_state != DVC_OPEN_STATE_CLOSED);
+}
+
 tbool WTSVirtualChannelRead(
 	/* __in */  void* hChannelHandle,
 	/* __in */  uint32 TimeOut,
@@ -277,89 +969,187 @@ tbool WTSVirtualChannelRead(
 	wts_data_item* item;
 	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
 
-	item = (wts_data_item*) list_peek(channel->receive_queue);
+	item = WTSVirtualChannelDequeue(channel, BufferSize, pBytesRead);
 	if (item == NULL)
-	{
-		wait_obj_clear(channel->receive_event);
-		*pBytesRead = 0;
-		return true;
-	}
-	*pBytesRead = item->length;
-	if (item->length > BufferSize)
-		return false;
-
-	/* remove the first element (same as what we just peek) */
-	freerdp_mutex_lock(channel->mutex);
-	list_dequeue(channel->receive_queue);
-	if (channel->receive_queue->head == NULL)
-		wait_obj_clear(channel->receive_event);
-	freerdp_mutex_unlock(channel->mutex);
+		return (*pBytesRead == 0 && WTSVirtualChannelIsOpen(channel));
 
 	memcpy(Buffer, item->buffer, item->length);
+	wts_data_item_recycle(channel, item);
 
 	return true;
 }
 
+tbool WTSVirtualChannelReadEx(
+	/* __in */  void* hChannelHandle,
+	/* __out */ uint8** ppBuffer,
+	/* __out */ uint32* pBytesRead)
+{
+	wts_data_item* item;
+	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
+
+	*ppBuffer = NULL;
+
+	item = WTSVirtualChannelDequeue(channel, 0xFFFFFFFF, pBytesRead);
+	if (item == NULL)
+		return WTSVirtualChannelIsOpen(channel);
+
+	*ppBuffer = item->buffer;
+	xfree(item);
+
+	return true;
+}
+
+static tbool WTSVirtualChannelSend(rdpPeerChannel* channel, uint8* Buffer, uint32 Length)
+{
+	wts_data_item* item;
+	WTSVirtualChannelManager* vcm = channel->vcm;
+
+	item = xnew(wts_data_item);
+	item->channel_id = channel->channel_id;
+	item->buffer = Buffer;
+	item->length = Length;
+	item->size = Length;
+
+	freerdp_mutex_lock(vcm->mutex);
+	wts_queue_item(vcm, item);
+	freerdp_mutex_unlock(vcm->mutex);
+
+	return true;
+}
+
+/**
+ * Queue a message of a dynamic channel. Until the client has accepted
+ * the channel, its messages wait in the pending queue of the channel.
+ */
+
+static tbool WTSVirtualChannelSendDynamic(rdpPeerChannel* channel, uint8* Buffer, uint32 Length)
+{
+	tbool result = true;
+	wts_data_item* item;
+	WTSVirtualChannelManager* vcm = channel->vcm;
+
+	item = wts_dvc_data_item_new(vcm, channel->channel_id, Buffer, Length);
+
+	freerdp_mutex_lock(vcm->mutex);
+	switch (channel->dvc_open_state)
+	{
+		case DVC_OPEN_STATE_NONE:
+		case DVC_OPEN_STATE_PENDING:
+			list_enqueue(channel->dvc_pending, item);
+			break;
+
+		case DVC_OPEN_STATE_SUCCEEDED:
+			wts_queue_item(vcm, item);
+			break;
+
+		default:
+			result = false;
+			break;
+	}
+	freerdp_mutex_unlock(vcm->mutex);
+
+	if (!result)
+		wts_data_item_free(vcm, item);
+
+	return result;
+}
+
 tbool WTSVirtualChannelWrite(
 	/* __in */  void* hChannelHandle,
 	/* __in */  uint8* Buffer,
 	/* __in */  uint32 Length,
 	/* __out */ uint32* pBytesWritten)
 {
+	uint8* buffer;
 	uint32 written = 0;
-	wts_data_item* item;
 	tbool result = false;
 	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
-	WTSVirtualChannelManager* vcm = channel->vcm;
 
 	if (channel == NULL)
 		return false;
 
 	if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_SVC)
 	{
-		item = xnew(wts_data_item);
-		item->channel_id = channel->channel_id;
-		item->buffer = xmalloc(Length);
-		item->length = Length;
-		memcpy(item->buffer, Buffer, Length);
-
-		freerdp_mutex_lock(vcm->mutex);
-		list_enqueue(vcm->send_queue, item);
-		freerdp_mutex_unlock(vcm->mutex);
+		buffer = xmalloc(Length > 0 ? Length : 1);
+		memcpy(buffer, Buffer, Length);
 
-		wait_obj_set(vcm->send_event);
-
-		written = Length;
-		result = true;
+		result = WTSVirtualChannelSend(channel, buffer, Length);
 	}
-	else
+	else if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC_SUB)
 	{
-		/* TODO: Send to DVC channel */
+		result = WTSVirtualChannelSendDynamic(channel, Buffer, Length);
 	}
 
+	if (result)
+		written = Length;
+
 	if (pBytesWritten != NULL)
 		*pBytesWritten = written;
 	return result;
 }
 
+tbool WTSVirtualChannelWriteEx(
+	/* __in */  void* hChannelHandle,
+	/* __in */  uint8* Buffer,
+	/* __in */  uint32 Length)
+{
+	tbool result = false;
+	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
+
+	if (channel != NULL && channel->channel_type == RDP_PEER_CHANNEL_TYPE_SVC)
+		return WTSVirtualChannelSend(channel, Buffer, Length);
+
+	/* dynamic channel data is laid out into its PDUs anyway */
+	if (channel != NULL && channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC_SUB)
+		result = WTSVirtualChannelSendDynamic(channel, Buffer, Length);
+
+	xfree(Buffer);
+	return result;
+}
+
 tbool WTSVirtualChannelClose(
 	/* __in */ void* hChannelHandle)
 {
 	wts_data_item* item;
 	rdpPeerChannel* channel = (rdpPeerChannel*) hChannelHandle;
+	WTSVirtualChannelManager* vcm;
 
 	if (channel != NULL)
 	{
+		vcm = channel->vcm;
+
+		if (channel->channel_type == RDP_PEER_CHANNEL_TYPE_DVC_SUB)
+		{
+			freerdp_mutex_lock(vcm->mutex);
+			list_remove(vcm->dvc_channels, channel);
+			if (channel->dvc_open_state == DVC_OPEN_STATE_PENDING ||
+				channel->dvc_open_state == DVC_OPEN_STATE_SUCCEEDED)
+			{
+				wts_dvc_send_close_request(vcm, channel);
+			}
+			freerdp_mutex_unlock(vcm->mutex);
+
+			while ((item = (wts_data_item*) list_dequeue(channel->dvc_pending)) != NULL)
+			{
+				wts_data_item_free(vcm, item);
+			}
+			list_free(channel->dvc_pending);
+			xfree(channel->dvc_name);
+		}
+
 		if (channel->index < channel->client->settings->num_channels)
 			channel->client->settings->channels[channel->index].handle = NULL;
-		stream_free(channel->receive_data);
+		if (channel->receive_item)
+			wts_data_item_free(vcm, channel->receive_item);
+		if (channel->free_item)
+			wts_data_item_free(vcm, channel->free_item);
 		if (channel->receive_event)
 			wait_obj_free(channel->receive_event);
 		if (channel->receive_queue)
 		{
 			while ((item = (wts_data_item*) list_dequeue(channel->receive_queue)) != NULL)
 			{
-				wts_data_item_free(item);
+				wts_data_item_free(vcm, item);
 			}
 			list_free(channel->receive_queue);
 		}
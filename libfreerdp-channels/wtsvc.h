@@ -27,6 +27,20 @@
 #include <freerdp/utils/wait_obj.h>
 #include <freerdp/channels/wtsvc.h>
 
+#define CREATE_REQUEST_PDU     0x01
+#define DATA_FIRST_PDU         0x02
+#define DATA_PDU               0x03
+#define CLOSE_REQUEST_PDU      0x04
+#define CAPABILITY_REQUEST_PDU 0x05
+
+#define DVC_HEADER_MAX_LENGTH	9 /* Cmd, ChannelId and Length */
+
+#define WTS_MESSAGE_MAX_LENGTH	(16 * 1024 * 1024) /* largest message reassembled for a client */
+
+#define WTS_BUFFER_MIN_SHIFT	11
+#define WTS_BUFFER_MAX_SHIFT	24
+#define WTS_BUFFER_POOL_DEPTH	4
+
 enum
 {
 	RDP_PEER_CHANNEL_TYPE_SVC = 0,
@@ -34,18 +48,63 @@ enum
 	RDP_PEER_CHANNEL_TYPE_DVC_SUB = 2
 };
 
+enum
+{
+	DRDYNVC_STATE_NONE = 0,
+	DRDYNVC_STATE_INITIALIZED = 1,
+	DRDYNVC_STATE_READY = 2
+};
+
+enum
+{
+	DVC_OPEN_STATE_NONE = 0,
+	DVC_OPEN_STATE_PENDING = 1,
+	DVC_OPEN_STATE_SUCCEEDED = 2,
+	DVC_OPEN_STATE_FAILED = 3,
+	DVC_OPEN_STATE_CLOSED = 4
+};
+
+typedef struct wts_buffer wts_buffer;
+struct wts_buffer
+{
+	uint8* data;
+	uint32 size;
+	int shift;
+	wts_buffer* next;
+};
+
+typedef struct wts_data_item
+{
+	uint16 channel_id;
+	uint8* buffer;
+	uint32 length;
+	uint32 size;
+
+	/* dynamic channel PDUs, laid out back to back in a pool buffer */
+	uint32 pdu_size;
+	wts_buffer* pool_buffer;
+} wts_data_item;
+
 typedef struct rdp_peer_channel
 {
 	WTSVirtualChannelManager* vcm;
 	freerdp_peer* client;
-	uint16 channel_id;
+	uint32 channel_id;
 	uint16 channel_type;
 	uint16 index;
 
-	STREAM* receive_data;
+	wts_data_item* receive_item;
+	wts_data_item* free_item;
 	struct wait_obj* receive_event;
 	LIST* receive_queue;
 	freerdp_mutex mutex;
+
+	/* dynamic channels, guarded by the manager mutex */
+	char* dvc_name;
+	uint8 dvc_open_state;
+	uint32 dvc_total_length;
+	uint32 dvc_discard_length; /* rest of a dropped message */
+	LIST* dvc_pending;
 } rdpPeerChannel;
 
 struct WTSVirtualChannelManager
@@ -53,9 +112,18 @@ struct WTSVirtualChannelManager
 	freerdp_peer* client;
 	struct wait_obj* send_event;
 	LIST* send_queue;
+	LIST* send_batch;
 	freerdp_mutex mutex;
 
 	rdpPeerChannel* drdynvc_channel;
+	uint8 drdynvc_state;
+	uint32 dvc_channel_id_seq;
+	uint32 dvc_chunk_size;
+	LIST* dvc_channels;
+
+	freerdp_mutex pool_mutex;
+	wts_buffer* pool[WTS_BUFFER_MAX_SHIFT + 1];
+	int pool_depth[WTS_BUFFER_MAX_SHIFT + 1];
 };
 
 #endif /* __WTSVC_H */
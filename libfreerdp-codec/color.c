@@ -17,14 +17,23 @@
  * limitations under the License.
  */
 
+#include "config.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/constants.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/utils/memory.h>
 
+#ifdef WITH_SSE2
+#include "color_sse2.h"
+
+/* set at runtime, the library may be built with SSE2 for a CPU without it */
+static tbool color_use_sse2 = false;
+#endif
+
 int freerdp_get_pixel(uint8 * data, int x, int y, int width, int height, int bpp)
 {
 	int start;
@@ -1059,3 +1068,94 @@ void freerdp_clrconv_free(HCLRCONV clrconv)
 		xfree(clrconv);
 	}
 }
+
+/**
+ * Enable the SIMD code paths of the color converters the CPU supports.
+ */
+
+void freerdp_color_set_cpu_opt(uint32 cpu_opt)
+{
+#ifdef WITH_SSE2
+	color_use_sse2 = (cpu_opt & CPU_SSE2) ? true : false;
+#endif
+}
+
+#define YUV_CLIP(_v) ((_v) < 0 ? 0 : ((_v) > 255 ? 255 : (_v)))
+
+/**
+ * Convert planar YUV 4:2:0 (BT.601, limited range) to 32bpp BGRX.
+ * The rows of the two chroma planes cover two rows of the luma plane.
+ */
+
+void freerdp_image_yuv420p_to_bgrx(const uint8* pY, int strideY, const uint8* pU, int strideU,
+	const uint8* pV, int strideV, uint8* dstData, int dstStride, int width, int height)
+{
+	int x, y;
+	int c, d, e;
+	int done;
+	uint8* dst;
+	const uint8* yrow;
+	const uint8* urow;
+	const uint8* vrow;
+
+	for (y = 0; y < height; y++)
+	{
+		yrow = pY + y * strideY;
+		urow = pU + (y / 2) * strideU;
+		vrow = pV + (y / 2) * strideV;
+		dst = dstData + y * dstStride;
+		done = 0;
+
+#ifdef WITH_SSE2
+		if (color_use_sse2)
+			done = freerdp_yuv420p_to_bgrx_row_sse2(yrow, urow, vrow, dst, width);
+#endif
+
+		for (x = done; x < width; x++)
+		{
+			c = yrow[x] - 16;
+			d = urow[x / 2] - 128;
+			e = vrow[x / 2] - 128;
+
+			dst[4 * x + 0] = YUV_CLIP((298 * c + 516 * d + 128) >> 8);
+			dst[4 * x + 1] = YUV_CLIP((298 * c - 100 * d - 208 * e + 128) >> 8);
+			dst[4 * x + 2] = YUV_CLIP((298 * c + 409 * e + 128) >> 8);
+			dst[4 * x + 3] = 0xFF;
+		}
+	}
+}
+
+/**
+ * Convert planar YUV 4:2:0 (BT.601, full range, as in JPEG) to 32bpp BGRX.
+ */
+
+void freerdp_image_yuvj420p_to_bgrx(const uint8* pY, int strideY, const uint8* pU, int strideU,
+	const uint8* pV, int strideV, uint8* dstData, int dstStride, int width, int height)
+{
+	int x, y;
+	int c, d, e;
+	uint8* dst;
+	const uint8* yrow;
+	const uint8* urow;
+	const uint8* vrow;
+
+	for (y = 0; y < height; y++)
+	{
+		yrow = pY + y * strideY;
+		urow = pU + (y / 2) * strideU;
+		vrow = pV + (y / 2) * strideV;
+		dst = dstData + y * dstStride;
+
+		for (x = 0; x < width; x++)
+		{
+			c = yrow[x] << 8;
+			d = urow[x / 2] - 128;
+			e = vrow[x / 2] - 128;
+
+			dst[4 * x + 0] = YUV_CLIP((c + 454 * d + 128) >> 8);
+			dst[4 * x + 1] = YUV_CLIP((c - 88 * d - 183 * e + 128) >> 8);
+			dst[4 * x + 2] = YUV_CLIP((c + 359 * e + 128) >> 8);
+			dst[4 * x + 3] = 0xFF;
+		}
+	}
+}
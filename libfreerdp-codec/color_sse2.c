@@ -0,0 +1,97 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Color Conversion Routines - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "color_sse2.h"
+
+/**
+ * Convert one row of YUV 4:2:0 to BGRX, 8 pixels at a time, with the
+ * same integer arithmetic as the C version.
+ * @return number of pixels converted, the caller converts the rest
+ */
+
+int freerdp_yuv420p_to_bgrx_row_sse2(const uint8* pY, const uint8* pU, const uint8* pV,
+	uint8* dst, int width)
+{
+	int x;
+	uint32 u32;
+	__m128i zero, y16, u16, v16, c, d, e, t;
+	__m128i lo, hi, r, g, b, bg, ra;
+	__m128i k16, k128, kCE, kCD, kGD, kGE, kround, ones, alpha;
+
+	zero = _mm_setzero_si128();
+	k16 = _mm_set1_epi16(16);
+	k128 = _mm_set1_epi16(128);
+	/* coefficient pairs for _mm_madd_epi16 */
+	kCE = _mm_set_epi16(409, 298, 409, 298, 409, 298, 409, 298);
+	kCD = _mm_set_epi16(516, 298, 516, 298, 516, 298, 516, 298);
+	kGD = _mm_set_epi16(-100, 298, -100, 298, -100, 298, -100, 298);
+	kGE = _mm_set_epi16(128, -208, 128, -208, 128, -208, 128, -208);
+	kround = _mm_set1_epi32(128);
+	ones = _mm_set1_epi16(1);
+	alpha = _mm_set1_epi8((char) 0xFF);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (pY + x)), zero);
+
+		memcpy(&u32, pU + x / 2, 4);
+		u16 = _mm_cvtsi32_si128((int) u32);
+		memcpy(&u32, pV + x / 2, 4);
+		v16 = _mm_cvtsi32_si128((int) u32);
+
+		/* each chroma sample covers two pixels */
+		u16 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(u16, u16), zero);
+		v16 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(v16, v16), zero);
+
+		c = _mm_sub_epi16(y16, k16);
+		d = _mm_sub_epi16(u16, k128);
+		e = _mm_sub_epi16(v16, k128);
+
+		/* R = (298 * c + 409 * e + 128) >> 8 */
+		lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, e), kCE), kround);
+		hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, e), kCE), kround);
+		r = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+		/* B = (298 * c + 516 * d + 128) >> 8 */
+		lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, d), kCD), kround);
+		hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, d), kCD), kround);
+		b = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+		/* G = (298 * c - 100 * d - 208 * e + 128) >> 8 */
+		t = _mm_unpacklo_epi16(e, ones);
+		lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, d), kGD), _mm_madd_epi16(t, kGE));
+		t = _mm_unpackhi_epi16(e, ones);
+		hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, d), kGD), _mm_madd_epi16(t, kGE));
+		g = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+		/* saturate to 0..255 and interleave */
+		b = _mm_packus_epi16(b, zero);
+		g = _mm_packus_epi16(g, zero);
+		r = _mm_packus_epi16(r, zero);
+
+		bg = _mm_unpacklo_epi8(b, g);
+		ra = _mm_unpacklo_epi8(r, alpha);
+
+		_mm_storeu_si128((__m128i*) (dst + 4 * x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i*) (dst + 4 * x + 16), _mm_unpackhi_epi16(bg, ra));
+	}
+
+	return x;
+}
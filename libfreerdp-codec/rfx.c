@@ -649,6 +649,20 @@ static void rfx_compose_message_channels(RFX_CONTEXT* context, STREAM* s)
 	stream_write_uint16(s, context->height); /* Channel.height */
 }
 
+static void rfx_update_tileset_properties(RFX_CONTEXT* context)
+{
+	uint16 properties;
+
+	/* properties in tilesets: note that this has different format from the one in TS_RFX_CONTEXT */
+	properties = 1; /* lt */
+	properties |= (context->flags << 1); /* flags */
+	properties |= (COL_CONV_ICT << 4); /* cct */
+	properties |= (CLW_XFORM_DWT_53_A << 6); /* xft */
+	properties |= ((context->mode == RLGR1 ? CLW_ENTROPY_RLGR1 : CLW_ENTROPY_RLGR3) << 10); /* et */
+	properties |= (SCALAR_QUANTIZATION << 14); /* qt */
+	context->properties = properties;
+}
+
 static void rfx_compose_message_context(RFX_CONTEXT* context, STREAM* s)
 {
 	uint16 properties;
@@ -668,14 +682,7 @@ static void rfx_compose_message_context(RFX_CONTEXT* context, STREAM* s)
 	properties |= (SCALAR_QUANTIZATION << 13); /* qt */
 	stream_write_uint16(s, properties);
 
-	/* properties in tilesets: note that this has different format from the one in TS_RFX_CONTEXT */
-	properties = 1; /* lt */
-	properties |= (context->flags << 1); /* flags */
-	properties |= (COL_CONV_ICT << 4); /* cct */
-	properties |= (CLW_XFORM_DWT_53_A << 6); /* xft */
-	properties |= ((context->mode == RLGR1 ? CLW_ENTROPY_RLGR1 : CLW_ENTROPY_RLGR3) << 10); /* et */
-	properties |= (SCALAR_QUANTIZATION << 14); /* qt */
-	context->properties = properties;
+	rfx_update_tileset_properties(context);
 }
 
 void rfx_compose_message_header(RFX_CONTEXT* context, STREAM* s)
@@ -774,8 +781,57 @@ static void rfx_compose_message_tile(RFX_CONTEXT* context, STREAM* s,
 	stream_set_pos(s, end_pos);
 }
 
-static void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
-	uint8* image_data, int width, int height, int rowstride)
+/**
+ * Mark the tiles of the width by height grid that intersect the rects.
+ * @return number of tiles marked
+ */
+
+static int rfx_mark_tiles(uint8* marks, int numTilesX, int numTilesY,
+	const RFX_RECT* rects, int num_rects, int width, int height)
+{
+	int i;
+	int count = 0;
+	int xIdx, yIdx;
+	int left, top, right, bottom;
+
+	for (i = 0; i < num_rects; i++)
+	{
+		right = MIN(rects[i].x + rects[i].width, width);
+		bottom = MIN(rects[i].y + rects[i].height, height);
+
+		if (rects[i].x >= right || rects[i].y >= bottom)
+			continue;
+
+		left = rects[i].x / 64;
+		top = rects[i].y / 64;
+		right = (right - 1) / 64;
+		bottom = (bottom - 1) / 64;
+
+		for (yIdx = top; yIdx <= bottom; yIdx++)
+		{
+			for (xIdx = left; xIdx <= right; xIdx++)
+			{
+				if (marks[yIdx * numTilesX + xIdx] == 0)
+				{
+					marks[yIdx * numTilesX + xIdx] = 1;
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Compose only the tileset block of a frame. Tiles do not depend on the
+ * frame they are sent in, so one tileset can be wrapped in frames for
+ * several contexts with rfx_compose_message_frame.
+ * Only the tiles intersecting the rects are encoded.
+ */
+
+void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
+	const RFX_RECT* rects, int num_rects, uint8* image_data, int width, int height, int rowstride)
 {
 	int size;
 	int start_pos, end_pos;
@@ -792,6 +848,10 @@ static void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
 	int xIdx;
 	int yIdx;
 	int tilesDataSize;
+	uint8* marks;
+
+	if (!context->header_processed)
+		rfx_update_tileset_properties(context);
 
 	if (context->num_quants == 0)
 	{
@@ -812,7 +872,8 @@ static void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
 
 	numTilesX = (width + 63) / 64;
 	numTilesY = (height + 63) / 64;
-	numTiles = numTilesX * numTilesY;
+	marks = (uint8*) xzalloc(numTilesX * numTilesY + 1);
+	numTiles = rfx_mark_tiles(marks, numTilesX, numTilesY, rects, num_rects, width, height);
 
 	size = 22 + numQuants * 5;
 	stream_check_size(s, size);
@@ -844,6 +905,9 @@ static void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
 	{
 		for (xIdx = 0; xIdx < numTilesX; xIdx++)
 		{
+			if (marks[yIdx * numTilesX + xIdx] == 0)
+				continue;
+
 			rfx_compose_message_tile(context, s,
 				image_data + yIdx * 64 * rowstride + xIdx * 8 * context->bits_per_pixel,
 				(xIdx < numTilesX - 1) ? 64 : width - xIdx * 64,
@@ -851,6 +915,8 @@ static void rfx_compose_message_tileset(RFX_CONTEXT* context, STREAM* s,
 				rowstride, quantVals, quantIdxY, quantIdxCb, quantIdxCr, xIdx, yIdx);
 		}
 	}
+	xfree(marks);
+
 	tilesDataSize = stream_get_pos(s) - end_pos;
 	size += tilesDataSize;
 	end_pos = stream_get_pos(s);
@@ -878,7 +944,7 @@ static void rfx_compose_message_data(RFX_CONTEXT* context, STREAM* s,
 {
 	rfx_compose_message_frame_begin(context, s);
 	rfx_compose_message_region(context, s, rects, num_rects);
-	rfx_compose_message_tileset(context, s, image_data, width, height, rowstride);
+	rfx_compose_message_tileset(context, s, rects, num_rects, image_data, width, height, rowstride);
 	rfx_compose_message_frame_end(context, s);
 }
 
@@ -892,3 +958,23 @@ FREERDP_API void rfx_compose_message(RFX_CONTEXT* context, STREAM* s,
 	rfx_compose_message_data(context, s, rects, num_rects, image_data, width, height, rowstride);
 }
 
+/**
+ * Compose a frame around a tileset made by rfx_compose_message_tileset,
+ * possibly with another context.
+ */
+
+void rfx_compose_message_frame(RFX_CONTEXT* context, STREAM* s,
+	const RFX_RECT* rects, int num_rects, uint8* tileset, int tileset_length)
+{
+	if (context->frame_idx == 0 && !context->header_processed)
+		rfx_compose_message_header(context, s);
+
+	rfx_compose_message_frame_begin(context, s);
+	rfx_compose_message_region(context, s, rects, num_rects);
+
+	stream_check_size(s, tileset_length);
+	stream_write(s, tileset, tileset_length);
+
+	rfx_compose_message_frame_end(context, s);
+}
+
@@ -1654,7 +1654,7 @@ void rdp_write_bitmap_codecs_capability_set(STREAM* s, rdpSettings* settings)
 
 void rdp_read_frame_acknowledge_capability_set(STREAM* s, uint16 length, rdpSettings* settings)
 {
-	stream_seek_uint32(s); /* (4 bytes) */
+	stream_read_uint32(s, settings->max_unacknowledged_frames); /* maxUnacknowledgedFrameCount (4 bytes) */
 }
 
 void rdp_read_bitmap_cache_v3_codec_id_capability_set(STREAM* s, uint16 length, rdpSettings* settings)
@@ -1683,7 +1683,7 @@ void rdp_write_frame_acknowledge_capability_set(STREAM* s, rdpSettings* settings
 
 	header = rdp_capability_set_start(s);
 
-	stream_write_uint32(s, 2); /* (4 bytes) */
+	stream_write_uint32(s, 2); /* maxUnacknowledgedFrameCount (4 bytes) */
 
 	rdp_capability_set_finish(s, header, CAPSET_TYPE_FRAME_ACKNOWLEDGE);
 }
@@ -1960,6 +1960,12 @@ void rdp_write_demand_active(STREAM* s, rdpSettings* settings)
 	rdp_write_surface_commands_capability_set(s, settings);
 	rdp_write_bitmap_codecs_capability_set(s, settings);
 
+	if (settings->frame_acknowledge)
+	{
+		numberCapabilities++;
+		rdp_write_frame_acknowledge_capability_set(s, settings);
+	}
+
 	stream_get_mark(s, em);
 
 	stream_set_mark(s, lm); /* go back to lengthCombinedCapabilities */
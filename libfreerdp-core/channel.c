@@ -52,11 +52,12 @@ tbool freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int size
 		return false;
 	}
 
+	/* the chunks are packed into as few transport writes as possible */
 	flags = CHANNEL_FLAG_FIRST;
 	left = size;
 	while (left > 0)
 	{
-		s = rdp_send_stream_init(rdp);
+		s = rdp_batch_stream_init(rdp, 8 + MIN(left, (int) rdp->settings->vc_chunk_size));
 
 		if (left > (int) rdp->settings->vc_chunk_size)
 		{
@@ -74,17 +75,16 @@ tbool freerdp_channel_send(rdpRdp* rdp, uint16 channel_id, uint8* data, int size
 
 		stream_write_uint32(s, size);
 		stream_write_uint32(s, flags);
-		stream_check_size(s, chunk_size);
 		stream_write(s, data, chunk_size);
 
-		rdp_send(rdp, s, channel_id);
+		rdp_batch_add(rdp, s, channel_id);
 
 		data += chunk_size;
 		left -= chunk_size;
 		flags = 0;
 	}
 
-	return true;
+	return rdp_batch_flush(rdp);
 }
 
 void freerdp_channel_process(freerdp* instance, STREAM* s, uint16 channel_id)
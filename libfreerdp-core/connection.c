@@ -59,6 +59,57 @@
  *
  */
 
+static const char* const connection_phase_names[] =
+{
+	"mcs",
+	"licensing",
+	"capabilities",
+	"finalization"
+};
+
+static int rdp_connection_phase(int state)
+{
+	if (state < CONNECTION_STATE_LICENSE)
+		return 0;
+	else if (state == CONNECTION_STATE_LICENSE)
+		return 1;
+	else if (state == CONNECTION_STATE_CAPABILITY)
+		return 2;
+
+	return 3;
+}
+
+/**
+ * Print the time spent in each phase of the connection sequence,
+ * when asked to with --timings.
+ */
+
+static void rdp_print_connection_times(rdpRdp* rdp, uint32 nego_time, uint32* phase_times, uint32 total_time)
+{
+	int i;
+	int len;
+	char times[256];
+	rdpTransport* transport = rdp->transport;
+	rdpTls* tls = transport->tls_in;
+
+	if (rdp->settings->print_timings == false)
+		return;
+
+	len = snprintf(times, sizeof(times), "tcp %u ms, nego %u ms", transport->tcp_time, nego_time);
+
+	if (tls != NULL && tls->ssl != NULL)
+		len += snprintf(times + len, sizeof(times) - len, ", tls %u ms (%s)", transport->tls_time,
+			SSL_session_reused(tls->ssl) ? "resumed" : "full handshake");
+
+	if (transport->credssp_time > 0)
+		len += snprintf(times + len, sizeof(times) - len, ", credssp %u ms", transport->credssp_time);
+
+	for (i = 0; i < 4; i++)
+		len += snprintf(times + len, sizeof(times) - len, ", %s %u ms", connection_phase_names[i], phase_times[i]);
+
+	printf("connection times: %s, total %u ms\n", times, total_time);
+}
+
 /**
  * Establish RDP Connection.\n
  * @msdn{cc240452}
@@ -67,10 +118,21 @@
 
 tbool rdp_client_connect(rdpRdp* rdp)
 {
+	int state;
+	uint32 now;
+	uint32 start;
+	uint32 phase_start;
+	uint32 nego_time;
+	uint32 phase_times[4];
 	tbool status;
 	uint32 selectedProtocol;
 	rdpSettings* settings = rdp->settings;
 
+	start = freerdp_get_mstime();
+	rdp->transport->tcp_time = 0;
+	rdp->transport->tls_time = 0;
+	rdp->transport->credssp_time = 0;
+
 	nego_init(rdp->nego);
 	nego_set_target(rdp->nego, settings->hostname, settings->port);
 	nego_set_cookie(rdp->nego, settings->username);
@@ -84,6 +146,8 @@ tbool rdp_client_connect(rdpRdp* rdp)
 		return false;
 	}
 
+	/* a gateway connection runs its TLS handshakes during the negotiation */
+	nego_time = freerdp_get_mstime() - start - rdp->transport->tcp_time - rdp->transport->tls_time;
 	selectedProtocol = rdp->nego->selected_protocol;
 
 	if ((selectedProtocol & PROTOCOL_TLS) || (selectedProtocol == PROTOCOL_RDP))
@@ -127,17 +191,30 @@ tbool rdp_client_connect(rdpRdp* rdp)
 
 	//freerdp_usleep(1000 * 1000 * 10);
 
+	memset(phase_times, 0, sizeof(phase_times));
+	phase_start = freerdp_get_mstime();
+	state = rdp->state;
+
 	while (rdp->state != CONNECTION_STATE_ACTIVE)
 	{
-		/* TODO: don't use sleep here */
-		freerdp_usleep(1000 * 100);
+		transport_wait(rdp->transport, 100);
 		if (rdp_check_fds(rdp) < 0)
 		{
 			LLOGLN(0, ("rdp_client_connect: error rdp_check_fds failed"));
 			return false;
 		}
+
+		if (rdp->state != state)
+		{
+			now = freerdp_get_mstime();
+			phase_times[rdp_connection_phase(state)] += now - phase_start;
+			phase_start = now;
+			state = rdp->state;
+		}
 	}
 
+	rdp_print_connection_times(rdp, nego_time, phase_times, freerdp_get_mstime() - start);
+
 	return true;
 }
 
@@ -158,6 +235,7 @@ tbool rdp_client_redirect(rdpRdp* rdp)
 	license_free(rdp->license);
 	transport_free(rdp->transport);
 	rdp->transport = transport_new(settings);
+	rdp->connection_id++;
 	rdp->license = license_new(rdp);
 	rdp->nego = nego_new(rdp->transport);
 	rdp->mcs = mcs_new(rdp->transport);
@@ -112,6 +112,17 @@ tbool freerdp_get_fds(freerdp* instance, void** rfds, int* rcount, void** wfds,
 	return true;
 }
 
+/**
+ * Get an identifier of the current connection. It changes when the
+ * connection is re-established (e.g. on redirection), which replaces the
+ * descriptors returned by freerdp_get_fds even if their numbers are reused.
+ */
+
+uint32 freerdp_get_connection_id(freerdp* instance)
+{
+	return instance->context->rdp->connection_id;
+}
+
 tbool freerdp_check_fds(freerdp* instance)
 {
 	int status;
@@ -17,9 +17,14 @@
  * limitations under the License.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* accept4 */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <freerdp/utils/print.h>
 
@@ -30,6 +35,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <net/if.h>
 #else
 #define close(_fd) closesocket(_fd)
@@ -37,27 +43,113 @@
 
 #include "listener.h"
 
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+#define HAVE_ACCEPT4
+#endif
+
+/* connections taken from a socket at once, before moving on to the next one */
+#define LISTENER_MAX_ACCEPTS	32
+
+static int freerdp_listener_socket(struct addrinfo* ai, tbool reuse_port, int backlog)
+{
+	int status;
+	int sockfd;
+	int option_value;
+#ifdef _WIN32
+	u_long arg;
+#endif
+
+	sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sockfd == -1)
+	{
+		perror("socket");
+		return -1;
+	}
+
+	option_value = 1;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void*) &option_value, sizeof(option_value)) == -1)
+		perror("setsockopt");
+
+	if (reuse_port)
+	{
+#ifdef SO_REUSEPORT
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void*) &option_value, sizeof(option_value)) == -1)
+			perror("setsockopt");
+#endif
+	}
+
+#ifndef _WIN32
+	fcntl(sockfd, F_SETFL, O_NONBLOCK);
+	fcntl(sockfd, F_SETFD, FD_CLOEXEC);
+#else
+	arg = 1;
+	ioctlsocket(sockfd, FIONBIO, &arg);
+#endif
+
+	status = bind(sockfd, ai->ai_addr, ai->ai_addrlen);
+	if (status != 0)
+	{
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	status = listen(sockfd, backlog);
+	if (status != 0)
+	{
+		perror("listen");
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+static void freerdp_listener_add_socket(rdpListener* listener, int sockfd, int acceptor)
+{
+	if (listener->num_sockfds + 1 > listener->max_sockfds)
+	{
+		listener->max_sockfds = (listener->max_sockfds > 0) ? listener->max_sockfds * 2 : 8;
+		listener->sockfds = xrenew(int, listener->sockfds, listener->max_sockfds);
+		listener->acceptors = xrenew(int, listener->acceptors, listener->max_sockfds);
+	}
+
+	listener->sockfds[listener->num_sockfds] = sockfd;
+	listener->acceptors[listener->num_sockfds] = acceptor;
+	listener->num_sockfds++;
+}
+
 static tbool freerdp_listener_open(freerdp_listener* instance, const char* bind_address, uint16 port)
 {
 	rdpListener* listener = (rdpListener*)instance->listener;
 	int status;
 	int sockfd;
+	int backlog;
+	int acceptor;
+	int num_acceptors;
+	int max_acceptors;
+	int num_addresses;
 	char servname[10];
 	struct addrinfo hints = { 0 };
 	struct addrinfo* res;
 	struct addrinfo* ai;
-	int option_value;
 	void* sin_addr;
 	char buf[50];
-#ifdef _WIN32
-	u_long arg;
-#endif
 
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	if (bind_address == NULL)
 		hints.ai_flags = AI_PASSIVE;
 
+	num_acceptors = (instance->num_acceptors > 1) ? instance->num_acceptors : 1;
+	backlog = (instance->backlog > 0) ? instance->backlog : SOMAXCONN;
+
+#ifndef SO_REUSEPORT
+	/* without SO_REUSEPORT only one socket can be bound to the address */
+	num_acceptors = 1;
+#endif
+
 	snprintf(servname, sizeof(servname), "%d", port);
 	status = getaddrinfo(bind_address, servname, &hints, &res);
 	if (status != 0)
@@ -66,58 +158,51 @@ static tbool freerdp_listener_open(freerdp_listener* instance, const char* bind_
 		return false;
 	}
 
-	for (ai = res; ai && listener->num_sockfds < 5; ai = ai->ai_next)
+	num_addresses = 0;
+	max_acceptors = 0;
+
+	for (ai = res; ai && num_addresses < 5; ai = ai->ai_next)
 	{
 		if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
 			continue;
 
-		sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-		if (sockfd == -1)
+		/* one socket per acceptor, the kernel balances the connections between them */
+		for (acceptor = 0; acceptor < num_acceptors; acceptor++)
 		{
-			perror("socket");
-			continue;
-		}
-
-		option_value = 1;
-
-		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void*) &option_value, sizeof(option_value)) == -1)
-			perror("setsockopt");
+			sockfd = freerdp_listener_socket(ai, (num_acceptors > 1), backlog);
 
-#ifndef _WIN32
-		fcntl(sockfd, F_SETFL, O_NONBLOCK);
-#else
-		arg = 1;
-		ioctlsocket(sockfd, FIONBIO, &arg);
-#endif
+			if (sockfd == -1)
+				break;
 
-		status = bind(sockfd, ai->ai_addr, ai->ai_addrlen);
-		if (status != 0)
-		{
-			perror("bind");
-			close(sockfd);
-			continue;
+			freerdp_listener_add_socket(listener, sockfd, acceptor);
 		}
 
-		status = listen(sockfd, 10);
-		if (status != 0)
-		{
-			perror("listen");
-			close(sockfd);
+		if (acceptor == 0)
 			continue;
-		}
 
-		listener->sockfds[listener->num_sockfds++] = sockfd;
+		num_addresses++;
+
+		if (acceptor > max_acceptors)
+			max_acceptors = acceptor;
 
 		if (ai->ai_family == AF_INET)
 			sin_addr = &(((struct sockaddr_in*)ai->ai_addr)->sin_addr);
 		else
 			sin_addr = &(((struct sockaddr_in6*)ai->ai_addr)->sin6_addr);
 
-		printf("Listening on %s port %s.\n", inet_ntop(ai->ai_family, sin_addr, buf, sizeof(buf)), servname);
+		printf("Listening on %s port %s", inet_ntop(ai->ai_family, sin_addr, buf, sizeof(buf)), servname);
+
+		if (acceptor > 1)
+			printf(" with %d acceptors", acceptor);
+
+		printf(".\n");
 	}
 
 	freeaddrinfo(res);
 
+	/* the acceptors that actually got a socket */
+	instance->num_acceptors = max_acceptors;
+
 	return (listener->num_sockfds > 0 ? true : false);
 }
 
@@ -134,26 +219,46 @@ static void freerdp_listener_close(freerdp_listener* instance)
 	listener->num_sockfds = 0;
 }
 
-static tbool freerdp_listener_get_fds(freerdp_listener* instance, void** rfds, int* rcount)
+static tbool freerdp_listener_get_acceptor_fds(freerdp_listener* instance, int acceptor, void** rfds, int* rcount)
 {
 	rdpListener* listener = (rdpListener*)instance->listener;
+	tbool found = false;
 	int i;
 
-	if (listener->num_sockfds < 1)
-		return false;
-
 	for (i = 0; i < listener->num_sockfds; i++)
 	{
+		if (acceptor >= 0 && listener->acceptors[i] != acceptor)
+			continue;
+
 		rfds[*rcount] = (void*)(long)(listener->sockfds[i]);
 		(*rcount)++;
+		found = true;
 	}
 
-	return true;
+	return found;
 }
 
-static tbool freerdp_listener_check_fds(freerdp_listener* instance)
+static tbool freerdp_listener_get_fds(freerdp_listener* instance, void** rfds, int* rcount)
+{
+	return freerdp_listener_get_acceptor_fds(instance, -1, rfds, rcount);
+}
+
+static void freerdp_listener_set_peer_options(int sockfd)
+{
+	int option_value = 1;
+
+	setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void*) &option_value, sizeof(option_value));
+#ifdef TCP_QUICKACK
+	setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, (void*) &option_value, sizeof(option_value));
+#endif
+}
+
+/**
+ * Take the pending connections of a listening socket, up to LISTENER_MAX_ACCEPTS.
+ */
+
+static tbool freerdp_listener_accept(freerdp_listener* instance, int sockfd)
 {
-	rdpListener* listener = (rdpListener*)instance->listener;
 	struct sockaddr_storage peer_addr;
 	socklen_t peer_addr_size;
 	int peer_sockfd;
@@ -161,13 +266,16 @@ static tbool freerdp_listener_check_fds(freerdp_listener* instance)
 	freerdp_peer* client;
 	void* sin_addr;
 
-	if (listener->num_sockfds < 1)
-		return false;
-
-	for (i = 0; i < listener->num_sockfds; i++)
+	for (i = 0; i < LISTENER_MAX_ACCEPTS; i++)
 	{
 		peer_addr_size = sizeof(peer_addr);
-		peer_sockfd = accept(listener->sockfds[i], (struct sockaddr *)&peer_addr, &peer_addr_size);
+
+		/* the peer socket stays blocking, the peer sets its own mode */
+#ifdef HAVE_ACCEPT4
+		peer_sockfd = accept4(sockfd, (struct sockaddr *)&peer_addr, &peer_addr_size, SOCK_CLOEXEC);
+#else
+		peer_sockfd = accept(sockfd, (struct sockaddr *)&peer_addr, &peer_addr_size);
+#endif
 
 		if (peer_sockfd == -1)
 		{
@@ -176,17 +284,29 @@ static tbool freerdp_listener_check_fds(freerdp_listener* instance)
 
 			/* No data available */
 			if (wsa_error == WSAEWOULDBLOCK)
-				continue;
+				return true;
 #else
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+
+			/* the connection went away before it was accepted */
+			if (errno == ECONNABORTED || errno == EINTR)
 				continue;
 #endif
 			perror("accept");
 			return false;
 		}
 
+		freerdp_listener_set_peer_options(peer_sockfd);
+
 		client = freerdp_peer_new(peer_sockfd);
 
+		if (client == NULL)
+		{
+			close(peer_sockfd);
+			continue;
+		}
+
 		if (peer_addr.ss_family == AF_INET)
 			sin_addr = &(((struct sockaddr_in*)&peer_addr)->sin_addr);
 		else
@@ -199,6 +319,31 @@ static tbool freerdp_listener_check_fds(freerdp_listener* instance)
 	return true;
 }
 
+static tbool freerdp_listener_check_acceptor_fds(freerdp_listener* instance, int acceptor)
+{
+	rdpListener* listener = (rdpListener*)instance->listener;
+	tbool found = false;
+	int i;
+
+	for (i = 0; i < listener->num_sockfds; i++)
+	{
+		if (acceptor >= 0 && listener->acceptors[i] != acceptor)
+			continue;
+
+		if (freerdp_listener_accept(instance, listener->sockfds[i]) == false)
+			return false;
+
+		found = true;
+	}
+
+	return found;
+}
+
+static tbool freerdp_listener_check_fds(freerdp_listener* instance)
+{
+	return freerdp_listener_check_acceptor_fds(instance, -1);
+}
+
 freerdp_listener* freerdp_listener_new(void)
 {
 	freerdp_listener* instance;
@@ -209,6 +354,8 @@ freerdp_listener* freerdp_listener_new(void)
 	instance->GetFileDescriptor = freerdp_listener_get_fds;
 	instance->CheckFileDescriptor = freerdp_listener_check_fds;
 	instance->Close = freerdp_listener_close;
+	instance->GetAcceptorFileDescriptor = freerdp_listener_get_acceptor_fds;
+	instance->CheckAcceptorFileDescriptor = freerdp_listener_check_acceptor_fds;
 
 	listener = xnew(rdpListener);
 	listener->instance = instance;
@@ -223,6 +370,8 @@ void freerdp_listener_free(freerdp_listener* instance)
 	rdpListener* listener;
 
 	listener = (rdpListener*)instance->listener;
+	xfree(listener->sockfds);
+	xfree(listener->acceptors);
 	xfree(listener);
 
 	xfree(instance);
@@ -29,8 +29,11 @@ struct rdp_listener
 {
 	freerdp_listener* instance;
 
- 	int sockfds[5];
+	/* sockets of all the acceptors, with the acceptor serving each */
+	int* sockfds;
+	int* acceptors;
 	int num_sockfds;
+	int max_sockfds;
 };
 
 #endif
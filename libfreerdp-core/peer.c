@@ -36,3 +36,13 @@ void freerdp_peer_free(freerdp_peer* client)
 {
 }
 
+void freerdp_peer_set_queue_output(freerdp_peer* client, tbool queue)
+{
+	transport_set_queue_output(client->context->rdp->transport, queue);
+}
+
+int freerdp_peer_flush_output(freerdp_peer* client)
+{
+	return transport_flush(client->context->rdp->transport);
+}
+
@@ -62,8 +62,8 @@ static const char* const DATA_PDU_TYPE_STRINGS[] =
 		"ARC Status", /* 0x32 */
 		"", "", "", /* 0x33 - 0x35 */
 		"Status Info", /* 0x36 */
-		"Monitor Layout" /* 0x37 */
-		"", "", "", /* 0x38 - 0x40 */
+		"Monitor Layout", /* 0x37 */
+		"Frame Acknowledge", "", "", /* 0x38 - 0x40 */
 		"", "", "", "", "", "" /* 0x41 - 0x46 */
 };
 
@@ -392,31 +392,78 @@ static uint32 rdp_get_sec_bytes(rdpRdp* rdp)
  * @param channel_id channel id
  */
 
-tbool rdp_send(rdpRdp* rdp, STREAM* s, uint16 channel_id)
+static uint16 rdp_seal(rdpRdp* rdp, STREAM* s, uint16 channel_id)
 {
 	uint16 length;
-	uint32 sec_bytes;
-	uint8* sec_hold;
 
 	length = stream_get_length(s);
 	stream_set_pos(s, 0);
 
 	rdp_write_header(rdp, s, length, channel_id);
-
-	sec_bytes = rdp_get_sec_bytes(rdp);
-	sec_hold = s->p;
-	stream_seek(s, sec_bytes);
-
-	s->p = sec_hold;
 	length += rdp_security_stream_out(rdp, s, length);
 
 	stream_set_pos(s, length);
+
+	return length;
+}
+
+tbool rdp_send(rdpRdp* rdp, STREAM* s, uint16 channel_id)
+{
+	rdp_seal(rdp, s, channel_id);
+
 	if (transport_write(rdp->transport, s) < 0)
 		return false;
 
 	return true;
 }
 
+/**
+ * Initialize an RDP packet stream in the send batch.\n
+ * Packets added with rdp_batch_add are packed back to back and written
+ * to the transport together by rdp_batch_flush, which also happens
+ * whenever the next packet would not fit in RDP_BATCH_SIZE bytes.
+ * @param rdp RDP module
+ * @param size maximum payload size of the packet
+ * @return packet stream, valid until the next call
+ */
+
+STREAM* rdp_batch_stream_init(rdpRdp* rdp, int size)
+{
+	int needed;
+	STREAM* batch = rdp->batch_stream;
+
+	/* headers, security header and FIPS padding */
+	needed = RDP_PACKET_HEADER_MAX_LENGTH + 16 + 8 + size;
+
+	if (stream_get_length(batch) > 0 && stream_get_length(batch) + needed > RDP_BATCH_SIZE)
+		rdp_batch_flush(rdp);
+
+	stream_check_size(batch, needed);
+	stream_attach(rdp->batch_packet, stream_get_tail(batch), needed);
+	stream_seek(rdp->batch_packet, RDP_PACKET_HEADER_MAX_LENGTH);
+	rdp_security_stream_init(rdp, rdp->batch_packet);
+
+	return rdp->batch_packet;
+}
+
+void rdp_batch_add(rdpRdp* rdp, STREAM* s, uint16 channel_id)
+{
+	stream_seek(rdp->batch_stream, rdp_seal(rdp, s, channel_id));
+}
+
+tbool rdp_batch_flush(rdpRdp* rdp)
+{
+	int status = 0;
+
+	if (stream_get_length(rdp->batch_stream) > 0)
+	{
+		status = transport_write(rdp->transport, rdp->batch_stream);
+		stream_set_pos(rdp->batch_stream, 0);
+	}
+
+	return (status >= 0) ? true : false;
+}
+
 tbool rdp_send_pdu(rdpRdp* rdp, STREAM* s, uint16 type, uint16 channel_id)
 {
 	uint16 length;
@@ -480,6 +527,18 @@ void rdp_recv_set_error_info_data_pdu(rdpRdp* rdp, STREAM* s)
 		rdp_print_errinfo(rdp->errorInfo);
 }
 
+static void rdp_recv_frame_ack(rdpRdp* rdp, STREAM* s)
+{
+	uint32 frameId;
+
+	if (stream_get_left(s) < 4)
+		return;
+
+	stream_read_uint32(s, frameId); /* frameId (4 bytes) */
+
+	IFCALL(rdp->update->SurfaceFrameAcknowledge, rdp->update->context, frameId);
+}
+
 tbool rdp_recv_data_pdu(rdpRdp* rdp, STREAM* s)
 {
 	uint8 type;
@@ -540,6 +599,7 @@ tbool rdp_recv_data_pdu(rdpRdp* rdp, STREAM* s)
 			break;
 
 		case DATA_PDU_TYPE_REFRESH_RECT:
+			update_recv_refresh_rect(rdp->update, comp_stream);
 			break;
 
 		case DATA_PDU_TYPE_PLAY_SOUND:
@@ -547,6 +607,7 @@ tbool rdp_recv_data_pdu(rdpRdp* rdp, STREAM* s)
 			break;
 
 		case DATA_PDU_TYPE_SUPPRESS_OUTPUT:
+			update_recv_suppress_output(rdp->update, comp_stream);
 			break;
 
 		case DATA_PDU_TYPE_SHUTDOWN_REQUEST:
@@ -600,6 +661,10 @@ tbool rdp_recv_data_pdu(rdpRdp* rdp, STREAM* s)
 		case DATA_PDU_TYPE_MONITOR_LAYOUT:
 			break;
 
+		case DATA_PDU_TYPE_FRAME_ACKNOWLEDGE:
+			rdp_recv_frame_ack(rdp, comp_stream);
+			break;
+
 		default:
 			break;
 	}
@@ -938,7 +1003,7 @@ int rdp_send_frame_ack(rdpRdp* rdp, int frame)
 	}
 	s = rdp_data_pdu_init(rdp);
 	stream_write_uint32(s, frame);
-	rdp_send_data_pdu(rdp, s, 56, rdp->mcs->user_id);
+	rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_FRAME_ACKNOWLEDGE, rdp->mcs->user_id);
 	return 0;
 }
 
@@ -1025,6 +1090,8 @@ rdpRdp* rdp_new(freerdp* instance)
 		rdp->mcs = mcs_new(rdp->transport);
 		rdp->redirection = redirection_new();
 		rdp->mppc = mppc_new(rdp);
+		rdp->batch_stream = stream_new(RDP_BATCH_SIZE);
+		rdp->batch_packet = stream_new(0);
 	}
 
 	return rdp;
@@ -1050,6 +1117,9 @@ void rdp_free(rdpRdp* rdp)
 		mcs_free(rdp->mcs);
 		redirection_free(rdp->redirection);
 		mppc_free(rdp);
+		stream_free(rdp->batch_stream);
+		stream_detach(rdp->batch_packet);
+		stream_free(rdp->batch_packet);
 		xfree(rdp);
 	}
 }
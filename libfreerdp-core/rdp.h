@@ -67,6 +67,9 @@
 #define RDP_PACKET_HEADER_MAX_LENGTH \
   (TPDU_DATA_LENGTH + MCS_SEND_DATA_HEADER_MAX_LENGTH)
 
+/* largest transport write made of batched packets, one TLS record */
+#define RDP_BATCH_SIZE                  16384
+
 #define PDU_TYPE_DEMAND_ACTIVE      0x1
 #define PDU_TYPE_CONFIRM_ACTIVE     0x3
 #define PDU_TYPE_DEACTIVATE_ALL     0x6
@@ -104,6 +107,7 @@
 #define DATA_PDU_TYPE_ARC_STATUS                   0x32
 #define DATA_PDU_TYPE_STATUS_INFO                  0x36
 #define DATA_PDU_TYPE_MONITOR_LAYOUT               0x37
+#define DATA_PDU_TYPE_FRAME_ACKNOWLEDGE            0x38
 
 /* Compression Types */
 #define PACKET_COMPRESSED       0x20
@@ -158,6 +162,9 @@ struct rdp_rdp
 	uint32 errorInfo;
 	uint32 finalize_sc_pdus;
 	boolean disconnect;
+	STREAM* batch_stream;
+	STREAM* batch_packet;
+	uint32 connection_id; /* changes when the transport is replaced */
 };
 
 void rdp_read_security_header(STREAM* s, uint16* flags);
@@ -189,6 +196,10 @@ boolean rdp_send_data_pdu(rdpRdp* rdp, STREAM* s, uint8 type,
 boolean rdp_recv_data_pdu(rdpRdp* rdp, STREAM* s);
 
 boolean rdp_send(rdpRdp* rdp, STREAM* s, uint16 channel_id);
+
+STREAM* rdp_batch_stream_init(rdpRdp* rdp, int size);
+void rdp_batch_add(rdpRdp* rdp, STREAM* s, uint16 channel_id);
+boolean rdp_batch_flush(rdpRdp* rdp);
 void rdp_recv(rdpRdp* rdp);
 
 int rdp_send_channel_data(rdpRdp* rdp, int channel_id, uint8* data, int size);
@@ -17,8 +17,19 @@
  * limitations under the License.
  */
 
+#include <time.h>
 #include <freerdp/utils/stream.h>
 #include <freerdp/utils/memory.h>
+#include <freerdp/utils/file.h>
+#include <openssl/pem.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#endif
 
 #include "tls.h"
 
@@ -30,31 +41,509 @@
 
 static int g_total_read = 0;
 
+static void tls_context_ref(SSL_CTX* ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_CTX_up_ref(ctx);
+#else
+	CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#endif
+}
+
+/**
+ * Client sessions are cached per host:port, so that reconnecting to a
+ * server (auto-reconnect, redirection, the second gateway channel)
+ * resumes the TLS session instead of running a full handshake.
+ * A session is only cached once the server certificate passed
+ * verification, under the host name it was verified for.
+ * With persist_tls_sessions they are also kept in ~/.freerdp/sessions
+ * and survive a restart of the client.
+ */
+
+#define TLS_SESSION_CACHE_SIZE	32
+
+typedef struct tls_session_entry tlsSessionEntry;
+struct tls_session_entry
+{
+	char* key;
+	SSL_SESSION* session;
+	X509* verified_cert; /* server certificate which passed verification */
+	tlsSessionEntry* next;
+};
+
+#ifndef _WIN32
+static pthread_mutex_t tls_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tls_session_lock()	pthread_mutex_lock(&tls_session_mutex)
+#define tls_session_unlock()	pthread_mutex_unlock(&tls_session_mutex)
+#else
+#define tls_session_lock()	do { } while (0)
+#define tls_session_unlock()	do { } while (0)
+#endif
+
+static SSL_CTX* tls_client_ctx = NULL;
+static tlsSessionEntry* tls_session_entries = NULL;
+
+static char* tls_session_key(const char* hostname, int port)
+{
+	char* key;
+
+	if (hostname == NULL)
+		return NULL;
+
+	key = (char*) xmalloc(strlen(hostname) + 8);
+	sprintf(key, "%s:%d", hostname, port);
+
+	return key;
+}
+
+static char* tls_session_file(rdpTls* tls, const char* key)
+{
+	int i;
+	char* path;
+	char* name;
+	char* file;
+
+	if (!tls->settings->persist_tls_sessions || tls->settings->config_path == NULL)
+		return NULL;
+
+	path = freerdp_construct_path(tls->settings->config_path, (char*) "sessions");
+
+	if (freerdp_check_file_exists(path) == false)
+		freerdp_mkdir(path);
+
+	/* IPv6 addresses and the port separator are not portable in file names */
+	name = xstrdup(key);
+
+	for (i = 0; name[i] != '\0'; i++)
+	{
+		if (name[i] == ':' || name[i] == '/' || name[i] == '\\')
+			name[i] = '_';
+	}
+
+	file = freerdp_construct_path(path, name);
+
+	xfree(name);
+	xfree(path);
+
+	return file;
+}
+
+static void tls_session_save(rdpTls* tls, const char* key, SSL_SESSION* session)
+{
+	int fd;
+	FILE* fp;
+	char* file;
+
+	file = tls_session_file(tls, key);
+
+	if (file == NULL)
+		return;
+
+#ifndef _WIN32
+	/* the session holds the master secret, keep it private */
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	fp = (fd != -1) ? fdopen(fd, "w") : NULL;
+
+	if (fp == NULL && fd != -1)
+		close(fd);
+#else
+	fd = -1;
+	fp = fopen(file, "w");
+#endif
+
+	if (fp != NULL)
+	{
+		PEM_write_SSL_SESSION(fp, session);
+		fclose(fp);
+	}
+	else
+	{
+		printf("tls_session_save: error opening [%s] for writing\n", file);
+	}
+
+	xfree(file);
+}
+
+static SSL_SESSION* tls_session_load(rdpTls* tls, const char* key)
+{
+	FILE* fp;
+	char* file;
+	SSL_SESSION* session = NULL;
+
+	file = tls_session_file(tls, key);
+
+	if (file == NULL)
+		return NULL;
+
+	fp = fopen(file, "r");
+
+	if (fp != NULL)
+	{
+		session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL);
+		fclose(fp);
+	}
+
+	xfree(file);
+
+	return session;
+}
+
+static tbool tls_session_expired(SSL_SESSION* session)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (!SSL_SESSION_is_resumable(session))
+		return true;
+#endif
+
+	return (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <= time(NULL)) ? true : false;
+}
+
+static void tls_session_entry_free(tlsSessionEntry* entry)
+{
+	if (entry->session != NULL)
+		SSL_SESSION_free(entry->session);
+
+	if (entry->verified_cert != NULL)
+		X509_free(entry->verified_cert);
+
+	xfree(entry->key);
+	xfree(entry);
+}
+
+/**
+ * Find the entry of a host, moving it to the front of the cache.
+ * Creates the entry when create is set, evicting the least recently used one.
+ * Must be called with the session lock held.
+ */
+
+static tlsSessionEntry* tls_session_find(const char* key, tbool create)
+{
+	int count;
+	tlsSessionEntry* prev = NULL;
+	tlsSessionEntry* entry;
+
+	for (entry = tls_session_entries; entry != NULL; prev = entry, entry = entry->next)
+	{
+		if (strcmp(entry->key, key) == 0)
+		{
+			if (prev != NULL)
+			{
+				prev->next = entry->next;
+				entry->next = tls_session_entries;
+				tls_session_entries = entry;
+			}
+
+			return entry;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	entry = xnew(tlsSessionEntry);
+	entry->key = xstrdup(key);
+	entry->next = tls_session_entries;
+	tls_session_entries = entry;
+
+	for (count = 1, prev = entry; prev->next != NULL; count++, prev = prev->next)
+	{
+		if (count == TLS_SESSION_CACHE_SIZE)
+		{
+			tls_session_entry_free(prev->next);
+			prev->next = NULL;
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/**
+ * Get a reference to the cached session of the target of a connection,
+ * falling back to the one kept on disk.
+ */
+
+static SSL_SESSION* tls_session_get(rdpTls* tls)
+{
+	char* key;
+	tlsSessionEntry* entry;
+	SSL_SESSION* session = NULL;
+
+	key = tls_session_key(tls->hostname, tls->port);
+
+	if (key == NULL)
+		return NULL;
+
+	tls_session_lock();
+
+	entry = tls_session_find(key, false);
+
+	if (entry != NULL && entry->session != NULL)
+	{
+		if (tls_session_expired(entry->session))
+		{
+			SSL_SESSION_free(entry->session);
+			entry->session = NULL;
+		}
+		else
+		{
+			session = entry->session;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+			SSL_SESSION_up_ref(session);
+#else
+			CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+#endif
+		}
+	}
+
+	tls_session_unlock();
+
+	if (session == NULL)
+	{
+		session = tls_session_load(tls, key);
+
+		if (session != NULL && tls_session_expired(session))
+		{
+			SSL_SESSION_free(session);
+			session = NULL;
+		}
+	}
+
+	xfree(key);
+
+	return session;
+}
+
+/**
+ * Forget the session of the target of a connection,
+ * after the server failed to resume it.
+ */
+
+static void tls_session_remove(rdpTls* tls)
+{
+	char* key;
+	char* file;
+	tlsSessionEntry* entry;
+
+	key = tls_session_key(tls->hostname, tls->port);
+
+	if (key == NULL)
+		return;
+
+	tls_session_lock();
+
+	entry = tls_session_find(key, false);
+
+	if (entry != NULL && entry->session != NULL)
+	{
+		SSL_SESSION_free(entry->session);
+		entry->session = NULL;
+	}
+
+	tls_session_unlock();
+
+	file = tls_session_file(tls, key);
+
+	if (file != NULL)
+	{
+		remove(file);
+		xfree(file);
+	}
+
+	xfree(key);
+}
+
+/**
+ * Cache a session of a connection under the host name its certificate
+ * was verified for, and keep it on disk. Takes over the reference.
+ */
+
+static void tls_session_store(rdpTls* tls, const char* hostname, SSL_SESSION* session)
+{
+	char* key;
+	tlsSessionEntry* entry;
+
+	key = tls_session_key(hostname, tls->port);
+
+	if (key == NULL)
+	{
+		SSL_SESSION_free(session);
+		return;
+	}
+
+	tls_session_save(tls, key, session);
+
+	tls_session_lock();
+
+	entry = tls_session_find(key, true);
+
+	if (entry->session != NULL)
+		SSL_SESSION_free(entry->session);
+
+	entry->session = session;
+
+	tls_session_unlock();
+
+	xfree(key);
+}
+
+/**
+ * Called by OpenSSL when the server issues a session: after a full
+ * handshake, or when a TLS 1.3 ticket is received. The full handshake
+ * completes before the certificate is verified, the session is held
+ * back until then.
+ */
+
+static int tls_new_session(SSL* ssl, SSL_SESSION* session)
+{
+	rdpTls* tls = (rdpTls*) SSL_get_app_data(ssl);
+
+	if (tls == NULL)
+		return 0;
+
+	if (tls->verified_hostname != NULL)
+	{
+		tls_session_store(tls, tls->verified_hostname, session);
+		return 1;
+	}
+
+	if (tls->pending_session != NULL)
+		SSL_SESSION_free(tls->pending_session);
+
+	tls->pending_session = session;
+
+	/* the connection or the cache holds the reference */
+	return 1;
+}
+
+/**
+ * Check whether the server certificate of a connection is the one
+ * which passed verification earlier for the same host.
+ */
+
+static tbool tls_session_cert_verified(rdpTls* tls, const char* hostname, X509* cert)
+{
+	char* key;
+	tbool verified = false;
+	tlsSessionEntry* entry;
+
+	key = tls_session_key(hostname, tls->port);
+
+	if (key == NULL)
+		return false;
+
+	tls_session_lock();
+
+	entry = tls_session_find(key, false);
+
+	if (entry != NULL && entry->verified_cert != NULL)
+		verified = (X509_cmp(entry->verified_cert, cert) == 0) ? true : false;
+
+	tls_session_unlock();
+
+	xfree(key);
+
+	return verified;
+}
+
+static void tls_session_set_verified(rdpTls* tls, const char* hostname, X509* cert)
+{
+	char* key;
+	tlsSessionEntry* entry;
+
+	key = tls_session_key(hostname, tls->port);
+
+	if (key == NULL)
+		return;
+
+	tls_session_lock();
+
+	entry = tls_session_find(key, true);
+
+	if (entry->verified_cert != NULL)
+		X509_free(entry->verified_cert);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	X509_up_ref(cert);
+#else
+	CRYPTO_add(&cert->references, 1, CRYPTO_LOCK_X509);
+#endif
+	entry->verified_cert = cert;
+
+	tls_session_unlock();
+
+	xfree(key);
+}
+
+/**
+ * Get a reference to the context shared by all client connections.
+ */
+
+static SSL_CTX* tls_get_client_context(void)
+{
+	SSL_CTX* ctx;
+
+	tls_session_lock();
+
+	if (tls_client_ctx == NULL)
+	{
+		ctx = SSL_CTX_new(SSLv23_client_method());
+
+		if (ctx == NULL)
+		{
+			tls_session_unlock();
+			printf("SSL_CTX_new failed\n");
+			return NULL;
+		}
+
+		/*
+		 * This is necessary, because the Microsoft TLS implementation is not perfect.
+		 * SSL_OP_ALL enables a couple of workarounds for buggy TLS implementations,
+		 * but the most important workaround being SSL_OP_TLS_BLOCK_PADDING_BUG.
+		 * As the size of the encrypted payload may give hints about its contents,
+		 * block padding is normally used, but the Microsoft TLS implementation
+		 * won't recognize it and will disconnect you after sending a TLS alert.
+		 */
+		SSL_CTX_set_options(ctx, SSL_OP_ALL);
+
+		// Explicitly disable deprecated SSL protocols
+		SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, tls_new_session);
+
+		tls_client_ctx = ctx;
+	}
+
+	ctx = tls_client_ctx;
+	tls_context_ref(ctx);
+
+	tls_session_unlock();
+
+	return ctx;
+}
+
+/**
+ * Set the host and port a connection is made to, which identify its cached session.
+ */
+
+void tls_set_target(rdpTls* tls, const char* hostname, int port)
+{
+	xfree(tls->hostname);
+	tls->hostname = (hostname != NULL) ? xstrdup(hostname) : NULL;
+	tls->port = port;
+}
+
 tbool tls_connect(rdpTls* tls)
 {
 	int connection_status;
+	SSL_SESSION* session;
 
 	LLOGLN(10, ("tls_connect:"));
-	tls->ctx = SSL_CTX_new(SSLv23_client_method());
+	tls->ctx = tls_get_client_context();
 
 	if (tls->ctx == NULL)
-	{
-		printf("SSL_CTX_new failed\n");
 		return false;
-	}
-
-	/*
-	 * This is necessary, because the Microsoft TLS implementation is not perfect.
-	 * SSL_OP_ALL enables a couple of workarounds for buggy TLS implementations,
-	 * but the most important workaround being SSL_OP_TLS_BLOCK_PADDING_BUG.
-	 * As the size of the encrypted payload may give hints about its contents,
-	 * block padding is normally used, but the Microsoft TLS implementation
-	 * won't recognize it and will disconnect you after sending a TLS alert.
-	 */
-	SSL_CTX_set_options(tls->ctx, SSL_OP_ALL);
-	
-	// Explicitly disable deprecated SSL protocols
-	SSL_CTX_set_options(tls->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
 
 	tls->ssl = SSL_new(tls->ctx);
 
@@ -64,52 +553,195 @@ tbool tls_connect(rdpTls* tls)
 		return false;
 	}
 
+	SSL_set_app_data(tls->ssl, tls);
+
 	if (SSL_set_fd(tls->ssl, tls->sockfd) < 1)
 	{
 		printf("SSL_set_fd failed\n");
 		return false;
 	}
 
+	session = tls_session_get(tls);
+
+	if (session != NULL)
+	{
+		SSL_set_session(tls->ssl, session);
+		SSL_SESSION_free(session);
+	}
+
 	connection_status = SSL_connect(tls->ssl);
 
 	if (connection_status <= 0)
 	{
 		if (tls_print_error("SSL_connect", tls->ssl, connection_status))
+		{
+			if (session != NULL)
+				tls_session_remove(tls);
+
 			return false;
+		}
 	}
 
+	LLOGLN(10, ("tls_connect: session %s", SSL_session_reused(tls->ssl) ? "resumed" : "negotiated"));
+
 	return true;
 }
 
-tbool tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file)
+#define TLS_SESSION_TIMEOUT	3600 /* seconds a session can be resumed */
+
+/**
+ * Build the context of a server certificate. A context is shared by all
+ * the connections using the certificate: the key is loaded once, and the
+ * session cache and ticket keys it holds let returning clients resume.
+ */
+
+static SSL_CTX* tls_server_context_new(const char* cert_file, const char* privatekey_file)
 {
-	int connection_status;
+	SSL_CTX* ctx;
 
-	tls->ctx = SSL_CTX_new(TLSv1_server_method());
+	ctx = SSL_CTX_new(TLSv1_server_method());
 
-	if (tls->ctx == NULL)
+	if (ctx == NULL)
 	{
 		printf("SSL_CTX_new failed\n");
-		return false;
+		return NULL;
 	}
 
-	if (SSL_CTX_use_RSAPrivateKey_file(tls->ctx, privatekey_file, SSL_FILETYPE_PEM) <= 0)
+	if (SSL_CTX_use_RSAPrivateKey_file(ctx, privatekey_file, SSL_FILETYPE_PEM) <= 0)
 	{
 		printf("SSL_CTX_use_RSAPrivateKey_file failed\n");
-		return false;
+		SSL_CTX_free(ctx);
+		return NULL;
 	}
 
-	tls->ssl = SSL_new(tls->ctx);
+	if (SSL_CTX_use_certificate_file(ctx, cert_file, SSL_FILETYPE_PEM) <= 0)
+	{
+		printf("SSL_CTX_use_certificate_file failed\n");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
 
-	if (tls->ssl == NULL)
+	/* a write the socket did not take is retried from the transport output queue */
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char*) "FreeRDP", 7);
+	SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+
+	return ctx;
+}
+
+typedef struct tls_server_entry tlsServerEntry;
+struct tls_server_entry
+{
+	char* cert_file;
+	char* privatekey_file;
+	SSL_CTX* ctx;
+	tlsServerEntry* next;
+};
+
+#ifndef _WIN32
+static pthread_mutex_t tls_server_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define tls_server_lock()	pthread_mutex_lock(&tls_server_mutex)
+#define tls_server_unlock()	pthread_mutex_unlock(&tls_server_mutex)
+#else
+#define tls_server_lock()	do { } while (0)
+#define tls_server_unlock()	do { } while (0)
+#endif
+
+static tlsServerEntry* tls_server_entries = NULL;
+
+/**
+ * Get a reference to the context of a server certificate,
+ * building it the first time the certificate is used.
+ */
+
+static SSL_CTX* tls_get_server_context(const char* cert_file, const char* privatekey_file)
+{
+	SSL_CTX* ctx = NULL;
+	tlsServerEntry* entry;
+
+	tls_server_lock();
+
+	for (entry = tls_server_entries; entry != NULL; entry = entry->next)
 	{
-		printf("SSL_new failed\n");
-		return false;
+		if (strcmp(entry->cert_file, cert_file) == 0 &&
+			strcmp(entry->privatekey_file, privatekey_file) == 0)
+		{
+			ctx = entry->ctx;
+			break;
+		}
+	}
+
+	if (ctx == NULL)
+	{
+		ctx = tls_server_context_new(cert_file, privatekey_file);
+
+		if (ctx != NULL)
+		{
+			entry = xnew(tlsServerEntry);
+			entry->cert_file = xstrdup(cert_file);
+			entry->privatekey_file = xstrdup(privatekey_file);
+			entry->ctx = ctx;
+			entry->next = tls_server_entries;
+			tls_server_entries = entry;
+		}
 	}
 
-	if (SSL_use_certificate_file(tls->ssl, cert_file, SSL_FILETYPE_PEM) <= 0)
+	if (ctx != NULL)
+		tls_context_ref(ctx);
+
+	tls_server_unlock();
+
+	return ctx;
+}
+
+#define TLS_ACCEPT_TIMEOUT	10 /* seconds */
+
+/**
+ * Bound the time a blocking socket waits on a client that stopped
+ * answering, saving the previous timeouts in old[2] when new is set.
+ */
+
+static void tls_set_socket_timeouts(int sockfd, struct timeval* new, struct timeval* old)
+{
+#ifndef _WIN32
+	socklen_t length;
+
+	if (new == NULL)
 	{
-		printf("SSL_use_certificate_file failed\n");
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &old[0], sizeof(struct timeval));
+		setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &old[1], sizeof(struct timeval));
+		return;
+	}
+
+	length = sizeof(struct timeval);
+	getsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &old[0], &length);
+	length = sizeof(struct timeval);
+	getsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &old[1], &length);
+
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, new, sizeof(struct timeval));
+	setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, new, sizeof(struct timeval));
+#endif
+}
+
+tbool tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file)
+{
+	int connection_status;
+	struct timeval timeout;
+	struct timeval saved[2];
+
+	tls->ctx = tls_get_server_context(cert_file, privatekey_file);
+
+	if (tls->ctx == NULL)
+		return false;
+
+	tls->ssl = SSL_new(tls->ctx);
+
+	if (tls->ssl == NULL)
+	{
+		printf("SSL_new failed\n");
 		return false;
 	}
 
@@ -119,14 +751,27 @@ tbool tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file
 		return false;
 	}
 
+	/* the handshake blocks its thread, so a silent client must not hold it forever */
+	memset(saved, 0, sizeof(saved));
+	timeout.tv_sec = TLS_ACCEPT_TIMEOUT;
+	timeout.tv_usec = 0;
+	tls_set_socket_timeouts(tls->sockfd, &timeout, saved);
+
 	connection_status = SSL_accept(tls->ssl);
 
+	tls_set_socket_timeouts(tls->sockfd, NULL, saved);
+
 	if (connection_status <= 0)
 	{
-		if (tls_print_error("SSL_accept", tls->ssl, connection_status))
-			return false;
+		/* on a blocking socket, wanting more data means the deadline passed */
+		tls_print_error("SSL_accept", tls->ssl, connection_status);
+		printf("tls_accept: handshake failed or timed out\n");
+		return false;
 	}
 
+	if (SSL_session_reused(tls->ssl))
+		printf("TLS session resumed\n");
+
 	printf("TLS connection accepted\n");
 
 	return true;
@@ -331,7 +976,7 @@ CryptoCert tls_get_certificate(rdpTls* tls)
 	return cert;
 }
 
-tbool tls_verify_certificate(rdpTls* tls, CryptoCert cert, char* hostname)
+static tbool tls_check_certificate(rdpTls* tls, CryptoCert cert, char* hostname)
 {
 	int match;
 	int index;
@@ -457,6 +1102,39 @@ tbool tls_verify_certificate(rdpTls* tls, CryptoCert cert, char* hostname)
 	return false;
 }
 
+/**
+ * Verify the server certificate of a connection. A certificate which
+ * passed verification for the same host is accepted again without
+ * going through the certificate store, which makes reconnecting cheaper.
+ * Only then the session of the connection is cached.
+ */
+
+tbool tls_verify_certificate(rdpTls* tls, CryptoCert cert, char* hostname)
+{
+	if (!tls_session_cert_verified(tls, hostname, cert->px509))
+	{
+		if (!tls_check_certificate(tls, cert, hostname))
+			return false;
+
+		if (!tls->settings->ignore_certificate)
+			tls_session_set_verified(tls, hostname, cert->px509);
+	}
+
+	if (hostname == NULL)
+		return true;
+
+	xfree(tls->verified_hostname);
+	tls->verified_hostname = xstrdup(hostname);
+
+	if (tls->pending_session != NULL)
+	{
+		tls_session_store(tls, hostname, tls->pending_session);
+		tls->pending_session = NULL;
+	}
+
+	return true;
+}
+
 void tls_print_certificate_error(char* hostname, char* fingerprint)
 {
 	printf("The host key for %s has changed\n", hostname);
@@ -526,13 +1204,28 @@ void tls_free(rdpTls* tls)
 	if (tls != NULL)
 	{
 		if (tls->ssl)
+		{
+			/*
+			 * OpenSSL invalidates the session of a connection which was not
+			 * shut down, but a dropped network connection should be resumed:
+			 * a TLS failure already invalidates the session with its alert.
+			 */
+			if (tls->hostname != NULL)
+				SSL_set_shutdown(tls->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+
 			SSL_free(tls->ssl);
+		}
 
 		if (tls->ctx)
 			SSL_CTX_free(tls->ctx);
 
 		certificate_store_free(tls->certificate_store);
 
+		if (tls->pending_session != NULL)
+			SSL_SESSION_free(tls->pending_session);
+
+		xfree(tls->verified_hostname);
+		xfree(tls->hostname);
 		xfree(tls);
 	}
 }
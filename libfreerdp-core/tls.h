@@ -36,11 +36,16 @@ struct rdp_tls
 	SSL* ssl;
 	int sockfd;
 	SSL_CTX* ctx;
+	char* hostname;
+	int port;
+	char* verified_hostname; /* host the certificate passed verification for */
+	SSL_SESSION* pending_session; /* issued before the certificate was verified */
 	rdpSettings* settings;
 	rdpCertificateStore* certificate_store;
 	STREAM* read_extra;
 };
 
+void tls_set_target(rdpTls* tls, const char* hostname, int port);
 boolean tls_connect(rdpTls* tls);
 boolean tls_accept(rdpTls* tls, const char* cert_file, const char* privatekey_file);
 boolean tls_disconnect(rdpTls* tls);
@@ -66,6 +66,7 @@ STREAM* transport_send_stream_init(rdpTransport* transport, int size)
 
 boolean transport_tsg_connect(rdpTransport* transport, const char* hostname, uint16 port)
 {
+	uint32 start;
 	rdpTsg* tsg = tsg_new(transport->settings);
 	tsg->transport = transport;
 	transport->tsg = tsg;
@@ -83,6 +84,10 @@ boolean transport_tsg_connect(rdpTransport* transport, const char* hostname, uin
 		transport->tls_out = tls_new(transport->settings);
 	}
 	transport->tls_out->sockfd = transport->tcp_out->sockfd;
+	/* the second channel resumes the session of the first one */
+	tls_set_target(transport->tls_in, transport->settings->tsg_server, 443);
+	tls_set_target(transport->tls_out, transport->settings->tsg_server, 443);
+	start = freerdp_get_mstime();
 	if (tls_connect(transport->tls_in) == false)
 	{
 		LLOGLN(0, ("transport_tsg_connect: tls_in tls_connect failed"));
@@ -94,6 +99,7 @@ boolean transport_tsg_connect(rdpTransport* transport, const char* hostname, uin
 		LLOGLN(0, ("transport_tsg_connect: tls_out tls_connect failed"));
 		return false;
 	}
+	transport->tls_time += freerdp_get_mstime() - start;
 	LLOGLN(10, ("transport_tsg_connect: tls_out tls_connect ok"));
 	if (!tsg_connect(tsg, hostname, port))
 	{
@@ -108,6 +114,7 @@ boolean transport_tsg_connect(rdpTransport* transport, const char* hostname, uin
 tbool transport_connect(rdpTransport* transport, const char* hostname, uint16 port)
 {
 	tbool ok;
+	uint32 start;
 
 	LLOGLN(10, ("transport_connect:"));
 	if (transport->settings->tsg)
@@ -115,10 +122,12 @@ tbool transport_connect(rdpTransport* transport, const char* hostname, uint16 po
 		LLOGLN(10, ("transport_connect: settings->tsg set"));
 		transport->layer = TRANSPORT_LAYER_TSG;
 		transport->tcp_out = tcp_new(transport->settings);
+		start = freerdp_get_mstime();
 		ok = tcp_connect(transport->tcp_in, transport->settings->tsg_server, 443);
 		if (ok)
 		{
 			ok = tcp_connect(transport->tcp_out, transport->settings->tsg_server, 443);
+			transport->tcp_time += freerdp_get_mstime() - start;
 			if (ok)
 			{
 				ok = transport_tsg_connect(transport, hostname, port);
@@ -146,7 +155,10 @@ tbool transport_connect(rdpTransport* transport, const char* hostname, uint16 po
 	{
 		LLOGLN(10, ("transport_connect: settings->tsg not set"));
 		transport->tcp_out = transport->tcp_in;
-		return tcp_connect(transport->tcp_in, hostname, port);
+		start = freerdp_get_mstime();
+		ok = tcp_connect(transport->tcp_in, hostname, port);
+		transport->tcp_time += freerdp_get_mstime() - start;
+		return ok;
 	}
 }
 
@@ -171,30 +183,31 @@ tbool transport_connect_rdp(rdpTransport* transport)
 
 tbool transport_connect_tls(rdpTransport* transport)
 {
+	tbool status;
+	uint32 start;
+
 	if (transport->tls_in == NULL)
 		transport->tls_in = tls_new(transport->settings);
 
 	transport->layer = TRANSPORT_LAYER_TLS;
 	transport->tls_in->sockfd = transport->tcp_in->sockfd;
+	tls_set_target(transport->tls_in, transport->settings->hostname, transport->settings->port);
 
-	if (tls_connect(transport->tls_in) == false)
-		return false;
+	start = freerdp_get_mstime();
+	status = tls_connect(transport->tls_in);
+	transport->tls_time += freerdp_get_mstime() - start;
 
-	return true;
+	return status;
 }
 
 tbool transport_connect_nla(rdpTransport* transport)
 {
+	int status;
+	uint32 start;
 	freerdp* instance;
 	rdpSettings* settings;
 
-	if (transport->tls_in == NULL)
-		transport->tls_in = tls_new(transport->settings);
-
-	transport->layer = TRANSPORT_LAYER_TLS;
-	transport->tls_in->sockfd = transport->tcp_in->sockfd;
-
-	if (tls_connect(transport->tls_in) == false)
+	if (transport_connect_tls(transport) == false)
 		return false;
 
 	/* Network Level Authentication */
@@ -208,7 +221,11 @@ tbool transport_connect_nla(rdpTransport* transport)
 	if (transport->credssp == NULL)
 		transport->credssp = credssp_new(instance, transport->tls_in, settings);
 
-	if (credssp_authenticate(transport->credssp) < 0)
+	start = freerdp_get_mstime();
+	status = credssp_authenticate(transport->credssp);
+	transport->credssp_time += freerdp_get_mstime() - start;
+
+	if (status < 0)
 	{
 		printf("Authentication failure, check credentials.\n"
 			"If credentials are valid, the NTLMSSP implementation may be to blame.\n");
@@ -472,6 +489,125 @@ static int transport_read_nonblocking(rdpTransport* transport)
 	return status;
 }
 
+static int transport_write_layer(rdpTransport* transport, uint8* data, int length)
+{
+	int status = -1;
+
+	switch (transport->layer)
+	{
+		case TRANSPORT_LAYER_TLS:
+			status = tls_write(transport->tls_in, data, length);
+			break;
+		case TRANSPORT_LAYER_TCP:
+			status = tcp_write(transport->tcp_in, data, length);
+			break;
+		case TRANSPORT_LAYER_TSG:
+			status = tsg_write(transport->tsg, data, length);
+			break;
+		default:
+			LLOGLN(0, ("transport_write: unknown transport->layer %d", transport->layer));
+			break;
+	}
+
+	return status;
+}
+
+/**
+ * Write as much of the queued output as the socket takes.
+ * @return number of bytes still queued, -1 on error
+ */
+
+int transport_flush(rdpTransport* transport)
+{
+	int status;
+	int queued;
+	int offset = 0;
+	STREAM* s = transport->send_queue;
+
+	if (s == NULL)
+		return 0;
+
+	queued = stream_get_pos(s);
+
+	while (offset < queued)
+	{
+		status = transport_write_layer(transport, s->data + offset, queued - offset);
+
+		if (status < 0)
+		{
+			transport->layer = TRANSPORT_LAYER_CLOSED;
+			return -1;
+		}
+
+		if (status == 0)
+			break;
+
+		offset += status;
+	}
+
+	if (offset > 0)
+	{
+		memmove(s->data, s->data + offset, queued - offset);
+		stream_set_pos(s, queued - offset);
+	}
+
+	return queued - offset;
+}
+
+/**
+ * Queue output instead of waiting for the socket when it is full, so that
+ * the thread serving the transport never stalls on a slow link. This puts
+ * the socket in non-blocking mode; the owner flushes the queue with
+ * transport_flush once the socket is writable again.
+ */
+
+void transport_set_queue_output(rdpTransport* transport, tbool queue)
+{
+	transport->queue_output = queue;
+	tcp_set_blocking_mode(transport->tcp_in, !queue);
+
+	if (queue && transport->send_queue == NULL)
+		transport->send_queue = stream_new(BUFFER_SIZE);
+}
+
+static int transport_write_queued(rdpTransport* transport, uint8* data, int length)
+{
+	int status;
+	int queued;
+	int total = length;
+
+	/* nothing may overtake the output already queued */
+	queued = transport_flush(transport);
+
+	if (queued < 0)
+		return -1;
+
+	while (queued == 0 && length > 0)
+	{
+		status = transport_write_layer(transport, data, length);
+
+		if (status < 0)
+		{
+			transport->layer = TRANSPORT_LAYER_CLOSED;
+			return -1;
+		}
+
+		if (status == 0)
+			break;
+
+		data += status;
+		length -= status;
+	}
+
+	if (length > 0)
+	{
+		stream_check_size(transport->send_queue, length);
+		stream_write(transport->send_queue, data, length);
+	}
+
+	return total;
+}
+
 int transport_write(rdpTransport* transport, STREAM* s)
 {
 	int status = -1;
@@ -490,23 +626,12 @@ int transport_write(rdpTransport* transport, STREAM* s)
 	}
 #endif
 
+	if (transport->queue_output && transport->layer != TRANSPORT_LAYER_TSG)
+		return transport_write_queued(transport, stream_get_head(s), length);
+
 	while (length > 0)
 	{
-		switch (transport->layer)
-		{
-			case TRANSPORT_LAYER_TLS:
-				status = tls_write(transport->tls_in, stream_get_tail(s), length);
-				break;
-			case TRANSPORT_LAYER_TCP:
-				status = tcp_write(transport->tcp_in, stream_get_tail(s), length);
-				break;
-			case TRANSPORT_LAYER_TSG:
-				status = tsg_write(transport->tsg, stream_get_tail(s), length);
-				break;
-			default:
-				LLOGLN(0, ("transport_write: unknown transport->layer %d", transport->layer));
-				break;
-		}
+		status = transport_write_layer(transport, stream_get_tail(s), length);
 
 		if (status < 0)
 			break; /* error occurred */
@@ -586,6 +711,29 @@ static int do_callback(rdpTransport* transport, STREAM* s)
 	return rv;
 }
 
+/**
+ * Wait up to millis for data to read on the transport.
+ */
+
+void transport_wait(rdpTransport* transport, int millis)
+{
+	rdpTls* tls;
+
+	/* a gateway connection reads through its out channel */
+	if (transport->layer == TRANSPORT_LAYER_TSG)
+		tls = transport->tls_out;
+	else if (transport->layer == TRANSPORT_LAYER_TLS)
+		tls = transport->tls_in;
+	else
+		tls = NULL;
+
+	/* records already decrypted by OpenSSL do not make the socket readable */
+	if (tls != NULL && tls->ssl != NULL && SSL_pending(tls->ssl) > 0)
+		return;
+
+	tcp_can_recv(transport->tcp_out->sockfd, millis);
+}
+
 int transport_check_fds(rdpTransport* transport)
 {
 	int pos;
@@ -812,6 +960,8 @@ void transport_free(rdpTransport* transport)
 		stream_free(transport->recv_stream);
 		stream_free(transport->send_stream);
 		stream_free(transport->proc_buffer);
+		if (transport->send_queue != NULL)
+			stream_free(transport->send_queue);
 		if (transport->tls_in)
 		{
 			tls_free(transport->tls_in);
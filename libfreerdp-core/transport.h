@@ -63,6 +63,15 @@ struct rdp_transport
 	int level;
 	STREAM* proc_buffer;
 	int tsg_frag_state;
+
+	/* output kept while the socket is full, see transport_set_queue_output */
+	boolean queue_output;
+	STREAM* send_queue;
+
+	/* time spent in the connection phases, in milliseconds */
+	uint32 tcp_time;
+	uint32 tls_time;
+	uint32 credssp_time;
 };
 
 STREAM* transport_recv_stream_init(rdpTransport* transport, int size);
@@ -78,8 +87,11 @@ boolean transport_accept_tls(rdpTransport* transport);
 boolean transport_accept_nla(rdpTransport* transport);
 int transport_read(rdpTransport* transport, STREAM* s);
 int transport_write(rdpTransport* transport, STREAM* s);
+void transport_set_queue_output(rdpTransport* transport, boolean queue);
+int transport_flush(rdpTransport* transport);
 void transport_get_fds(rdpTransport* transport, void** rfds, int* rcount);
 int transport_check_fds(rdpTransport* transport);
+void transport_wait(rdpTransport* transport, int millis);
 boolean transport_set_blocking_mode(rdpTransport* transport, boolean blocking);
 rdpTransport* transport_new(rdpSettings* settings);
 void transport_free(rdpTransport* transport);
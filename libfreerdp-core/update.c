@@ -155,6 +155,46 @@ void update_recv_play_sound(rdpUpdate* update, STREAM* s)
 	update->PlaySound(update->context, &update->play_sound);
 }
 
+void update_recv_refresh_rect(rdpUpdate* update, STREAM* s)
+{
+	int i;
+	uint8 count;
+	RECTANGLE_16 areas[256];
+
+	if (stream_get_left(s) < 4)
+		return;
+
+	stream_read_uint8(s, count); /* numberOfAreas (1 byte) */
+	stream_seek(s, 3); /* pad3Octets (3 bytes) */
+
+	if (stream_get_left(s) < count * 8)
+		return;
+
+	for (i = 0; i < count; i++)
+		freerdp_read_rectangle_16(s, &areas[i]);
+
+	IFCALL(update->RefreshRect, update->context, count, areas);
+}
+
+void update_recv_suppress_output(rdpUpdate* update, STREAM* s)
+{
+	uint8 allow;
+	RECTANGLE_16 area;
+
+	if (stream_get_left(s) < 4)
+		return;
+
+	stream_read_uint8(s, allow); /* allowDisplayUpdates (1 byte) */
+	stream_seek(s, 3); /* pad3Octets (3 bytes) */
+
+	memset(&area, 0, sizeof(area));
+
+	if (allow > 0 && stream_get_left(s) >= 8)
+		freerdp_read_rectangle_16(s, &area);
+
+	IFCALL(update->SuppressOutput, update->context, allow, &area);
+}
+
 void update_read_pointer_position(STREAM* s, POINTER_POSITION_UPDATE* pointer_position)
 {
 	stream_read_uint16(s, pointer_position->xPos); /* xPos (2 bytes) */
@@ -44,6 +44,8 @@ void update_read_bitmap(rdpUpdate* update, STREAM* s, BITMAP_UPDATE* bitmap_upda
 void update_read_palette(rdpUpdate* update, STREAM* s, PALETTE_UPDATE* palette_update);
 void update_recv_play_sound(rdpUpdate* update, STREAM* s);
 void update_recv_pointer(rdpUpdate* update, STREAM* s);
+void update_recv_refresh_rect(rdpUpdate* update, STREAM* s);
+void update_recv_suppress_output(rdpUpdate* update, STREAM* s);
 void update_recv(rdpUpdate* update, STREAM* s);
 
 void update_read_pointer_position(STREAM* s, POINTER_POSITION_UPDATE* pointer_position);
@@ -70,7 +70,7 @@ HGDI_DC gdi_CreateDC(HCLRCONV clrconv, int bpp)
 	hDC->invert = clrconv->invert;
 	hDC->rgb555 = clrconv->rgb555;
 
-	hDC->hwnd = (HGDI_WND) malloc(sizeof(GDI_WND));
+	hDC->hwnd = (HGDI_WND) calloc(1, sizeof(GDI_WND));
 	hDC->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	hDC->hwnd->invalid->null = 1;
 
@@ -219,6 +219,9 @@ int gdi_DeleteDC(HGDI_DC hdc)
 		if (hdc->hwnd->cinvalid != NULL)
 			free(hdc->hwnd->cinvalid);
 
+		if (hdc->hwnd->scratch != NULL)
+			free(hdc->hwnd->scratch);
+
 		if (hdc->hwnd->invalid != NULL)
 			free(hdc->hwnd->invalid);
 
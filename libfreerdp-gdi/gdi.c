@@ -792,7 +792,7 @@ void gdi_init_primary(rdpGdi* gdi)
 	if (gdi->drawing == NULL)
 		gdi->drawing = gdi->primary;
 
-	gdi->primary->hdc->hwnd = (HGDI_WND) malloc(sizeof(GDI_WND));
+	gdi->primary->hdc->hwnd = (HGDI_WND) calloc(1, sizeof(GDI_WND));
 	gdi->primary->hdc->hwnd->invalid = gdi_CreateRectRgn(0, 0, 0, 0);
 	gdi->primary->hdc->hwnd->invalid->null = 1;
 
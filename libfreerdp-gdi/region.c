@@ -349,8 +349,337 @@ INLINE int gdi_PtInRect(HGDI_RECT rc, int x, int y)
 	return 0;
 }
 
+/**
+ * Make sure a rectangle array can hold at least n rectangles.
+ * @param rects pointer to rectangle array, reallocated as needed
+ * @param count pointer to the allocated number of rectangles
+ * @param n required number of rectangles
+ */
+
+static void gdi_rects_reserve(HGDI_RGN* rects, int* count, int n)
+{
+	if (n <= *count && *rects != NULL)
+		return;
+
+	if (*count < 1)
+		*count = 32;
+
+	while (*count < n)
+		*count *= 2;
+
+	*rects = (HGDI_RGN) realloc(*rects, sizeof(GDI_RGN) * (*count));
+}
+
+/**
+ * Find the end of the band starting at a given index.
+ * Rectangles of a band share the same top and height.
+ */
+
+static int gdi_band_end(HGDI_RGN rects, int nrects, int i)
+{
+	int y = rects[i].y;
+
+	while (i < nrects && rects[i].y == y)
+		i++;
+
+	return i;
+}
+
+/**
+ * Append one band to a banded rectangle list, coalescing it with the
+ * previous band when both have identical horizontal spans and touch.
+ */
+
+static int gdi_append_band(HGDI_RGN* dst, int* count, int n, int* prevBand,
+		int* spans, int nspans, int top, int bottom)
+{
+	int i;
+	int prev = *prevBand;
+
+	if (nspans < 1)
+		return n;
+
+	if (prev >= 0 && (n - prev) == nspans && (*dst)[prev].y + (*dst)[prev].h == top)
+	{
+		for (i = 0; i < nspans; i++)
+		{
+			if ((*dst)[prev + i].x != spans[2 * i] ||
+				(*dst)[prev + i].w != spans[2 * i + 1] - spans[2 * i])
+				break;
+		}
+
+		if (i == nspans)
+		{
+			for (i = prev; i < n; i++)
+				(*dst)[i].h = bottom - (*dst)[i].y;
+
+			return n;
+		}
+	}
+
+	gdi_rects_reserve(dst, count, n + nspans);
+
+	for (i = 0; i < nspans; i++)
+	{
+		(*dst)[n + i].objectType = GDIOBJECT_REGION;
+		(*dst)[n + i].x = spans[2 * i];
+		(*dst)[n + i].y = top;
+		(*dst)[n + i].w = spans[2 * i + 1] - spans[2 * i];
+		(*dst)[n + i].h = bottom - top;
+		(*dst)[n + i].null = 0;
+	}
+
+	*prevBand = n;
+
+	return n + nspans;
+}
+
+/**
+ * Combine the horizontal spans of two bands.
+ * @param a first band
+ * @param na number of rectangles in the first band
+ * @param b second band
+ * @param nb number of rectangles in the second band
+ * @param mode GDI_RGN_AND, GDI_RGN_OR or GDI_RGN_DIFF
+ * @param spans output array of (left, right) pairs, room for na + nb pairs
+ * @return number of spans written
+ */
+
+static int gdi_combine_spans(HGDI_RGN a, int na, HGDI_RGN b, int nb, int mode, int* spans)
+{
+	int i = 0;
+	int j = 0;
+	int k = 0;
+	int n = 0;
+	int left, right;
+	int start, end;
+
+	if (mode == GDI_RGN_OR)
+	{
+		while (i < na || j < nb)
+		{
+			HGDI_RGN next;
+
+			if (j >= nb || (i < na && a[i].x <= b[j].x))
+				next = &a[i++];
+			else
+				next = &b[j++];
+
+			if (n > 0 && next->x <= spans[2 * n - 1])
+			{
+				if (next->x + next->w > spans[2 * n - 1])
+					spans[2 * n - 1] = next->x + next->w;
+			}
+			else
+			{
+				spans[2 * n] = next->x;
+				spans[2 * n + 1] = next->x + next->w;
+				n++;
+			}
+		}
+	}
+	else if (mode == GDI_RGN_AND)
+	{
+		while (i < na && j < nb)
+		{
+			left = MAX(a[i].x, b[j].x);
+			right = MIN(a[i].x + a[i].w, b[j].x + b[j].w);
+
+			if (left < right)
+			{
+				spans[2 * n] = left;
+				spans[2 * n + 1] = right;
+				n++;
+			}
+
+			if (a[i].x + a[i].w < b[j].x + b[j].w)
+				i++;
+			else
+				j++;
+		}
+	}
+	else if (mode == GDI_RGN_DIFF)
+	{
+		for (i = 0; i < na; i++)
+		{
+			start = a[i].x;
+			end = a[i].x + a[i].w;
+
+			while (j < nb && b[j].x + b[j].w <= start)
+				j++;
+
+			for (k = j; k < nb && b[k].x < end; k++)
+			{
+				if (b[k].x > start)
+				{
+					spans[2 * n] = start;
+					spans[2 * n + 1] = b[k].x;
+					n++;
+				}
+
+				start = MAX(start, b[k].x + b[k].w);
+
+				if (start >= end)
+					break;
+			}
+
+			if (start < end)
+			{
+				spans[2 * n] = start;
+				spans[2 * n + 1] = end;
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Combine two banded rectangle lists into a new banded rectangle list.\n
+ * Rectangles are sorted by top then left, rectangles of a band share the same
+ * top and height, do not overlap, and vertically adjacent bands with identical
+ * spans are coalesced. A single rectangle is a valid banded list.
+ * @param dst pointer to destination array, reallocated as needed
+ * @param count pointer to the allocated size of the destination array
+ * @param src1 first banded list
+ * @param nsrc1 number of rectangles in the first list
+ * @param src2 second banded list
+ * @param nsrc2 number of rectangles in the second list
+ * @param mode GDI_RGN_AND, GDI_RGN_OR or GDI_RGN_DIFF
+ * @return number of rectangles in the destination array
+ */
+
+int gdi_CombineRects(HGDI_RGN* dst, int* count, HGDI_RGN src1, int nsrc1, HGDI_RGN src2, int nsrc2, int mode)
+{
+	int n = 0;
+	int e1, e2;
+	int i1 = 0;
+	int i2 = 0;
+	int in1, in2;
+	int nspans;
+	int top, bottom;
+	int prevBand = -1;
+	int* spans;
+
+	spans = (int*) malloc(sizeof(int) * 2 * (nsrc1 + nsrc2 + 1));
+
+	if (nsrc1 > 0 && nsrc2 > 0)
+		top = MIN(src1[0].y, src2[0].y);
+	else if (nsrc1 > 0)
+		top = src1[0].y;
+	else if (nsrc2 > 0)
+		top = src2[0].y;
+	else
+		top = 0;
+
+	while (i1 < nsrc1 || i2 < nsrc2)
+	{
+		if (mode == GDI_RGN_AND && (i1 >= nsrc1 || i2 >= nsrc2))
+			break;
+
+		if (mode == GDI_RGN_DIFF && i1 >= nsrc1)
+			break;
+
+		e1 = (i1 < nsrc1) ? gdi_band_end(src1, nsrc1, i1) : i1;
+		e2 = (i2 < nsrc2) ? gdi_band_end(src2, nsrc2, i2) : i2;
+
+		in1 = (i1 < nsrc1) && (src1[i1].y <= top);
+		in2 = (i2 < nsrc2) && (src2[i2].y <= top);
+
+		/* the strip ends where the next band starts or the current one ends */
+		bottom = 0x7FFFFFFF;
+
+		if (i1 < nsrc1)
+			bottom = MIN(bottom, in1 ? src1[i1].y + src1[i1].h : src1[i1].y);
+
+		if (i2 < nsrc2)
+			bottom = MIN(bottom, in2 ? src2[i2].y + src2[i2].h : src2[i2].y);
+
+		if (in1 || in2)
+		{
+			nspans = gdi_combine_spans(&src1[i1], in1 ? e1 - i1 : 0,
+					&src2[i2], in2 ? e2 - i2 : 0, mode, spans);
+
+			n = gdi_append_band(dst, count, n, &prevBand, spans, nspans, top, bottom);
+		}
+
+		top = bottom;
+
+		if (in1 && src1[i1].y + src1[i1].h <= top)
+			i1 = e1;
+
+		if (in2 && src2[i2].y + src2[i2].h <= top)
+			i2 = e2;
+	}
+
+	free(spans);
+
+	return n;
+}
+
+/**
+ * Reduce a banded rectangle list to at most a given number of rectangles.\n
+ * Bands are first collapsed to their horizontal extent, and if that is not
+ * enough the whole list is replaced by its bounding rectangle. The result
+ * always covers the original area.
+ * @param rects banded list, modified in place
+ * @param nrects number of rectangles in the list
+ * @param max maximum number of rectangles
+ * @return new number of rectangles
+ */
+
+int gdi_SimplifyRects(HGDI_RGN rects, int nrects, int max)
+{
+	int i, e, n;
+	int left, top, right, bottom;
+
+	if (nrects <= max || nrects < 1)
+		return nrects;
+
+	n = 0;
+
+	for (i = 0; i < nrects; i = e)
+	{
+		e = gdi_band_end(rects, nrects, i);
+		left = rects[i].x;
+		right = rects[e - 1].x + rects[e - 1].w;
+
+		if (n > 0 && rects[n - 1].x == left && rects[n - 1].w == right - left &&
+			rects[n - 1].y + rects[n - 1].h == rects[i].y)
+		{
+			rects[n - 1].h += rects[i].h;
+		}
+		else
+		{
+			top = rects[i].y;
+			gdi_SetRgn(&rects[n++], left, top, right - left, rects[i].h);
+		}
+	}
+
+	if (n <= max)
+		return n;
+
+	left = rects[0].x;
+	top = rects[0].y;
+	right = rects[0].x + rects[0].w;
+	bottom = rects[n - 1].y + rects[n - 1].h;
+
+	for (i = 1; i < n; i++)
+	{
+		left = MIN(left, rects[i].x);
+		right = MAX(right, rects[i].x + rects[i].w);
+	}
+
+	gdi_SetRgn(&rects[0], left, top, right - left, bottom - top);
+
+	return 1;
+}
+
 /**
  * Invalidate a given region, such that it is redrawn on the next region update.\n
+ * The window keeps both the bounding rectangle of everything invalidated and
+ * a minimal banded list of rectangles, capped at maxInvalid rectangles.
  * @msdn{dd145003}
  * @param hdc device context
  * @param x x1
@@ -362,10 +691,14 @@ INLINE int gdi_PtInRect(HGDI_RECT rc, int x, int y)
 
 INLINE int gdi_InvalidateRegion(HGDI_DC hdc, int x, int y, int w, int h)
 {
+	GDI_RGN rect;
 	GDI_RECT inv;
 	GDI_RECT rgn;
+	HGDI_WND hwnd;
 	HGDI_RGN invalid;
 	HGDI_RGN cinvalid;
+	int ninvalid;
+	int count;
 
 	if (hdc->hwnd == NULL)
 		return 0;
@@ -373,38 +706,57 @@ INLINE int gdi_InvalidateRegion(HGDI_DC hdc, int x, int y, int w, int h)
 	if (hdc->hwnd->invalid == NULL)
 		return 0;
 
-	cinvalid = hdc->hwnd->cinvalid;
+	hwnd = hdc->hwnd;
+
+	gdi_CRgnToRect(x, y, w, h, &rgn);
+
+	if (rgn.left < 0)
+		rgn.left = 0;
 
-	if (hdc->hwnd->ninvalid + 1 > hdc->hwnd->count)
+	if (rgn.top < 0)
+		rgn.top = 0;
+
+	if (rgn.right < rgn.left || rgn.bottom < rgn.top)
+		return 0;
+
+	gdi_RectToRgn(&rgn, &rect);
+	rect.objectType = GDIOBJECT_REGION;
+	rect.null = 0;
+
+	if (hwnd->ninvalid < 1)
 	{
-		hdc->hwnd->count *= 2;
-		cinvalid = (HGDI_RGN) realloc(cinvalid, sizeof(GDI_RGN) * (hdc->hwnd->count));
+		gdi_rects_reserve(&hwnd->cinvalid, &hwnd->count, 1);
+		hwnd->cinvalid[0] = rect;
+		hwnd->ninvalid = 1;
+	}
+	else
+	{
+		ninvalid = gdi_CombineRects(&hwnd->scratch, &hwnd->scount,
+				hwnd->cinvalid, hwnd->ninvalid, &rect, 1, GDI_RGN_OR);
+
+		/* swap the scratch array in as the new list */
+		cinvalid = hwnd->cinvalid;
+		count = hwnd->count;
+		hwnd->cinvalid = hwnd->scratch;
+		hwnd->count = hwnd->scount;
+		hwnd->scratch = cinvalid;
+		hwnd->scount = count;
+
+		hwnd->ninvalid = gdi_SimplifyRects(hwnd->cinvalid, ninvalid,
+				(hwnd->maxInvalid > 0) ? hwnd->maxInvalid : GDI_MAX_INVALID_RECTS);
 	}
 
-	gdi_SetRgn(&cinvalid[hdc->hwnd->ninvalid++], x, y, w, h);
-	hdc->hwnd->cinvalid = cinvalid;
-
-	invalid = hdc->hwnd->invalid;
+	invalid = hwnd->invalid;
 
 	if (invalid->null)
 	{
-		invalid->x = x;
-		invalid->y = y;
-		invalid->w = w;
-		invalid->h = h;
+		gdi_RectToRgn(&rgn, invalid);
 		invalid->null = 0;
 		return 0;
 	}
 
-	gdi_CRgnToRect(x, y, w, h, &rgn);
 	gdi_RgnToRect(invalid, &inv);
 
-	if (rgn.left < 0)
-		rgn.left = 0;
-
-	if (rgn.top < 0)
-		rgn.top = 0;
-
 	if (rgn.left < inv.left)
 		inv.left = rgn.left;
 
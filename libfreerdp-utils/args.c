@@ -101,6 +101,8 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 				"  --gdi: graphics rendering (hw, sw)\n"
 				"  --no-osb: disable offscreen bitmaps\n"
 				"  --no-bmp-cache: disable bitmap cache\n"
+				"  --bmp-cache-budget: memory budget in MB for decoded cached bitmaps (implies --bmp-cache-lazy)\n"
+				"  --bmp-cache-lazy: keep cached bitmaps compressed until first use\n"
 				"  --bcv3: codec for bitmap cache v3 (rfx, nsc, jpeg)\n"
 				"  --plugin: load a virtual channel plugin\n"
 				"  --rfx: enable RemoteFX\n"
@@ -124,6 +126,7 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 				"  --tsg <TSG Username>:<Password>:<Domain>:<TSG Adress>: Connect through TSG\n"
 				"  --ntlm: force NTLM authentication protocol version (1 or 2)\n"
 				"  --ignore-certificate: ignore verification of logon certificate\n"
+				"  --persist-tls-sessions: keep TLS sessions in ~/.freerdp/sessions to resume them on the next run\n"
 				"  --sec: force protocol security (rdp, tls or nla)\n"
 				"  --secure-checksum: use salted checksums with Standard RDP encryption\n"
 				"  --version: print version information\n"
@@ -131,6 +134,7 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 				"  --multimon-set: hard set monitor list: <num of monitors> <x> <y> <width> <height> <isprimary>, ...\n"
 				"                  two screen example --multimon-set 2 0 0 512 768 1 512 0 512 768 0\n"
 				"  --no-orders: do not accept any drawing orders, only bitmaps\n"
+				"  --timings: print the time spent in each phase of the connection\n"
 				"\n", argv[0]);
 			return FREERDP_ARGS_PARSE_HELP; //TODO: What is the correct return
 		}
@@ -326,6 +330,26 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 		{
 			settings->bitmap_cache = false;
 		}
+		else if (strcmp("--bmp-cache-budget", argv[index]) == 0)
+		{
+			index++;
+			if (index == argc)
+			{
+				printf("missing bitmap cache budget\n");
+				return FREERDP_ARGS_PARSE_FAILURE;
+			}
+			t = atoi(argv[index]);
+			if (t < 0 || t > 4095)
+			{
+				printf("bitmap cache budget must be between 0 and 4095 MB\n");
+				return FREERDP_ARGS_PARSE_FAILURE;
+			}
+			settings->bitmap_cache_budget = (uint32) t * 1024 * 1024;
+		}
+		else if (strcmp("--bmp-cache-lazy", argv[index]) == 0)
+		{
+			settings->bitmap_cache_lazy_decode = true;
+		}
 		else if (strcmp("--no-auth", argv[index]) == 0)
 		{
 			settings->authentication = false;
@@ -334,6 +358,14 @@ int freerdp_parse_args(rdpSettings* settings, int argc, char** argv,
 		{
 			settings->ignore_certificate = true;
 		}
+		else if (strcmp("--persist-tls-sessions", argv[index]) == 0)
+		{
+			settings->persist_tls_sessions = true;
+		}
+		else if (strcmp("--timings", argv[index]) == 0)
+		{
+			settings->print_timings = true;
+		}
 		else if (strcmp("--certificate-name", argv[index]) == 0)
 		{
 			index++;
@@ -17,6 +17,7 @@
  * limitations under the License.
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,10 @@
 #include <freerdp/utils/memory.h>
 #include <freerdp/utils/dsp.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 uint8* dsp_resample(uint8* src, int bytes_per_sample,
 	uint32 schan, uint32 srate, int sframes,
 	uint32 rchan, uint32 rrate, int * prframes)
@@ -62,6 +67,333 @@ uint8* dsp_resample(uint8* src, int bytes_per_sample,
 	return dst;
 }
 
+/**
+ * Streaming polyphase resampler.
+ *
+ * The rate ratio is reduced to up/down, and each output frame is a
+ * windowed-sinc FIR over the input frames around its position. One set
+ * of coefficients is precomputed for each of the up phases between two
+ * input frames. Channels are mapped on input, so the filter only runs
+ * on the output channels. The last frames of a packet are kept as history
+ * for the next one, which adds half the filter length of latency.
+ */
+
+#define DSP_RESAMPLER_MAX_PHASES	1024
+#define DSP_RESAMPLER_MIN_HALF_TAPS	8
+#define DSP_RESAMPLER_MAX_HALF_TAPS	32
+
+struct _DSP_RESAMPLER
+{
+	int bytes_per_sample;
+	int schan;
+	int rchan;
+	uint32 up;
+	uint32 down;
+
+	int phases;
+	int half_taps;
+	int taps;
+	float* coefs;
+
+	float* buf;
+	int buf_frames;
+	int frames;
+	int pos;
+	uint32 phase;
+};
+
+static uint32 dsp_gcd(uint32 a, uint32 b)
+{
+	uint32 t;
+
+	while (b != 0)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static void dsp_resampler_init_coefs(DSP_RESAMPLER* resampler)
+{
+	int p, k;
+	double x;
+	double h;
+	double fc;
+	double sum;
+	float* c;
+
+	/* when decimating, the cutoff moves down to the output Nyquist */
+	fc = (resampler->up < resampler->down) ? (double) resampler->up / resampler->down : 1.0;
+	fc *= 0.95;
+
+	for (p = 0; p < resampler->phases; p++)
+	{
+		c = resampler->coefs + p * resampler->taps;
+		sum = 0;
+
+		for (k = 0; k < resampler->taps; k++)
+		{
+			x = (resampler->half_taps - 1 - k) + (double) p / resampler->phases;
+			h = (x == 0) ? fc : sin(M_PI * fc * x) / (M_PI * x);
+			/* Blackman window over [-half_taps, half_taps] */
+			x /= resampler->half_taps;
+			h *= 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2 * M_PI * x);
+			c[k] = (float) h;
+			sum += h;
+		}
+
+		/* unity gain for every phase */
+		for (k = 0; k < resampler->taps; k++)
+			c[k] = (float) (c[k] / sum);
+	}
+}
+
+DSP_RESAMPLER* dsp_resampler_new(int bytes_per_sample,
+	uint32 schan, uint32 srate, uint32 rchan, uint32 rrate)
+{
+	uint32 g;
+	DSP_RESAMPLER* resampler;
+
+	if ((bytes_per_sample != 1 && bytes_per_sample != 2) ||
+		schan < 1 || rchan < 1 || srate < 1 || rrate < 1)
+	{
+		printf("dsp_resampler_new: unsupported format\n");
+		return NULL;
+	}
+
+	resampler = xnew(DSP_RESAMPLER);
+	resampler->bytes_per_sample = bytes_per_sample;
+	resampler->schan = schan;
+	resampler->rchan = rchan;
+
+	g = dsp_gcd(srate, rrate);
+	resampler->up = rrate / g;
+	resampler->down = srate / g;
+	resampler->phases = (resampler->up > DSP_RESAMPLER_MAX_PHASES) ? DSP_RESAMPLER_MAX_PHASES : resampler->up;
+
+	resampler->half_taps = DSP_RESAMPLER_MIN_HALF_TAPS;
+	if (resampler->up < resampler->down)
+	{
+		resampler->half_taps = (DSP_RESAMPLER_MIN_HALF_TAPS * resampler->down + resampler->up - 1) / resampler->up;
+		if (resampler->half_taps > DSP_RESAMPLER_MAX_HALF_TAPS)
+			resampler->half_taps = DSP_RESAMPLER_MAX_HALF_TAPS;
+	}
+	resampler->taps = resampler->half_taps * 2;
+
+	resampler->coefs = xmalloc(sizeof(float) * resampler->phases * resampler->taps);
+	dsp_resampler_init_coefs(resampler);
+
+	dsp_resampler_reset(resampler);
+
+	return resampler;
+}
+
+void dsp_resampler_free(DSP_RESAMPLER* resampler)
+{
+	if (resampler != NULL)
+	{
+		xfree(resampler->coefs);
+		xfree(resampler->buf);
+		xfree(resampler);
+	}
+}
+
+static void dsp_resampler_reserve(DSP_RESAMPLER* resampler, int frames)
+{
+	int size;
+
+	if (frames <= resampler->buf_frames)
+		return;
+
+	size = (resampler->buf_frames > 0) ? resampler->buf_frames : 1024;
+
+	while (size < frames)
+		size *= 2;
+
+	resampler->buf = xrenew(float, resampler->buf, size * resampler->rchan);
+	resampler->buf_frames = size;
+}
+
+/**
+ * Drop the history, the next packet starts after silence.
+ */
+
+void dsp_resampler_reset(DSP_RESAMPLER* resampler)
+{
+	resampler->frames = resampler->half_taps - 1;
+	resampler->pos = resampler->half_taps - 1;
+	resampler->phase = 0;
+
+	dsp_resampler_reserve(resampler, resampler->frames);
+	memset(resampler->buf, 0, sizeof(float) * resampler->frames * resampler->rchan);
+}
+
+/**
+ * Upper bound of the frames produced by the next dsp_resampler_process.
+ */
+
+int dsp_resampler_max_frames(DSP_RESAMPLER* resampler, int sframes)
+{
+	uint64 frames;
+
+	frames = resampler->frames - resampler->pos + sframes;
+
+	return (int) (frames * resampler->up / resampler->down + 1);
+}
+
+static void dsp_resampler_append(DSP_RESAMPLER* resampler, const uint8* src, int sframes)
+{
+	int i, c;
+	float v;
+	float s[8];
+	float* dst;
+	int schan = resampler->schan;
+	int rchan = resampler->rchan;
+
+	dsp_resampler_reserve(resampler, resampler->frames + sframes);
+	dst = resampler->buf + resampler->frames * rchan;
+
+	for (i = 0; i < sframes; i++)
+	{
+		for (c = 0; c < schan; c++)
+		{
+			if (resampler->bytes_per_sample == 2)
+			{
+				v = (sint16) (((uint16) src[0]) | (((uint16) src[1]) << 8));
+				src += 2;
+			}
+			else
+			{
+				v = (float) (((sint8) *src) * 256);
+				src++;
+			}
+
+			if (schan == rchan)
+				dst[c] = v;
+			else if (c < 8)
+				s[c] = v;
+		}
+
+		if (rchan > schan)
+		{
+			/* copy the source channels over the extra ones */
+			for (c = 0; c < rchan; c++)
+				dst[c] = s[(c % schan) % 8];
+		}
+		else if (rchan < schan)
+		{
+			/* average the source channels folding onto each output */
+			for (c = 0; c < rchan; c++)
+			{
+				int k, n = 0;
+
+				v = 0;
+				for (k = c; k < schan && k < 8; k += rchan, n++)
+					v += s[k];
+				dst[c] = v / n;
+			}
+		}
+
+		dst += rchan;
+	}
+
+	resampler->frames += sframes;
+}
+
+/**
+ * Resample a packet of interleaved frames.
+ * @param resampler resampler
+ * @param src source frames, in the source format
+ * @param sframes number of source frames
+ * @param dst output buffer, in the output format
+ * @param max_rframes capacity of dst in frames, see dsp_resampler_max_frames
+ * @return number of frames written to dst
+ */
+
+int dsp_resampler_process(DSP_RESAMPLER* resampler, const uint8* src, int sframes,
+	uint8* dst, int max_rframes)
+{
+	int c, k;
+	int move;
+	int rframes;
+	long v;
+	float acc;
+	float* in;
+	float* coefs;
+	int rchan = resampler->rchan;
+	int taps = resampler->taps;
+	int half_taps = resampler->half_taps;
+
+	if (sframes > 0)
+		dsp_resampler_append(resampler, src, sframes);
+
+	rframes = 0;
+
+	while (rframes < max_rframes && resampler->pos + half_taps < resampler->frames)
+	{
+		if (resampler->phases == resampler->up)
+			coefs = resampler->coefs + resampler->phase * taps;
+		else
+			coefs = resampler->coefs + (int) ((uint64) resampler->phase * resampler->phases / resampler->up) * taps;
+
+		in = resampler->buf + (resampler->pos - (half_taps - 1)) * rchan;
+
+		for (c = 0; c < rchan; c++)
+		{
+			acc = 0;
+			for (k = 0; k < taps; k++)
+				acc += in[k * rchan + c] * coefs[k];
+
+			v = (long) (acc < 0 ? acc - 0.5f : acc + 0.5f);
+
+			if (resampler->bytes_per_sample == 2)
+			{
+				if (v < -32768)
+					v = -32768;
+				else if (v > 32767)
+					v = 32767;
+				*dst++ = (uint8) (v & 0xFF);
+				*dst++ = (uint8) ((v >> 8) & 0xFF);
+			}
+			else
+			{
+				v >>= 8;
+				if (v < -128)
+					v = -128;
+				else if (v > 127)
+					v = 127;
+				*dst++ = (uint8) v;
+			}
+		}
+
+		rframes++;
+
+		resampler->phase += resampler->down;
+		if (resampler->phase >= resampler->up)
+		{
+			resampler->pos += resampler->phase / resampler->up;
+			resampler->phase %= resampler->up;
+		}
+	}
+
+	/* keep only the history needed by the next output frame */
+	move = resampler->pos - (half_taps - 1);
+	if (move > 0)
+	{
+		if (move > resampler->frames)
+			move = resampler->frames;
+		memmove(resampler->buf, resampler->buf + move * rchan,
+			sizeof(float) * (resampler->frames - move) * rchan);
+		resampler->frames -= move;
+		resampler->pos -= move;
+	}
+
+	return rframes;
+}
+
 /**
  * Microsoft IMA ADPCM specification:
  *
@@ -122,19 +454,16 @@ static uint16 dsp_decode_ima_adpcm_sample(ADPCM* adpcm,
 	return (uint16) d;
 }
 
-uint8* dsp_decode_ima_adpcm(ADPCM* adpcm,
-	uint8* src, int size, int channels, int block_size, int* out_size)
+static int dsp_decode_ima_adpcm_to(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, uint8* dst)
 {
 	uint8* out;
-	uint8* dst;
 	uint8 sample;
 	uint16 decoded;
 	int channel;
 	int i;
 
-	*out_size = size * 4;
-	out = (uint8 *) xzalloc(*out_size);
-	dst = out;
+	out = dst;
 	while (size > 0)
 	{
 		if (size % block_size == 0)
@@ -143,14 +472,12 @@ uint8* dsp_decode_ima_adpcm(ADPCM* adpcm,
 			adpcm->last_step[0] = (sint16) (*(src + 2));
 			src += 4;
 			size -= 4;
-			*out_size -= 16;
 			if (channels > 1)
 			{
 				adpcm->last_sample[1] = (sint16) (((uint16)(*src)) | (((uint16)(*(src + 1))) << 8));
 				adpcm->last_step[1] = (sint16) (*(src + 2));
 				src += 4;
 				size -= 4;
-				*out_size -= 16;
 			}
 		}
 
@@ -186,6 +513,16 @@ uint8* dsp_decode_ima_adpcm(ADPCM* adpcm,
 			size--;
 		}
 	}
+	return dst - out;
+}
+
+uint8* dsp_decode_ima_adpcm(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size)
+{
+	uint8* out;
+
+	out = (uint8*) xzalloc(size * 4);
+	*out_size = dsp_decode_ima_adpcm_to(adpcm, src, size, channels, block_size, out);
 	return out;
 }
 
@@ -277,16 +614,22 @@ static uint8 dsp_encode_ima_adpcm_sample(ADPCM* adpcm,
 	return enc;
 }
 
-uint8* dsp_encode_ima_adpcm(ADPCM* adpcm,
-	uint8* src, int size, int channels, int block_size, int* out_size)
+/* encoded data plus a block header every block_size bytes */
+static int dsp_encode_ima_adpcm_size(int size, int block_size)
+{
+	int data_size = size / 4 + 8;
+
+	return data_size + 8 * (data_size / (block_size > 8 ? block_size - 8 : 1) + 1);
+}
+
+static int dsp_encode_ima_adpcm_to(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, uint8* out)
 {
-	uint8* out;
 	uint8* dst;
 	sint16 sample;
 	uint8 encoded;
 	int i;
 
-	out = (uint8*) xzalloc(size / 2);
 	dst = out;
 	while (size > 0)
 	{
@@ -330,6 +673,64 @@ uint8* dsp_encode_ima_adpcm(ADPCM* adpcm,
 			size -= 4;
 		}
 	}
-	*out_size = dst - out;
+	return dst - out;
+}
+
+uint8* dsp_encode_ima_adpcm(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size)
+{
+	uint8* out;
+
+	out = (uint8*) xzalloc(dsp_encode_ima_adpcm_size(size, block_size));
+	*out_size = dsp_encode_ima_adpcm_to(adpcm, src, size, channels, block_size, out);
+	return out;
+}
+
+/**
+ * The ADPCM context also owns an output buffer, reused by
+ * dsp_ima_adpcm_decode and dsp_ima_adpcm_encode. The returned data
+ * stays valid until the next call on the same context.
+ */
+
+static uint8* dsp_ima_adpcm_reserve(ADPCM* adpcm, int size)
+{
+	if (size > adpcm->buffer_size)
+	{
+		adpcm->buffer = xrenew(uint8, adpcm->buffer, size);
+		adpcm->buffer_size = size;
+	}
+
+	return adpcm->buffer;
+}
+
+void dsp_ima_adpcm_reset(ADPCM* adpcm)
+{
+	memset(adpcm->last_sample, 0, sizeof(adpcm->last_sample));
+	memset(adpcm->last_step, 0, sizeof(adpcm->last_step));
+}
+
+void dsp_ima_adpcm_uninit(ADPCM* adpcm)
+{
+	xfree(adpcm->buffer);
+	memset(adpcm, 0, sizeof(ADPCM));
+}
+
+uint8* dsp_ima_adpcm_decode(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size)
+{
+	uint8* out;
+
+	out = dsp_ima_adpcm_reserve(adpcm, size * 4);
+	*out_size = dsp_decode_ima_adpcm_to(adpcm, src, size, channels, block_size, out);
+	return out;
+}
+
+uint8* dsp_ima_adpcm_encode(ADPCM* adpcm,
+	uint8* src, int size, int channels, int block_size, int* out_size)
+{
+	uint8* out;
+
+	out = dsp_ima_adpcm_reserve(adpcm, dsp_encode_ima_adpcm_size(size, block_size));
+	*out_size = dsp_encode_ima_adpcm_to(adpcm, src, size, channels, block_size, out);
 	return out;
 }
@@ -49,6 +49,18 @@ static RDP_EVENT* freerdp_cliprdr_event_new(uint16 event_type)
 	return event;
 }
 
+static RDP_VIDEO_FRAME_POOL* video_frame_pool = NULL;
+
+void freerdp_video_frame_pool_register(RDP_VIDEO_FRAME_POOL* pool)
+{
+	video_frame_pool = pool;
+}
+
+RDP_VIDEO_FRAME_POOL* freerdp_video_frame_pool_get(void)
+{
+	return video_frame_pool;
+}
+
 static RDP_EVENT* freerdp_tsmf_event_new(uint16 event_type)
 {
 	RDP_EVENT* event = NULL;
@@ -132,6 +144,8 @@ static void freerdp_tsmf_event_free(RDP_EVENT* event)
 		case RDP_EVENT_TYPE_TSMF_VIDEO_FRAME:
 			{
 				RDP_VIDEO_FRAME_EVENT* vevent = (RDP_VIDEO_FRAME_EVENT*)event;
+				if (vevent->frame_buffer)
+					vevent->frame_buffer->pool->Release(vevent->frame_buffer->pool, vevent->frame_buffer);
 				xfree(vevent->frame_data);
 				xfree(vevent->visible_rects);
 			}
@@ -0,0 +1,476 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * Event Loop Utils
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <freerdp/utils/memory.h>
+#include <freerdp/utils/event_loop.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sys/types.h>
+#else
+#include <winsock2.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#define EVENT_LOOP_MAX_EVENTS	64
+
+/* registration state of one descriptor, the table is indexed by fd */
+struct event_loop_fd
+{
+	uint8 registered; /* 0, EVENT_LOOP_EXPLICIT or EVENT_LOOP_SYNCED */
+	uint8 writable; /* also wait for the descriptor to become writable */
+	uint32 seen; /* last event_loop_update_fds generation listing this fd */
+	uint32 ready; /* last event_loop_wait generation reporting this fd */
+	void* data;
+};
+
+#define EVENT_LOOP_EXPLICIT	1
+#define EVENT_LOOP_SYNCED	2
+
+struct event_loop
+{
+#ifdef HAVE_SYS_EPOLL_H
+	int epoll_fd;
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+#endif
+	struct event_loop_fd* table;
+	int table_size;
+
+	/* descriptors registered through event_loop_update_fds */
+	int* synced;
+	int num_synced;
+	int max_synced;
+	uint32 sync_gen;
+
+	/* descriptors reported by the last event_loop_wait */
+	int* ready;
+	int num_ready;
+	int max_ready;
+	uint32 wait_gen;
+
+	int max_fd;
+};
+
+static tbool event_loop_reserve(struct event_loop* loop, int fd)
+{
+	int size;
+
+	if (fd < 0)
+		return false;
+
+	if (fd < loop->table_size)
+		return true;
+
+	size = (loop->table_size > 0) ? loop->table_size : 64;
+
+	while (size <= fd)
+		size *= 2;
+
+	loop->table = xrenew(struct event_loop_fd, loop->table, size);
+	memset(&loop->table[loop->table_size], 0, sizeof(struct event_loop_fd) * (size - loop->table_size));
+	loop->table_size = size;
+
+	return true;
+}
+
+static tbool event_loop_register(struct event_loop* loop, int fd, void* data, uint8 how)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	int status;
+	struct epoll_event event;
+#endif
+
+	if (!event_loop_reserve(loop, fd))
+		return false;
+
+#ifdef HAVE_SYS_EPOLL_H
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if (loop->table[fd].registered != 0 && loop->table[fd].writable)
+		event.events |= EPOLLOUT;
+
+	/*
+	 * Closing a descriptor removes it from the epoll set, so a slot still
+	 * marked registered may belong to a closed descriptor whose number was
+	 * reused: modify the registration and add it again if it is gone.
+	 */
+	if (loop->table[fd].registered != 0)
+	{
+		status = epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+
+		if (status < 0 && errno == ENOENT)
+			status = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	}
+	else
+	{
+		status = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+		if (status < 0 && errno == EEXIST)
+			status = epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+	}
+
+	if (status < 0)
+	{
+		printf("event_loop_register: epoll_ctl failed for fd %d\n", fd);
+		memset(&loop->table[fd], 0, sizeof(struct event_loop_fd));
+		return false;
+	}
+#endif
+
+	if (fd > loop->max_fd)
+		loop->max_fd = fd;
+
+	loop->table[fd].registered = how;
+	loop->table[fd].data = data;
+
+	return true;
+}
+
+static void event_loop_unregister(struct event_loop* loop, int fd)
+{
+	if (fd < 0 || fd >= loop->table_size || loop->table[fd].registered == 0)
+		return;
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* a descriptor closed by its owner is already gone from the set */
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
+	memset(&loop->table[fd], 0, sizeof(struct event_loop_fd));
+
+	while (loop->max_fd >= 0 && (loop->max_fd >= loop->table_size || loop->table[loop->max_fd].registered == 0))
+		loop->max_fd--;
+}
+
+struct event_loop* event_loop_new(void)
+{
+	struct event_loop* loop;
+
+	loop = xnew(struct event_loop);
+
+	if (loop == NULL)
+		return NULL;
+
+	loop->max_fd = -1;
+
+#ifdef HAVE_SYS_EPOLL_H
+	loop->epoll_fd = epoll_create(EVENT_LOOP_MAX_EVENTS);
+
+	if (loop->epoll_fd < 0)
+	{
+		printf("event_loop_new: epoll_create failed\n");
+		xfree(loop);
+		return NULL;
+	}
+#endif
+
+	return loop;
+}
+
+void event_loop_free(struct event_loop* loop)
+{
+	if (loop != NULL)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		close(loop->epoll_fd);
+#endif
+		xfree(loop->table);
+		xfree(loop->synced);
+		xfree(loop->ready);
+		xfree(loop);
+	}
+}
+
+tbool event_loop_add_fd(struct event_loop* loop, int fd, void* data)
+{
+	return event_loop_register(loop, fd, data, EVENT_LOOP_EXPLICIT);
+}
+
+tbool event_loop_remove_fd(struct event_loop* loop, int fd)
+{
+	event_loop_unregister(loop, fd);
+	return true;
+}
+
+/**
+ * Also report a registered descriptor when it becomes writable,
+ * for as long as its owner has output waiting.
+ * @param loop event loop
+ * @param fd registered descriptor
+ * @param writable true to wait for writability as well, false to stop
+ * @return true on success
+ */
+
+tbool event_loop_set_writable(struct event_loop* loop, int fd, tbool writable)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event event;
+#endif
+
+	if (fd < 0 || fd >= loop->table_size || loop->table[fd].registered == 0)
+		return false;
+
+	if (loop->table[fd].writable == (writable ? 1 : 0))
+		return true;
+
+#ifdef HAVE_SYS_EPOLL_H
+	memset(&event, 0, sizeof(event));
+	event.events = writable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	event.data.fd = fd;
+
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+	{
+		printf("event_loop_set_writable: epoll_ctl failed for fd %d\n", fd);
+		return false;
+	}
+#endif
+
+	loop->table[fd].writable = writable ? 1 : 0;
+
+	return true;
+}
+
+static int event_loop_wait_obj_fd(struct wait_obj* obj)
+{
+	int count = 0;
+	void* fds[1];
+
+	wait_obj_get_fds(obj, fds, &count);
+
+	return (count == 1) ? (int)(long) fds[0] : -1;
+}
+
+tbool event_loop_add_wait_obj(struct event_loop* loop, struct wait_obj* obj, void* data)
+{
+	return event_loop_add_fd(loop, event_loop_wait_obj_fd(obj), data);
+}
+
+tbool event_loop_remove_wait_obj(struct event_loop* loop, struct wait_obj* obj)
+{
+	return event_loop_remove_fd(loop, event_loop_wait_obj_fd(obj));
+}
+
+/**
+ * Bring the synced part of the set in line with a descriptor list.
+ * Every listed descriptor is registered again, which also recovers the
+ * ones closed and reused since the previous call, so callers only need
+ * to call this when their descriptors changed.
+ * @param loop event loop
+ * @param fds descriptor list, as filled by the *_get_fds functions
+ * @param count number of descriptors in the list
+ * @return true on success
+ */
+
+tbool event_loop_update_fds(struct event_loop* loop, void** fds, int count)
+{
+	int i, fd, n;
+
+	loop->sync_gen++;
+
+	for (i = 0; i < count; i++)
+	{
+		fd = (int)(long) fds[i];
+
+		if (fd < 0)
+			continue;
+
+		if (fd < loop->table_size && loop->table[fd].registered == EVENT_LOOP_EXPLICIT)
+			continue;
+
+		if (fd >= loop->table_size || loop->table[fd].registered == 0)
+		{
+			if (loop->num_synced + 1 > loop->max_synced)
+			{
+				loop->max_synced = (loop->max_synced > 0) ? loop->max_synced * 2 : 16;
+				loop->synced = xrenew(int, loop->synced, loop->max_synced);
+			}
+
+			loop->synced[loop->num_synced++] = fd;
+		}
+
+		if (!event_loop_register(loop, fd, NULL, EVENT_LOOP_SYNCED))
+			return false;
+
+		loop->table[fd].seen = loop->sync_gen;
+	}
+
+	/* drop synced descriptors that are no longer listed */
+	for (i = 0, n = 0; i < loop->num_synced; i++)
+	{
+		fd = loop->synced[i];
+
+		if (fd >= loop->table_size || loop->table[fd].registered != EVENT_LOOP_SYNCED)
+			continue;
+
+		if (loop->table[fd].seen != loop->sync_gen)
+		{
+			event_loop_unregister(loop, fd);
+			continue;
+		}
+
+		loop->synced[n++] = fd;
+	}
+
+	loop->num_synced = n;
+
+	return true;
+}
+
+static void event_loop_set_ready(struct event_loop* loop, int fd)
+{
+	if (loop->num_ready + 1 > loop->max_ready)
+	{
+		loop->max_ready = (loop->max_ready > 0) ? loop->max_ready * 2 : EVENT_LOOP_MAX_EVENTS;
+		loop->ready = xrenew(int, loop->ready, loop->max_ready);
+	}
+
+	loop->ready[loop->num_ready++] = fd;
+	loop->table[fd].ready = loop->wait_gen;
+}
+
+/**
+ * Wait for registered descriptors to become readable, or writable
+ * for the ones set with event_loop_set_writable.
+ * @param loop event loop
+ * @param timeout timeout in milliseconds, negative to wait forever
+ * @return number of ready descriptors, 0 on timeout or signal, -1 on error
+ */
+
+int event_loop_wait(struct event_loop* loop, int timeout)
+{
+	int i;
+	int status;
+#ifdef HAVE_SYS_EPOLL_H
+	int fd;
+#endif
+
+	loop->wait_gen++;
+	loop->num_ready = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	status = epoll_wait(loop->epoll_fd, loop->events, EVENT_LOOP_MAX_EVENTS, timeout);
+
+	if (status < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (i = 0; i < status; i++)
+	{
+		fd = loop->events[i].data.fd;
+
+		if (fd < loop->table_size && loop->table[fd].registered)
+			event_loop_set_ready(loop, fd);
+	}
+#else
+	{
+		fd_set rfds;
+		fd_set wfds;
+		struct timeval time;
+		struct timeval* ptime = NULL;
+
+		if (timeout >= 0)
+		{
+			time.tv_sec = timeout / 1000;
+			time.tv_usec = (timeout * 1000) % 1000000;
+			ptime = &time;
+		}
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+
+		for (i = 0; i <= loop->max_fd; i++)
+		{
+			if (loop->table[i].registered)
+				FD_SET(i, &rfds);
+
+			if (loop->table[i].registered && loop->table[i].writable)
+				FD_SET(i, &wfds);
+		}
+
+		status = select(loop->max_fd + 1, &rfds, &wfds, NULL, ptime);
+
+		if (status < 0)
+			return (errno == EINTR) ? 0 : -1;
+
+		for (i = 0; i <= loop->max_fd; i++)
+		{
+			if (loop->table[i].registered && (FD_ISSET(i, &rfds) || FD_ISSET(i, &wfds)))
+				event_loop_set_ready(loop, i);
+		}
+	}
+#endif
+
+	return loop->num_ready;
+}
+
+tbool event_loop_is_ready(struct event_loop* loop, int fd)
+{
+	if (fd < 0 || fd >= loop->table_size)
+		return false;
+
+	return (loop->table[fd].ready == loop->wait_gen);
+}
+
+/**
+ * Get a descriptor reported by the last event_loop_wait.
+ * @param loop event loop
+ * @param index index between 0 and the value returned by event_loop_wait
+ * @param data receives the data pointer given at registration, may be NULL
+ * @return descriptor, or -1 if index is out of range
+ */
+
+int event_loop_get_ready(struct event_loop* loop, int index, void** data)
+{
+	int fd;
+
+	if (index < 0 || index >= loop->num_ready)
+		return -1;
+
+	fd = loop->ready[index];
+
+	if (data != NULL)
+		*data = loop->table[fd].data;
+
+	return fd;
+}
+
+/**
+ * Get a descriptor that becomes readable when the loop has events,
+ * allowing an event loop to be nested in another one.
+ */
+
+int event_loop_get_fd(struct event_loop* loop)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	return loop->epoll_fd;
+#else
+	return -1;
+#endif
+}
@@ -68,6 +68,13 @@ static void svc_data_in_item_free(svc_data_in_item* item)
 	xfree(item);
 }
 
+/**
+ * Streams whose write completed are kept for reuse by svc_plugin_stream_new,
+ * up to SVC_STREAM_POOL_DEPTH streams of at most SVC_STREAM_POOL_MAX_SIZE bytes.
+ */
+#define SVC_STREAM_POOL_DEPTH		32
+#define SVC_STREAM_POOL_MAX_SIZE	0x10000
+
 struct rdp_svc_plugin_private
 {
 	void* init_handle;
@@ -75,7 +82,12 @@ struct rdp_svc_plugin_private
 	STREAM* data_in;
 
 	LIST* data_in_list;
+	LIST* data_in_batch;
 	freerdp_thread* thread;
+
+	freerdp_mutex pool_mutex;
+	STREAM* pool[SVC_STREAM_POOL_DEPTH];
+	int pool_count;
 };
 
 static rdpSvcPlugin* svc_plugin_find_by_init_handle(void* init_handle)
@@ -211,7 +223,10 @@ static void svc_plugin_open_event(uint32 openHandle, uint32 event, void* pData,
 			svc_plugin_process_received(plugin, pData, dataLength, totalLength, dataFlags);
 			break;
 		case CHANNEL_EVENT_WRITE_COMPLETE:
-			stream_free((STREAM*)pData);
+			if (plugin->write_complete_callback)
+				plugin->write_complete_callback(plugin, pData);
+			else
+				svc_plugin_stream_free(plugin, (STREAM*)pData);
 			break;
 		case CHANNEL_EVENT_USER:
 			svc_plugin_process_event(plugin, (RDP_EVENT*)pData);
@@ -221,29 +236,31 @@ static void svc_plugin_open_event(uint32 openHandle, uint32 event, void* pData,
 
 static void svc_plugin_process_data_in(rdpSvcPlugin* plugin)
 {
+	LIST* batch;
 	svc_data_in_item* item;
 
-	while (1)
+	/* take everything queued so far at once, swapping in the empty batch list */
+	freerdp_thread_lock(plugin->priv->thread);
+	batch = plugin->priv->data_in_list;
+	plugin->priv->data_in_list = plugin->priv->data_in_batch;
+	plugin->priv->data_in_batch = batch;
+	freerdp_thread_unlock(plugin->priv->thread);
+
+	while ((item = list_dequeue(batch)) != NULL)
 	{
 		/* terminate signal */
 		if (freerdp_thread_is_stopped(plugin->priv->thread))
-			break;
-
-		freerdp_thread_lock(plugin->priv->thread);
-		item = list_dequeue(plugin->priv->data_in_list);
-		freerdp_thread_unlock(plugin->priv->thread);
-
-		if (item != NULL)
 		{
-			/* the ownership of the data is passed to the callback */
-			if (item->data_in)
-				IFCALL(plugin->receive_callback, plugin, item->data_in);
-			if (item->event_in)
-				IFCALL(plugin->event_callback, plugin, item->event_in);
-			xfree(item);
+			svc_data_in_item_free(item);
+			continue;
 		}
-		else
-			break;
+
+		/* the ownership of the data is passed to the callback */
+		if (item->data_in)
+			IFCALL(plugin->receive_callback, plugin, item->data_in);
+		if (item->event_in)
+			IFCALL(plugin->event_callback, plugin, item->event_in);
+		xfree(item);
 	}
 }
 
@@ -293,6 +310,7 @@ static void svc_plugin_process_connected(rdpSvcPlugin* plugin, void* pData, uint
 	}
 
 	plugin->priv->data_in_list = list_new();
+	plugin->priv->data_in_batch = list_new();
 	plugin->priv->thread = freerdp_thread_new();
 
 	freerdp_thread_start(plugin->priv->thread, svc_plugin_thread_func, plugin);
@@ -313,6 +331,11 @@ static void svc_plugin_process_terminated(rdpSvcPlugin* plugin)
 	while ((item = list_dequeue(plugin->priv->data_in_list)) != NULL)
 		svc_data_in_item_free(item);
 	list_free(plugin->priv->data_in_list);
+	list_free(plugin->priv->data_in_batch);
+
+	while (plugin->priv->pool_count > 0)
+		stream_free(plugin->priv->pool[--plugin->priv->pool_count]);
+	freerdp_mutex_free(plugin->priv->pool_mutex);
 
 	if (plugin->priv->data_in != NULL)
 	{
@@ -364,6 +387,7 @@ void svc_plugin_init(rdpSvcPlugin* plugin, CHANNEL_ENTRY_POINTS* pEntryPoints)
 	memcpy(&plugin->channel_entry_points, pEntryPoints, pEntryPoints->cbSize);
 
 	plugin->priv = xnew(rdpSvcPluginPrivate);
+	plugin->priv->pool_mutex = freerdp_mutex_new();
 
 	/* Add it to the global list */
 	list = xnew(rdpSvcPluginList);
@@ -378,6 +402,55 @@ void svc_plugin_init(rdpSvcPlugin* plugin, CHANNEL_ENTRY_POINTS* pEntryPoints)
 		&plugin->channel_def, 1, VIRTUAL_CHANNEL_VERSION_WIN2000, svc_plugin_init_event);
 }
 
+/**
+ * Get a zeroed stream for an outgoing PDU, reusing one from a completed
+ * write when possible. Streams given to svc_plugin_send return to the pool
+ * once written, whether they were allocated here or with stream_new.
+ */
+
+STREAM* svc_plugin_stream_new(rdpSvcPlugin* plugin, int size)
+{
+	STREAM* s = NULL;
+
+	freerdp_mutex_lock(plugin->priv->pool_mutex);
+	if (plugin->priv->pool_count > 0)
+		s = plugin->priv->pool[--plugin->priv->pool_count];
+	freerdp_mutex_unlock(plugin->priv->pool_mutex);
+
+	if (s == NULL)
+		return stream_new(size);
+
+	stream_set_pos(s, 0);
+
+	if (size > 0)
+	{
+		stream_check_size(s, size);
+		memset(stream_get_head(s), 0, size);
+	}
+
+	return s;
+}
+
+void svc_plugin_stream_free(rdpSvcPlugin* plugin, STREAM* s)
+{
+	if (s == NULL)
+		return;
+
+	if (stream_get_size(s) > 0 && stream_get_size(s) <= SVC_STREAM_POOL_MAX_SIZE)
+	{
+		freerdp_mutex_lock(plugin->priv->pool_mutex);
+		if (plugin->priv->pool_count < SVC_STREAM_POOL_DEPTH)
+		{
+			plugin->priv->pool[plugin->priv->pool_count++] = s;
+			s = NULL;
+		}
+		freerdp_mutex_unlock(plugin->priv->pool_mutex);
+	}
+
+	if (s != NULL)
+		stream_free(s);
+}
+
 int svc_plugin_send(rdpSvcPlugin* plugin, STREAM* data_out)
 {
 	uint32 error = 0;
@@ -388,13 +461,33 @@ int svc_plugin_send(rdpSvcPlugin* plugin, STREAM* data_out)
 		stream_get_data(data_out), stream_get_length(data_out), data_out);
 	if (error != CHANNEL_RC_OK)
 	{
-		stream_free(data_out);
+		svc_plugin_stream_free(plugin, data_out);
 		printf("svc_plugin_send: VirtualChannelWrite failed %d\n", error);
 	}
 
 	return error;
 }
 
+/**
+ * Send data from a buffer managed by the plugin itself. The plugin must
+ * set write_complete_callback, which receives user_data once the write
+ * completed; on failure the buffer is left to the caller.
+ */
+
+int svc_plugin_send_buffer(rdpSvcPlugin* plugin, uint8* data, uint32 length, void* user_data)
+{
+	uint32 error = 0;
+
+	DEBUG_SVC("length %d", length);
+
+	error = plugin->channel_entry_points.pVirtualChannelWrite(plugin->priv->open_handle,
+		data, length, user_data);
+	if (error != CHANNEL_RC_OK)
+		printf("svc_plugin_send_buffer: VirtualChannelWrite failed %d\n", error);
+
+	return error;
+}
+
 int svc_plugin_send_event(rdpSvcPlugin* plugin, RDP_EVENT* event)
 {
 	uint32 error = 0;
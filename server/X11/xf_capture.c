@@ -0,0 +1,971 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 Server Screen Capture
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <freerdp/kbd/kbd.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/utils/memory.h>
+
+#include "xf_event.h"
+#include "xf_encode.h"
+#include "xf_peer.h"
+
+#include "xf_capture.h"
+
+/* all the captures, one per display */
+static xfCapture* xf_captures = NULL;
+static pthread_mutex_t xf_captures_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef WITH_XDAMAGE
+
+static void xf_xdamage_init(xfInfo* xfi)
+{
+	Bool pixmaps;
+	int damage_event;
+	int damage_error;
+	int major, minor;
+	XGCValues values;
+
+	if (XShmQueryExtension(xfi->display) != False)
+	{
+		XShmQueryVersion(xfi->display, &major, &minor, &pixmaps);
+
+		if (pixmaps == False)
+		{
+			printf("XShmQueryVersion failed\n");
+			return;
+		}
+	}
+	else
+	{
+		printf("XShmQueryExtension failed\n");
+		return;
+	}
+
+	if (XDamageQueryExtension(xfi->display, &damage_event, &damage_error) == 0)
+	{
+		printf("XDamageQueryExtension failed\n");
+		return;
+	}
+
+	XDamageQueryVersion(xfi->display, &major, &minor);
+
+	if (XDamageQueryVersion(xfi->display, &major, &minor) == 0)
+	{
+		printf("XDamageQueryVersion failed\n");
+		return;
+	}
+	else if (major < 1)
+	{
+		printf("XDamageQueryVersion failed: major:%d minor:%d\n", major, minor);
+		return;
+	}
+
+	xfi->xdamage_notify_event = damage_event + XDamageNotify;
+	xfi->xdamage = XDamageCreate(xfi->display, xfi->root_window, XDamageReportDeltaRectangles);
+
+	if (xfi->xdamage == None)
+	{
+		printf("XDamageCreate failed\n");
+		return;
+	}
+
+#ifdef WITH_XFIXES
+	xfi->xdamage_region = XFixesCreateRegion(xfi->display, NULL, 0);
+
+	if (xfi->xdamage_region == None)
+	{
+		printf("XFixesCreateRegion failed\n");
+		XDamageDestroy(xfi->display, xfi->xdamage);
+		xfi->xdamage = None;
+		return;
+	}
+#endif
+
+	values.subwindow_mode = IncludeInferiors;
+	xfi->xdamage_gc = XCreateGC(xfi->display, xfi->root_window, GCSubwindowMode, &values);
+	XSetFunction(xfi->display, xfi->xdamage_gc, GXcopy);
+}
+
+#endif
+
+static void xf_xshm_init(xfInfo* xfi)
+{
+	xfi->fb_shm_info.shmid = -1;
+	xfi->fb_shm_info.shmaddr = (char*) -1;
+
+	xfi->fb_image = XShmCreateImage(xfi->display, xfi->visual, xfi->depth,
+			ZPixmap, NULL, &(xfi->fb_shm_info), xfi->width, xfi->height);
+
+	if (xfi->fb_image == NULL)
+	{
+		printf("XShmCreateImage failed\n");
+		return;
+	}
+
+	xfi->fb_shm_info.shmid = shmget(IPC_PRIVATE,
+			xfi->fb_image->bytes_per_line * xfi->fb_image->height, IPC_CREAT | 0600);
+
+	if (xfi->fb_shm_info.shmid == -1)
+	{
+		printf("shmget failed\n");
+		return;
+	}
+
+	xfi->fb_shm_info.readOnly = False;
+	xfi->fb_shm_info.shmaddr = shmat(xfi->fb_shm_info.shmid, 0, 0);
+	xfi->fb_image->data = xfi->fb_shm_info.shmaddr;
+
+	if (xfi->fb_shm_info.shmaddr == ((char*) -1))
+	{
+		printf("shmat failed\n");
+		return;
+	}
+
+	XShmAttach(xfi->display, &(xfi->fb_shm_info));
+	XSync(xfi->display, False);
+
+	shmctl(xfi->fb_shm_info.shmid, IPC_RMID, 0);
+
+	xfi->fb_pixmap = XShmCreatePixmap(xfi->display,
+			xfi->root_window, xfi->fb_image->data, &(xfi->fb_shm_info),
+			xfi->fb_image->width, xfi->fb_image->height, xfi->fb_image->depth);
+}
+
+/**
+ * Without XShm, damage is read with XGetSubImage into a screen sized
+ * image, which then keeps the last captured contents like the shared one.
+ */
+
+static void xf_image_init(xfInfo* xfi)
+{
+	char* data;
+
+	data = (char*) xzalloc(xfi->width * xfi->height * xfi->bytesPerPixel);
+
+	xfi->fb_image = XCreateImage(xfi->display, xfi->visual, xfi->depth, ZPixmap, 0,
+			data, xfi->width, xfi->height, xfi->scanline_pad, xfi->width * xfi->bytesPerPixel);
+
+	if (xfi->fb_image == NULL)
+	{
+		printf("XCreateImage failed\n");
+		xfree(data);
+	}
+}
+
+static xfInfo* xf_info_init(void)
+{
+	int i;
+	xfInfo* xfi;
+	int pf_count;
+	int vi_count;
+	XVisualInfo* vi;
+	XVisualInfo* vis;
+	XVisualInfo template;
+	XPixmapFormatValues* pf;
+	XPixmapFormatValues* pfs;
+
+	xfi = xnew(xfInfo);
+
+	//xfi->use_xshm = true;
+	xfi->display = XOpenDisplay(NULL);
+
+	if (xfi->display == NULL)
+	{
+		printf("failed to open display: %s\n", XDisplayName(NULL));
+		exit(1);
+	}
+
+	xfi->xfds = ConnectionNumber(xfi->display);
+	xfi->number = DefaultScreen(xfi->display);
+	xfi->screen = ScreenOfDisplay(xfi->display, xfi->number);
+	xfi->depth = DefaultDepthOfScreen(xfi->screen);
+	xfi->width = WidthOfScreen(xfi->screen);
+	xfi->height = HeightOfScreen(xfi->screen);
+	xfi->root_window = DefaultRootWindow(xfi->display);
+
+	pfs = XListPixmapFormats(xfi->display, &pf_count);
+
+	if (pfs == NULL)
+	{
+		printf("XListPixmapFormats failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < pf_count; i++)
+	{
+		pf = pfs + i;
+
+		if (pf->depth == xfi->depth)
+		{
+			xfi->bpp = pf->bits_per_pixel;
+			xfi->scanline_pad = pf->scanline_pad;
+			break;
+		}
+	}
+	XFree(pfs);
+
+	memset(&template, 0, sizeof(template));
+	template.class = TrueColor;
+	template.screen = xfi->number;
+
+	vis = XGetVisualInfo(xfi->display, VisualClassMask | VisualScreenMask, &template, &vi_count);
+
+	if (vis == NULL)
+	{
+		printf("XGetVisualInfo failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < vi_count; i++)
+	{
+		vi = vis + i;
+
+		if (vi->depth == xfi->depth)
+		{
+			xfi->visual = vi->visual;
+			break;
+		}
+	}
+	XFree(vis);
+
+	xfi->clrconv = freerdp_clrconv_new(CLRCONV_ALPHA | CLRCONV_INVERT);
+
+	XSelectInput(xfi->display, xfi->root_window, SubstructureNotifyMask);
+
+#ifdef WITH_XDAMAGE
+	xf_xdamage_init(xfi);
+#endif
+
+	xfi->bytesPerPixel = 4;
+
+	if (xfi->use_xshm)
+		xf_xshm_init(xfi);
+	else
+		xf_image_init(xfi);
+
+	freerdp_kbd_init(xfi->display, 0);
+
+	return xfi;
+}
+
+
+static void xf_info_free(xfInfo* xfi)
+{
+#ifdef WITH_XDAMAGE
+#ifdef WITH_XFIXES
+	if (xfi->xdamage_region != None)
+		XFixesDestroyRegion(xfi->display, xfi->xdamage_region);
+#endif
+	if (xfi->xdamage != None)
+		XDamageDestroy(xfi->display, xfi->xdamage);
+
+	if (xfi->xdamage_gc != NULL)
+		XFreeGC(xfi->display, xfi->xdamage_gc);
+#endif
+
+	if (xfi->fb_pixmap != 0)
+		XFreePixmap(xfi->display, xfi->fb_pixmap);
+
+	if (xfi->fb_shm_info.shmaddr != ((char*) -1))
+	{
+		XShmDetach(xfi->display, &(xfi->fb_shm_info));
+		shmdt(xfi->fb_shm_info.shmaddr);
+	}
+
+	if (xfi->fb_image != NULL)
+	{
+		/* with XShm the image data is the shared memory segment */
+		if (xfi->use_xshm)
+			xfi->fb_image->data = NULL;
+
+		XDestroyImage(xfi->fb_image);
+	}
+
+	freerdp_clrconv_free(xfi->clrconv);
+	XCloseDisplay(xfi->display);
+	xfree(xfi);
+}
+
+static uint64 xf_capture_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static xfFrame* xf_frame_new(void)
+{
+	xfFrame* frame;
+
+	frame = xnew(xfFrame);
+	frame->refcount = 1;
+	frame->tileset = stream_new(65536);
+
+	return frame;
+}
+
+xfFrame* xf_frame_ref(xfFrame* frame)
+{
+	__sync_fetch_and_add(&frame->refcount, 1);
+	return frame;
+}
+
+void xf_frame_unref(xfFrame* frame)
+{
+	if (frame == NULL)
+		return;
+
+	if (__sync_sub_and_fetch(&frame->refcount, 1) == 0)
+	{
+		stream_free(frame->tileset);
+		xfree(frame->rects);
+		xfree(frame);
+	}
+}
+
+static xfCapture* xf_capture_new(xfRuntime* runtime, const char* name)
+{
+	xfInfo* xfi;
+	xfCapture* capture;
+
+	capture = xnew(xfCapture);
+	capture->name = xstrdup(name);
+	capture->runtime = runtime;
+	capture->fps = 24;
+
+	pthread_mutex_init(&(capture->mutex), NULL);
+	pthread_mutex_init(&(capture->lock), NULL);
+
+	capture->info = xf_info_init();
+	xfi = capture->info;
+
+	/* only encodes tilesets, the peers compose the messages */
+	capture->rfx_context = rfx_context_new();
+	capture->rfx_context->mode = RLGR3;
+	capture->rfx_context->width = xfi->width;
+	capture->rfx_context->height = xfi->height;
+	rfx_context_set_pixel_format(capture->rfx_context, RFX_PIXEL_FORMAT_BGRA);
+
+	capture->tiles_x = (xfi->width + 63) / 64;
+	capture->tiles_y = (xfi->height + 63) / 64;
+	capture->tile_hashes = (uint32*) xzalloc(sizeof(uint32) * capture->tiles_x * capture->tiles_y);
+
+	return capture;
+}
+
+static void xf_capture_free(xfCapture* capture)
+{
+	xfCaptureStats stats;
+
+	/* the encode pool must be done with the display before it goes away */
+	xf_runtime_wait_encode(capture->runtime, &(capture->encode_busy));
+
+	xf_capture_get_stats(capture, &stats);
+
+	if (stats.tiles_encoded + stats.tiles_unchanged > 0)
+	{
+		printf("xf_capture: %s: %llu frames, %llu tiles encoded, %llu unchanged tiles skipped (%d%%)\n",
+				capture->name, (unsigned long long) stats.frames_encoded,
+				(unsigned long long) stats.tiles_encoded, (unsigned long long) stats.tiles_unchanged,
+				(int) (stats.tiles_unchanged * 100 / (stats.tiles_encoded + stats.tiles_unchanged)));
+	}
+
+	rfx_context_free(capture->rfx_context);
+	xf_info_free(capture->info);
+	xfree(capture->tile_hashes);
+
+	pthread_mutex_destroy(&(capture->mutex));
+	pthread_mutex_destroy(&(capture->lock));
+
+	xfree(capture->peers);
+	xfree(capture->name);
+	xfree(capture);
+}
+
+/**
+ * Get the capture of the default display, opening it for the first peer.
+ */
+
+xfCapture* xf_capture_get(xfRuntime* runtime)
+{
+	const char* name;
+	xfCapture* capture;
+
+	name = XDisplayName(NULL);
+
+	pthread_mutex_lock(&xf_captures_mutex);
+
+	for (capture = xf_captures; capture != NULL; capture = capture->next)
+	{
+		if (strcmp(capture->name, name) == 0)
+			break;
+	}
+
+	if (capture == NULL)
+	{
+		capture = xf_capture_new(runtime, name);
+		capture->next = xf_captures;
+		xf_captures = capture;
+	}
+
+	capture->refcount++;
+
+	pthread_mutex_unlock(&xf_captures_mutex);
+
+	return capture;
+}
+
+void xf_capture_release(xfCapture* capture)
+{
+	xfCapture** link;
+
+	if (capture == NULL)
+		return;
+
+	pthread_mutex_lock(&xf_captures_mutex);
+
+	if (--capture->refcount > 0)
+	{
+		pthread_mutex_unlock(&xf_captures_mutex);
+		return;
+	}
+
+	for (link = &xf_captures; *link != NULL; link = &(*link)->next)
+	{
+		if (*link == capture)
+		{
+			*link = capture->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&xf_captures_mutex);
+
+	xf_capture_free(capture);
+}
+
+static int xf_rect_area(int left, int top, int right, int bottom)
+{
+	return (right - left) * (bottom - top);
+}
+
+/**
+ * Add an area to the damage list. Areas that overlap or touch are merged,
+ * so the list stays made of disjoint boxes; once it is full the new area
+ * is merged with the box it grows the least.
+ */
+
+static void xf_capture_invalidate_locked(xfCapture* capture, int x, int y, int width, int height)
+{
+	int i, best;
+	int cost, best_cost;
+	int left, top, right, bottom;
+	RFX_RECT* rect;
+
+	left = MAX(x, 0);
+	top = MAX(y, 0);
+	right = MIN(x + width, capture->info->width);
+	bottom = MIN(y + height, capture->info->height);
+
+	if (left >= right || top >= bottom)
+		return;
+
+	i = 0;
+
+	while (i < capture->num_damage)
+	{
+		rect = &capture->damage[i];
+
+		if (left > rect->x + rect->width || right < rect->x ||
+				top > rect->y + rect->height || bottom < rect->y)
+		{
+			i++;
+			continue;
+		}
+
+		/* the merged box may now touch boxes already passed */
+		left = MIN(left, rect->x);
+		top = MIN(top, rect->y);
+		right = MAX(right, rect->x + rect->width);
+		bottom = MAX(bottom, rect->y + rect->height);
+
+		capture->damage[i] = capture->damage[--capture->num_damage];
+		i = 0;
+	}
+
+	if (capture->num_damage == XF_CAPTURE_MAX_RECTS)
+	{
+		best = 0;
+		best_cost = -1;
+
+		for (i = 0; i < capture->num_damage; i++)
+		{
+			rect = &capture->damage[i];
+
+			cost = xf_rect_area(MIN(left, rect->x), MIN(top, rect->y),
+					MAX(right, rect->x + rect->width), MAX(bottom, rect->y + rect->height)) -
+					rect->width * rect->height;
+
+			if (best_cost < 0 || cost < best_cost)
+			{
+				best = i;
+				best_cost = cost;
+			}
+		}
+
+		rect = &capture->damage[best];
+		left = MIN(left, rect->x);
+		top = MIN(top, rect->y);
+		right = MAX(right, rect->x + rect->width);
+		bottom = MAX(bottom, rect->y + rect->height);
+
+		capture->damage[best] = capture->damage[--capture->num_damage];
+	}
+
+	rect = &capture->damage[capture->num_damage++];
+	rect->x = left;
+	rect->y = top;
+	rect->width = right - left;
+	rect->height = bottom - top;
+}
+
+/**
+ * Send the whole screen with the next frame, including the tiles whose
+ * content did not change since they were last sent.
+ */
+
+static void xf_capture_refresh_area_locked(xfCapture* capture, int x, int y, int width, int height)
+{
+	capture->refresh_pending = true;
+	xf_capture_invalidate_locked(capture, x, y, width, height);
+}
+
+static void xf_capture_refresh_locked(xfCapture* capture)
+{
+	xf_capture_refresh_area_locked(capture, 0, 0, capture->info->width, capture->info->height);
+}
+
+void xf_capture_refresh(xfCapture* capture, int x, int y, int width, int height)
+{
+	pthread_mutex_lock(&(capture->lock));
+	xf_capture_refresh_area_locked(capture, x, y, width, height);
+	pthread_mutex_unlock(&(capture->lock));
+}
+
+/**
+ * Add a batch of damaged areas, taking the capture lock once for all.
+ */
+
+void xf_capture_invalidate(xfCapture* capture, const RFX_RECT* rects, int num_rects)
+{
+	int i;
+
+	pthread_mutex_lock(&(capture->lock));
+
+	for (i = 0; i < num_rects; i++)
+		xf_capture_invalidate_locked(capture, rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+
+	pthread_mutex_unlock(&(capture->lock));
+}
+
+/**
+ * Publish the frame rate and quality a peer can take. The peer changes
+ * them on its own I/O worker, the tick of any peer reads them.
+ */
+
+void xf_capture_set_pace(xfCapture* capture, freerdp_peer* client, int fps, int quality)
+{
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
+
+	pthread_mutex_lock(&(capture->lock));
+	xfp->pace_fps = fps;
+	xfp->pace_quality = quality;
+	pthread_mutex_unlock(&(capture->lock));
+}
+
+/**
+ * Start publishing frames to a peer. The area the peer has nothing of,
+ * usually the whole screen, is sent with the next frame.
+ */
+
+void xf_capture_subscribe(xfCapture* capture, freerdp_peer* client, int x, int y, int width, int height)
+{
+	int i;
+
+	pthread_mutex_lock(&(capture->lock));
+
+	for (i = 0; i < capture->num_peers; i++)
+	{
+		if (capture->peers[i] == client)
+			break;
+	}
+
+	if (i == capture->num_peers)
+	{
+		if (capture->num_peers + 1 > capture->max_peers)
+		{
+			capture->max_peers = (capture->max_peers > 0) ? capture->max_peers * 2 : 8;
+			capture->peers = xrenew(freerdp_peer*, capture->peers, capture->max_peers);
+		}
+
+		capture->peers[capture->num_peers++] = client;
+	}
+
+	xf_capture_refresh_area_locked(capture, x, y, width, height);
+
+	pthread_mutex_unlock(&(capture->lock));
+}
+
+void xf_capture_unsubscribe(xfCapture* capture, freerdp_peer* client)
+{
+	int i;
+
+	pthread_mutex_lock(&(capture->lock));
+
+	for (i = 0; i < capture->num_peers; i++)
+	{
+		if (capture->peers[i] == client)
+		{
+			capture->peers[i] = capture->peers[--capture->num_peers];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&(capture->lock));
+}
+
+/**
+ * Use the default quantization values, made coarser by the quality level.
+ */
+
+static void xf_capture_set_quality(xfCapture* capture)
+{
+	int i;
+	RFX_CONTEXT* context = capture->rfx_context;
+	static const uint32 quants[10] = { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 };
+
+	if (context->quants == NULL)
+	{
+		context->num_quants = 1;
+		context->quants = (uint32*) xmalloc(sizeof(quants));
+		context->quant_idx_y = 0;
+		context->quant_idx_cb = 0;
+		context->quant_idx_cr = 0;
+	}
+
+	for (i = 0; i < 10; i++)
+		context->quants[i] = MIN(quants[i] + capture->quality, 15);
+}
+
+/**
+ * Tell whether a tile of the frame changed since it was last encoded,
+ * updating its hash.
+ */
+
+static boolean xf_capture_tile_changed(xfCapture* capture, xfFrame* frame, uint8* data, int rowstride,
+		int tile_x, int tile_y)
+{
+	uint32 hash;
+	uint32* cached;
+	int width, height;
+	xfInfo* xfi = capture->info;
+
+	width = MIN(64, frame->width - tile_x * 64);
+	height = MIN(64, frame->height - tile_y * 64);
+	data = &data[(tile_y * 64 * rowstride) + (tile_x * 64 * xfi->bytesPerPixel)];
+
+	/* zero marks a tile that was never sent */
+	hash = xf_tile_hash(data, width, height, rowstride);
+	hash = (hash != 0) ? hash : 1;
+
+	cached = &capture->tile_hashes[((frame->y / 64) + tile_y) * capture->tiles_x + (frame->x / 64) + tile_x];
+
+	if (*cached == hash && capture->refresh == false)
+	{
+		capture->tiles_unchanged++;
+		return false;
+	}
+
+	*cached = hash;
+	capture->tiles_encoded++;
+
+	return true;
+}
+
+/**
+ * Turn the damage rects into frame rects covering only the changed tiles:
+ * each run of changed tiles in a row of a damage rect gives one rect.
+ */
+
+static void xf_capture_changed_rects(xfCapture* capture, xfFrame* frame, uint8* data, int rowstride)
+{
+	int i;
+	int tiles_x;
+	int max_rects;
+	uint8* changed;
+	RFX_RECT* rect;
+	int run, tile_x, tile_y;
+	int left, top, right, bottom;
+	int run_left, run_right, row_top, row_bottom;
+
+	tiles_x = (frame->width + 63) / 64;
+	changed = (uint8*) xzalloc(tiles_x * ((frame->height + 63) / 64));
+
+	max_rects = capture->num_rects;
+	frame->rects = (RFX_RECT*) xzalloc(sizeof(RFX_RECT) * max_rects);
+	frame->num_rects = 0;
+
+	for (i = 0; i < capture->num_rects; i++)
+	{
+		left = capture->rects[i].x - frame->x;
+		top = capture->rects[i].y - frame->y;
+		right = left + capture->rects[i].width;
+		bottom = top + capture->rects[i].height;
+
+		for (tile_y = top / 64; tile_y <= (bottom - 1) / 64; tile_y++)
+		{
+			run = -1;
+
+			for (tile_x = left / 64; tile_x <= (right - 1) / 64 + 1; tile_x++)
+			{
+				/* 0 not hashed yet, 1 changed, 2 unchanged */
+				if (tile_x <= (right - 1) / 64 && changed[tile_y * tiles_x + tile_x] == 0)
+				{
+					changed[tile_y * tiles_x + tile_x] = xf_capture_tile_changed(capture, frame,
+							data, rowstride, tile_x, tile_y) ? 1 : 2;
+				}
+
+				if (tile_x <= (right - 1) / 64 && changed[tile_y * tiles_x + tile_x] == 1)
+				{
+					if (run < 0)
+						run = tile_x;
+					continue;
+				}
+
+				if (run < 0)
+					continue;
+
+				run_left = MAX(left, run * 64);
+				run_right = MIN(right, tile_x * 64);
+				row_top = MAX(top, tile_y * 64);
+				row_bottom = MIN(bottom, (tile_y + 1) * 64);
+				run = -1;
+
+				if (frame->num_rects + 1 > max_rects)
+				{
+					max_rects *= 2;
+					frame->rects = xrenew(RFX_RECT, frame->rects, max_rects);
+				}
+
+				rect = &frame->rects[frame->num_rects++];
+				rect->x = run_left;
+				rect->y = row_top;
+				rect->width = run_right - run_left;
+				rect->height = row_bottom - row_top;
+			}
+		}
+	}
+
+	xfree(changed);
+}
+
+/**
+ * Capture and encode the damage of a frame. The frame is aligned on the
+ * tile grid of the screen so that tiles can be compared with the ones
+ * previously sent. Runs on the encode pool.
+ */
+
+static boolean xf_capture_encode_frame(xfCapture* capture, xfFrame* frame)
+{
+	int i;
+	uint8* data;
+	int rowstride;
+	XImage* image;
+	int left, top, right, bottom;
+	xfInfo* xfi = capture->info;
+
+	capture->tiles_encoded = 0;
+	capture->tiles_unchanged = 0;
+
+	if (capture->num_rects < 1)
+		return false;
+
+	left = capture->rects[0].x;
+	top = capture->rects[0].y;
+	right = left + capture->rects[0].width;
+	bottom = top + capture->rects[0].height;
+
+	for (i = 1; i < capture->num_rects; i++)
+	{
+		left = MIN(left, capture->rects[i].x);
+		top = MIN(top, capture->rects[i].y);
+		right = MAX(right, capture->rects[i].x + capture->rects[i].width);
+		bottom = MAX(bottom, capture->rects[i].y + capture->rects[i].height);
+	}
+
+	frame->x = left & ~63;
+	frame->y = top & ~63;
+	frame->width = MIN((right + 63) & ~63, xfi->width) - frame->x;
+	frame->height = MIN((bottom + 63) & ~63, xfi->height) - frame->y;
+
+	/* only the damaged rects are copied, the encoder reads them in place */
+	image = xf_snapshot_rects(capture, capture->rects, capture->num_rects);
+
+	if (image == NULL)
+		return false;
+
+	rowstride = image->bytes_per_line;
+	data = (uint8*) image->data;
+	data = &data[(frame->y * rowstride) + (frame->x * xfi->bytesPerPixel)];
+
+	/* the surface bits rects are relative to the destination */
+	xf_capture_changed_rects(capture, frame, data, rowstride);
+
+	if (frame->num_rects > 0)
+	{
+		xf_capture_set_quality(capture);
+		rfx_compose_message_tileset(capture->rfx_context, frame->tileset, frame->rects, frame->num_rects,
+				data, frame->width, frame->height, rowstride);
+	}
+
+	return (frame->num_rects > 0);
+}
+
+static void xf_capture_encode_job(void* param)
+{
+	int i;
+	xfFrame* frame;
+	xfEvent* event;
+	xfPeerContext* xfp;
+	boolean encoded;
+	xfCapture* capture = (xfCapture*) param;
+
+	frame = xf_frame_new();
+	encoded = xf_capture_encode_frame(capture, frame);
+
+	pthread_mutex_lock(&(capture->lock));
+
+	if (encoded)
+		capture->stats.frames_encoded++;
+
+	capture->stats.tiles_encoded += capture->tiles_encoded;
+	capture->stats.tiles_unchanged += capture->tiles_unchanged;
+
+	for (i = 0; encoded && i < capture->num_peers; i++)
+	{
+		xfp = (xfPeerContext*) capture->peers[i]->context;
+		event = (xfEvent*) xf_event_frame_new(frame);
+
+		/* the frame is lost for a peer that stopped draining its queue */
+		if (xf_event_push(xfp->event_queue, XF_EVENT_SOURCE_ENCODER, event) == false)
+		{
+			xf_event_free(event);
+			xf_capture_refresh_locked(capture);
+		}
+	}
+
+	capture->encoding = false;
+
+	pthread_mutex_unlock(&(capture->lock));
+
+	xf_frame_unref(frame);
+}
+
+/**
+ * Called on the frame timer of every peer: drain the damage of the
+ * display and, at most once per frame period, hand the damage list to
+ * the encode pool unless the previous frame is still being encoded.
+ */
+
+void xf_capture_tick(xfCapture* capture)
+{
+	int i;
+	uint64 now;
+	int fps, quality;
+	xfPeerContext* xfp;
+
+	xf_process_xevents(capture);
+
+	now = xf_capture_get_time();
+
+	pthread_mutex_lock(&(capture->lock));
+
+	if (capture->encoding || capture->num_peers < 1 || now < capture->next_frame)
+	{
+		pthread_mutex_unlock(&(capture->lock));
+		return;
+	}
+
+	/* the slowest peer sets the pace, frames are shared */
+	fps = XF_PEER_MAX_FPS;
+	quality = 0;
+
+	for (i = 0; i < capture->num_peers; i++)
+	{
+		xfp = (xfPeerContext*) capture->peers[i]->context;
+		fps = MIN(fps, xfp->pace_fps);
+		quality = MAX(quality, xfp->pace_quality);
+	}
+
+	/* resend what was sent at the coarser quantization */
+	if (quality < capture->quality)
+		xf_capture_refresh_locked(capture);
+
+	capture->fps = fps;
+	capture->quality = quality;
+
+	if (capture->num_damage < 1)
+	{
+		pthread_mutex_unlock(&(capture->lock));
+		return;
+	}
+
+	memcpy(capture->rects, capture->damage, sizeof(RFX_RECT) * capture->num_damage);
+	capture->num_rects = capture->num_damage;
+	capture->num_damage = 0;
+	capture->refresh = capture->refresh_pending;
+	capture->refresh_pending = false;
+
+	capture->encoding = true;
+	capture->next_frame = now + 1000000 / capture->fps;
+
+	pthread_mutex_unlock(&(capture->lock));
+
+	xf_runtime_submit_encode(capture->runtime, xf_capture_encode_job, (void*) capture, &(capture->encode_busy));
+}
+
+/**
+ * Copy the encode counters of the capture, e.g. to tell how much
+ * the tile cache saves.
+ */
+
+void xf_capture_get_stats(xfCapture* capture, xfCaptureStats* stats)
+{
+	pthread_mutex_lock(&(capture->lock));
+	*stats = capture->stats;
+	pthread_mutex_unlock(&(capture->lock));
+}
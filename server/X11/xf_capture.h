@@ -0,0 +1,125 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 Server Screen Capture
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __XF_CAPTURE_H
+#define __XF_CAPTURE_H
+
+typedef struct xf_frame xfFrame;
+typedef struct xf_capture xfCapture;
+typedef struct xf_capture_stats xfCaptureStats;
+
+#include <pthread.h>
+#include <freerdp/peer.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/utils/stream.h>
+
+#include "xfreerdp.h"
+#include "xf_runtime.h"
+
+#define XF_CAPTURE_MAX_RECTS	32
+
+/**
+ * An encoded RemoteFX tileset, shared by the peers it is published to.
+ * Each peer wraps it in a frame of its own RemoteFX context.
+ */
+struct xf_frame
+{
+	int refcount;
+
+	int x;
+	int y;
+	int width;
+	int height;
+
+	/* relative to x and y */
+	RFX_RECT* rects;
+	int num_rects;
+
+	STREAM* tileset;
+};
+
+/**
+ * Counters of the encoded frames since the capture started.
+ */
+struct xf_capture_stats
+{
+	uint64 frames_encoded;
+	uint64 tiles_encoded;
+	uint64 tiles_unchanged;
+};
+
+/**
+ * The capture and encode stage of an X display. Damage is accumulated
+ * once for the display, each frame is captured and encoded once on the
+ * encode pool and then published to all the subscribed peers.
+ */
+struct xf_capture
+{
+	char* name;
+	int refcount;
+	xfCapture* next;
+
+	xfInfo* info;
+	xfRuntime* runtime;
+	RFX_CONTEXT* rfx_context;
+
+	/* guards the display, which the input handlers also use */
+	pthread_mutex_t mutex;
+
+	/* guards the damage, the subscribers and the frame state */
+	pthread_mutex_t lock;
+	RFX_RECT damage[XF_CAPTURE_MAX_RECTS];
+	int num_damage;
+	int fps;
+	int quality;
+	uint64 next_frame;
+	boolean encoding;
+	RFX_RECT rects[XF_CAPTURE_MAX_RECTS];
+	int num_rects;
+	boolean refresh;
+	boolean refresh_pending;
+	xfCaptureStats stats;
+
+	/* content hash of each 64x64 tile of the screen, owned by the encode job */
+	uint32* tile_hashes;
+	int tiles_x;
+	int tiles_y;
+	int tiles_encoded; /* in the frame being encoded */
+	int tiles_unchanged;
+	freerdp_peer** peers;
+	int num_peers;
+	int max_peers;
+
+	/* guarded by the runtime mutex */
+	boolean encode_busy;
+};
+
+xfCapture* xf_capture_get(xfRuntime* runtime);
+void xf_capture_release(xfCapture* capture);
+
+void xf_capture_subscribe(xfCapture* capture, freerdp_peer* client, int x, int y, int width, int height);
+void xf_capture_unsubscribe(xfCapture* capture, freerdp_peer* client);
+void xf_capture_invalidate(xfCapture* capture, const RFX_RECT* rects, int num_rects);
+void xf_capture_refresh(xfCapture* capture, int x, int y, int width, int height);
+void xf_capture_set_pace(xfCapture* capture, freerdp_peer* client, int fps, int quality);
+void xf_capture_tick(xfCapture* capture);
+void xf_capture_get_stats(xfCapture* capture, xfCaptureStats* stats);
+
+xfFrame* xf_frame_ref(xfFrame* frame);
+void xf_frame_unref(xfFrame* frame);
+
+#endif /* __XF_CAPTURE_H */
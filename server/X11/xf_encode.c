@@ -17,19 +17,19 @@
  * limitations under the License.
  */
 
+#include <string.h>
 #include <X11/Xlib.h>
-#include <freerdp/utils/sleep.h>
 
 #include "xf_encode.h"
 
-XImage* xf_snapshot(xfPeerContext* xfp, int x, int y, int width, int height)
+XImage* xf_snapshot(xfCapture* capture, int x, int y, int width, int height)
 {
 	XImage* image;
-	xfInfo* xfi = xfp->info;
+	xfInfo* xfi = capture->info;
 
 	if (xfi->use_xshm)
 	{
-		pthread_mutex_lock(&(xfp->mutex));
+		pthread_mutex_lock(&(capture->mutex));
 
 		XCopyArea(xfi->display, xfi->root_window, xfi->fb_pixmap,
 				xfi->xdamage_gc, x, y, width, height, x, y);
@@ -38,134 +38,202 @@ XImage* xf_snapshot(xfPeerContext* xfp, int x, int y, int width, int height)
 
 		image = xfi->fb_image;
 
-		pthread_mutex_unlock(&(xfp->mutex));
+		pthread_mutex_unlock(&(capture->mutex));
 	}
 	else
 	{
-		pthread_mutex_lock(&(xfp->mutex));
+		pthread_mutex_lock(&(capture->mutex));
 
 		image = XGetImage(xfi->display, xfi->root_window,
 				x, y, width, height, AllPlanes, ZPixmap);
 
-		pthread_mutex_unlock(&(xfp->mutex));
+		pthread_mutex_unlock(&(capture->mutex));
 	}
 
 	return image;
 }
 
-void xf_xdamage_subtract_region(xfPeerContext* xfp, int x, int y, int width, int height)
+/**
+ * Copy screen rects into the screen sized image, at their screen
+ * position. With XShm this takes a single round trip, otherwise one
+ * XGetSubImage per rect.
+ */
+
+XImage* xf_snapshot_rects(xfCapture* capture, const RFX_RECT* rects, int num_rects)
 {
-	XRectangle region;
-	xfInfo* xfi = xfp->info;
+	int i;
+	xfInfo* xfi = capture->info;
 
-	region.x = x;
-	region.y = y;
-	region.width = width;
-	region.height = height;
+	if (xfi->fb_image == NULL)
+		return NULL;
 
-#ifdef WITH_XFIXES
-	pthread_mutex_lock(&(xfp->mutex));
-	XFixesSetRegion(xfi->display, xfi->xdamage_region, &region, 1);
-	XDamageSubtract(xfi->display, xfi->xdamage, xfi->xdamage_region, None);
-	pthread_mutex_unlock(&(xfp->mutex));
-#endif
+	pthread_mutex_lock(&(capture->mutex));
+
+	for (i = 0; i < num_rects; i++)
+	{
+		if (xfi->use_xshm)
+		{
+			XCopyArea(xfi->display, xfi->root_window, xfi->fb_pixmap, xfi->xdamage_gc,
+					rects[i].x, rects[i].y, rects[i].width, rects[i].height, rects[i].x, rects[i].y);
+		}
+		else
+		{
+			XGetSubImage(xfi->display, xfi->root_window, rects[i].x, rects[i].y,
+					rects[i].width, rects[i].height, AllPlanes, ZPixmap,
+					xfi->fb_image, rects[i].x, rects[i].y);
+		}
+	}
+
+	if (xfi->use_xshm)
+		XSync(xfi->display, False);
+
+	pthread_mutex_unlock(&(capture->mutex));
+
+	return xfi->fb_image;
 }
 
-void* xf_frame_rate_thread(void* param)
-{
-	xfInfo* xfi;
-	xfEvent* event;
-	xfPeerContext* xfp;
-	freerdp_peer* client;
-	uint32 wait_interval;
+#ifdef WITH_XDAMAGE
 
-	client = (freerdp_peer*) param;
-	xfp = (xfPeerContext*) client->context;
-	xfi = xfp->info;
+#define XF_XDAMAGE_BATCH	64
 
-	wait_interval = 1000000 / xfp->fps;
+/**
+ * Acknowledge a batch of damage notifications with the X server and add
+ * the areas to the capture in one go.
+ */
 
-	while (1)
+static void xf_xdamage_flush(xfCapture* capture, const RFX_RECT* rects, int num_rects)
+{
+#ifdef WITH_XFIXES
+	int i;
+	XRectangle region[XF_XDAMAGE_BATCH];
+	xfInfo* xfi = capture->info;
+
+	for (i = 0; i < num_rects; i++)
 	{
-		event = xf_event_new(XF_EVENT_TYPE_FRAME_TICK);
-		xf_event_push(xfp->event_queue, (xfEvent*) event);
-		freerdp_usleep(wait_interval);
+		region[i].x = rects[i].x;
+		region[i].y = rects[i].y;
+		region[i].width = rects[i].width;
+		region[i].height = rects[i].height;
 	}
-}
 
-void* xf_monitor_updates(void* param)
-{
-	int fds;
-	xfInfo* xfi;
-	XEvent xevent;
-	fd_set rfds_set;
-	int select_status;
-	int pending_events;
-	xfPeerContext* xfp;
-	freerdp_peer* client;
-	uint32 wait_interval;
-	struct timeval timeout;
-	int x, y, width, height;
-	XDamageNotifyEvent* notify;
-	xfEventRegion* event_region;
+	pthread_mutex_lock(&(capture->mutex));
+	XFixesSetRegion(xfi->display, xfi->xdamage_region, region, num_rects);
+	XDamageSubtract(xfi->display, xfi->xdamage, xfi->xdamage_region, None);
+	pthread_mutex_unlock(&(capture->mutex));
+#endif
 
-	client = (freerdp_peer*) param;
-	xfp = (xfPeerContext*) client->context;
-	xfi = xfp->info;
+	xf_capture_invalidate(capture, rects, num_rects);
+}
 
-	fds = xfi->xfds;
-	wait_interval = (1000000 / 2500);
-	memset(&timeout, 0, sizeof(struct timeval));
+#endif
 
-	pthread_create(&(xfp->frame_rate_thread), 0, xf_frame_rate_thread, (void*) client);
+/**
+ * Drain the X events of a captured display, turning damage notifications
+ * into invalid regions. Runs on the I/O worker whose frame tick comes first.
+ */
 
-	pthread_detach(pthread_self());
+void xf_process_xevents(xfCapture* capture)
+{
+	XEvent xevent;
+	xfInfo* xfi = capture->info;
+#ifdef WITH_XDAMAGE
+	int num_damage = 0;
+	XDamageNotifyEvent* notify;
+	RFX_RECT damage[XF_XDAMAGE_BATCH];
+#endif
 
 	while (1)
 	{
-		FD_ZERO(&rfds_set);
-		FD_SET(fds, &rfds_set);
-
-		timeout.tv_sec = 0;
-		timeout.tv_usec = wait_interval;
-		select_status = select(fds + 1, &rfds_set, NULL, NULL, &timeout);
+		pthread_mutex_lock(&(capture->mutex));
 
-		if (select_status == -1)
+		if (XPending(xfi->display) < 1)
 		{
-			printf("select failed\n");
-		}
-		else if (select_status == 0)
-		{
-			//printf("select timeout\n");
+			pthread_mutex_unlock(&(capture->mutex));
+			break;
 		}
 
-		pthread_mutex_lock(&(xfp->mutex));
-		pending_events = XPending(xfi->display);
-		pthread_mutex_unlock(&(xfp->mutex));
+		memset(&xevent, 0, sizeof(xevent));
+		XNextEvent(xfi->display, &xevent);
 
-		if (pending_events > 0)
+		pthread_mutex_unlock(&(capture->mutex));
+
+#ifdef WITH_XDAMAGE
+		if (xevent.type == xfi->xdamage_notify_event)
 		{
-			pthread_mutex_lock(&(xfp->mutex));
-			memset(&xevent, 0, sizeof(xevent));
-			XNextEvent(xfi->display, &xevent);
-			pthread_mutex_unlock(&(xfp->mutex));
+			notify = (XDamageNotifyEvent*) &xevent;
+
+			damage[num_damage].x = notify->area.x;
+			damage[num_damage].y = notify->area.y;
+			damage[num_damage].width = notify->area.width;
+			damage[num_damage].height = notify->area.height;
 
-			if (xevent.type == xfi->xdamage_notify_event)
+			if (++num_damage == XF_XDAMAGE_BATCH)
 			{
-				notify = (XDamageNotifyEvent*) &xevent;
+				xf_xdamage_flush(capture, damage, num_damage);
+				num_damage = 0;
+			}
+		}
+#endif
+	}
 
-				x = notify->area.x;
-				y = notify->area.y;
-				width = notify->area.width;
-				height = notify->area.height;
+#ifdef WITH_XDAMAGE
+	if (num_damage > 0)
+		xf_xdamage_flush(capture, damage, num_damage);
+#endif
+}
 
-				xf_xdamage_subtract_region(xfp, x, y, width, height);
+#define XF_HASH_PRIME1	2654435761U
+#define XF_HASH_PRIME2	2246822519U
+#define XF_HASH_PRIME3	3266489917U
+#define XF_HASH_PRIME4	668265263U
+#define XF_HASH_PRIME5	374761393U
 
-				event_region = xf_event_region_new(x, y, width, height);
-				xf_event_push(xfp->event_queue, (xfEvent*) event_region);
-			}
+#define XF_HASH_ROTL(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+#define XF_HASH_ROUND(acc, input)	acc = XF_HASH_ROTL(acc + (input) * XF_HASH_PRIME2, 13) * XF_HASH_PRIME1
+
+/**
+ * Hash the 32-bit pixels of a tile, xxHash32 style: four independent
+ * lanes take the pixels in turn, so the rounds can run in parallel.
+ */
+
+uint32 xf_tile_hash(uint8* data, int width, int height, int rowstride)
+{
+	int x, y;
+	uint32* pixel;
+	uint32 hash;
+	uint32 lanes[4];
+
+	lanes[0] = XF_HASH_PRIME1 + XF_HASH_PRIME2;
+	lanes[1] = XF_HASH_PRIME2;
+	lanes[2] = 0;
+	lanes[3] = 0 - XF_HASH_PRIME1;
+
+	for (y = 0; y < height; y++)
+	{
+		pixel = (uint32*) &data[y * rowstride];
+
+		for (x = 0; x + 4 <= width; x += 4)
+		{
+			XF_HASH_ROUND(lanes[0], pixel[x]);
+			XF_HASH_ROUND(lanes[1], pixel[x + 1]);
+			XF_HASH_ROUND(lanes[2], pixel[x + 2]);
+			XF_HASH_ROUND(lanes[3], pixel[x + 3]);
 		}
+
+		for (; x < width; x++)
+			XF_HASH_ROUND(lanes[x & 3], pixel[x]);
 	}
 
-	return NULL;
+	hash = XF_HASH_ROTL(lanes[0], 1) + XF_HASH_ROTL(lanes[1], 7) +
+			XF_HASH_ROTL(lanes[2], 12) + XF_HASH_ROTL(lanes[3], 18);
+	hash += (uint32) (width * height * 4);
+	hash = XF_HASH_ROTL(hash + XF_HASH_PRIME5, 17) * XF_HASH_PRIME4;
+
+	hash ^= hash >> 15;
+	hash *= XF_HASH_PRIME2;
+	hash ^= hash >> 13;
+	hash *= XF_HASH_PRIME3;
+	hash ^= hash >> 16;
+
+	return hash;
 }
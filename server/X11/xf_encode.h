@@ -23,10 +23,11 @@
 #include <pthread.h>
 #include "xfreerdp.h"
 
-#include "xf_peer.h"
+#include "xf_capture.h"
 
-XImage* xf_snapshot(xfPeerContext* xfp, int x, int y, int width, int height);
-void xf_xdamage_subtract_region(xfPeerContext* xfp, int x, int y, int width, int height);
-void* xf_monitor_updates(void* param);
+XImage* xf_snapshot(xfCapture* capture, int x, int y, int width, int height);
+XImage* xf_snapshot_rects(xfCapture* capture, const RFX_RECT* rects, int num_rects);
+void xf_process_xevents(xfCapture* capture);
+uint32 xf_tile_hash(uint8* data, int width, int height, int rowstride);
 
 #endif /* __XF_ENCODE_H */
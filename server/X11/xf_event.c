@@ -22,128 +22,140 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <X11/Xlib.h>
 #include <freerdp/utils/memory.h>
 
 #include "xf_event.h"
 
-int xf_is_event_set(xfEventQueue* event_queue)
-{
-	fd_set rfds;
-	int num_set;
-	struct timeval time;
+/**
+ * Each event source owns a bounded single producer, single consumer ring,
+ * so pushing and popping only take a memory barrier. The consumer is woken
+ * through an eventfd, written only when the queue goes from idle to
+ * signaled: a burst of events costs one write and one read.
+ */
 
-	FD_ZERO(&rfds);
-	FD_SET(event_queue->pipe_fd[0], &rfds);
-	memset(&time, 0, sizeof(time));
-	num_set = select(event_queue->pipe_fd[0] + 1, &rfds, 0, 0, &time);
+void xf_set_event(xfEventQueue* event_queue)
+{
+	uint64 value = 1;
 
-	return (num_set == 1);
+	/* a full barrier: the ring update is visible before the flag is tested */
+	if (__sync_bool_compare_and_swap(&event_queue->signaled, 0, 1))
+	{
+		if (write(event_queue->event_fd, &value, sizeof(value)) != sizeof(value))
+			printf("xf_set_event: error\n");
+	}
 }
 
-void xf_signal_event(xfEventQueue* event_queue)
+void xf_clear_event(xfEventQueue* event_queue)
 {
-	int length;
+	uint64 value;
+
+	if (event_queue->signaled == 0)
+		return;
 
-	length = write(event_queue->pipe_fd[1], "sig", 4);
+	if (read(event_queue->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		printf("xf_clear_event: error\n");
 
-	if (length != 4)
-		printf("xf_signal_event: error\n");
+	/* cleared before the rings are drained, so no push can be missed */
+	__sync_bool_compare_and_swap(&event_queue->signaled, 1, 0);
 }
 
-void xf_set_event(xfEventQueue* event_queue)
+int xf_event_queue_get_fd(xfEventQueue* event_queue)
 {
-	int length;
-
-	length = write(event_queue->pipe_fd[1], "sig", 4);
-
-	if (length != 4)
-		printf("xf_set_event: error\n");
+	return event_queue->event_fd;
 }
 
-void xf_clear_event(xfEventQueue* event_queue)
+/**
+ * Push an event from the given source. Only one thread at a time may push
+ * for a given source.
+ * @return false if the ring of that source is full, the event is not queued
+ */
+
+boolean xf_event_push(xfEventQueue* event_queue, int source, xfEvent* event)
 {
-	int length;
+	uint32 tail;
+	xfEventRing* ring;
 
-	while (xf_is_event_set(event_queue))
-	{
-		length = read(event_queue->pipe_fd[0], &length, 4);
+	if (source < 0 || source >= XF_EVENT_SOURCE_COUNT)
+		return false;
 
-		if (length != 4)
-			printf("xf_clear_event: error\n");
-	}
+	ring = &event_queue->rings[source];
+	tail = ring->tail;
+
+	if (tail - ring->head >= XF_EVENT_RING_SIZE)
+		return false;
+
+	ring->events[tail & (XF_EVENT_RING_SIZE - 1)] = event;
+
+	/* publish the slot before the new tail */
+	__sync_synchronize();
+	ring->tail = tail + 1;
+
+	xf_set_event(event_queue);
+
+	return true;
 }
 
-void xf_event_push(xfEventQueue* event_queue, xfEvent* event)
+static xfEventRing* xf_event_next_ring(xfEventQueue* event_queue)
 {
-	pthread_mutex_lock(&(event_queue->mutex));
+	int i;
+	xfEventRing* ring;
 
-	if (event_queue->count >= event_queue->size)
+	for (i = 0; i < XF_EVENT_SOURCE_COUNT; i++)
 	{
-		event_queue->size *= 2;
-		event_queue->events = (xfEvent**) xrealloc((void*) event_queue->events, sizeof(xfEvent*) * event_queue->size);
+		ring = &event_queue->rings[i];
+
+		if (ring->head != ring->tail)
+		{
+			/* read the slot only after seeing the tail that published it */
+			__sync_synchronize();
+			return ring;
+		}
 	}
 
-	event_queue->events[(event_queue->count)++] = event;
-
-	xf_set_event(event_queue);
-
-	pthread_mutex_unlock(&(event_queue->mutex));
+	return NULL;
 }
 
 xfEvent* xf_event_peek(xfEventQueue* event_queue)
 {
-	xfEvent* event;
-
-	pthread_mutex_lock(&(event_queue->mutex));
+	xfEventRing* ring;
 
-	if (event_queue->count < 1)
-		event = NULL;
-	else
-		event = event_queue->events[0];
+	ring = xf_event_next_ring(event_queue);
 
-	pthread_mutex_unlock(&(event_queue->mutex));
+	if (ring == NULL)
+		return NULL;
 
-	return event;
+	return ring->events[ring->head & (XF_EVENT_RING_SIZE - 1)];
 }
 
 xfEvent* xf_event_pop(xfEventQueue* event_queue)
 {
 	xfEvent* event;
+	xfEventRing* ring;
 
-	pthread_mutex_lock(&(event_queue->mutex));
+	ring = xf_event_next_ring(event_queue);
 
-	if (event_queue->count < 1)
+	if (ring == NULL)
 		return NULL;
 
-	event = event_queue->events[0];
-	(event_queue->count)--;
-
-	memmove(&event_queue->events[0], &event_queue->events[1], event_queue->count * sizeof(void*));
+	event = ring->events[ring->head & (XF_EVENT_RING_SIZE - 1)];
 
-	pthread_mutex_unlock(&(event_queue->mutex));
+	/* the slot is read before the producer may reuse it */
+	__sync_synchronize();
+	ring->head++;
 
 	return event;
 }
 
-xfEventRegion* xf_event_region_new(int x, int y, int width, int height)
+xfEventFrame* xf_event_frame_new(xfFrame* frame)
 {
-	xfEventRegion* event_region = xnew(xfEventRegion);
+	xfEventFrame* event_frame = xnew(xfEventFrame);
 
-	if (event_region != NULL)
-	{
-		event_region->x = x;
-		event_region->y = y;
-		event_region->width = width;
-		event_region->height = height;
-	}
+	event_frame->type = XF_EVENT_TYPE_FRAME_ENCODED;
+	event_frame->frame = xf_frame_ref(frame);
 
-	return event_region;
-}
-
-void xf_event_region_free(xfEventRegion* event_region)
-{
-	xfree(event_region);
+	return event_frame;
 }
 
 xfEvent* xf_event_new(int type)
@@ -155,6 +167,12 @@ xfEvent* xf_event_new(int type)
 
 void xf_event_free(xfEvent* event)
 {
+	if (event == NULL)
+		return;
+
+	if (event->type == XF_EVENT_TYPE_FRAME_ENCODED)
+		xf_frame_unref(((xfEventFrame*) event)->frame);
+
 	xfree(event);
 }
 
@@ -164,17 +182,10 @@ xfEventQueue* xf_event_queue_new()
 
 	if (event_queue != NULL)
 	{
-		event_queue->pipe_fd[0] = -1;
-		event_queue->pipe_fd[1] = -1;
-
-		event_queue->size = 16;
-		event_queue->count = 0;
-		event_queue->events = (xfEvent**) xzalloc(sizeof(xfEvent*) * event_queue->size);
-
-		if (pipe(event_queue->pipe_fd) < 0)
-			printf("xf_event_queue_new: pipe failed\n");
+		event_queue->event_fd = eventfd(0, EFD_NONBLOCK);
 
-		pthread_mutex_init(&(event_queue->mutex), NULL);
+		if (event_queue->event_fd < 0)
+			printf("xf_event_queue_new: eventfd failed\n");
 	}
 
 	return event_queue;
@@ -182,17 +193,19 @@ xfEventQueue* xf_event_queue_new()
 
 void xf_event_queue_free(xfEventQueue* event_queue)
 {
-	if (event_queue->pipe_fd[0] != -1)
-	{
-		close(event_queue->pipe_fd[0]);
-		event_queue->pipe_fd[0] = -1;
-	}
+	xfEvent* event;
+
+	if (event_queue == NULL)
+		return;
+
+	while ((event = xf_event_pop(event_queue)) != NULL)
+		xf_event_free(event);
 
-	if (event_queue->pipe_fd[1] != -1)
+	if (event_queue->event_fd != -1)
 	{
-		close(event_queue->pipe_fd[1]);
-		event_queue->pipe_fd[1] = -1;
+		close(event_queue->event_fd);
+		event_queue->event_fd = -1;
 	}
 
-	pthread_mutex_destroy(&(event_queue->mutex));
+	xfree(event_queue);
 }
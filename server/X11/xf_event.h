@@ -21,18 +21,19 @@
 #define __XF_EVENT_H
 
 typedef struct xf_event xfEvent;
+typedef struct xf_event_ring xfEventRing;
 typedef struct xf_event_queue xfEventQueue;
-typedef struct xf_event_region xfEventRegion;
+typedef struct xf_event_frame xfEventFrame;
 
 #include <pthread.h>
 #include "xfreerdp.h"
 
 #include "xf_peer.h"
+#include "xf_capture.h"
 
 enum xf_event_type
 {
-	XF_EVENT_TYPE_REGION,
-	XF_EVENT_TYPE_FRAME_TICK
+	XF_EVENT_TYPE_FRAME_ENCODED
 };
 
 struct xf_event
@@ -40,31 +41,50 @@ struct xf_event
 	int type;
 };
 
+/*
+ * One ring per event source, each with a single producer. Damage does not
+ * go through the queue: the capture of the display accumulates it.
+ */
+enum xf_event_source
+{
+	XF_EVENT_SOURCE_ENCODER,
+	XF_EVENT_SOURCE_COUNT
+};
+
+#define XF_EVENT_RING_SIZE	256 /* must be a power of two */
+
+struct xf_event_ring
+{
+	/* head and tail sit on their own cache lines */
+	volatile uint32 head;
+	uint8 pad_head[60];
+	volatile uint32 tail;
+	uint8 pad_tail[60];
+	xfEvent* events[XF_EVENT_RING_SIZE];
+};
+
 struct xf_event_queue
 {
-	int size;
-	int count;
-	int pipe_fd[2];
-	xfEvent** events;
-	pthread_mutex_t mutex;
+	int event_fd;
+	volatile int signaled;
+	xfEventRing rings[XF_EVENT_SOURCE_COUNT];
 };
 
-struct xf_event_region
+/* holds a reference on the frame */
+struct xf_event_frame
 {
 	int type;
 
-	int x;
-	int y;
-	int width;
-	int height;
+	xfFrame* frame;
 };
 
-void xf_event_push(xfEventQueue* event_queue, xfEvent* event);
+boolean xf_event_push(xfEventQueue* event_queue, int source, xfEvent* event);
 xfEvent* xf_event_peek(xfEventQueue* event_queue);
 xfEvent* xf_event_pop(xfEventQueue* event_queue);
+void xf_clear_event(xfEventQueue* event_queue);
+int xf_event_queue_get_fd(xfEventQueue* event_queue);
 
-xfEventRegion* xf_event_region_new(int x, int y, int width, int height);
-void xf_event_region_free(xfEventRegion* event_region);
+xfEventFrame* xf_event_frame_new(xfFrame* frame);
 
 xfEvent* xf_event_new(int type);
 void xf_event_free(xfEvent* event);
@@ -42,14 +42,14 @@ void xf_input_keyboard_event(rdpInput* input, uint16 flags, uint16 code)
 	if (keycode != 0)
 	{
 #ifdef WITH_XTEST
-		pthread_mutex_lock(&(xfp->mutex));
+		pthread_mutex_lock(&(xfp->capture->mutex));
 
 		if (flags & KBD_FLAGS_DOWN)
 			XTestFakeKeyEvent(xfi->display, keycode, True, 0);
 		else if (flags & KBD_FLAGS_RELEASE)
 			XTestFakeKeyEvent(xfi->display, keycode, False, 0);
 
-		pthread_mutex_unlock(&(xfp->mutex));
+		pthread_mutex_unlock(&(xfp->capture->mutex));
 #endif
 	}
 }
@@ -66,7 +66,7 @@ void xf_input_mouse_event(rdpInput* input, uint16 flags, uint16 x, uint16 y)
 	xfPeerContext* xfp = (xfPeerContext*) input->context;
 	xfInfo* xfi = xfp->info;
 
-	pthread_mutex_lock(&(xfp->mutex));
+	pthread_mutex_lock(&(xfp->capture->mutex));
 #ifdef WITH_XTEST
 
 	if (flags & PTR_FLAGS_WHEEL)
@@ -100,7 +100,7 @@ void xf_input_mouse_event(rdpInput* input, uint16 flags, uint16 x, uint16 y)
 			XTestFakeButtonEvent(xfi->display, button, down, 0);
 	}
 #endif
-	pthread_mutex_unlock(&(xfp->mutex));
+	pthread_mutex_unlock(&(xfp->capture->mutex));
 }
 
 void xf_input_extended_mouse_event(rdpInput* input, uint16 flags, uint16 x, uint16 y)
@@ -108,11 +108,11 @@ void xf_input_extended_mouse_event(rdpInput* input, uint16 flags, uint16 x, uint
 	xfPeerContext* xfp = (xfPeerContext*) input->context;
 	xfInfo* xfi = xfp->info;
 
-	pthread_mutex_lock(&(xfp->mutex));
+	pthread_mutex_lock(&(xfp->capture->mutex));
 #ifdef WITH_XTEST
 	XTestFakeMotionEvent(xfi->display, 0, x, y, CurrentTime);
 #endif
-	pthread_mutex_unlock(&(xfp->mutex));
+	pthread_mutex_unlock(&(xfp->capture->mutex));
 }
 
 void xf_input_register_callbacks(rdpInput* input)
@@ -21,9 +21,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <sys/select.h>
@@ -40,230 +39,12 @@ extern tbool xf_pcap_dump_realtime;
 #include "xf_event.h"
 #include "xf_input.h"
 #include "xf_encode.h"
+#include "xf_runtime.h"
 
 #include "xf_peer.h"
 
-#ifdef WITH_XDAMAGE
-
-void xf_xdamage_init(xfInfo* xfi)
-{
-	Bool pixmaps;
-	int damage_event;
-	int damage_error;
-	int major, minor;
-	XGCValues values;
-
-	if (XShmQueryExtension(xfi->display) != False)
-	{
-		XShmQueryVersion(xfi->display, &major, &minor, &pixmaps);
-
-		if (pixmaps == False)
-		{
-			printf("XShmQueryVersion failed\n");
-			return;
-		}
-	}
-	else
-	{
-		printf("XShmQueryExtension failed\n");
-		return;
-	}
-
-	if (XDamageQueryExtension(xfi->display, &damage_event, &damage_error) == 0)
-	{
-		printf("XDamageQueryExtension failed\n");
-		return;
-	}
-
-	XDamageQueryVersion(xfi->display, &major, &minor);
-
-	if (XDamageQueryVersion(xfi->display, &major, &minor) == 0)
-	{
-		printf("XDamageQueryVersion failed\n");
-		return;
-	}
-	else if (major < 1)
-	{
-		printf("XDamageQueryVersion failed: major:%d minor:%d\n", major, minor);
-		return;
-	}
-
-	xfi->xdamage_notify_event = damage_event + XDamageNotify;
-	xfi->xdamage = XDamageCreate(xfi->display, xfi->root_window, XDamageReportDeltaRectangles);
-
-	if (xfi->xdamage == None)
-	{
-		printf("XDamageCreate failed\n");
-		return;
-	}
-
-#ifdef WITH_XFIXES
-	xfi->xdamage_region = XFixesCreateRegion(xfi->display, NULL, 0);
-
-	if (xfi->xdamage_region == None)
-	{
-		printf("XFixesCreateRegion failed\n");
-		XDamageDestroy(xfi->display, xfi->xdamage);
-		xfi->xdamage = None;
-		return;
-	}
-#endif
-
-	values.subwindow_mode = IncludeInferiors;
-	xfi->xdamage_gc = XCreateGC(xfi->display, xfi->root_window, GCSubwindowMode, &values);
-	XSetFunction(xfi->display, xfi->xdamage_gc, GXcopy);
-}
-
-#endif
-
-void xf_xshm_init(xfInfo* xfi)
-{
-	xfi->fb_shm_info.shmid = -1;
-	xfi->fb_shm_info.shmaddr = (char*) -1;
-
-	xfi->fb_image = XShmCreateImage(xfi->display, xfi->visual, xfi->depth,
-			ZPixmap, NULL, &(xfi->fb_shm_info), xfi->width, xfi->height);
-
-	if (xfi->fb_image == NULL)
-	{
-		printf("XShmCreateImage failed\n");
-		return;
-	}
-
-	xfi->fb_shm_info.shmid = shmget(IPC_PRIVATE,
-			xfi->fb_image->bytes_per_line * xfi->fb_image->height, IPC_CREAT | 0600);
-
-	if (xfi->fb_shm_info.shmid == -1)
-	{
-		printf("shmget failed\n");
-		return;
-	}
-
-	xfi->fb_shm_info.readOnly = False;
-	xfi->fb_shm_info.shmaddr = shmat(xfi->fb_shm_info.shmid, 0, 0);
-	xfi->fb_image->data = xfi->fb_shm_info.shmaddr;
-
-	if (xfi->fb_shm_info.shmaddr == ((char*) -1))
-	{
-		printf("shmat failed\n");
-		return;
-	}
-
-	XShmAttach(xfi->display, &(xfi->fb_shm_info));
-	XSync(xfi->display, False);
-
-	shmctl(xfi->fb_shm_info.shmid, IPC_RMID, 0);
-
-	xfi->fb_pixmap = XShmCreatePixmap(xfi->display,
-			xfi->root_window, xfi->fb_image->data, &(xfi->fb_shm_info),
-			xfi->fb_image->width, xfi->fb_image->height, xfi->fb_image->depth);
-}
-
-xfInfo* xf_info_init()
-{
-	int i;
-	xfInfo* xfi;
-	int pf_count;
-	int vi_count;
-	XVisualInfo* vi;
-	XVisualInfo* vis;
-	XVisualInfo template;
-	XPixmapFormatValues* pf;
-	XPixmapFormatValues* pfs;
-
-	xfi = xnew(xfInfo);
-
-	//xfi->use_xshm = true;
-	xfi->display = XOpenDisplay(NULL);
-
-	XInitThreads();
-
-	if (xfi->display == NULL)
-	{
-		printf("failed to open display: %s\n", XDisplayName(NULL));
-		exit(1);
-	}
-
-	xfi->xfds = ConnectionNumber(xfi->display);
-	xfi->number = DefaultScreen(xfi->display);
-	xfi->screen = ScreenOfDisplay(xfi->display, xfi->number);
-	xfi->depth = DefaultDepthOfScreen(xfi->screen);
-	xfi->width = WidthOfScreen(xfi->screen);
-	xfi->height = HeightOfScreen(xfi->screen);
-	xfi->root_window = DefaultRootWindow(xfi->display);
-
-	pfs = XListPixmapFormats(xfi->display, &pf_count);
-
-	if (pfs == NULL)
-	{
-		printf("XListPixmapFormats failed\n");
-		exit(1);
-	}
-
-	for (i = 0; i < pf_count; i++)
-	{
-		pf = pfs + i;
-
-		if (pf->depth == xfi->depth)
-		{
-			xfi->bpp = pf->bits_per_pixel;
-			xfi->scanline_pad = pf->scanline_pad;
-			break;
-		}
-	}
-	XFree(pfs);
-
-	memset(&template, 0, sizeof(template));
-	template.class = TrueColor;
-	template.screen = xfi->number;
-
-	vis = XGetVisualInfo(xfi->display, VisualClassMask | VisualScreenMask, &template, &vi_count);
-
-	if (vis == NULL)
-	{
-		printf("XGetVisualInfo failed\n");
-		exit(1);
-	}
-
-	for (i = 0; i < vi_count; i++)
-	{
-		vi = vis + i;
-
-		if (vi->depth == xfi->depth)
-		{
-			xfi->visual = vi->visual;
-			break;
-		}
-	}
-	XFree(vis);
-
-	xfi->clrconv = freerdp_clrconv_new(CLRCONV_ALPHA | CLRCONV_INVERT);
-
-	XSelectInput(xfi->display, xfi->root_window, SubstructureNotifyMask);
-
-#ifdef WITH_XDAMAGE
-	xf_xdamage_init(xfi);
-#endif
-
-	xf_xshm_init(xfi);
-
-	xfi->bytesPerPixel = 4;
-
-	freerdp_kbd_init(xfi->display, 0);
-
-	return xfi;
-}
-
 void xf_peer_context_new(freerdp_peer* client, xfPeerContext* context)
 {
-	context->info = xf_info_init();
-	context->rfx_context = rfx_context_new();
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = context->info->width;
-	context->rfx_context->height = context->info->height;
-
-	rfx_context_set_pixel_format(context->rfx_context, RFX_PIXEL_FORMAT_BGRA);
-
 	context->s = stream_new(65536);
 }
 
@@ -271,13 +52,20 @@ void xf_peer_context_free(freerdp_peer* client, xfPeerContext* context)
 {
 	if (context)
 	{
+		if (context->capture != NULL)
+		{
+			xf_capture_unsubscribe(context->capture, client);
+			xf_capture_release(context->capture);
+		}
+
+		xf_event_queue_free(context->event_queue);
 		stream_free(context->s);
 		rfx_context_free(context->rfx_context);
 		xfree(context);
 	}
 }
 
-void xf_peer_init(freerdp_peer* client)
+void xf_peer_init(freerdp_peer* client, xfRuntime* runtime)
 {
 	xfInfo* xfi;
 	xfPeerContext* xfp;
@@ -290,14 +78,22 @@ void xf_peer_init(freerdp_peer* client)
 	xfp = (xfPeerContext*) client->context;
 
 	xfp->fps = 24;
-	xfp->thread = 0;
+	xfp->pace_fps = xfp->fps;
+	xfp->timer_fd = -1;
 	xfp->activations = 0;
 	xfp->event_queue = xf_event_queue_new();
 
+	/* the display is captured and encoded once for all its peers */
+	xfp->capture = xf_capture_get(runtime);
+	xfp->info = xfp->capture->info;
 	xfi = xfp->info;
-	xfp->hdc = gdi_CreateDC(xfi->clrconv, xfi->bpp);
 
-	pthread_mutex_init(&(xfp->mutex), NULL);
+	/* only frames the tilesets of the capture, the header and frame index are per peer */
+	xfp->rfx_context = rfx_context_new();
+	xfp->rfx_context->mode = RLGR3;
+	xfp->rfx_context->width = xfi->width;
+	xfp->rfx_context->height = xfi->height;
+	rfx_context_set_pixel_format(xfp->rfx_context, RFX_PIXEL_FORMAT_BGRA);
 }
 
 STREAM* xf_peer_stream_init(xfPeerContext* context)
@@ -312,7 +108,7 @@ void xf_peer_live_rfx(freerdp_peer* client)
 	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
 	if (xfp->activations == 1)
-		pthread_create(&(xfp->thread), 0, xf_monitor_updates, (void*) client);
+		xf_runtime_start_frames(client);
 }
 
 static tbool xf_peer_sleep_tsdiff(uint32 *old_sec, uint32 *old_usec, uint32 new_sec, uint32 new_usec)
@@ -390,90 +186,208 @@ void xf_peer_dump_rfx(freerdp_peer* client)
 	}
 }
 
-void xf_peer_rfx_update(freerdp_peer* client, int x, int y, int width, int height)
+static uint64 xf_peer_get_time(void)
 {
-	STREAM* s;
-	uint8* data;
-	xfInfo* xfi;
-	RFX_RECT rect;
-	XImage* image;
-	rdpUpdate* update;
-	xfPeerContext* xfp;
-	SURFACE_BITS_COMMAND* cmd;
+	struct timespec ts;
 
-	update = client->update;
-	xfp = (xfPeerContext*) client->context;
-	cmd = &update->surface_bits_command;
-	xfi = xfp->info;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32 xf_peer_frames_in_flight(xfPeerContext* xfp)
+{
+	return xfp->frame_acks ? xfp->frame_id - xfp->frame_acked : 0;
+}
+
+static void xf_peer_set_fps(freerdp_peer* client, int fps)
+{
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
-	if (width * height <= 0)
+	if (fps == xfp->fps)
 		return;
 
-	s = xf_peer_stream_init(xfp);
+	xfp->fps = fps;
+	xf_runtime_start_frames(client);
+}
 
-	if (xfi->use_xshm)
-	{
-		width = x + width;
-		height = y + height;
-		x = 0;
-		y = 0;
+/**
+ * Back off when the link does not keep up: halve the frame rate and use a
+ * coarser quantization, at most once per 250 ms so that a single burst of
+ * congestion is only counted once.
+ */
 
-		rect.x = x;
-		rect.y = y;
-		rect.width = width;
-		rect.height = height;
+static void xf_peer_congested(freerdp_peer* client, uint64 now)
+{
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
-		image = xf_snapshot(xfp, x, y, width, height);
+	if (now - xfp->last_decrease < 250000)
+		return;
 
-		data = (uint8*) image->data;
-		data = &data[(y * image->bytes_per_line) + (x * image->bits_per_pixel)];
+	xfp->last_decrease = now;
+	xfp->last_increase = now;
 
-		rfx_compose_message(xfp->rfx_context, s, &rect, 1, data,
-				width, height, image->bytes_per_line);
+	xfp->quality = MIN(xfp->quality + 1, XF_PEER_MAX_QUALITY);
+	xf_peer_set_fps(client, MAX(xfp->fps / 2, XF_PEER_MIN_FPS));
+	xf_capture_set_pace(xfp->capture, client, xfp->fps, xfp->quality);
+}
 
-		cmd->destLeft = x;
-		cmd->destTop = y;
-		cmd->destRight = x + width;
-		cmd->destBottom = y + height;
-	}
+/**
+ * Probe for more bandwidth after a second without congestion: first
+ * restore the quality, then raise the frame rate one step at a time.
+ */
+
+static void xf_peer_uncongested(freerdp_peer* client, uint64 now)
+{
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
+
+	if (now - xfp->last_increase < 1000000)
+		return;
+
+	xfp->last_increase = now;
+
+	if (xfp->quality > 0)
+		xfp->quality--;
 	else
+		xf_peer_set_fps(client, MIN(xfp->fps + 2, XF_PEER_MAX_FPS));
+
+	xf_capture_set_pace(xfp->capture, client, xfp->fps, xfp->quality);
+}
+
+/**
+ * Called by the frame timer. The capture is shared, so the tick of
+ * whichever peer comes first drives it.
+ */
+
+tbool xf_peer_frame_tick(freerdp_peer* client)
+{
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
+
+	xf_capture_tick(xfp->capture);
+
+	return true;
+}
+
+/**
+ * Wrap a frame published by the capture in a RemoteFX message of this peer.
+ */
+
+static void xf_peer_send_frame(freerdp_peer* client, xfFrame* frame)
+{
+	STREAM* s;
+	uint64 now;
+	SURFACE_BITS_COMMAND cmd;
+	SURFACE_FRAME_MARKER marker;
+	rdpUpdate* update = client->update;
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
+
+	s = xf_peer_stream_init(xfp);
+
+	rfx_compose_message_frame(xfp->rfx_context, s, frame->rects, frame->num_rects,
+			stream_get_head(frame->tileset), stream_get_length(frame->tileset));
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.destLeft = frame->x;
+	cmd.destTop = frame->y;
+	cmd.destRight = frame->x + frame->width;
+	cmd.destBottom = frame->y + frame->height;
+	cmd.bpp = 32;
+	cmd.codecID = client->settings->rfx_codec_id;
+	cmd.width = frame->width;
+	cmd.height = frame->height;
+	cmd.bitmapDataLength = stream_get_length(s);
+	cmd.bitmapData = stream_get_head(s);
+
+	if (xfp->frame_acks)
 	{
-		rect.x = 0;
-		rect.y = 0;
-		rect.width = width;
-		rect.height = height;
+		marker.frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+		marker.frameId = xfp->frame_id;
+		update->SurfaceFrameMarker(update->context, &marker);
+	}
 
-		image = xf_snapshot(xfp, x, y, width, height);
+	update->SurfaceBits(update->context, &cmd);
+
+	if (xfp->frame_acks)
+	{
+		marker.frameAction = SURFACECMD_FRAMEACTION_END;
+		update->SurfaceFrameMarker(update->context, &marker);
+		xfp->frame_id++;
+	}
+
+	/* the transport queues what the socket does not take right away */
+	xfp->output_queued = freerdp_peer_flush_output(client);
+	now = xf_peer_get_time();
+
+	if (xfp->output_queued > 0)
+		xf_peer_congested(client, now);
+	else if (xfp->frame_acks == false)
+		xf_peer_uncongested(client, now);
+}
 
-		rfx_compose_message(xfp->rfx_context, s, &rect, 1,
-				(uint8*) image->data, width, height, width * xfi->bytesPerPixel);
+/**
+ * Send the frames queued by the capture, holding them back while the
+ * client has as many unacknowledged frames as it allows.
+ */
 
-		cmd->destLeft = x;
-		cmd->destTop = y;
-		cmd->destRight = x + width;
-		cmd->destBottom = y + height;
+static void xf_peer_send_frames(freerdp_peer* client)
+{
+	xfEvent* event;
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
-		XDestroyImage(image);
+	while ((event = xf_event_peek(xfp->event_queue)) != NULL)
+	{
+		/* hold frames back while the client or the link has not taken the previous ones */
+		if (event->type == XF_EVENT_TYPE_FRAME_ENCODED && xfp->activated &&
+				(xf_peer_frames_in_flight(xfp) >= xfp->max_frames_in_flight || xfp->output_queued > 0))
+		{
+			xf_peer_congested(client, xf_peer_get_time());
+			break;
+		}
+
+		event = xf_event_pop(xfp->event_queue);
+
+		if (event->type == XF_EVENT_TYPE_FRAME_ENCODED)
+		{
+			if (xfp->activated)
+				xf_peer_send_frame(client, ((xfEventFrame*) event)->frame);
+
+			xf_event_free(event);
+		}
+		else
+		{
+			xf_event_free(event);
+		}
 	}
+}
 
-	cmd->bpp = 32;
-	cmd->codecID = client->settings->rfx_codec_id;
-	cmd->width = width;
-	cmd->height = height;
-	cmd->bitmapDataLength = stream_get_length(s);
-	cmd->bitmapData = stream_get_head(s);
+static void xf_peer_frame_acknowledge(rdpContext* context, uint32 frameId)
+{
+	freerdp_peer* client = context->peer;
+	xfPeerContext* xfp = (xfPeerContext*) context;
 
-	update->SurfaceBits(update->context, cmd);
+	if (xfp->frame_acks == false)
+		return;
+
+	/* acknowledgements are cumulative, ignore stale ones */
+	if ((sint32) (frameId + 1 - xfp->frame_acked) <= 0 || (sint32) (xfp->frame_id - (frameId + 1)) < 0)
+		return;
+
+	xfp->frame_acked = frameId + 1;
+
+	if (xf_peer_frames_in_flight(xfp) < xfp->max_frames_in_flight)
+		xf_peer_uncongested(client, xf_peer_get_time());
+
+	xf_peer_send_frames(client);
 }
 
 tbool xf_peer_get_fds(freerdp_peer* client, void** rfds, int* rcount)
 {
 	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
-	if (xfp->event_queue->pipe_fd[0] == -1)
+	if (xf_event_queue_get_fd(xfp->event_queue) == -1)
 		return true;
 
-	rfds[*rcount] = (void *)(long) xfp->event_queue->pipe_fd[0];
+	rfds[*rcount] = (void *)(long) xf_event_queue_get_fd(xfp->event_queue);
 	(*rcount)++;
 
 	return true;
@@ -481,48 +395,92 @@ tbool xf_peer_get_fds(freerdp_peer* client, void** rfds, int* rcount)
 
 tbool xf_peer_check_fds(freerdp_peer* client)
 {
-	xfInfo* xfi;
-	xfEvent* event;
 	xfPeerContext* xfp;
-	HGDI_RGN invalid_region;
 
 	xfp = (xfPeerContext*) client->context;
-	xfi = xfp->info;
 
-	if (xfp->activated == false)
-		return true;
+	xf_clear_event(xfp->event_queue);
+	xf_peer_send_frames(client);
 
-	event = xf_event_peek(xfp->event_queue);
+	return true;
+}
 
-	if (event != NULL)
-	{
-		if (event->type == XF_EVENT_TYPE_REGION)
-		{
-			xfEventRegion* region = (xfEventRegion*) xf_event_pop(xfp->event_queue);
-			gdi_InvalidateRegion(xfp->hdc, region->x, region->y, region->width, region->height);
-			xf_event_region_free(region);
-		}
-		else if (event->type == XF_EVENT_TYPE_FRAME_TICK)
-		{
-			event = xf_event_pop(xfp->event_queue);
-			invalid_region = xfp->hdc->hwnd->invalid;
+/**
+ * Write the output the transport queued while the socket was full,
+ * then send the frames held back meanwhile once it is all out.
+ */
 
-			if (invalid_region->null == false)
-			{
-				xf_peer_rfx_update(client, invalid_region->x, invalid_region->y,
-					invalid_region->w, invalid_region->h);
-			}
+tbool xf_peer_flush_output(freerdp_peer* client)
+{
+	int queued;
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
 
-			invalid_region->null = 1;
-			xfp->hdc->hwnd->ninvalid = 0;
+	queued = freerdp_peer_flush_output(client);
 
-			xf_event_free(event);
-		}
+	if (queued < 0)
+		return false;
+
+	if (queued == 0 && xfp->output_queued > 0)
+	{
+		xfp->output_queued = 0;
+		xf_peer_send_frames(client);
+	}
+	else
+	{
+		xfp->output_queued = queued;
 	}
 
 	return true;
 }
 
+/**
+ * Rectangles are inclusive in Refresh Rect and Suppress Output PDUs.
+ */
+
+static void xf_peer_refresh_rect(rdpContext* context, uint8 count, RECTANGLE_16* areas)
+{
+	int i;
+	xfPeerContext* xfp = (xfPeerContext*) context;
+
+	if (xfp->activated == false || xfp->suppressed)
+		return;
+
+	for (i = 0; i < count; i++)
+	{
+		xf_capture_refresh(xfp->capture, areas[i].left, areas[i].top,
+				areas[i].right - areas[i].left + 1, areas[i].bottom - areas[i].top + 1);
+	}
+}
+
+/**
+ * A client that is minimized or otherwise not showing the session stops
+ * receiving frames, which stops the capture and encoding altogether once
+ * no other peer shares the display. It resumes with the visible area.
+ */
+
+static void xf_peer_suppress_output(rdpContext* context, uint8 allow, RECTANGLE_16* area)
+{
+	freerdp_peer* client = context->peer;
+	xfPeerContext* xfp = (xfPeerContext*) context;
+
+	if (xfp->activated == false)
+		return;
+
+	if (allow == 0 && xfp->suppressed == false)
+	{
+		xfp->suppressed = true;
+		xf_capture_unsubscribe(xfp->capture, client);
+		xf_runtime_start_frames(client);
+	}
+	else if (allow != 0 && xfp->suppressed)
+	{
+		xfp->suppressed = false;
+		xf_capture_subscribe(xfp->capture, client, area->left, area->top,
+				area->right - area->left + 1, area->bottom - area->top + 1);
+		xf_runtime_start_frames(client);
+	}
+}
+
 tbool xf_peer_capabilities(freerdp_peer* client)
 {
 	return true;
@@ -575,6 +533,12 @@ tbool xf_peer_activate(freerdp_peer* client)
 	rfx_context_reset(xfp->rfx_context);
 	xfp->activated = true;
 
+	/* frames are acknowledged if the client sent the capability */
+	xfp->frame_acks = (client->settings->frame_acknowledge && client->settings->max_unacknowledged_frames > 0);
+	xfp->max_frames_in_flight = MAX(client->settings->max_unacknowledged_frames, 1);
+	xfp->frame_acked = xfp->frame_id;
+	xfp->suppressed = false;
+
 	if (xf_pcap_file != NULL)
 	{
 		client->update->dump_rfx = true;
@@ -584,28 +548,23 @@ tbool xf_peer_activate(freerdp_peer* client)
 	{
 		xf_peer_live_rfx(client);
 		xfp->activations++;
+
+		/* a (re)activated peer needs the whole screen */
+		xf_capture_subscribe(xfp->capture, client, 0, 0, xfp->info->width, xfp->info->height);
 	}
 
 	return true;
 }
 
-void* xf_peer_main_loop(void* arg)
+void xf_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
 {
-	int i;
-	int fds;
-	int max_fds;
-	int rcount;
-	void* rfds[32];
-	fd_set rfds_set;
 	rdpSettings* settings;
 	char* server_file_path;
-	freerdp_peer* client = (freerdp_peer*) arg;
-
-	memset(rfds, 0, sizeof(rfds));
+	xfRuntime* runtime = (xfRuntime*) instance->info;
 
 	printf("We've got a client %s\n", client->hostname);
 
-	xf_peer_init(client);
+	xf_peer_init(client, runtime);
 	settings = client->settings;
 
 	/* Initialize the real server settings here */
@@ -627,84 +586,20 @@ void* xf_peer_main_loop(void* arg)
 
 	settings->nla_security = false;
 	settings->rfx_codec = true;
+	settings->frame_acknowledge = true;
 
 	client->Capabilities = xf_peer_capabilities;
 	client->PostConnect = xf_peer_post_connect;
 	client->Activate = xf_peer_activate;
 
 	xf_input_register_callbacks(client->input);
+	client->update->SurfaceFrameAcknowledge = xf_peer_frame_acknowledge;
 
 	client->Initialize(client);
 
-	while (1)
-	{
-		rcount = 0;
-
-		if (client->GetFileDescriptor(client, rfds, &rcount) == false)
-		{
-			printf("Failed to get FreeRDP file descriptor\n");
-			break;
-		}
-		if (xf_peer_get_fds(client, rfds, &rcount) == false)
-		{
-			printf("Failed to get xfreerdp file descriptor\n");
-			break;
-		}
-
-		max_fds = 0;
-		FD_ZERO(&rfds_set);
-
-		for (i = 0; i < rcount; i++)
-		{
-			fds = (int)(long)(rfds[i]);
-
-			if (fds > max_fds)
-				max_fds = fds;
-
-			FD_SET(fds, &rfds_set);
-		}
-
-		if (max_fds == 0)
-			break;
-
-		if (select(max_fds + 1, &rfds_set, NULL, NULL, NULL) == -1)
-		{
-			/* these are not really errors */
-			if (!((errno == EAGAIN) ||
-				(errno == EWOULDBLOCK) ||
-				(errno == EINPROGRESS) ||
-				(errno == EINTR))) /* signal occurred */
-			{
-				printf("select failed\n");
-				break;
-			}
-		}
-
-		if (client->CheckFileDescriptor(client) == false)
-		{
-			printf("Failed to check freerdp file descriptor\n");
-			break;
-		}
-		if ((xf_peer_check_fds(client)) == false)
-		{
-			printf("Failed to check xfreerdp file descriptor\n");
-			break;
-		}
-	}
-
-	printf("Client %s disconnected.\n", client->hostname);
-
-	client->Disconnect(client);
-	freerdp_peer_context_free(client);
-	freerdp_peer_free(client);
-
-	return NULL;
-}
-
-void xf_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
-{
-	pthread_t th;
+	client->update->RefreshRect = xf_peer_refresh_rect;
+	client->update->SuppressOutput = xf_peer_suppress_output;
 
-	pthread_create(&th, 0, xf_peer_main_loop, client);
-	pthread_detach(th);
+	/* from here on the peer is served by one of the runtime I/O workers */
+	xf_runtime_add_peer(runtime, client);
 }
@@ -31,6 +31,15 @@
 typedef struct xf_peer_context xfPeerContext;
 
 #include "xfreerdp.h"
+#include "xf_runtime.h"
+#include "xf_capture.h"
+
+#define XF_PEER_MAX_FDS		8
+
+#define XF_PEER_MIN_FPS		4
+#define XF_PEER_MAX_FPS		30
+#define XF_PEER_IDLE_FPS	1
+#define XF_PEER_MAX_QUALITY	3 /* coarsest quantization level */
 
 struct xf_peer_context
 {
@@ -38,17 +47,41 @@ struct xf_peer_context
 
 	int fps;
 	STREAM* s;
-	HGDI_DC hdc;
 	xfInfo* info;
 	int activations;
-	pthread_t thread;
 	boolean activated;
-	pthread_mutex_t mutex;
+	boolean suppressed;
+	xfCapture* capture;
 	RFX_CONTEXT* rfx_context;
 	xfEventQueue* event_queue;
-	pthread_t frame_rate_thread;
+
+	/* owned by the I/O worker serving this peer */
+	xfWorker* worker;
+	xfPeerContext* next;
+	int fds[XF_PEER_MAX_FDS];
+	int num_fds;
+	int timer_fd;
+	boolean watch_output; /* waiting for the socket to take the queued output */
+
+	/* flow control, owned by the I/O worker serving this peer */
+	int quality;
+	int output_queued; /* bytes the transport holds until the socket is writable */
+	boolean frame_acks;
+	uint32 frame_id;
+	uint32 frame_acked;
+	uint32 max_frames_in_flight;
+	uint64 last_decrease;
+	uint64 last_increase;
+
+	/* copy of fps and quality read by the capture, guarded by its lock */
+	int pace_fps;
+	int pace_quality;
 };
 
+tbool xf_peer_get_fds(freerdp_peer* client, void** rfds, int* rcount);
+tbool xf_peer_check_fds(freerdp_peer* client);
+tbool xf_peer_frame_tick(freerdp_peer* client);
+tbool xf_peer_flush_output(freerdp_peer* client);
 void xf_peer_accepted(freerdp_listener* instance, freerdp_peer* client);
 
 #endif /* __XF_PEER_H */
@@ -0,0 +1,539 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 Server Runtime
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <X11/Xlib.h>
+#include <freerdp/utils/memory.h>
+
+#include "xf_event.h"
+
+#include "xf_runtime.h"
+
+static void xf_worker_wake(xfWorker* worker)
+{
+	if (write(worker->wake_fd[1], "w", 1) != 1 && errno != EAGAIN)
+		printf("xf_worker_wake: write failed\n");
+}
+
+static void xf_worker_clear_wake(xfWorker* worker)
+{
+	char buf[64];
+
+	while (read(worker->wake_fd[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+static boolean xf_worker_attach_peer(xfWorker* worker, freerdp_peer* client)
+{
+	int i;
+	int rcount;
+	void* rfds[32];
+	xfPeerContext* xfp;
+
+	xfp = (xfPeerContext*) client->context;
+
+	rcount = 0;
+
+	if (client->GetFileDescriptor(client, rfds, &rcount) == false ||
+			xf_peer_get_fds(client, rfds, &rcount) == false)
+	{
+		printf("xf_worker_attach_peer: failed to get peer file descriptors\n");
+		return false;
+	}
+
+	xfp->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+	if (xfp->timer_fd < 0)
+	{
+		printf("xf_worker_attach_peer: timerfd_create failed\n");
+		return false;
+	}
+
+	rfds[rcount++] = (void*)(long) xfp->timer_fd;
+
+	xfp->num_fds = 0;
+
+	for (i = 0; i < rcount && xfp->num_fds < XF_PEER_MAX_FDS; i++)
+	{
+		if (event_loop_add_fd(worker->loop, (int)(long) rfds[i], (void*) client))
+			xfp->fds[xfp->num_fds++] = (int)(long) rfds[i];
+	}
+
+	freerdp_peer_set_queue_output(client, true);
+	xfp->watch_output = false;
+
+	xfp->worker = worker;
+	xfp->next = worker->peers;
+	worker->peers = xfp;
+	worker->num_peers++;
+
+	return true;
+}
+
+static void xf_worker_detach_peer(xfWorker* worker, freerdp_peer* client)
+{
+	int i;
+	xfPeerContext* xfp;
+	xfPeerContext** link;
+
+	xfp = (xfPeerContext*) client->context;
+
+	for (i = 0; i < xfp->num_fds; i++)
+		event_loop_remove_fd(worker->loop, xfp->fds[i]);
+
+	xfp->num_fds = 0;
+
+	for (link = &worker->peers; *link != NULL; link = &(*link)->next)
+	{
+		if (*link == xfp)
+		{
+			*link = xfp->next;
+			worker->num_peers--;
+			break;
+		}
+	}
+
+	if (xfp->timer_fd >= 0)
+	{
+		close(xfp->timer_fd);
+		xfp->timer_fd = -1;
+	}
+
+	printf("Client %s disconnected.\n", client->hostname);
+
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+}
+
+static void xf_worker_take_pending(xfWorker* worker)
+{
+	int i;
+
+	xf_worker_clear_wake(worker);
+
+	pthread_mutex_lock(&(worker->mutex));
+
+	for (i = 0; i < worker->num_pending; i++)
+	{
+		if (xf_worker_attach_peer(worker, worker->pending[i]) == false)
+		{
+			worker->pending[i]->Disconnect(worker->pending[i]);
+			freerdp_peer_context_free(worker->pending[i]);
+			freerdp_peer_free(worker->pending[i]);
+		}
+	}
+
+	worker->num_pending = 0;
+
+	pthread_mutex_unlock(&(worker->mutex));
+}
+
+static boolean xf_worker_service_fd(xfWorker* worker, freerdp_peer* client, int fd)
+{
+	uint64 expirations;
+	xfPeerContext* xfp;
+
+	xfp = (xfPeerContext*) client->context;
+
+	if (fd == xfp->timer_fd)
+	{
+		if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			return true;
+
+		return xf_peer_frame_tick(client);
+	}
+
+	if (client->CheckFileDescriptor(client) == false)
+	{
+		printf("Failed to check freerdp file descriptor\n");
+		return false;
+	}
+
+	if (xf_peer_check_fds(client) == false)
+	{
+		printf("Failed to check xfreerdp file descriptor\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Output the socket did not take stays queued in the transport; watch
+ * the socket for writability until the queue has drained.
+ */
+
+static boolean xf_worker_service_peer(xfWorker* worker, freerdp_peer* client, int fd)
+{
+	boolean watch;
+	xfPeerContext* xfp;
+
+	xfp = (xfPeerContext*) client->context;
+
+	if (xf_worker_service_fd(worker, client, fd) == false)
+		return false;
+
+	if (xf_peer_flush_output(client) == false)
+	{
+		printf("Failed to flush xfreerdp output\n");
+		return false;
+	}
+
+	watch = (xfp->output_queued > 0);
+
+	if (watch != xfp->watch_output)
+	{
+		event_loop_set_writable(worker->loop, client->sockfd, watch);
+		xfp->watch_output = watch;
+	}
+
+	return true;
+}
+
+static void* xf_worker_thread(void* arg)
+{
+	int i;
+	int fd;
+	int count;
+	void* data;
+	xfPeerContext* xfp;
+	freerdp_peer* client;
+	xfWorker* worker = (xfWorker*) arg;
+	xfRuntime* runtime = worker->runtime;
+
+	while (runtime->stopping == false)
+	{
+		count = event_loop_wait(worker->loop, -1);
+
+		if (count < 0)
+		{
+			printf("xf_worker_thread: event_loop_wait failed\n");
+			break;
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			fd = event_loop_get_ready(worker->loop, i, &data);
+
+			if (fd < 0)
+				continue;
+
+			if (fd == worker->wake_fd[0])
+			{
+				xf_worker_take_pending(worker);
+				continue;
+			}
+
+			client = (freerdp_peer*) data;
+
+			/* a previous descriptor of the same peer may have closed it */
+			for (xfp = worker->peers; xfp != NULL; xfp = xfp->next)
+			{
+				if (xfp->_p.peer == client)
+					break;
+			}
+
+			if (xfp == NULL)
+				continue;
+
+			if (xf_worker_service_peer(worker, client, fd) == false)
+				xf_worker_detach_peer(worker, client);
+		}
+	}
+
+	xf_worker_take_pending(worker);
+
+	while (worker->peers != NULL)
+		xf_worker_detach_peer(worker, worker->peers->_p.peer);
+
+	return NULL;
+}
+
+static void* xf_encoder_thread(void* arg)
+{
+	xfEncodeJob* job;
+	xfRuntime* runtime = (xfRuntime*) arg;
+
+	pthread_mutex_lock(&(runtime->mutex));
+
+	while (1)
+	{
+		while (runtime->job_head == NULL && runtime->stopping == false)
+			pthread_cond_wait(&(runtime->job_cond), &(runtime->mutex));
+
+		if (runtime->job_head == NULL)
+			break;
+
+		job = runtime->job_head;
+		runtime->job_head = job->next;
+
+		if (runtime->job_head == NULL)
+			runtime->job_tail = NULL;
+
+		pthread_mutex_unlock(&(runtime->mutex));
+
+		job->func(job->param);
+
+		pthread_mutex_lock(&(runtime->mutex));
+
+		*(job->busy) = false;
+		pthread_cond_broadcast(&(runtime->done_cond));
+
+		xfree(job);
+	}
+
+	pthread_mutex_unlock(&(runtime->mutex));
+
+	return NULL;
+}
+
+/**
+ * Queue an encoding job on the shared encode pool.
+ * busy is set until the job has run, it is guarded by the runtime mutex.
+ */
+
+boolean xf_runtime_submit_encode(xfRuntime* runtime, pfEncodeJob func, void* param, boolean* busy)
+{
+	xfEncodeJob* job;
+
+	job = xnew(xfEncodeJob);
+	job->func = func;
+	job->param = param;
+	job->busy = busy;
+
+	pthread_mutex_lock(&(runtime->mutex));
+
+	*busy = true;
+
+	if (runtime->job_tail != NULL)
+		runtime->job_tail->next = job;
+	else
+		runtime->job_head = job;
+
+	runtime->job_tail = job;
+
+	pthread_cond_signal(&(runtime->job_cond));
+	pthread_mutex_unlock(&(runtime->mutex));
+
+	return true;
+}
+
+void xf_runtime_wait_encode(xfRuntime* runtime, boolean* busy)
+{
+	pthread_mutex_lock(&(runtime->mutex));
+
+	while (*busy)
+		pthread_cond_wait(&(runtime->done_cond), &(runtime->mutex));
+
+	pthread_mutex_unlock(&(runtime->mutex));
+}
+
+/**
+ * Arm the frame timer of an activated peer at its frame rate,
+ * or re-arm it after the rate changed.
+ */
+
+boolean xf_runtime_start_frames(freerdp_peer* client)
+{
+	int fps;
+	struct itimerspec spec;
+	xfPeerContext* xfp = (xfPeerContext*) client->context;
+
+	/* a suppressed peer only keeps the display events drained */
+	fps = xfp->suppressed ? XF_PEER_IDLE_FPS : xfp->fps;
+
+	if (xfp->timer_fd < 0 || fps < 1)
+		return false;
+
+	memset(&spec, 0, sizeof(spec));
+	/* tv_nsec must stay below one second, which 1 fps would reach */
+	spec.it_interval.tv_sec = 1 / fps;
+	spec.it_interval.tv_nsec = (1000000000 / fps) % 1000000000;
+	spec.it_value = spec.it_interval;
+
+	if (timerfd_settime(xfp->timer_fd, 0, &spec, NULL) < 0)
+	{
+		printf("xf_runtime_start_frames: timerfd_settime failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Hand a newly accepted and initialized peer over to an I/O worker.
+ */
+
+boolean xf_runtime_add_peer(xfRuntime* runtime, freerdp_peer* client)
+{
+	xfWorker* worker;
+
+	/* peers may be added from several acceptor threads */
+	pthread_mutex_lock(&(runtime->mutex));
+	worker = &runtime->workers[runtime->next_worker];
+	runtime->next_worker = (runtime->next_worker + 1) % runtime->num_workers;
+	pthread_mutex_unlock(&(runtime->mutex));
+
+	pthread_mutex_lock(&(worker->mutex));
+
+	if (worker->num_pending + 1 > worker->max_pending)
+	{
+		worker->max_pending = (worker->max_pending > 0) ? worker->max_pending * 2 : 8;
+		worker->pending = xrenew(freerdp_peer*, worker->pending, worker->max_pending);
+	}
+
+	worker->pending[worker->num_pending++] = client;
+
+	pthread_mutex_unlock(&(worker->mutex));
+
+	xf_worker_wake(worker);
+
+	return true;
+}
+
+static void xf_worker_uninit(xfWorker* worker)
+{
+	if (worker->wake_fd[0] != -1)
+		close(worker->wake_fd[0]);
+
+	if (worker->wake_fd[1] != -1)
+		close(worker->wake_fd[1]);
+
+	event_loop_free(worker->loop);
+	xfree(worker->pending);
+	pthread_mutex_destroy(&(worker->mutex));
+}
+
+static boolean xf_worker_init(xfWorker* worker, xfRuntime* runtime)
+{
+	worker->runtime = runtime;
+	worker->wake_fd[0] = worker->wake_fd[1] = -1;
+	pthread_mutex_init(&(worker->mutex), NULL);
+
+	worker->loop = event_loop_new();
+
+	if (worker->loop == NULL || pipe(worker->wake_fd) < 0)
+	{
+		xf_worker_uninit(worker);
+		return false;
+	}
+
+	fcntl(worker->wake_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(worker->wake_fd[1], F_SETFL, O_NONBLOCK);
+
+	if (event_loop_add_fd(worker->loop, worker->wake_fd[0], NULL) == false ||
+			pthread_create(&(worker->thread), 0, xf_worker_thread, (void*) worker) != 0)
+	{
+		xf_worker_uninit(worker);
+		return false;
+	}
+
+	return true;
+}
+
+xfRuntime* xf_runtime_new(int num_workers, int num_encoders)
+{
+	int i;
+	xfRuntime* runtime;
+
+	if (num_workers < 1)
+		num_workers = 1;
+
+	if (num_encoders < 1)
+		num_encoders = 1;
+
+	runtime = xnew(xfRuntime);
+
+	pthread_mutex_init(&(runtime->mutex), NULL);
+	pthread_cond_init(&(runtime->job_cond), NULL);
+	pthread_cond_init(&(runtime->done_cond), NULL);
+
+	runtime->encoders = (pthread_t*) xzalloc(sizeof(pthread_t) * num_encoders);
+
+	for (i = 0; i < num_encoders; i++)
+	{
+		if (pthread_create(&(runtime->encoders[i]), 0, xf_encoder_thread, (void*) runtime) != 0)
+			break;
+
+		runtime->num_encoders++;
+	}
+
+	runtime->workers = (xfWorker*) xzalloc(sizeof(xfWorker) * num_workers);
+
+	for (i = 0; i < num_workers; i++)
+	{
+		if (xf_worker_init(&runtime->workers[i], runtime) == false)
+		{
+			printf("xf_runtime_new: failed to start I/O worker %d\n", i);
+			break;
+		}
+
+		runtime->num_workers++;
+	}
+
+	if (runtime->num_workers < 1 || runtime->num_encoders < 1)
+	{
+		xf_runtime_free(runtime);
+		return NULL;
+	}
+
+	printf("Server runtime: %d I/O workers, %d encoders\n", runtime->num_workers, runtime->num_encoders);
+
+	return runtime;
+}
+
+void xf_runtime_free(xfRuntime* runtime)
+{
+	int i;
+	xfWorker* worker;
+
+	if (runtime == NULL)
+		return;
+
+	pthread_mutex_lock(&(runtime->mutex));
+	runtime->stopping = true;
+	pthread_cond_broadcast(&(runtime->job_cond));
+	pthread_mutex_unlock(&(runtime->mutex));
+
+	for (i = 0; i < runtime->num_workers; i++)
+	{
+		worker = &runtime->workers[i];
+		xf_worker_wake(worker);
+		pthread_join(worker->thread, NULL);
+	}
+
+	for (i = 0; i < runtime->num_encoders; i++)
+		pthread_join(runtime->encoders[i], NULL);
+
+	for (i = 0; i < runtime->num_workers; i++)
+		xf_worker_uninit(&runtime->workers[i]);
+
+	pthread_cond_destroy(&(runtime->job_cond));
+	pthread_cond_destroy(&(runtime->done_cond));
+	pthread_mutex_destroy(&(runtime->mutex));
+
+	xfree(runtime->workers);
+	xfree(runtime->encoders);
+	xfree(runtime);
+}
@@ -0,0 +1,89 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * X11 Server Runtime
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __XF_RUNTIME_H
+#define __XF_RUNTIME_H
+
+typedef struct xf_runtime xfRuntime;
+typedef struct xf_worker xfWorker;
+typedef struct xf_encode_job xfEncodeJob;
+
+#include <pthread.h>
+#include <freerdp/peer.h>
+#include <freerdp/utils/event_loop.h>
+
+#include "xf_peer.h"
+
+/**
+ * The runtime serves all sessions from a fixed set of threads:
+ * I/O workers each multiplex a share of the peers on one event loop
+ * (transport, event queue and frame timer descriptors),
+ * and a shared encode pool runs the RemoteFX encoding of frames.
+ */
+
+struct xf_worker
+{
+	pthread_t thread;
+	xfRuntime* runtime;
+	struct event_loop* loop;
+
+	int wake_fd[2];
+	pthread_mutex_t mutex;
+	freerdp_peer** pending;
+	int num_pending;
+	int max_pending;
+
+	xfPeerContext* peers;
+	int num_peers;
+};
+
+typedef void (*pfEncodeJob)(void* param);
+
+struct xf_encode_job
+{
+	pfEncodeJob func;
+	void* param;
+	boolean* busy;
+	xfEncodeJob* next;
+};
+
+struct xf_runtime
+{
+	int num_workers;
+	int next_worker;
+	xfWorker* workers;
+
+	int num_encoders;
+	pthread_t* encoders;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	xfEncodeJob* job_head;
+	xfEncodeJob* job_tail;
+
+	boolean stopping;
+};
+
+xfRuntime* xf_runtime_new(int num_workers, int num_encoders);
+void xf_runtime_free(xfRuntime* runtime);
+
+boolean xf_runtime_add_peer(xfRuntime* runtime, freerdp_peer* client);
+boolean xf_runtime_start_frames(freerdp_peer* client);
+boolean xf_runtime_submit_encode(xfRuntime* runtime, pfEncodeJob func, void* param, boolean* busy);
+void xf_runtime_wait_encode(xfRuntime* runtime, boolean* busy);
+
+#endif /* __XF_RUNTIME_H */
@@ -18,6 +18,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,16 +26,40 @@
 #include <X11/Xutil.h>
 #include <sys/select.h>
 #include <sys/signal.h>
+#include <unistd.h>
 
 #include <freerdp/utils/memory.h>
 
 #include "xf_peer.h"
+#include "xf_runtime.h"
 #include "xfreerdp.h"
 
 char* xf_pcap_file = NULL;
 tbool xf_pcap_dump_realtime = true;
 
-void xf_server_main_loop(freerdp_listener* instance)
+#define XF_SERVER_MAX_ACCEPTORS	4
+
+struct xf_acceptor
+{
+	pthread_t thread;
+	freerdp_listener* instance;
+	int index;
+};
+typedef struct xf_acceptor xfAcceptor;
+
+/* written to when an acceptor stops and never read, so that it wakes up all the others */
+static int xf_server_stop_fds[2] = { -1, -1 };
+
+static void xf_server_stop(void)
+{
+	if (xf_server_stop_fds[1] != -1)
+	{
+		if (write(xf_server_stop_fds[1], "x", 1) < 0)
+			perror("xf_server_stop");
+	}
+}
+
+void xf_server_main_loop(freerdp_listener* instance, int acceptor)
 {
 	int i;
 	int fds;
@@ -49,7 +74,7 @@ void xf_server_main_loop(freerdp_listener* instance)
 	{
 		rcount = 0;
 
-		if (instance->GetFileDescriptor(instance, rfds, &rcount) == false)
+		if (instance->GetAcceptorFileDescriptor(instance, acceptor, rfds, &rcount) == false)
 		{
 			printf("Failed to get FreeRDP file descriptor\n");
 			break;
@@ -71,6 +96,14 @@ void xf_server_main_loop(freerdp_listener* instance)
 		if (max_fds == 0)
 			break;
 
+		if (xf_server_stop_fds[0] != -1)
+		{
+			if (xf_server_stop_fds[0] > max_fds)
+				max_fds = xf_server_stop_fds[0];
+
+			FD_SET(xf_server_stop_fds[0], &rfds_set);
+		}
+
 		if (select(max_fds + 1, &rfds_set, NULL, NULL, NULL) == -1)
 		{
 			/* these are not really errors */
@@ -83,25 +116,57 @@ void xf_server_main_loop(freerdp_listener* instance)
 				break;
 			}
 		}
+		else if (xf_server_stop_fds[0] != -1 && FD_ISSET(xf_server_stop_fds[0], &rfds_set))
+		{
+			break;
+		}
 
-		if (instance->CheckFileDescriptor(instance) == false)
+		if (instance->CheckAcceptorFileDescriptor(instance, acceptor) == false)
 		{
 			printf("Failed to check FreeRDP file descriptor\n");
 			break;
 		}
 	}
 
-	instance->Close(instance);
+	/* the server goes down with any of its acceptors */
+	xf_server_stop();
+}
+
+static void* xf_server_acceptor_thread(void* arg)
+{
+	xfAcceptor* acceptor = (xfAcceptor*) arg;
+
+	xf_server_main_loop(acceptor->instance, acceptor->index);
+
+	return NULL;
 }
 
 int main(int argc, char* argv[])
 {
+	int i;
+	long num_cpus;
+	xfAcceptor* acceptors;
+	xfRuntime* runtime;
 	freerdp_listener* instance;
 
 	/* ignore SIGPIPE, otherwise an SSL_write failure could crash the server */
 	signal(SIGPIPE, SIG_IGN);
 
+	/* displays are shared between the I/O workers and the encode pool */
+	XInitThreads();
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	runtime = xf_runtime_new(num_cpus, num_cpus);
+
+	if (runtime == NULL)
+		return 1;
+
 	instance = freerdp_listener_new();
+	instance->info = (void*) runtime;
 	instance->PeerAccepted = xf_peer_accepted;
 
 	if (argc > 1)
@@ -110,14 +175,48 @@ int main(int argc, char* argv[])
 	if (argc > 2 && !strcmp(argv[2], "--fast"))
 		xf_pcap_dump_realtime = false;
 
+	/* one acceptor thread per SO_REUSEPORT socket, so that a burst of logins is not accepted serially */
+	instance->num_acceptors = (num_cpus < XF_SERVER_MAX_ACCEPTORS) ? num_cpus : XF_SERVER_MAX_ACCEPTORS;
+
+	if (pipe(xf_server_stop_fds) == -1)
+	{
+		/* the acceptors could not stop each other */
+		perror("pipe");
+		xf_server_stop_fds[0] = xf_server_stop_fds[1] = -1;
+		instance->num_acceptors = 1;
+	}
+
 	/* Open the server socket and start listening. */
 	if (instance->Open(instance, NULL, 3389))
 	{
-		/* Entering the server main loop. In a real server the listener can be run in its own thread. */
-		xf_server_main_loop(instance);
+		/* Open lowers num_acceptors to the sockets it could open */
+		acceptors = xzalloc(sizeof(xfAcceptor) * instance->num_acceptors);
+
+		for (i = 1; i < instance->num_acceptors; i++)
+		{
+			acceptors[i].instance = instance;
+			acceptors[i].index = i;
+			pthread_create(&(acceptors[i].thread), NULL, xf_server_acceptor_thread, &acceptors[i]);
+		}
+
+		/* the first acceptor runs on the main thread */
+		xf_server_main_loop(instance, 0);
+
+		for (i = 1; i < instance->num_acceptors; i++)
+			pthread_join(acceptors[i].thread, NULL);
+
+		xfree(acceptors);
+		instance->Close(instance);
+	}
+
+	if (xf_server_stop_fds[0] != -1)
+	{
+		close(xf_server_stop_fds[0]);
+		close(xf_server_stop_fds[1]);
 	}
 
 	freerdp_listener_free(instance);
+	xf_runtime_free(runtime);
 
 	return 0;
 }
@@ -0,0 +1,247 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Client
+ * FreeRDP Listener Accept Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Measures the connection rate the listener sustains: loopback clients
+ * connect in a loop and wait for the server to close the connection,
+ * while each acceptor thread accepts on its own SO_REUSEPORT socket.
+ *
+ * A connection counts once the server closes it, whether PeerAccepted
+ * freed the peer or freerdp_peer_new failed and the listener closed the
+ * socket itself. The rate is that of accept and close, it does not
+ * include any peer setup; the number of connections that reached
+ * PeerAccepted is reported apart.
+ *
+ * Usage: tfreerdp-accept [acceptors] [clients] [seconds] [port]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <freerdp/utils/memory.h>
+#include <freerdp/listener.h>
+
+struct bench_thread
+{
+	pthread_t thread;
+	freerdp_listener* instance;
+	int index;
+	int connections;
+};
+typedef struct bench_thread benchThread;
+
+static int bench_port = 3390;
+static volatile tbool bench_stopping = false;
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int bench_accepted = 0;
+
+static uint64 bench_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((uint64) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static void bench_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
+{
+	pthread_mutex_lock(&bench_mutex);
+	bench_accepted++;
+	pthread_mutex_unlock(&bench_mutex);
+
+	/* closing the connection right away completes the client round trip */
+	freerdp_peer_free(client);
+}
+
+static void* bench_acceptor_thread(void* arg)
+{
+	int i;
+	int fds;
+	int max_fds;
+	int rcount;
+	void* rfds[32];
+	fd_set rfds_set;
+	struct timeval timeout;
+	benchThread* acceptor = (benchThread*) arg;
+	freerdp_listener* instance = acceptor->instance;
+
+	while (!bench_stopping)
+	{
+		rcount = 0;
+
+		if (instance->GetAcceptorFileDescriptor(instance, acceptor->index, rfds, &rcount) == false)
+			break;
+
+		max_fds = 0;
+		FD_ZERO(&rfds_set);
+
+		for (i = 0; i < rcount; i++)
+		{
+			fds = (int)(long)(rfds[i]);
+
+			if (fds > max_fds)
+				max_fds = fds;
+
+			FD_SET(fds, &rfds_set);
+		}
+
+		/* wake up now and then to notice the end of the run */
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000;
+
+		if (select(max_fds + 1, &rfds_set, NULL, NULL, &timeout) == -1 && errno != EINTR)
+			break;
+
+		if (instance->CheckAcceptorFileDescriptor(instance, acceptor->index) == false)
+			break;
+	}
+
+	return NULL;
+}
+
+static void* bench_client_thread(void* arg)
+{
+	int sockfd;
+	char buf[16];
+	struct timeval timeout;
+	struct sockaddr_in addr;
+	benchThread* client = (benchThread*) arg;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(bench_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+
+	while (!bench_stopping)
+	{
+		sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (sockfd == -1)
+			break;
+
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		if (connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) == 0)
+		{
+			/* the connection has been accepted once the server closes it */
+			if (recv(sockfd, buf, sizeof(buf), 0) == 0)
+				client->connections++;
+		}
+
+		close(sockfd);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	int i;
+	int seconds = 5;
+	int num_clients = 16;
+	int num_acceptors = 1;
+	int connections = 0;
+	uint64 start;
+	uint64 elapsed;
+	benchThread* clients;
+	benchThread* acceptors;
+	freerdp_listener* instance;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (argc > 1)
+		num_acceptors = atoi(argv[1]);
+	if (argc > 2)
+		num_clients = atoi(argv[2]);
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+	if (argc > 4)
+		bench_port = atoi(argv[4]);
+
+	if (num_acceptors < 1 || num_clients < 1 || seconds < 1)
+	{
+		printf("usage: %s [acceptors] [clients] [seconds] [port]\n", argv[0]);
+		return 1;
+	}
+
+	instance = freerdp_listener_new();
+	instance->PeerAccepted = bench_peer_accepted;
+	instance->num_acceptors = num_acceptors;
+
+	if (!instance->Open(instance, "127.0.0.1", bench_port))
+	{
+		freerdp_listener_free(instance);
+		return 1;
+	}
+
+	/* fewer without SO_REUSEPORT */
+	num_acceptors = instance->num_acceptors;
+
+	acceptors = xzalloc(sizeof(benchThread) * num_acceptors);
+	clients = xzalloc(sizeof(benchThread) * num_clients);
+
+	for (i = 0; i < num_acceptors; i++)
+	{
+		acceptors[i].instance = instance;
+		acceptors[i].index = i;
+		pthread_create(&(acceptors[i].thread), NULL, bench_acceptor_thread, &acceptors[i]);
+	}
+
+	start = bench_time_us();
+
+	for (i = 0; i < num_clients; i++)
+		pthread_create(&(clients[i].thread), NULL, bench_client_thread, &clients[i]);
+
+	sleep(seconds);
+	bench_stopping = true;
+
+	for (i = 0; i < num_clients; i++)
+	{
+		pthread_join(clients[i].thread, NULL);
+		connections += clients[i].connections;
+	}
+
+	elapsed = bench_time_us() - start;
+
+	for (i = 0; i < num_acceptors; i++)
+		pthread_join(acceptors[i].thread, NULL);
+
+	printf("%d acceptors, %d clients: %d connections accepted and closed in %.2f s, %.0f/s (%d reached PeerAccepted)\n",
+		num_acceptors, num_clients, connections, elapsed / 1000000.0,
+		connections * 1000000.0 / elapsed, bench_accepted);
+
+	instance->Close(instance);
+	freerdp_listener_free(instance);
+
+	xfree(acceptors);
+	xfree(clients);
+
+	return 0;
+}